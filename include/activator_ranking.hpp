@@ -0,0 +1,80 @@
+#ifndef ACTIVATOR_RANKING_HPP
+#define ACTIVATOR_RANKING_HPP
+
+// C++ includes
+#include <array>
+#include <experimental/optional>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "server_table.hpp"
+
+namespace std
+{
+	using namespace experimental;
+}
+
+// Indexed max-heap over server activators. Updating one server costs
+// O(log N), the current leader is available in O(1). Storage is fixed,
+// one entry per server_table slot, so nothing allocates on the BT task.
+class activator_ranking
+{
+public:
+	/* Constants */
+	static constexpr std::size_t CAPACITY = server_table::CAPACITY;
+
+	/* Inner types */
+	using slots_t = std::array<std::size_t, CAPACITY>;
+
+	/* Constructors */
+	activator_ranking();
+	activator_ranking(const activator_ranking&) = default;
+	activator_ranking(activator_ranking&&) = default;
+
+	/* Destructor */
+	~activator_ranking() = default;
+
+	/* Operators */
+	activator_ranking& operator=(const activator_ranking&) = default;
+	activator_ranking& operator=(activator_ranking&&) = default;
+
+	/* Getters */
+	std::size_t size() const;
+	bool empty() const;
+	// Last activator of slot, 0 if it is not ranked
+	std::uint8_t activator(std::size_t slot) const;
+
+	/* Methods */
+	// Adds the slot if it is not ranked yet. Slots past CAPACITY are ignored
+	void update(std::size_t slot, std::uint8_t activator);
+	// Slot with the largest activator
+	std::optional<std::size_t> top() const;
+	// Fills out with up to k slots, largest activator first, in O(k log k),
+	// and returns how many
+	std::size_t top_k(std::size_t k, slots_t& out) const;
+	void clear();
+
+private:
+	/* Inner types */
+	struct node_t
+	{
+		std::uint8_t activator;
+		std::size_t slot;
+	};
+
+	static constexpr std::size_t NPOS = static_cast<std::size_t>(-1);
+
+	/* Members */
+	std::array<node_t, CAPACITY> m_heap;
+	std::size_t m_size;
+	// slot -> index into m_heap
+	std::array<std::size_t, CAPACITY> m_position;
+
+	/* Methods */
+	void sift_up(std::size_t i);
+	void sift_down(std::size_t i);
+	void swap_nodes(std::size_t a, std::size_t b);
+};
+
+#endif
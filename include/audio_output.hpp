@@ -0,0 +1,73 @@
+#ifndef AUDIO_OUTPUT_HPP
+#define AUDIO_OUTPUT_HPP
+
+// C++ includes
+#include <atomic>
+// C includes
+#include <cstddef>
+#include <cstdint>
+
+// Plays the PCM of the A2DP sink, 16 bit stereo, on I2S at the fixed rate
+// of sample_rate_converter. The driver runs two DMA buffers, so one plays
+// while the other is filled. Playback starts once JITTER_MS of audio is
+// buffered in the PCM ring and starts over when the ring runs dry; until
+// then, and while nothing streams, the DMA buffers play silence.
+// Only the PCM consumer calls play() and idle(), set_source_rate() may be
+// called from any task and takes effect on the next available().
+class audio_output
+{
+public:
+	/* Constants */
+	static constexpr std::size_t BYTES_PER_FRAME = 4;
+	static constexpr std::size_t DMA_BUFFERS = 2;
+	// Frames per DMA buffer, about 12 ms at 44.1 kHz
+	static constexpr std::size_t DMA_FRAMES = 512;
+	static constexpr std::size_t DMA_BYTES = DMA_FRAMES * BYTES_PER_FRAME;
+	static constexpr std::uint32_t JITTER_MS = 40;
+	// Until AUDIO_CFG says otherwise
+	static constexpr std::uint32_t DEFAULT_SOURCE_RATE = 44100;
+
+	/* Constructors */
+	audio_output();
+	audio_output(const audio_output&) = delete;
+	audio_output(audio_output&&) = delete;
+
+	/* Destructor */
+	~audio_output() = default;
+
+	/* Operators */
+	audio_output& operator=(const audio_output&) = delete;
+	audio_output& operator=(audio_output&&) = delete;
+
+	/* Getters */
+	// Rate of the PCM in the ring, which sizes the jitter buffer
+	std::uint32_t source_rate() const;
+	// Times the ring ran dry during playback
+	std::uint32_t underruns() const;
+
+	/* Methods */
+	void start();
+	void set_source_rate(std::uint32_t sample_rate);
+	// Bytes to take from a ring holding buffered bytes, 0 while the jitter
+	// buffer fills
+	std::size_t available(std::size_t buffered);
+	// Hands len bytes to the DMA buffers, blocking until one is free; len 0
+	// plays one buffer of silence. Returns the bytes taken.
+	std::size_t play(const std::uint8_t *data, std::size_t len);
+	// Nothing streams: stops the DMA buffers repeating the last audio
+	void idle();
+
+private:
+	/* Members */
+	std::atomic<std::uint32_t> m_pending_rate;
+	std::uint32_t m_source_rate;
+	std::size_t m_jitter_bytes;
+	bool m_playing;
+	bool m_silent;
+	std::uint32_t m_underruns;
+
+	/* Methods */
+	void apply_source_rate();
+};
+
+#endif
@@ -2,16 +2,43 @@
 #define BLUETOOTH_ADDRESS_HPP
 
 // C++ includes
+#include <functional>
 #include <iosfwd>
 #include <string>
+// C includes
+#include <cstddef>
+#include <cstdint>
 // ESP includes
 #include "esp_bt_device.h"
 
+static_assert(
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+    "bluetooth_address packing assumes a little-endian target");
+
+// The six address bytes share storage with a 64-bit word (byte i at bits
+// 8*i, top two bytes zero), so comparing and hashing are single integer
+// operations while raw() still hands ESP APIs a plain esp_bd_addr_t.
 class bluetooth_address
 {
 public:
+    /* Constants */
+    // "xx:xx:xx:xx:xx:xx" plus terminator
+    static constexpr std::size_t STRING_SIZE = ESP_BD_ADDR_LEN * 3;
+
 	/* Constructors */
     bluetooth_address(esp_bd_addr_t addr);
+    constexpr explicit bluetooth_address(std::uint64_t packed)
+        : m_packed(packed & 0xffffffffffffull)
+    {
+    }
+    constexpr bluetooth_address(
+        std::uint8_t b0, std::uint8_t b1, std::uint8_t b2,
+        std::uint8_t b3, std::uint8_t b4, std::uint8_t b5)
+        : m_packed(
+            std::uint64_t(b0) << 0 | std::uint64_t(b1) << 8 | std::uint64_t(b2) << 16 |
+            std::uint64_t(b3) << 24 | std::uint64_t(b4) << 32 | std::uint64_t(b5) << 40)
+    {
+    }
     bluetooth_address(const bluetooth_address&) = default;
     bluetooth_address(bluetooth_address&&) = default;
 
@@ -25,20 +52,55 @@ public:
     /* Getters */
     esp_bd_addr_t& raw();
     const esp_bd_addr_t& raw() const;
+    constexpr std::uint64_t packed() const
+    {
+        return m_packed;
+    }
 
     /* Implicit conversions */
     operator esp_bd_addr_t&();
     operator const esp_bd_addr_t&() const;
 
 private:
-    esp_bd_addr_t m_addr;
+    union
+    {
+        std::uint64_t m_packed;
+        esp_bd_addr_t m_addr;
+    };
 };
 
-bool operator==(const bluetooth_address& l, const bluetooth_address& r);
-bool operator!=(const bluetooth_address& l, const bluetooth_address& r);
+constexpr bool operator==(const bluetooth_address& l, const bluetooth_address& r)
+{
+    return l.packed() == r.packed();
+}
+
+constexpr bool operator!=(const bluetooth_address& l, const bluetooth_address& r)
+{
+    return l.packed() != r.packed();
+}
+
+// Orders the same way the printed form sorts
+bool operator<(const bluetooth_address& l, const bluetooth_address& r);
 
 std::ostream& operator<<(std::ostream& out, const bluetooth_address& addr);
 
+// Writes "xx:xx:xx:xx:xx:xx" into buffer and returns it, without allocating
+const char *format(const bluetooth_address& addr, char (&buffer)[bluetooth_address::STRING_SIZE]);
+
 std::string to_string(const bluetooth_address& addr);
 
+namespace std
+{
+    template<>
+    struct hash<bluetooth_address>
+    {
+        constexpr std::size_t operator()(const bluetooth_address& addr) const
+        {
+            // Fibonacci multiply, folded so 32-bit targets keep the high bits
+            return static_cast<std::size_t>(
+                (addr.packed() * 0x9e3779b97f4a7c15ull) >> (64 - 8 * sizeof(std::size_t)));
+        }
+    };
+}
+
 #endif
@@ -2,15 +2,29 @@
 #define BLUETOOTH_CLIENT_HPP
 
 // C++ includes
+#include <atomic>
+#include <condition_variable>
 #include <experimental/optional>
 #include <functional>
-#include <vector>
+#include <mutex>
 #include <tuple>
 // C includes
 #include <cstdint>
 // My includes
+#include "activator_ranking.hpp"
+#include "audio_output.hpp"
 #include "bluetooth_server_info.hpp"
+#include "conn_param_policy.hpp"
+#include "link_scheduler.hpp"
+#include "pcm_analysis.hpp"
+#include "pcm_capture.hpp"
+#include "pcm_ring_buffer.hpp"
+#include "sample_rate_converter.hpp"
+#include "server_cache.hpp"
+#include "server_index.hpp"
+#include "server_table.hpp"
 #include "state_machine.hpp"
+#include "switch_policy.hpp"
 // ESP includes
 #include "esp_a2dp_api.h"
 #include "esp_gap_ble_api.h"
@@ -24,6 +38,12 @@ namespace std
 class bluetooth_client
 {
 public:
+	/* Constants */
+	// The sink always decodes to interleaved stereo
+	static constexpr std::size_t AUDIO_CHANNELS = audio_output::BYTES_PER_FRAME / 2;
+	// About 23 ms at 44.1 kHz
+	static constexpr std::size_t LEVEL_BLOCK_FRAMES = 1024;
+
 	/* Constructors */
 	bluetooth_client();
 	bluetooth_client(const bluetooth_client&) = delete;
@@ -44,10 +64,37 @@ public:
 
 private:
 	/* Members */
-	std::vector<bluetooth_server_info> m_servers;
+	server_table m_servers;
+	server_index m_index;
+	activator_ranking m_ranking;
+	server_cache m_cache;
+	conn_param_policy m_policy;
+	switch_policy m_switching;
+	// Guards m_ranking and m_switching, used by the BT task and the
+	// coalescing window flush on the timer service
+	std::mutex m_switch_mutex;
 	state_machine m_sm;
-	decltype(m_servers)::const_iterator m_peer;
 	std::uint16_t m_interface;
+	// Ends an A2DP session, on the timer service
+	std::size_t m_a2dp_timer;
+	// Ends a coalescing window of m_switching, on the timer service
+	std::size_t m_flush_timer;
+
+	pcm_ring_buffer m_pcm;
+	sample_rate_converter m_converter;
+	// Converted PCM the driver did not take yet, played before the next
+	// convert() overwrites it; only touched by the PCM consumer
+	const std::uint8_t *m_unplayed;
+	std::size_t m_unplayed_len;
+	audio_output m_output;
+	pcm_capture m_capture;
+	pcm_analyzer<AUDIO_CHANNELS, LEVEL_BLOCK_FRAMES> m_levels;
+	std::mutex m_pcm_mutex;
+	std::condition_variable m_pcm_cv;
+	std::atomic<bool> m_streaming;
+	// When the last stream stopped, 0 while streaming. Measures the audio
+	// gap of a switch; only touched on the A2DP task
+	std::uint32_t m_silent_since_ms;
 
 	/* Methods */
 	void initialize();
@@ -61,6 +108,7 @@ private:
 	void a2dp_data_callback(
 		const std::uint8_t *data,
 		std::uint32_t len);
+	void pcm_consumer();
 
 	void ble_gap_callback(
 		esp_gap_ble_cb_event_t event,
@@ -70,7 +118,18 @@ private:
 		esp_gatt_if_t gattc_if,
 		esp_ble_gattc_cb_param_t *param);
 
+	static std::uint32_t now_ms();
+	void update_conn_params(
+		const bluetooth_address& addr,
+		const bluetooth_server_info::conn_params_t& params);
+	// Adds a server to m_servers and the lookup structures next to it
+	bool add_server(const bluetooth_server_info& server);
+	// A new activator value of slot, notified or advertised
+	void handle_activator(std::size_t slot, std::uint8_t activator);
+	// Runs a switch decision, once per coalescing window
 	void handle_activator_notification();
+	// Decides on the notifications coalesced in the window that just ended
+	void handle_window_end();
 };
 
 #endif
@@ -5,15 +5,40 @@
 #include <cstdint>
 // My includes
 #include "bluetooth_address.hpp"
+// ESP includes
+#include "esp_bt_device.h"
 
 class bluetooth_server_info
 {
 public:
+	/* Inner types */
+	// Connection parameters, in the units of esp_ble_conn_update_params_t
+	struct conn_params_t
+	{
+		std::uint16_t min_int;
+		std::uint16_t max_int;
+		std::uint16_t latency;
+		std::uint16_t timeout;
+	};
+
+	/* Constants */
+	// conn_id of a server that has no BLE link
+	static constexpr std::uint16_t INVALID_CONN_ID = 0xffff;
+	// Attribute handle not discovered yet
+	static constexpr std::uint16_t INVALID_HANDLE = 0;
+	static constexpr conn_params_t DEFAULT_CONN_PARAMS = {
+		3200,	// * 1.25ms
+		3200,	// * 1.25ms
+		0,
+		400,	// * 10ms
+	};
+
 	/* Constructors */
 	bluetooth_server_info(
 		bluetooth_address address,
-		std::uint16_t conn_id = 0,
-		std::uint8_t activator = 0);
+		std::uint16_t conn_id = INVALID_CONN_ID,
+		std::uint8_t activator = 0,
+		esp_ble_addr_type_t address_type = BLE_ADDR_TYPE_PUBLIC);
 	bluetooth_server_info(const bluetooth_server_info&) = default;
 	bluetooth_server_info(bluetooth_server_info&&) = default;
 
@@ -33,12 +58,24 @@ public:
 	std::uint16_t& conn_id();
 	const bool& ble_connected() const;
 	bool& ble_connected();
+	const esp_ble_addr_type_t& address_type() const;
+	esp_ble_addr_type_t& address_type();
+	const std::uint16_t& notify_handle() const;
+	std::uint16_t& notify_handle();
+	const std::uint16_t& cccd_handle() const;
+	std::uint16_t& cccd_handle();
+	const conn_params_t& conn_params() const;
+	conn_params_t& conn_params();
 
 private:
 	bluetooth_address m_address;
 	std::uint16_t m_conn_id;
 	std::uint8_t m_activator;
 	bool m_ble_connected;
+	esp_ble_addr_type_t m_address_type;
+	std::uint16_t m_notify_handle;
+	std::uint16_t m_cccd_handle;
+	conn_params_t m_conn_params;
 };
 
 bool operator==(const bluetooth_server_info& l, const bluetooth_server_info& r);
@@ -0,0 +1,108 @@
+#ifndef CONN_PARAM_POLICY_HPP
+#define CONN_PARAM_POLICY_HPP
+
+// C++ includes
+#include <array>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "bluetooth_server_info.hpp"
+#include "server_table.hpp"
+
+// Chooses per-link connection intervals from activator activity. Quiet
+// servers stay on their long interval to save airtime and power; a server
+// whose activator moves or nears the switch threshold is moved to a short
+// interval so the BLE -> A2DP decision sees it quickly. Promotion and
+// demotion use separate levels plus a quiet period (hysteresis), and at
+// most FAST_LINKS links are fast at once (airtime budget).
+class conn_param_policy
+{
+public:
+	/* Inner types */
+	enum class mode_t : std::uint8_t
+	{
+		SLOW,
+		FAST,
+	};
+
+	struct decision_t
+	{
+		std::size_t slot;
+		mode_t mode;
+	};
+
+	/* Constants */
+	// 30-50 ms; the slow side uses the server's own (cached) parameters
+	static constexpr bluetooth_server_info::conn_params_t FAST_PARAMS = {
+		24,		// * 1.25ms
+		40,		// * 1.25ms
+		0,
+		400,	// * 10ms
+	};
+	// Two fast links cost ~65 connection events/s, against ~0.25 per slow link
+	static constexpr std::size_t FAST_LINKS = 2;
+	// Switching happens above 2, so get fast one step before
+	static constexpr std::uint8_t PROMOTE_LEVEL = 2;
+	static constexpr std::uint8_t DEMOTE_LEVEL = 1;
+	// A change within this long of the previous notification counts as activity
+	static constexpr std::uint32_t ACTIVITY_WINDOW_MS = 2000;
+	static constexpr std::uint32_t QUIET_PERIOD_MS = 10000;
+	// Rejected demotions sent again while the fast links are taken
+	static constexpr std::uint8_t DEMOTE_RETRIES = 2;
+
+	// Enough for demoting every fast link and promoting one
+	using decisions_t = std::array<decision_t, FAST_LINKS + 1>;
+
+	/* Constructors */
+	conn_param_policy();
+	conn_param_policy(const conn_param_policy&) = default;
+	conn_param_policy(conn_param_policy&&) = default;
+
+	/* Destructor */
+	~conn_param_policy() = default;
+
+	/* Operators */
+	conn_param_policy& operator=(const conn_param_policy&) = default;
+	conn_param_policy& operator=(conn_param_policy&&) = default;
+
+	/* Getters */
+	mode_t mode(std::size_t slot) const;
+
+	/* Methods */
+	void on_connected(std::size_t slot, std::uint32_t now_ms);
+	void on_disconnected(std::size_t slot);
+	// Fills out with the links whose parameters should be changed and
+	// returns how many. Their mode is committed immediately and reverted if
+	// the update is rejected.
+	std::size_t on_activator(
+		std::size_t slot,
+		std::uint8_t activator,
+		std::uint32_t now_ms,
+		decisions_t& out);
+	// Returns true if the slow parameters of slot should be sent again: a
+	// rejected demotion is not reverted while it would exceed FAST_LINKS
+	bool on_update_result(std::size_t slot, bool success);
+
+private:
+	/* Inner types */
+	struct link_t
+	{
+		bool connected;
+		bool pending;
+		mode_t mode;
+		std::uint8_t attempts;
+		std::uint8_t activator;
+		std::uint32_t last_notification;
+		std::uint32_t last_activity;
+	};
+
+	/* Members */
+	// By server_table slot
+	std::array<link_t, server_table::CAPACITY> m_links;
+
+	/* Methods */
+	std::size_t fast_links() const;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef CONNECTION_PIPELINE_HPP
+#define CONNECTION_PIPELINE_HPP
+
+// C++ includes
+#include <array>
+#include <chrono>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "bluetooth_server_info.hpp"
+#include "reconnect_engine.hpp"
+#include "retry_policy.hpp"
+#include "server_table.hpp"
+#include "timer_wheel.hpp"
+
+// Drives open -> MTU -> discover -> subscribe -> enable notifications for
+// several servers at once. Up to MAX_IN_FLIGHT setups are outstanding; as
+// soon as one finishes the next server is started, so round trips of
+// different servers overlap. Servers with cached handles skip discovery.
+// Every step has a deadline; a step that times out or fails is retried
+// after a backoff, as is a request the stack refuses, and a server that
+// runs out of retries is skipped and handed to the reconnect engine.
+class connection_pipeline
+{
+public:
+	/* Inner types */
+	enum class step_t
+	{
+		FREE,
+		OPENING,
+		CONFIGURING_MTU,
+		DISCOVERING,
+		SUBSCRIBING,
+		ENABLING,
+	};
+
+	struct entry_t
+	{
+		step_t step;
+		std::size_t server;
+		std::uint16_t conn_id;
+		// Subscribe completions carry no conn_id, they are matched in issue order
+		std::uint32_t order;
+		// Requests that went over the air for this setup
+		std::uint8_t round_trips;
+		// Retries of the current step
+		std::uint8_t attempts;
+		// The entry's timer ends a backoff rather than a deadline
+		bool backing_off;
+		bool discovered;
+	};
+
+	static constexpr std::size_t MAX_IN_FLIGHT = 3;
+
+	// Activator service and characteristic, as laid out by the server firmware
+	static constexpr std::uint16_t SERVICE_UUID = 0x00ff;
+	static constexpr std::uint16_t NOTIFY_CHAR_UUID = 0xff01;
+
+	// Indexed by step_t. Subscribing is local to Bluedroid, so it gets a
+	// short deadline
+	static constexpr retry_policy STEP_POLICIES[] = {
+		{    0, 0,   0,    0 },	// FREE
+		{ 5000, 2, 500, 4000 },	// OPENING
+		{ 2000, 2, 250, 2000 },	// CONFIGURING_MTU
+		{ 4000, 2, 250, 2000 },	// DISCOVERING
+		{ 1000, 1, 100,  100 },	// SUBSCRIBING
+		{ 2000, 2, 250, 2000 },	// ENABLING
+	};
+
+	/* Constructors */
+	// Entry i uses timer first_timer + i of timers
+	connection_pipeline(
+		timer_wheel *timers,
+		std::size_t first_timer,
+		const reconnect_engine *reconnects);
+	connection_pipeline(const connection_pipeline&) = delete;
+	connection_pipeline(connection_pipeline&&) = default;
+
+	/* Destructor */
+	~connection_pipeline() = default;
+
+	/* Operators */
+	connection_pipeline& operator=(const connection_pipeline&) = delete;
+	connection_pipeline& operator=(connection_pipeline&&) = default;
+
+	/* Getters */
+	bool done() const;
+	std::size_t in_flight() const;
+	// Servers given up on since start()
+	std::size_t skipped() const;
+
+	/* Methods */
+	// Starts connecting every live server that is not connected yet, at
+	// most limit at once
+	void start(std::uint16_t interface, server_table *servers, std::size_t limit = MAX_IN_FLIGHT);
+	// A link of a server that is not being set up is closed again
+	void on_opened(std::size_t server, std::uint16_t conn_id);
+	void on_open_failed(std::size_t server);
+	void on_mtu_configured(std::uint16_t conn_id);
+	void on_discovered(std::uint16_t conn_id, std::uint32_t status);
+	// Registering for notifications reports no conn_id, it answers the
+	// oldest server subscribing
+	void on_subscribed(std::uint32_t status);
+	void on_notifications_enabled(std::uint16_t conn_id, std::uint32_t status);
+	// The link of server went down, its setup is given up on right away
+	// instead of at the step's deadline. May come before its open
+	void on_dropped(std::size_t server);
+	// Picks up servers added to the list since the pipeline ran dry
+	void resume();
+	// Abandons the setups in flight, their links are closed
+	void stop();
+	// Timer first_timer + entry expired
+	void on_timeout(std::size_t entry);
+
+private:
+	/* Members */
+	std::array<entry_t, MAX_IN_FLIGHT> m_entries;
+	server_table *m_servers;
+	std::size_t m_next;
+	std::uint16_t m_interface;
+	std::uint32_t m_order;
+	std::chrono::steady_clock::time_point m_started;
+	timer_wheel *m_timers;
+	std::size_t m_first_timer;
+	std::size_t m_skipped;
+	const reconnect_engine *m_reconnects;
+	std::size_t m_limit;
+
+	/* Methods */
+	static std::uint32_t now_ms();
+	void fill();
+	// Moves to step and sends its request
+	void enter(entry_t& e, step_t step);
+	void issue(entry_t& e);
+	void retry(entry_t& e, const char *reason);
+	std::size_t timer_of(const entry_t& e) const;
+	void finish(entry_t& e);
+	// close is false when the link is already gone
+	void fail(entry_t& e, const char *reason, bool close = true);
+	// Logs the time to ready once the last server is done
+	void report() const;
+	entry_t *find(step_t step, std::uint16_t conn_id);
+};
+
+#endif
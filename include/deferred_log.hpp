@@ -0,0 +1,123 @@
+#ifndef DEFERRED_LOG_HPP
+#define DEFERRED_LOG_HPP
+
+// C++ includes
+#include <array>
+#include <atomic>
+#include <type_traits>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "bluetooth_address.hpp"
+#include "mailbox.hpp"
+
+// Logs from hot callbacks without formatting on the caller's task. The
+// caller only stores the tag and format pointers (both must be string
+// literals) and up to MAX_ARGS raw arguments into a lock-free queue; a
+// low-priority task formats and prints them later through ESP_LOGI.
+//
+// Supported arguments are integers/enums (printed with %d, %u, %x, ...)
+// and bluetooth_address (printed with %s).
+#define DEFERRED_LOGI(tag, format, ...) \
+	deferred_log::instance().log(tag, format, ##__VA_ARGS__)
+
+class deferred_log
+{
+public:
+	/* Constants */
+	static constexpr std::size_t MAX_ARGS = 4;
+	static constexpr std::size_t QUEUE_CAPACITY = 64;
+	// Messages per tag per second, anything above is dropped
+	static constexpr std::uint32_t RATE_LIMIT = 20;
+	static constexpr std::size_t MAX_TAGS = 8;
+
+	/* Constructors */
+	deferred_log();
+	deferred_log(const deferred_log&) = delete;
+	deferred_log(deferred_log&&) = delete;
+
+	/* Destructor */
+	~deferred_log() = default;
+
+	/* Operators */
+	deferred_log& operator=(const deferred_log&) = delete;
+	deferred_log& operator=(deferred_log&&) = delete;
+
+	/* Getters */
+	std::uint32_t rate_limited() const;
+	std::uint32_t overflowed() const;
+
+	/* Methods */
+	// Starts the formatting task
+	void start();
+
+	template<typename... Args>
+	void log(const char *tag, const char *format, const Args&... args)
+	{
+		static_assert(sizeof...(Args) <= MAX_ARGS, "too many deferred_log arguments");
+
+		if (!admit(tag))
+			return;
+
+		entry_t entry{tag, format, sizeof...(Args), {{encode(args)...}}};
+		if (!m_queue.push(0, entry))
+			m_overflowed.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/* Static getters */
+	static deferred_log& instance();
+
+private:
+	/* Inner types */
+	enum class kind_t : std::uint8_t
+	{
+		INTEGER,
+		ADDRESS,
+	};
+
+	struct arg_t
+	{
+		kind_t kind;
+		std::int64_t value;
+	};
+
+	struct entry_t
+	{
+		const char *tag;
+		const char *format;
+		std::size_t count;
+		std::array<arg_t, MAX_ARGS> args;
+	};
+
+	struct tag_limit_t
+	{
+		std::atomic<const char *> tag;
+		std::atomic<std::uint32_t> second;
+		std::atomic<std::uint32_t> count;
+	};
+
+	/* Members */
+	mailbox<entry_t, 1, QUEUE_CAPACITY> m_queue;
+	std::array<tag_limit_t, MAX_TAGS> m_limits;
+	std::atomic<std::uint32_t> m_rate_limited;
+	std::atomic<std::uint32_t> m_overflowed;
+
+	/* Methods */
+	bool admit(const char *tag);
+	void consumer();
+	static void print(const entry_t& entry);
+
+	template<typename T, typename = std::enable_if_t<std::is_integral<T>::value || std::is_enum<T>::value>>
+	static arg_t encode(T value)
+	{
+		return {kind_t::INTEGER, static_cast<std::int64_t>(value)};
+	}
+
+	static arg_t encode(const bluetooth_address& addr)
+	{
+		return {kind_t::ADDRESS, static_cast<std::int64_t>(addr.packed())};
+	}
+};
+
+#endif
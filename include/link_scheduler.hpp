@@ -0,0 +1,89 @@
+#ifndef LINK_SCHEDULER_HPP
+#define LINK_SCHEDULER_HPP
+
+// C++ includes
+#include <array>
+#include <experimental/optional>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "server_table.hpp"
+// ESP includes
+#include "sdkconfig.h"
+
+namespace std
+{
+	using namespace experimental;
+}
+
+// Picks which servers hold one of the few BLE links, when there are more
+// servers than links. Servers with recent activity keep their link; the
+// others are rotated out, each after a dwell time long enough to set it
+// up and get a sample, in favour of the server outside the set whose last
+// sample is the oldest. An active server outside the set (seen through
+// its advertisements) goes first. Servers that advertise their activator
+// are sampled by the scan and mostly never need a link to be watched.
+class link_scheduler
+{
+public:
+	/* Constants */
+	// One ACL link stays free for A2DP
+	static constexpr std::size_t LINKS = CONFIG_BT_ACL_CONNECTIONS - 1;
+	static constexpr std::uint32_t ROTATE_MS = 2000;
+	// Open, MTU and subscribe take about a second, then a notification
+	static constexpr std::uint32_t DWELL_MS = 4000;
+	// A sample this old counts as stale enough to rotate a link for it
+	static constexpr std::uint32_t STALE_MS = 6000;
+	// Activity within this long keeps a server in the set
+	static constexpr std::uint32_t ACTIVE_MS = 10000;
+	// At or above this an unchanged activator still counts as activity
+	static constexpr std::uint8_t ACTIVE_LEVEL = 2;
+
+	using evictions_t = std::array<std::size_t, LINKS>;
+
+	/* Constructors */
+	link_scheduler();
+	link_scheduler(const link_scheduler&) = default;
+	link_scheduler(link_scheduler&&) = default;
+
+	/* Destructor */
+	~link_scheduler() = default;
+
+	/* Operators */
+	link_scheduler& operator=(const link_scheduler&) = default;
+	link_scheduler& operator=(link_scheduler&&) = default;
+
+	/* Getters */
+	std::uint32_t rotations() const;
+
+	/* Methods */
+	// Stores an activator value of slot, from a notification or an
+	// advertisement. On the task that owns the table
+	static void on_sample(
+		server_table& servers,
+		std::size_t slot,
+		std::uint8_t activator,
+		std::uint32_t now_ms);
+	// Updates the live flags of servers and fills out with the connected
+	// slots that left the set and should be closed. Returns how many.
+	std::size_t plan(server_table& servers, std::uint32_t now_ms, evictions_t& out);
+	// Age of the oldest sample among servers
+	static std::uint32_t worst_staleness(const server_table& servers, std::uint32_t now_ms);
+
+private:
+	/* Members */
+	// When each slot last joined the set
+	std::array<std::uint32_t, server_table::CAPACITY> m_joined_ms;
+	std::uint32_t m_rotations;
+
+	/* Methods */
+	static bool active(const server_table& servers, std::size_t slot, std::uint32_t now_ms);
+	// Outsider that most needs a link
+	static std::optional<std::size_t> best_outsider(const server_table& servers, std::uint32_t now_ms);
+	// Live member that can best give its link up
+	std::optional<std::size_t> weakest_member(const server_table& servers, std::uint32_t now_ms) const;
+	void join(server_table& servers, std::size_t slot, std::uint32_t now_ms);
+};
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef MAILBOX_HPP
+#define MAILBOX_HPP
+
+// C++ includes
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+// C includes
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free multi-producer/single-consumer queue (Vyukov's
+// sequence-numbered ring). Storage is fixed at compile time.
+template<typename T, std::size_t CAPACITY>
+class mpsc_queue
+{
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+public:
+	/* Constructors */
+	mpsc_queue()
+		: m_enqueue(0)
+		, m_dequeue(0)
+	{
+		for (std::size_t i = 0; i < CAPACITY; i++)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	mpsc_queue(const mpsc_queue&) = delete;
+	mpsc_queue(mpsc_queue&&) = delete;
+
+	/* Destructor */
+	~mpsc_queue() = default;
+
+	/* Operators */
+	mpsc_queue& operator=(const mpsc_queue&) = delete;
+	mpsc_queue& operator=(mpsc_queue&&) = delete;
+
+	/* Methods */
+	// Any thread. Returns false if the queue is full.
+	bool push(const T& value)
+	{
+		auto pos = m_enqueue.load(std::memory_order_relaxed);
+		cell_t *cell;
+		for (;;)
+		{
+			cell = &m_cells[pos & (CAPACITY - 1)];
+			const auto sequence = cell->sequence.load(std::memory_order_acquire);
+			const auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+			if (diff == 0)
+			{
+				if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = m_enqueue.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->value = value;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer thread only. Returns false if the queue is empty.
+	bool pop(T& value)
+	{
+		auto& cell = m_cells[m_dequeue & (CAPACITY - 1)];
+		const auto sequence = cell.sequence.load(std::memory_order_acquire);
+		if (static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(m_dequeue + 1) < 0)
+			return false;
+
+		value = cell.value;
+		cell.sequence.store(m_dequeue + CAPACITY, std::memory_order_release);
+		++m_dequeue;
+		return true;
+	}
+
+private:
+	/* Inner types */
+	struct cell_t
+	{
+		std::atomic<std::size_t> sequence;
+		T value;
+	};
+
+	/* Members */
+	std::array<cell_t, CAPACITY> m_cells;
+	std::atomic<std::size_t> m_enqueue;
+	std::size_t m_dequeue;
+};
+
+// Priority mailbox made of one mpsc_queue per lane; lane 0 is served first.
+// Producers never block. The consumer sleeps on a condition variable, which
+// producers only touch when the consumer has announced it is waiting.
+template<typename T, std::size_t LANES, std::size_t CAPACITY>
+class mailbox
+{
+public:
+	/* Constructors */
+	mailbox()
+		: m_lanes()
+		, m_waiting(false)
+		, m_dropped(0)
+		, m_mutex()
+		, m_cv()
+	{
+	}
+	mailbox(const mailbox&) = delete;
+	mailbox(mailbox&&) = delete;
+
+	/* Destructor */
+	~mailbox() = default;
+
+	/* Operators */
+	mailbox& operator=(const mailbox&) = delete;
+	mailbox& operator=(mailbox&&) = delete;
+
+	/* Getters */
+	std::uint32_t dropped() const
+	{
+		return m_dropped.load(std::memory_order_relaxed);
+	}
+
+	/* Methods */
+	// Any thread. Returns false, and counts a drop, if the lane is full.
+	bool push(std::size_t lane, const T& value)
+	{
+		if (!m_lanes[lane].push(value))
+		{
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		// Pairs with the fence in pop(): either we see m_waiting or the
+		// consumer sees our message
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_waiting.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> l(m_mutex);
+			m_cv.notify_one();
+		}
+		return true;
+	}
+
+	// Consumer thread only
+	bool try_pop(T& value)
+	{
+		for (auto& lane : m_lanes)
+			if (lane.pop(value))
+				return true;
+		return false;
+	}
+
+	// Consumer thread only. Blocks until a message is available.
+	T pop()
+	{
+		T value;
+		if (try_pop(value))
+			return value;
+
+		std::unique_lock<std::mutex> l(m_mutex);
+		// Announce before re-checking, so a producer that misses the flag
+		// has pushed early enough for try_pop to see it
+		m_waiting.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		while (!try_pop(value))
+			m_cv.wait(l);
+		m_waiting.store(false, std::memory_order_relaxed);
+		return value;
+	}
+
+	// Consumer thread only. Blocks until a message is available or timeout
+	// has passed, returns false in the latter case.
+	template<typename Rep, typename Period>
+	bool pop_for(T& value, const std::chrono::duration<Rep, Period>& timeout)
+	{
+		if (try_pop(value))
+			return true;
+
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+		std::unique_lock<std::mutex> l(m_mutex);
+		m_waiting.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto popped = try_pop(value);
+		while (!popped && m_cv.wait_until(l, deadline) != std::cv_status::timeout)
+			popped = try_pop(value);
+		// A message may have landed right as the wait timed out
+		if (!popped)
+			popped = try_pop(value);
+		m_waiting.store(false, std::memory_order_relaxed);
+		return popped;
+	}
+
+private:
+	/* Members */
+	std::array<mpsc_queue<T, CAPACITY>, LANES> m_lanes;
+	std::atomic<bool> m_waiting;
+	std::atomic<std::uint32_t> m_dropped;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef PCM_ANALYSIS_HPP
+#define PCM_ANALYSIS_HPP
+
+// C++ includes
+#include <algorithm>
+#include <cmath>
+#include <limits>
+// C includes
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Levels of one channel over a block, as fractions of full scale
+struct pcm_level_t
+{
+	float rms;
+	float peak;
+	float dc_offset;
+	// Samples at full scale
+	std::uint32_t clips;
+};
+
+inline float to_dbfs(float level)
+{
+	return 20.0f * std::log10(std::max(level, 1e-6f));
+}
+
+// Kernels over one block of interleaved 16 bit PCM. Channel count and block
+// size are template parameters, so the loop has a constant trip count and
+// stride, and its body is branch free: the compiler can unroll it and, where
+// the target has SIMD, vectorize the reductions.
+template<std::size_t CHANNELS, std::size_t BLOCK_FRAMES>
+struct pcm_kernels
+{
+	static_assert(CHANNELS > 0, "CHANNELS must not be 0");
+	static_assert(BLOCK_FRAMES > 0, "BLOCK_FRAMES must not be 0");
+	// Sums of samples are kept in 32 bits
+	static_assert(
+		BLOCK_FRAMES <= std::numeric_limits<std::int32_t>::max() / 32768,
+		"BLOCK_FRAMES too large for 32 bit sums");
+
+	/* Constants */
+	static constexpr std::size_t SAMPLES = CHANNELS * BLOCK_FRAMES;
+	static constexpr std::int32_t FULL_SCALE = 32768;
+	// Either rail counts as a clip
+	static constexpr std::int32_t CLIP_LEVEL = 32767;
+
+	/* Static getters */
+	// One pass per channel with four scalar accumulators. Keeping them in
+	// arrays indexed by channel, in a single pass over the frames, made
+	// the stereo loop slower than a plain scalar one on the host
+	static void levels(const std::int16_t *block, pcm_level_t (&out)[CHANNELS])
+	{
+		for (std::size_t c = 0; c < CHANNELS; c++)
+		{
+			std::int32_t sum = 0;
+			std::int64_t squares = 0;
+			std::int32_t peak = 0;
+			std::uint32_t clips = 0;
+
+			for (std::size_t i = 0; i < BLOCK_FRAMES; i++)
+			{
+				const std::int32_t x = block[i * CHANNELS + c];
+				const auto magnitude = x < 0 ? -x : x;
+				sum += x;
+				squares += x * x;
+				peak = std::max(peak, magnitude);
+				clips += magnitude >= CLIP_LEVEL;
+			}
+
+			const auto mean_square = static_cast<float>(squares) / BLOCK_FRAMES;
+			out[c].rms = std::sqrt(mean_square) / FULL_SCALE;
+			out[c].peak = static_cast<float>(peak) / FULL_SCALE;
+			out[c].dc_offset = static_cast<float>(sum) / BLOCK_FRAMES / FULL_SCALE;
+			out[c].clips = clips;
+		}
+	}
+};
+
+template<std::size_t CHANNELS, std::size_t BLOCK_FRAMES>
+constexpr std::size_t pcm_kernels<CHANNELS, BLOCK_FRAMES>::SAMPLES;
+template<std::size_t CHANNELS, std::size_t BLOCK_FRAMES>
+constexpr std::int32_t pcm_kernels<CHANNELS, BLOCK_FRAMES>::FULL_SCALE;
+template<std::size_t CHANNELS, std::size_t BLOCK_FRAMES>
+constexpr std::int32_t pcm_kernels<CHANNELS, BLOCK_FRAMES>::CLIP_LEVEL;
+
+// Cuts a byte stream of interleaved 16 bit PCM into blocks and keeps the
+// levels of the last complete one, plus running counts. Only the thread that
+// writes may read the metrics.
+template<std::size_t CHANNELS, std::size_t BLOCK_FRAMES>
+class pcm_analyzer
+{
+public:
+	/* Inner types */
+	using kernels = pcm_kernels<CHANNELS, BLOCK_FRAMES>;
+
+	struct metrics_t
+	{
+		// Of the last block
+		pcm_level_t channels[CHANNELS];
+		std::uint32_t blocks;
+		std::uint32_t silent_blocks;
+		std::uint32_t clips;
+	};
+
+	/* Constants */
+	// A block whose peaks all stay below this, about -66 dBFS, is silent
+	static constexpr float SILENCE_LEVEL = 16.0f / kernels::FULL_SCALE;
+
+	/* Constructors */
+	pcm_analyzer()
+		: m_block()
+		, m_fill(0)
+		, m_metrics()
+	{
+	}
+	pcm_analyzer(const pcm_analyzer&) = delete;
+	pcm_analyzer(pcm_analyzer&&) = delete;
+
+	/* Destructor */
+	~pcm_analyzer() = default;
+
+	/* Operators */
+	pcm_analyzer& operator=(const pcm_analyzer&) = delete;
+	pcm_analyzer& operator=(pcm_analyzer&&) = delete;
+
+	/* Getters */
+	const metrics_t& metrics() const
+	{
+		return m_metrics;
+	}
+
+	/* Methods */
+	// Little endian samples, the block picks up where the last write ended
+	void write(const std::uint8_t *data, std::size_t len)
+	{
+		auto *const block = reinterpret_cast<std::uint8_t *>(m_block);
+		while (len > 0)
+		{
+			const auto part = std::min(len, sizeof(m_block) - m_fill);
+			std::memcpy(block + m_fill, data, part);
+			m_fill += part;
+			data += part;
+			len -= part;
+
+			if (m_fill == sizeof(m_block))
+			{
+				m_fill = 0;
+				analyze();
+			}
+		}
+	}
+
+private:
+	/* Members */
+	std::int16_t m_block[kernels::SAMPLES];
+	std::size_t m_fill;
+	metrics_t m_metrics;
+
+	/* Methods */
+	void analyze()
+	{
+		kernels::levels(m_block, m_metrics.channels);
+
+		auto silent = true;
+		for (const auto& level : m_metrics.channels)
+		{
+			silent = silent && level.peak < SILENCE_LEVEL;
+			m_metrics.clips += level.clips;
+		}
+		m_metrics.silent_blocks += silent;
+		++m_metrics.blocks;
+	}
+};
+
+template<std::size_t CHANNELS, std::size_t BLOCK_FRAMES>
+constexpr float pcm_analyzer<CHANNELS, BLOCK_FRAMES>::SILENCE_LEVEL;
+
+#endif
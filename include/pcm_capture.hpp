@@ -0,0 +1,96 @@
+#ifndef PCM_CAPTURE_HPP
+#define PCM_CAPTURE_HPP
+
+// C++ includes
+#include <atomic>
+#include <functional>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "pcm_ring_buffer.hpp"
+
+// Streams the played PCM off the device as binary frames. The consumer
+// encodes a frame per write() into a ring and never blocks; a low priority
+// task drains the ring into the sink. A frame that does not fit is dropped,
+// which shows up as a gap in seq.
+//
+// Frame layout, little endian, decoded by tools/pcm_decode.py:
+//   u16 magic 'P' 'C', u8 version, u8 flags, u32 seq, u32 timestamp_ms,
+//   u32 sample_rate, u8 channels, u8 reserved, u16 frames,
+//   u16 payload_len, u16 checksum (Fletcher-16 of the payload), payload
+// The payload is frames * channels int16 samples, interleaved. With
+// FLAG_DELTA each sample is instead the difference to the previous sample
+// of its channel (0 before the first), zigzag mapped and varint coded, so
+// every frame decodes on its own. A frame that would not shrink is sent raw.
+class pcm_capture
+{
+public:
+	/* Inner types */
+	// Takes up to len bytes, returns how many it took
+	using sink_t = std::function<std::size_t(const std::uint8_t *data, std::size_t len)>;
+
+	/* Constants */
+	static constexpr std::uint16_t MAGIC = 0x4350;
+	static constexpr std::uint8_t VERSION = 1;
+	static constexpr std::uint8_t FLAG_DELTA = 0x01;
+	static constexpr std::uint8_t MAX_CHANNELS = 8;
+	static constexpr std::size_t HEADER_SIZE = 24;
+	// One frame carries at most this much PCM, longer writes are split
+	static constexpr std::size_t MAX_PCM_BYTES = 2048;
+	// A varint of a 17 bit zigzag value takes up to 3 bytes
+	static constexpr std::size_t MAX_FRAME_SIZE = HEADER_SIZE + MAX_PCM_BYTES / 2 * 3;
+
+	/* Constructors */
+	pcm_capture(std::size_t capacity, bool compress);
+	pcm_capture(const pcm_capture&) = delete;
+	pcm_capture(pcm_capture&&) = delete;
+
+	/* Destructor */
+	~pcm_capture() = default;
+
+	/* Operators */
+	pcm_capture& operator=(const pcm_capture&) = delete;
+	pcm_capture& operator=(pcm_capture&&) = delete;
+
+	/* Getters */
+	std::uint32_t frames() const;
+	std::uint32_t dropped() const;
+	// PCM bytes in and frame bytes out, for the compression ratio
+	std::uint32_t pcm_bytes() const;
+	std::uint32_t encoded_bytes() const;
+
+	/* Methods */
+	// Starts the task that feeds sink
+	void start(sink_t sink);
+	// Consumer side, len bytes of 16 bit PCM with up to MAX_CHANNELS channels
+	void write(const std::uint8_t *data, std::size_t len, std::uint32_t sample_rate, std::uint8_t channels);
+	// Encodes one frame of at most MAX_PCM_BYTES into out, returns its size
+	std::size_t encode(
+		std::uint8_t *out,
+		const std::uint8_t *data,
+		std::size_t len,
+		std::uint32_t sample_rate,
+		std::uint8_t channels);
+
+	/* Static getters */
+	// Installs a driver on a UART that only sends, for a sink at line rate
+	static sink_t uart_sink(int port, int tx_pin, int baud_rate);
+
+private:
+	/* Members */
+	pcm_ring_buffer m_ring;
+	bool m_compress;
+	sink_t m_sink;
+	std::uint32_t m_seq;
+	std::atomic<std::uint32_t> m_dropped;
+	std::atomic<std::uint32_t> m_pcm_bytes;
+	std::atomic<std::uint32_t> m_encoded_bytes;
+	std::uint8_t m_frame[MAX_FRAME_SIZE];
+
+	/* Methods */
+	void drain();
+	static std::uint32_t now_ms();
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef PCM_RING_BUFFER_HPP
+#define PCM_RING_BUFFER_HPP
+
+// C++ includes
+#include <atomic>
+#include <memory>
+// C includes
+#include <cstddef>
+#include <cstdint>
+
+// Single-producer/single-consumer byte ring for PCM coming out of the A2DP sink.
+// The producer (Bluedroid A2DP task) only ever calls write(), the consumer only
+// ever calls read(). Neither side blocks or allocates after construction.
+class pcm_ring_buffer
+{
+public:
+	/* Constructors */
+	// Capacity is rounded up to the next power of two
+	explicit pcm_ring_buffer(std::size_t capacity);
+	pcm_ring_buffer(const pcm_ring_buffer&) = delete;
+	pcm_ring_buffer(pcm_ring_buffer&&) = delete;
+
+	/* Destructor */
+	~pcm_ring_buffer() = default;
+
+	/* Operators */
+	pcm_ring_buffer& operator=(const pcm_ring_buffer&) = delete;
+	pcm_ring_buffer& operator=(pcm_ring_buffer&&) = delete;
+
+	/* Getters */
+	std::size_t capacity() const;
+	std::size_t size() const;
+	bool empty() const;
+	std::uint32_t overruns() const;
+	std::uint32_t underruns() const;
+
+	/* Methods */
+	// Producer side. Copies the whole packet or nothing; a packet that does
+	// not fit is dropped and counted as an overrun.
+	bool write(const std::uint8_t *data, std::size_t len);
+	// Consumer side. Returns the number of bytes copied into out; finding the
+	// ring empty is counted as an underrun.
+	std::size_t read(std::uint8_t *out, std::size_t len);
+	// Consumer side, without a copy. Points data at the oldest bytes and
+	// returns how many of them, at most len, are contiguous; they stay in
+	// the ring until consume() releases them.
+	std::size_t peek(const std::uint8_t *&data, std::size_t len) const;
+	void consume(std::size_t len);
+
+private:
+	/* Members */
+	std::unique_ptr<std::uint8_t[]> m_data;
+	std::size_t m_mask;
+	std::atomic<std::size_t> m_head;
+	std::atomic<std::size_t> m_tail;
+	std::atomic<std::uint32_t> m_overruns;
+	std::atomic<std::uint32_t> m_underruns;
+};
+
+#endif
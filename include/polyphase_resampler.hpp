@@ -0,0 +1,230 @@
+#ifndef POLYPHASE_RESAMPLER_HPP
+#define POLYPHASE_RESAMPLER_HPP
+
+// C++ includes
+#include <algorithm>
+#include <limits>
+// C includes
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+constexpr std::uint32_t rate_gcd(std::uint32_t a, std::uint32_t b)
+{
+	return b == 0 ? a : rate_gcd(b, a % b);
+}
+
+// Filter bank of a rational IN -> OUT resampler, computed by the compiler.
+// The rate ratio reduces to PHASES / STEP; the prototype is a Kaiser
+// windowed sinc of PHASES * TAPS taps cut at CUTOFF of the lower rate,
+// split into PHASES filters of TAPS Q14 coefficients each. Every phase
+// has unity gain at DC.
+template<std::uint32_t IN, std::uint32_t OUT, std::size_t TAPS>
+struct polyphase_table
+{
+	/* Constants */
+	static constexpr std::size_t PHASES = OUT / rate_gcd(IN, OUT);
+	static constexpr std::size_t STEP = IN / rate_gcd(IN, OUT);
+	static constexpr std::size_t LENGTH = PHASES * TAPS;
+	// Fraction of the lower rate, 0.5 being its Nyquist frequency
+	static constexpr double CUTOFF = 0.45;
+	static constexpr double KAISER_BETA = 8.0;
+	static constexpr int COEFFICIENT_BITS = 14;
+
+	/* Constructors */
+	constexpr polyphase_table()
+		: coefficients()
+	{
+		const auto lower = IN < OUT ? IN : OUT;
+		// In cycles per sample at IN * PHASES
+		const auto fc = CUTOFF * lower / (static_cast<double>(IN) * PHASES);
+		const auto center = (LENGTH - 1) / 2.0;
+
+		double prototype[LENGTH] = {};
+		double sum = 0;
+		for (std::size_t k = 0; k < LENGTH; k++)
+		{
+			const auto ratio = 2 * (k - center) / (LENGTH - 1);
+			const auto window = bessel_i0(KAISER_BETA * sqrt(1 - ratio * ratio)) / bessel_i0(KAISER_BETA);
+			prototype[k] = 2 * fc * sinc(2 * fc * (k - center)) * window;
+			sum += prototype[k];
+		}
+
+		// Phase p holds taps p, p + PHASES, ..., newest sample last
+		const auto scale = PHASES / sum * (1 << COEFFICIENT_BITS);
+		for (std::size_t p = 0; p < PHASES; p++)
+		{
+			for (std::size_t j = 0; j < TAPS; j++)
+			{
+				const auto value = prototype[(TAPS - 1 - j) * PHASES + p] * scale;
+				coefficients[p][j] = static_cast<std::int16_t>(value + (value < 0 ? -0.5 : 0.5));
+			}
+		}
+	}
+
+	/* Members */
+	std::int16_t coefficients[PHASES][TAPS];
+
+private:
+	static constexpr double PI = 3.14159265358979323846;
+
+	/* Static getters */
+	static constexpr double sin(double x)
+	{
+		if (x < 0)
+			return -sin(-x);
+
+		// Into [-pi, pi], where the series converges quickly
+		x -= static_cast<long long>(x / (2 * PI)) * 2 * PI;
+		if (x > PI)
+			x -= 2 * PI;
+
+		double term = x;
+		double result = x;
+		for (int n = 1; n < 15; n++)
+		{
+			term *= -x * x / ((2 * n) * (2 * n + 1));
+			result += term;
+		}
+		return result;
+	}
+
+	static constexpr double sinc(double x)
+	{
+		return x == 0 ? 1 : sin(PI * x) / (PI * x);
+	}
+
+	static constexpr double sqrt(double x)
+	{
+		if (x <= 0)
+			return 0;
+
+		double result = x < 1 ? 1 : x;
+		for (int i = 0; i < 32; i++)
+			result = (result + x / result) / 2;
+		return result;
+	}
+
+	static constexpr double bessel_i0(double x)
+	{
+		double term = 1;
+		double result = 1;
+		for (int k = 1; k < 40; k++)
+		{
+			term *= x / (2 * k);
+			result += term * term;
+		}
+		return result;
+	}
+};
+
+template<std::uint32_t IN, std::uint32_t OUT, std::size_t TAPS>
+constexpr std::size_t polyphase_table<IN, OUT, TAPS>::PHASES;
+template<std::uint32_t IN, std::uint32_t OUT, std::size_t TAPS>
+constexpr std::size_t polyphase_table<IN, OUT, TAPS>::STEP;
+template<std::uint32_t IN, std::uint32_t OUT, std::size_t TAPS>
+constexpr std::size_t polyphase_table<IN, OUT, TAPS>::LENGTH;
+template<std::uint32_t IN, std::uint32_t OUT, std::size_t TAPS>
+constexpr double polyphase_table<IN, OUT, TAPS>::CUTOFF;
+template<std::uint32_t IN, std::uint32_t OUT, std::size_t TAPS>
+constexpr double polyphase_table<IN, OUT, TAPS>::KAISER_BETA;
+template<std::uint32_t IN, std::uint32_t OUT, std::size_t TAPS>
+constexpr int polyphase_table<IN, OUT, TAPS>::COEFFICIENT_BITS;
+template<std::uint32_t IN, std::uint32_t OUT, std::size_t TAPS>
+constexpr double polyphase_table<IN, OUT, TAPS>::PI;
+
+// Streaming IN -> OUT resampler of interleaved 16 bit PCM. Its table is a
+// compile time constant in flash, its only state the last TAPS frames of
+// each channel, so it never allocates. The history is stored twice in a
+// row, so every output is one contiguous dot product.
+template<std::uint32_t IN, std::uint32_t OUT, std::size_t CHANNELS, std::size_t TAPS>
+class polyphase_resampler
+{
+public:
+	/* Inner types */
+	using table_t = polyphase_table<IN, OUT, TAPS>;
+
+	/* Constants */
+	static constexpr table_t TABLE = table_t();
+
+	/* Constructors */
+	polyphase_resampler()
+		: m_history()
+		, m_position(0)
+		, m_phase(0)
+	{
+	}
+	polyphase_resampler(const polyphase_resampler&) = delete;
+	polyphase_resampler(polyphase_resampler&&) = delete;
+
+	/* Destructor */
+	~polyphase_resampler() = default;
+
+	/* Operators */
+	polyphase_resampler& operator=(const polyphase_resampler&) = delete;
+	polyphase_resampler& operator=(polyphase_resampler&&) = delete;
+
+	/* Methods */
+	// Forgets the previous stream
+	void reset()
+	{
+		std::memset(m_history, 0, sizeof(m_history));
+		m_position = 0;
+		m_phase = 0;
+	}
+
+	// Consumes all frames of in, little endian, and returns the number of
+	// frames written to out, which must hold max_output(frames)
+	std::size_t process(const std::uint8_t *in, std::size_t frames, std::int16_t *out)
+	{
+		std::size_t produced = 0;
+		for (std::size_t i = 0; i < frames; i++)
+		{
+			std::int16_t frame[CHANNELS];
+			std::memcpy(frame, in + i * sizeof(frame), sizeof(frame));
+			for (std::size_t c = 0; c < CHANNELS; c++)
+				m_history[c][m_position] = m_history[c][m_position + TAPS] = frame[c];
+			m_position = m_position + 1 < TAPS ? m_position + 1 : 0;
+
+			for (; m_phase < table_t::PHASES; m_phase += table_t::STEP)
+			{
+				for (std::size_t c = 0; c < CHANNELS; c++)
+					out[produced * CHANNELS + c] = filter(TABLE.coefficients[m_phase], &m_history[c][m_position]);
+				++produced;
+			}
+			m_phase -= table_t::PHASES;
+		}
+		return produced;
+	}
+
+	/* Static getters */
+	static constexpr std::size_t max_output(std::size_t frames)
+	{
+		return (frames + 1) * table_t::PHASES / table_t::STEP + 1;
+	}
+
+private:
+	/* Members */
+	std::int16_t m_history[CHANNELS][2 * TAPS];
+	std::size_t m_position;
+	std::size_t m_phase;
+
+	/* Static getters */
+	static std::int16_t filter(const std::int16_t (&coefficients)[TAPS], const std::int16_t *window)
+	{
+		// The taps of a phase add up to well below 4 in magnitude, so 32 bits do
+		std::int32_t sum = 1 << (table_t::COEFFICIENT_BITS - 1);
+		for (std::size_t j = 0; j < TAPS; j++)
+			sum += coefficients[j] * window[j];
+
+		sum >>= table_t::COEFFICIENT_BITS;
+		return static_cast<std::int16_t>(std::min<std::int32_t>(
+			std::max<std::int32_t>(sum, std::numeric_limits<std::int16_t>::min()),
+			std::numeric_limits<std::int16_t>::max()));
+	}
+};
+
+template<std::uint32_t IN, std::uint32_t OUT, std::size_t CHANNELS, std::size_t TAPS>
+constexpr typename polyphase_resampler<IN, OUT, CHANNELS, TAPS>::table_t polyphase_resampler<IN, OUT, CHANNELS, TAPS>::TABLE;
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef RECONNECT_ENGINE_HPP
+#define RECONNECT_ENGINE_HPP
+
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "retry_policy.hpp"
+#include "server_table.hpp"
+
+// Brings back servers whose link dropped or could not be set up. A server
+// is held back for an exponential backoff with jitter, so servers that
+// dropped together (e.g. on interference) do not all retry at once; once
+// the hold ends the connection pipeline sets it up again. After
+// POLICY.retries failed setups in a row the server is left to the link
+// scheduler, which rotates it back in when its sample is stale.
+class reconnect_engine
+{
+public:
+	/* Constants */
+	// Only backoff and retries are used, the pipeline has its own deadlines
+	static constexpr retry_policy POLICY = { 0, 6, 1000, 30000 };
+	// Setups in flight outside of start up, A2DP shares the radio
+	static constexpr std::size_t MAX_IN_FLIGHT = 2;
+
+	/* Constructors */
+	reconnect_engine() = default;
+	reconnect_engine(const reconnect_engine&) = default;
+	reconnect_engine(reconnect_engine&&) = default;
+
+	/* Destructor */
+	~reconnect_engine() = default;
+
+	/* Operators */
+	reconnect_engine& operator=(const reconnect_engine&) = default;
+	reconnect_engine& operator=(reconnect_engine&&) = default;
+
+	/* Methods */
+	// A connected server lost its link
+	void on_dropped(server_table& servers, std::size_t slot, std::uint32_t now_ms) const;
+	void on_connected(server_table& servers, std::size_t slot) const;
+	// Setting slot up failed. Returns false once the server is given up on
+	bool on_failed(server_table& servers, std::size_t slot, std::uint32_t now_ms) const;
+	static bool holding(const server_table& servers, std::size_t slot);
+	// Not held, or the hold is over
+	static bool ready(const server_table& servers, std::size_t slot, std::uint32_t now_ms);
+
+private:
+	/* Methods */
+	// Between half and all of the backoff of attempt
+	void hold(server_table& servers, std::size_t slot, std::uint8_t attempt, std::uint32_t now_ms) const;
+};
+
+#endif
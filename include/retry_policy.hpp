@@ -0,0 +1,28 @@
+#ifndef RETRY_POLICY_HPP
+#define RETRY_POLICY_HPP
+
+// C includes
+#include <cstdint>
+
+// How long to wait for the answer to a request, how often to try again
+// and how long to back off between tries. The backoff doubles with every
+// attempt up to backoff_cap_ms.
+struct retry_policy
+{
+	// 0 waits forever
+	std::uint32_t deadline_ms;
+	std::uint8_t retries;
+	std::uint32_t backoff_ms;
+	std::uint32_t backoff_cap_ms;
+
+	// attempt counts from 1 for the first retry
+	constexpr std::uint32_t backoff(std::uint8_t attempt) const
+	{
+		auto delay = backoff_ms;
+		for (std::uint8_t i = 1; i < attempt && delay < backoff_cap_ms; i++)
+			delay *= 2;
+		return delay < backoff_cap_ms ? delay : backoff_cap_ms;
+	}
+};
+
+#endif
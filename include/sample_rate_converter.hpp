@@ -0,0 +1,73 @@
+#ifndef SAMPLE_RATE_CONVERTER_HPP
+#define SAMPLE_RATE_CONVERTER_HPP
+
+// C++ includes
+#include <atomic>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "polyphase_resampler.hpp"
+
+// Brings the PCM of the A2DP sink, whatever rate AUDIO_CFG negotiated, to
+// OUTPUT_RATE. There is one resampler per supported input rate, each with
+// its filter bank fixed at compile time, so a new rate only selects another
+// one and clears its history. 48 kHz, and any rate without a resampler,
+// pass through untouched.
+// Only the PCM consumer calls convert(), set_input_rate() may be called
+// from any task and takes effect on the next convert().
+class sample_rate_converter
+{
+public:
+	/* Constants */
+	static constexpr std::uint32_t OUTPUT_RATE = 48000;
+	static constexpr std::size_t CHANNELS = 2;
+	static constexpr std::size_t BYTES_PER_FRAME = CHANNELS * sizeof(std::int16_t);
+	static constexpr std::size_t TAPS = 32;
+	static constexpr std::size_t MAX_INPUT_FRAMES = 512;
+	static constexpr std::size_t MAX_INPUT_BYTES = MAX_INPUT_FRAMES * BYTES_PER_FRAME;
+
+	/* Constructors */
+	sample_rate_converter();
+	sample_rate_converter(const sample_rate_converter&) = delete;
+	sample_rate_converter(sample_rate_converter&&) = delete;
+
+	/* Destructor */
+	~sample_rate_converter() = default;
+
+	/* Operators */
+	sample_rate_converter& operator=(const sample_rate_converter&) = delete;
+	sample_rate_converter& operator=(sample_rate_converter&&) = delete;
+
+	/* Getters */
+	std::uint32_t input_rate() const;
+
+	/* Methods */
+	void set_input_rate(std::uint32_t sample_rate);
+	// Converts up to MAX_INPUT_BYTES of whole frames. Points out at the
+	// converted PCM, the input itself when it passes through, and returns
+	// its size in bytes; out stays valid until the next call.
+	std::size_t convert(const std::uint8_t *in, std::size_t len, const std::uint8_t *&out);
+
+private:
+	/* Inner types */
+	template<std::uint32_t IN>
+	using resampler_t = polyphase_resampler<IN, OUTPUT_RATE, CHANNELS, TAPS>;
+
+	/* Constants */
+	// The largest ratio there is a resampler for
+	static constexpr std::size_t MAX_OUTPUT_FRAMES = resampler_t<16000>::max_output(MAX_INPUT_FRAMES);
+
+	/* Members */
+	std::atomic<std::uint32_t> m_pending_rate;
+	std::uint32_t m_input_rate;
+	resampler_t<16000> m_from_16k;
+	resampler_t<32000> m_from_32k;
+	resampler_t<44100> m_from_44k;
+	std::int16_t m_output[MAX_OUTPUT_FRAMES * CHANNELS];
+
+	/* Methods */
+	void apply_input_rate();
+};
+
+#endif
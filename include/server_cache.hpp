@@ -0,0 +1,41 @@
+#ifndef SERVER_CACHE_HPP
+#define SERVER_CACHE_HPP
+
+// C++ includes
+#include <vector>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "bluetooth_server_info.hpp"
+#include "server_table.hpp"
+
+// Known servers persisted in NVS, so a reboot can connect straight away
+// instead of scanning first. Only what is needed to reconnect is kept:
+// address, address type, last connection parameters and the discovered
+// GATT handles.
+class server_cache
+{
+public:
+	/* Constants */
+	static constexpr std::size_t MAX_ENTRIES = server_table::CAPACITY;
+
+	/* Constructors */
+	server_cache() = default;
+	server_cache(const server_cache&) = delete;
+	server_cache(server_cache&&) = default;
+
+	/* Destructor */
+	~server_cache() = default;
+
+	/* Operators */
+	server_cache& operator=(const server_cache&) = delete;
+	server_cache& operator=(server_cache&&) = default;
+
+	/* Methods */
+	// Empty if nothing is stored or the stored layout is from another version
+	std::vector<bluetooth_server_info> load() const;
+	bool store(const server_table& servers) const;
+};
+
+#endif
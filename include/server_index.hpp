@@ -0,0 +1,73 @@
+#ifndef SERVER_INDEX_HPP
+#define SERVER_INDEX_HPP
+
+// C++ includes
+#include <array>
+#include <experimental/optional>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "bluetooth_address.hpp"
+
+namespace std
+{
+	using namespace experimental;
+}
+
+// Maps conn_id and address to a slot in the server list in constant time.
+// conn_id goes through a direct table, addresses through a small
+// open-addressed hash keyed on the packed 48-bit address. Slots are never
+// removed, only rebound, so there are no tombstones.
+class server_index
+{
+public:
+	/* Constants */
+	// Bluedroid hands out conn_ids as link indices, so they stay small
+	static constexpr std::size_t MAX_CONN_ID = 16;
+	// Power of two, kept at most half full
+	static constexpr std::size_t ADDRESS_BUCKETS = 128;
+
+	/* Constructors */
+	server_index();
+	server_index(const server_index&) = default;
+	server_index(server_index&&) = default;
+
+	/* Destructor */
+	~server_index() = default;
+
+	/* Operators */
+	server_index& operator=(const server_index&) = default;
+	server_index& operator=(server_index&&) = default;
+
+	/* Methods */
+	// Returns false if the table is too full to take another address
+	bool insert(const bluetooth_address& addr, std::size_t slot);
+	std::optional<std::size_t> find(const bluetooth_address& addr) const;
+
+	void bind(std::uint16_t conn_id, std::size_t slot);
+	void unbind(std::uint16_t conn_id);
+	std::optional<std::size_t> find(std::uint16_t conn_id) const;
+
+	void clear();
+
+private:
+	/* Inner types */
+	struct bucket_t
+	{
+		std::uint64_t key;
+		std::uint16_t slot;
+	};
+
+	static constexpr std::uint16_t EMPTY = 0xffff;
+
+	/* Members */
+	std::array<std::uint16_t, MAX_CONN_ID> m_by_conn_id;
+	std::array<bucket_t, ADDRESS_BUCKETS> m_by_address;
+	std::size_t m_addresses;
+
+	/* Methods */
+	static std::size_t hash(const bluetooth_address& addr);
+};
+
+#endif
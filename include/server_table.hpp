@@ -0,0 +1,130 @@
+#ifndef SERVER_TABLE_HPP
+#define SERVER_TABLE_HPP
+
+// C++ includes
+#include <array>
+#include <atomic>
+#include <experimental/optional>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "bluetooth_address.hpp"
+#include "bluetooth_server_info.hpp"
+// ESP includes
+#include "esp_bt_device.h"
+
+namespace std
+{
+	using namespace experimental;
+}
+
+// Fixed-capacity list of the known servers, stored as one array per field
+// (struct of arrays), so scans over one field such as the connected flags
+// touch contiguous memory. A server keeps its slot for as long as the table
+// lives: slots are handed out in order and never move, which is what
+// server_index, activator_ranking and the policies key on. Nothing is
+// allocated, the table is sized at compile time.
+//
+// Two tasks share the table. add() runs on the BT task (scan results); it
+// fills the slot and only then publishes it with a release store of the
+// size, which readers load with acquire, so a slot below size() is always
+// complete. conn_params() belongs to the BT task, which settles it from
+// UPDATE_CONN_PARAMS_EVT, and is kept in one atomic word so the cache can
+// read it. Every other column is written by the state machine handler
+// only; the BT task posts what it learns (links, samples) as messages.
+class server_table
+{
+public:
+	/* Constants */
+	// More than the controller has ACL links, link_scheduler rotates them
+	static constexpr std::size_t CAPACITY = 32;
+
+	/* Constructors */
+	server_table();
+	server_table(const server_table&) = delete;
+	server_table(server_table&&) = delete;
+
+	/* Destructor */
+	~server_table() = default;
+
+	/* Operators */
+	server_table& operator=(const server_table&) = delete;
+	server_table& operator=(server_table&&) = delete;
+
+	/* Getters */
+	std::size_t size() const;
+	bool empty() const;
+	bool full() const;
+
+	// Per slot, slot < size()
+	bluetooth_address address(std::size_t slot) const;
+	const esp_ble_addr_type_t& address_type(std::size_t slot) const;
+	esp_ble_addr_type_t& address_type(std::size_t slot);
+	const std::uint16_t& conn_id(std::size_t slot) const;
+	std::uint16_t& conn_id(std::size_t slot);
+	const std::uint8_t& activator(std::size_t slot) const;
+	std::uint8_t& activator(std::size_t slot);
+	const bool& ble_connected(std::size_t slot) const;
+	bool& ble_connected(std::size_t slot);
+	const std::uint16_t& notify_handle(std::size_t slot) const;
+	std::uint16_t& notify_handle(std::size_t slot);
+	const std::uint16_t& cccd_handle(std::size_t slot) const;
+	std::uint16_t& cccd_handle(std::size_t slot);
+	// Any task
+	bluetooth_server_info::conn_params_t conn_params(std::size_t slot) const;
+	// Picked by link_scheduler to hold a BLE link
+	const bool& live(std::size_t slot) const;
+	bool& live(std::size_t slot);
+	// Last activator value, from a notification or an advertisement
+	const std::uint32_t& sampled_ms(std::size_t slot) const;
+	std::uint32_t& sampled_ms(std::size_t slot);
+	// Last sample that showed activity, 0 if none did
+	const std::uint32_t& active_ms(std::size_t slot) const;
+	std::uint32_t& active_ms(std::size_t slot);
+	// Held back by reconnect_engine until then, 0 if not held
+	const std::uint32_t& retry_at_ms(std::size_t slot) const;
+	std::uint32_t& retry_at_ms(std::size_t slot);
+	// Failed setups in a row
+	const std::uint8_t& failures(std::size_t slot) const;
+	std::uint8_t& failures(std::size_t slot);
+
+	/* Setters */
+	void set_conn_params(std::size_t slot, const bluetooth_server_info::conn_params_t& params);
+
+	/* Methods */
+	// Slot of the new server, nothing if the table is full. One task at a time
+	std::optional<std::size_t> add(const bluetooth_server_info& server);
+	// Copy of the record in slot, e.g. for the cache
+	bluetooth_server_info info(std::size_t slot) const;
+	// First live slot at or after from without a BLE link, that
+	// reconnect_engine does not hold back at now_ms
+	std::optional<std::size_t> next_to_connect(std::size_t from, std::uint32_t now_ms) const;
+	std::size_t connected() const;
+	std::size_t live_count() const;
+
+private:
+	/* Members */
+	std::atomic<std::size_t> m_size;
+	// Packed, see bluetooth_address::packed()
+	std::array<std::uint64_t, CAPACITY> m_addresses;
+	std::array<esp_ble_addr_type_t, CAPACITY> m_address_types;
+	std::array<std::uint16_t, CAPACITY> m_conn_ids;
+	std::array<std::uint8_t, CAPACITY> m_activators;
+	std::array<bool, CAPACITY> m_ble_connected;
+	std::array<std::uint16_t, CAPACITY> m_notify_handles;
+	std::array<std::uint16_t, CAPACITY> m_cccd_handles;
+	// Packed, see pack()
+	std::array<std::atomic<std::uint64_t>, CAPACITY> m_conn_params;
+	std::array<bool, CAPACITY> m_live;
+	std::array<std::uint32_t, CAPACITY> m_sampled_ms;
+	std::array<std::uint32_t, CAPACITY> m_active_ms;
+	std::array<std::uint32_t, CAPACITY> m_retry_at_ms;
+	std::array<std::uint8_t, CAPACITY> m_failures;
+
+	/* Methods */
+	static std::uint64_t pack(const bluetooth_server_info::conn_params_t& params);
+	static bluetooth_server_info::conn_params_t unpack(std::uint64_t packed);
+};
+
+#endif
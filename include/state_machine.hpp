@@ -2,14 +2,22 @@
 #define STATE_MACHINE_HPP
 
 // C++ includes
+#include <atomic>
 #include <experimental/optional>
-#include <mutex>
-#include <queue>
-#include <vector>
+// C includes
+#include <cstdio>
 // ESP includes
 #include "esp_gattc_api.h"
 // My includes
 #include "bluetooth_server_info.hpp"
+#include "connection_pipeline.hpp"
+#include "link_scheduler.hpp"
+#include "mailbox.hpp"
+#include "reconnect_engine.hpp"
+#include "retry_policy.hpp"
+#include "server_cache.hpp"
+#include "server_table.hpp"
+#include "timer_wheel.hpp"
 
 namespace std
 {
@@ -29,28 +37,40 @@ public:
 		IDLE_TO_BLE_0,
 		IDLE_TO_BLE_1,
 		IDLE_TO_BLE_2,
-		IDLE_TO_BLE_3,
-		IDLE_TO_BLE_4,
 
-		BLE_TO_A2DP_0,
 		BLE_TO_A2DP_1,
 
-		A2DP_TO_BLE_0,
 		A2DP_TO_BLE_1,
 		A2DP_TO_BLE_2,
+
+		A2DP_TO_A2DP_1,
+		A2DP_TO_A2DP_2,
+		A2DP_TO_A2DP_3,
+
+		COUNT,
 	};
 
 	enum class msg_t
 	{
+		// Once from idle_to_ble(), then again for every switch attempt
 		IDLE_TO_BLE_START,
+		// arg is the server slot to play from
 		BLE_TO_A2DP_START,
 		A2DP_TO_BLE_START,
+		// arg is the server slot to hand over to
+		A2DP_TO_A2DP_START,
 
 		SCAN_FINISHED,
+		// arg is the server slot, NO_SLOT if it is not in the table
 		BLE_OPENED,
+		BLE_OPEN_FAILED,
 		MTU_CONFIGURED,
+		SERVICES_DISCOVERED,
+		NOTIFICATIONS_ENABLED,
 
+		// arg is the status of registering for notifications
 		BLE_CONNECTED,
+		// arg is the server slot, NO_SLOT if it is not in the table
 		BLE_DISCONNECTED,
 
 		A2DP_CONNECTED,
@@ -58,15 +78,110 @@ public:
 		A2DP_MEDIA_STARTED,
 		A2DP_DISCONNECTING,
 		A2DP_DISCONNECTED,
+		// A peer paged for a handover answered SDP as an A2DP source.
+		// conn_id:arg is its packed address
+		PEER_PREPARED,
+		// The same peer is no A2DP source, or could not be reached
+		PEER_UNSUITABLE,
+
+		// arg is the server slot << 8 | its activator. Taken in any state
+		// once the server table is known, outside of the transition table
+		ACTIVATOR_SAMPLED,
+
+		// Never queued. Raised by the handler when one of its timers
+		// expires, arg is the timer
+		TIMEOUT,
+		// Never queued. Selects the completion transitions of a state, taken
+		// right after any other transition as long as their guard holds
+		COMPLETION,
+
+		COUNT,
+	};
+
+	// Mailbox lanes, served in declaration order
+	enum class lane_t
+	{
+		FAILURE,
+		CONTROL,
+		PROGRESS,
+		// Activator samples, stale by the time anything else is waiting
+		SAMPLE,
+
+		COUNT,
 	};
 
-	struct priority_msg_t
+	struct message_t
 	{
 		msg_t msg;
-		int priority;
+		std::uint16_t conn_id;
+		// Message specific, e.g. a GATT status
+		std::uint32_t arg;
 	};
 
-	static bool is_priority_over(const priority_msg_t& l, const priority_msg_t& r);
+	using guard_t = bool (state_machine::*)(const message_t&) const;
+	using action_t = void (state_machine::*)(const message_t&);
+
+	// Rows for the same (state, msg) pair are adjacent and tried in order,
+	// the first one whose guard passes is taken
+	struct transition_t
+	{
+		state_t state;
+		msg_t msg;
+		// nullptr always passes
+		guard_t guard;
+		// nullptr when the message is expected but needs no work
+		action_t action;
+		state_t next;
+		// Shown next to the message on the exported graph
+		const char *label;
+	};
+
+	// How long a switch step waits for its answer and how it retries. On
+	// a timeout with retries left the step backs off, then runs request
+	// again; once they are used up the TIMEOUT rows of the table decide
+	struct deadline_t
+	{
+		state_t state;
+		retry_policy policy;
+		action_t request;
+	};
+
+	static constexpr std::size_t MAILBOX_CAPACITY = 16;
+
+	// Timers of the handler
+	static constexpr std::size_t STATE_TIMER = 0;
+	static constexpr std::size_t SCAN_TIMER = 1;
+	// Periodic while in BLE or A2DP
+	static constexpr std::size_t LINK_TIMER = 2;
+	static constexpr std::size_t PIPELINE_TIMERS = 3;
+	static constexpr std::size_t TIMER_COUNT = PIPELINE_TIMERS + connection_pipeline::MAX_IN_FLIGHT;
+	static constexpr std::uint32_t TIMER_TICK_MS = 10;
+	// arg of BLE_OPENED and BLE_DISCONNECTED for a peer outside the table
+	static constexpr std::uint32_t NO_SLOT = 0xffffffff;
+
+	// Scan timing, in units of 0.625 ms
+	struct scan_profile_t
+	{
+		std::uint16_t interval;
+		std::uint16_t window;
+	};
+
+	// Looking for servers at start up, 60% of the radio
+	static constexpr scan_profile_t DISCOVERY_SCAN = {
+		0x50,	// 50 ms
+		0x30,	// 30 ms
+	};
+	// From BLE on, for servers that boot late, ~2.3% of the radio
+	static constexpr scan_profile_t BACKGROUND_SCAN = {
+		0x800,	// 1.28 s
+		0x30,	// 30 ms
+	};
+
+	static constexpr std::uint8_t SCAN_SECONDS = 5;
+	// The scan normally reports back after SCAN_SECONDS
+	static constexpr std::uint32_t SCAN_DEADLINE_MS = 8000;
+
+	static lane_t lane_of(msg_t msg);
 
 	/* Constructors */
 	state_machine();
@@ -77,56 +192,194 @@ public:
 	~state_machine() = default;
 
 	/* Getters */
-	const std::optional<bluetooth_address>& a2dp_address() const;
+	// A2DP peer, any task: a snapshot the handler publishes on every change
+	std::optional<bluetooth_address> a2dp_address() const;
 
 	/* Operators */
 	state_machine& operator=(const state_machine&) = delete;
 	state_machine& operator=(state_machine&&) = default;
 
+	/* Static getters */
+	static const char *state_name(state_t state);
+	static const char *msg_name(msg_t msg);
+
 	/* Methods */
+	// Writes the transition table as a Graphviz digraph, docs/state_machine.dot
+	// is this output and should be refreshed whenever the table changes
+	static void write_graph(std::FILE *out);
 	void start();
-	// Switches from idle to (N BLE, 0 A2DP). Should be run only once, after scanning
-	void idle_to_ble(std::uint16_t interface, std::vector<bluetooth_server_info> *servers);
-	// Switches from (N BLE, 0 A2DP) to (N - 1 BLE, 1 A2DP)
-	void ble_to_a2dp(bluetooth_address addr);
+	// Takes effect the next time the background scan starts
+	void set_background_scan(scan_profile_t profile);
+	// The switches below may be requested from any task, they only post a
+	// message. One request is in flight at a time; each returns false,
+	// and nothing is posted, outside of its starting state or while
+	// another request was not taken by the handler yet.
+	// Switches from idle to (N BLE, 0 A2DP), so it succeeds once. Servers
+	// already in the list (from the cache) are connected while scanning
+	bool idle_to_ble(
+		std::uint16_t interface,
+		server_table *servers,
+		const server_cache *cache);
+	// Switches from (N BLE, 0 A2DP) to (N - 1 BLE, 1 A2DP), with A2DP to
+	// server slot
+	bool ble_to_a2dp(std::size_t slot);
 	// Switches from (N - 1 BLE, 1 A2DP) to (N BLE, 0 A2DP)
-	void a2dp_to_ble();
+	bool a2dp_to_ble();
+	// Moves A2DP from the current peer to the one of server slot without
+	// going through BLE. It is paged and its services discovered while the
+	// current peer still streams; the current peer is only dropped once
+	// that worked
+	bool handover(std::size_t slot);
 	void notify_scan_finished();
-	void notify_ble_opened(int conn_id);
-	void notify_mtu_configured();
+	void notify_ble_opened(std::uint16_t conn_id, std::uint32_t slot);
+	void notify_ble_open_failed(std::size_t server);
+	void notify_mtu_configured(std::uint16_t conn_id);
+	void notify_services_discovered(std::uint16_t conn_id, std::uint32_t status);
+	void notify_notifications_enabled(std::uint16_t conn_id, std::uint32_t status);
 
-	void notify_ble_connected();
-	void notify_ble_disconnected();
+	void notify_ble_connected(std::uint32_t status);
+	void notify_ble_disconnected(std::uint16_t conn_id, std::uint32_t slot);
+	// Only the handler writes the server table, samples of the BT task go
+	// through here. Dropped without a word when the lane is full, the
+	// server's next sample makes up for it
+	void notify_activator_sampled(std::size_t slot, std::uint8_t activator);
 
 	void notify_a2dp_connected();
 	void notify_a2dp_media_started();
 	void notify_a2dp_media_stopped();
 	void notify_a2dp_disconnecting();
 	void notify_a2dp_disconnected();
+	void notify_peer_prepared(const bluetooth_address& peer, bool a2dp_source);
 
 private:
+	/* Inner types */
+	// Holds the transition table, defined next to the actions it names
+	struct transitions;
+
+	// What idle_to_ble() was given, for the handler to take over
+	struct idle_to_ble_t
+	{
+		std::uint16_t interface;
+		server_table *servers;
+		const server_cache *cache;
+	};
+
 	/* Members */
-	std::priority_queue<
-		priority_msg_t,
-		std::vector<priority_msg_t>,
-		std::decay_t<decltype(is_priority_over)>> m_messages;
-	std::mutex m_message_mutex;
+	mailbox<
+		message_t,
+		static_cast<std::size_t>(lane_t::COUNT),
+		MAILBOX_CAPACITY> m_messages;
 
-	std::vector<bluetooth_server_info> *m_servers;
+	// Written by idle_to_ble() before it posts, read once the handler
+	// takes the message
+	idle_to_ble_t m_idle_to_ble;
+	server_table *m_servers;
+	const server_cache *m_cache;
+	bool m_scan_finished;
+	scan_profile_t m_background_scan;
 	state_t m_state;
+	// m_state for the switch requests of other tasks
+	std::atomic<state_t> m_published_state;
+	// A switch was requested and its message not dispatched yet
+	std::atomic<bool> m_switch_requested;
 	state_t m_saved_state;
 	std::optional<bluetooth_address> m_a2dp_address;
+	// Packed m_a2dp_address for a2dp_address(), 0 when there is none
+	std::atomic<std::uint64_t> m_published_address;
+	// Next A2DP peer while handing over
+	std::optional<bluetooth_address> m_handover_address;
+
+	timer_wheel m_timers;
+	// Retries of the current switch step
+	std::uint8_t m_attempts;
+	// STATE_TIMER ends a backoff rather than a deadline
+	bool m_backing_off;
+	// The stack refused a request of the transition being taken
+	bool m_refused;
 
-	std::vector<bluetooth_server_info>::iterator m_to_connect;
+	reconnect_engine m_reconnects;
+	connection_pipeline m_pipeline;
+	link_scheduler m_scheduler;
 	std::uint16_t m_interface;
-	int m_saved_conn_id;
 
 	/* Methods */
+	static std::uint32_t now_ms();
+	static const deadline_t *deadline_of(state_t state);
 	void handler();
-	void send_msg(msg_t msg, int priority);
-	void notify_idle_to_ble_start();
-	void notify_ble_to_a2dp_start();
-	void notify_a2dp_to_ble_start();
+	void set_a2dp_address(std::optional<bluetooth_address> addr);
+	void set_state(state_t state);
+	// Claims the one in-flight switch request if the state is from
+	bool request_switch(state_t from);
+	void dispatch(const message_t& message);
+	const transition_t *select(const message_t& message) const;
+	void take(const transition_t& transition, const message_t& message);
+	// Arms the deadline of a state that was just entered
+	void enter(state_t state);
+	// Picks the servers that hold a link, closes the ones that lost theirs
+	void plan_links();
+	// Sets up live servers that have no link and are not held back
+	void connect_links();
+	// seconds == 0 scans until stopped
+	static void scan(const scan_profile_t& profile, std::uint32_t seconds);
+	// Notes a request the stack refused, take() then times the step out
+	void request(const char *what, esp_err_t err);
+	// Returns false if the message was dropped
+	bool send_msg(
+		msg_t msg,
+		std::uint16_t conn_id = bluetooth_server_info::INVALID_CONN_ID,
+		std::uint32_t arg = 0);
+	bool notify_idle_to_ble_start();
+	bool notify_ble_to_a2dp_start(std::size_t slot);
+	bool notify_a2dp_to_ble_start();
+	bool notify_a2dp_to_a2dp_start(std::size_t slot);
+
+	// Guards
+	bool no_servers(const message_t& message) const;
+	bool idle_to_ble_done(const message_t& message) const;
+	bool scan_timer(const message_t& message) const;
+	bool link_timer(const message_t& message) const;
+	bool state_timer(const message_t& message) const;
+	bool backing_off(const message_t& message) const;
+	bool retries_left(const message_t& message) const;
+	bool handover_peer(const message_t& message) const;
+
+	// Actions
+	void take_idle_to_ble(const message_t& message);
+	void start_scan(const message_t& message);
+	void start_scan_and_pipeline(const message_t& message);
+	void restart_idle_to_ble(const message_t& message);
+	void start_pipeline(const message_t& message);
+	void scan_timed_out(const message_t& message);
+	void pipeline_opened(const message_t& message);
+	void pipeline_open_failed(const message_t& message);
+	void pipeline_timeout(const message_t& message);
+	void pipeline_mtu_configured(const message_t& message);
+	void pipeline_discovered(const message_t& message);
+	void pipeline_subscribed(const message_t& message);
+	void pipeline_notifications_enabled(const message_t& message);
+	void pipeline_scan_finished(const message_t& message);
+	void finish_idle_to_ble(const message_t& message);
+	void rotate_links(const message_t& message);
+	void reconnect_links(const message_t& message);
+	void server_dropped(const message_t& message);
+	void start_ble_to_a2dp(const message_t& message);
+	void connect_a2dp(const message_t& message);
+	void finish_ble_to_a2dp(const message_t& message);
+	void fail_ble_to_a2dp(const message_t& message);
+	void give_up_ble_to_a2dp(const message_t& message);
+	void stop_media(const message_t& message);
+	void disconnect_a2dp(const message_t& message);
+	void finish_a2dp_to_ble(const message_t& message);
+	void a2dp_lost(const message_t& message);
+	void give_up_a2dp_to_ble(const message_t& message);
+	void prepare_handover(const message_t& message);
+	void abort_handover(const message_t& message);
+	void break_a2dp(const message_t& message);
+	void make_a2dp(const message_t& message);
+	void finish_handover(const message_t& message);
+	void fail_handover(const message_t& message);
+	void retry_request(const message_t& message);
+	void back_off(const message_t& message);
 };
 
 #endif
@@ -0,0 +1,137 @@
+#ifndef SWITCH_POLICY_HPP
+#define SWITCH_POLICY_HPP
+
+// C++ includes
+#include <array>
+#include <experimental/optional>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "server_table.hpp"
+
+namespace std
+{
+	using namespace experimental;
+}
+
+// Decides when A2DP should be connected or moved to another server, from
+// the activator notifications. Notifications are coalesced: a decision
+// runs at most once per window, notifications in between only update the
+// per-server state and are decided on when the window ends. A server is armed once its activator reaches ARM_LEVEL
+// and disarmed only when it falls to DISARM_LEVEL (hysteresis), so values
+// wobbling around the threshold do not flap. Only an armed leader is
+// switched to, taking A2DP from another server needs a lead of MARGIN
+// over it, and after a switch nothing moves for the dwell time.
+class switch_policy
+{
+public:
+	/* Inner types */
+	enum class action_t : std::uint8_t
+	{
+		NONE,
+		// No A2DP yet, connect slot
+		CONNECT,
+		// A2DP runs with another server, move it to slot
+		HANDOVER,
+	};
+
+	enum class notify_t : std::uint8_t
+	{
+		// Run decide() now
+		DECIDE,
+		// Coalesced, the first of its window: call on_window_end() in
+		// window_left() ms
+		FLUSH_LATER,
+		// Coalesced, the end of the window is already due
+		COALESCED,
+	};
+
+	struct decision_t
+	{
+		action_t action;
+		std::size_t slot;
+	};
+
+	struct config_t
+	{
+		std::uint32_t window_ms;
+		std::uint32_t dwell_ms;
+		std::uint8_t arm_level;
+		std::uint8_t disarm_level;
+		std::uint8_t margin;
+	};
+
+	/* Constants */
+	// Switching used to happen above 2 on every notification
+	static constexpr config_t DEFAULT_CONFIG = {
+		250,	// ms
+		5000,	// ms
+		3,
+		1,
+		1,
+	};
+
+	/* Constructors */
+	explicit switch_policy(const config_t& config = DEFAULT_CONFIG);
+	switch_policy(const switch_policy&) = default;
+	switch_policy(switch_policy&&) = default;
+
+	/* Destructor */
+	~switch_policy() = default;
+
+	/* Operators */
+	switch_policy& operator=(const switch_policy&) = default;
+	switch_policy& operator=(switch_policy&&) = default;
+
+	/* Getters */
+	const config_t& config() const;
+	bool armed(std::size_t slot) const;
+	// Notifications folded into a later decision
+	std::uint32_t coalesced() const;
+	std::uint32_t switches() const;
+
+	// Until the current window ends
+	std::uint32_t window_left(std::uint32_t now_ms) const;
+
+	/* Methods */
+	// Records a notification in O(1) and says whether to decide now or
+	// at the end of the window
+	notify_t on_activator(std::size_t slot, std::uint8_t activator, std::uint32_t now_ms);
+	// Returns true when notifications were coalesced since the last
+	// decision and decide() should run for them
+	bool on_window_end(std::uint32_t now_ms);
+	void on_disconnected(std::size_t slot);
+	// leader is the slot with the largest activator, peer the slot A2DP
+	// runs with (if it is known). Nothing changes until commit().
+	decision_t decide(
+		std::optional<std::size_t> leader,
+		bool a2dp,
+		std::optional<std::size_t> peer,
+		std::uint32_t now_ms) const;
+	// A switch that was started: the dwell time starts now
+	void commit(const decision_t& decision, std::uint32_t now_ms);
+
+private:
+	/* Inner types */
+	struct server_t
+	{
+		std::uint8_t activator;
+		bool armed;
+	};
+
+	/* Members */
+	config_t m_config;
+	// By server_table slot
+	std::array<server_t, server_table::CAPACITY> m_servers;
+	bool m_decided;
+	std::uint32_t m_last_decision;
+	// Notifications coalesced since the last decision
+	bool m_pending;
+	bool m_switched;
+	std::uint32_t m_last_switch;
+	std::uint32_t m_coalesced;
+	std::uint32_t m_switches;
+};
+
+#endif
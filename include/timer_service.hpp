@@ -0,0 +1,90 @@
+#ifndef TIMER_SERVICE_HPP
+#define TIMER_SERVICE_HPP
+
+// C++ includes
+#include <array>
+#include <functional>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "mailbox.hpp"
+#include "timer_wheel.hpp"
+
+// One task for every delayed action of the client, instead of a sleeping
+// thread (and its FreeRTOS task and stack) per action. Timers are created
+// up front and then armed, re-armed and cancelled from any task through a
+// lock-free command queue; only the service task touches the wheel.
+// Callbacks run on the service task: they should post work elsewhere,
+// e.g. a state_machine message, and never block.
+class timer_service
+{
+public:
+	/* Inner types */
+	using callback_t = std::function<void()>;
+
+	/* Constants */
+	static constexpr std::size_t CAPACITY = 16;
+	static constexpr std::size_t QUEUE_CAPACITY = 32;
+	static constexpr std::uint32_t TICK_MS = 10;
+	// Returned by create() once every timer is taken
+	static constexpr std::size_t NO_TIMER = static_cast<std::size_t>(-1);
+
+	/* Constructors */
+	timer_service();
+	timer_service(const timer_service&) = delete;
+	timer_service(timer_service&&) = delete;
+
+	/* Destructor */
+	~timer_service() = default;
+
+	/* Operators */
+	timer_service& operator=(const timer_service&) = delete;
+	timer_service& operator=(timer_service&&) = delete;
+
+	/* Getters */
+	// Commands lost because the queue was full
+	std::uint32_t dropped() const;
+
+	/* Methods */
+	// Only before start()
+	std::size_t create(callback_t callback);
+	// Starts the service task
+	void start();
+	// Any task, never blocks. Fires delay_ms after the call, to within a
+	// tick; arming an armed timer moves it. Returns false if the command
+	// was dropped.
+	bool arm(std::size_t timer, std::uint32_t delay_ms);
+	// Any task. A cancel racing with the expiry may come too late.
+	bool cancel(std::size_t timer);
+
+	/* Static getters */
+	static timer_service& instance();
+
+private:
+	/* Inner types */
+	struct command_t
+	{
+		std::uint32_t issued_ms;
+		std::uint32_t delay_ms;
+		std::uint16_t timer;
+		bool cancel;
+	};
+
+	/* Members */
+	mailbox<command_t, 1, QUEUE_CAPACITY> m_commands;
+	std::array<callback_t, CAPACITY> m_callbacks;
+	std::size_t m_created;
+	// The wheel's ticks start here
+	std::uint32_t m_start_ms;
+	timer_wheel m_wheel;
+
+	/* Methods */
+	static std::uint32_t now_ms();
+	bool post(const command_t& command);
+	void run();
+	void apply(const command_t& command);
+	void advance(std::uint32_t now);
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+// C++ includes
+#include <algorithm>
+#include <array>
+#include <memory>
+// C includes
+#include <cstddef>
+#include <cstdint>
+
+// Hierarchical timer wheel over a fixed set of timers, identified by their
+// index in [0, capacity). Arming, re-arming and cancelling are O(1); a
+// timer due in more than one wheel turn sits on a coarser level and is
+// cascaded down as its time comes closer. Delays past the last level are
+// parked on it and re-cascaded, so any delay works. Not thread safe: the
+// owner arms timers and calls advance() from one task.
+class timer_wheel
+{
+public:
+	/* Constants */
+	static constexpr std::size_t LEVELS = 3;
+	static constexpr std::size_t SLOT_BITS = 6;
+	static constexpr std::size_t SLOTS = 1 << SLOT_BITS;
+	// Returned by next_expiry_ms() when nothing is armed
+	static constexpr std::uint32_t NEVER = 0xffffffff;
+
+	/* Constructors */
+	// All storage is allocated here, arming never allocates
+	timer_wheel(std::size_t capacity, std::uint32_t tick_ms, std::uint32_t now_ms);
+	timer_wheel(const timer_wheel&) = delete;
+	timer_wheel(timer_wheel&&) = default;
+
+	/* Destructor */
+	~timer_wheel() = default;
+
+	/* Operators */
+	timer_wheel& operator=(const timer_wheel&) = delete;
+	timer_wheel& operator=(timer_wheel&&) = default;
+
+	/* Getters */
+	std::size_t capacity() const;
+	std::uint32_t tick_ms() const;
+	// Number of armed timers
+	std::size_t armed() const;
+	bool armed(std::size_t timer) const;
+
+	/* Methods */
+	// Fires the timer delay_ms after the time of the last advance(), rounded
+	// up to a whole tick. An armed timer is moved.
+	void arm(std::size_t timer, std::uint32_t delay_ms);
+	void cancel(std::size_t timer);
+	void cancel_all();
+	// How long until advance() has work to do: a timer expiring or a coarse
+	// level to cascade
+	std::uint32_t next_expiry_ms() const;
+
+	// Calls expired(timer) for every timer due by now_ms, in expiry order.
+	// The callback may arm and cancel timers, including the expired one.
+	template<typename F>
+	void advance(std::uint32_t now_ms, F&& expired)
+	{
+		// Differences only, so the millisecond clock may wrap
+		const auto ticks = (now_ms - m_last_ms) / m_tick_ms;
+		m_last_ms += ticks * m_tick_ms;
+		const auto now = m_now + ticks;
+		while (m_now != now)
+		{
+			if (m_armed == 0)
+			{
+				m_now = now;
+				break;
+			}
+
+			// Skip the ticks where nothing happens
+			const auto idle = std::min(next_expiry() - 1, now - m_now);
+			m_now += idle;
+			if (m_now == now)
+				break;
+
+			++m_now;
+			cascade();
+
+			auto& head = m_slots[0][m_now & (SLOTS - 1)];
+			while (head != NIL)
+			{
+				const auto timer = head;
+				unlink(timer);
+				expired(static_cast<std::size_t>(timer));
+			}
+		}
+	}
+
+private:
+	/* Inner types */
+	struct node_t
+	{
+		// Absolute, in ticks
+		std::uint32_t expires;
+		std::uint16_t prev;
+		std::uint16_t next;
+		std::uint8_t level;
+		std::uint8_t slot;
+		bool armed;
+	};
+
+	static constexpr std::uint16_t NIL = 0xffff;
+
+	/* Members */
+	std::unique_ptr<node_t[]> m_nodes;
+	std::size_t m_capacity;
+	std::array<std::array<std::uint16_t, SLOTS>, LEVELS> m_slots;
+	std::array<std::size_t, LEVELS> m_per_level;
+	std::size_t m_armed;
+	std::uint32_t m_tick_ms;
+	std::uint32_t m_last_ms;
+	// In ticks, counted from construction
+	std::uint32_t m_now;
+
+	/* Methods */
+	// In ticks, never 0 while something is armed
+	std::uint32_t next_expiry() const;
+	void insert(std::uint16_t timer);
+	void unlink(std::uint16_t timer);
+	void cascade();
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef TRACE_BUFFER_HPP
+#define TRACE_BUFFER_HPP
+
+// C++ includes
+#include <array>
+#include <atomic>
+// C includes
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+// My includes
+#include "mailbox.hpp"
+
+// Fixed-size binary event log kept in RAM. Recording is one atomic
+// increment and a 16-byte store, cheap enough to leave enabled; text is
+// only produced by dump(), away from the hot paths. request_dump() hands
+// the printing to a low-priority task.
+class trace_buffer
+{
+public:
+	/* Inner types */
+	enum class event_t : std::uint8_t
+	{
+		STATE,		// arg = previous state
+		MSG,		// arg = msg_t
+		MSG_DROPPED,	// arg = msg_t
+		BLE_GAP,	// arg = esp_gap_ble_cb_event_t
+		BLE_GATTC,	// arg = esp_gattc_cb_event_t
+		A2DP,		// arg = esp_a2d_cb_event_t
+		A2DP_GAP,	// arg = esp_bt_gap_cb_event_t
+	};
+
+	struct record_t
+	{
+		// Sequence number plus one, 0 marks a slot that was never written
+		std::uint32_t sequence;
+		// Low 32 bits of esp_timer_get_time(), in microseconds
+		std::uint32_t timestamp;
+		event_t event;
+		std::uint8_t state;
+		std::uint16_t conn_id;
+		std::uint32_t arg;
+	};
+
+	static_assert(sizeof(record_t) == 16, "trace records are meant to be 16 bytes");
+
+	// Power of two
+	static constexpr std::size_t CAPACITY = 512;
+	// Dumps requested and not printed yet, more are dropped
+	static constexpr std::size_t REQUEST_CAPACITY = 2;
+
+	/* Constructors */
+	trace_buffer();
+	trace_buffer(const trace_buffer&) = delete;
+	trace_buffer(trace_buffer&&) = delete;
+
+	/* Destructor */
+	~trace_buffer() = default;
+
+	/* Operators */
+	trace_buffer& operator=(const trace_buffer&) = delete;
+	trace_buffer& operator=(trace_buffer&&) = delete;
+
+	/* Methods */
+	// Starts the dump task
+	void start();
+	// Any thread, never blocks. Old records are overwritten.
+	void record(event_t event, std::uint8_t state, std::uint16_t conn_id, std::uint32_t arg);
+	// Prints the records not dumped yet as hex lines between TRACE-BEGIN and
+	// TRACE-END markers; tools/trace_decode.py turns them into timelines.
+	// Slow: printing 512 records takes over a second on the console
+	void dump(std::FILE *out);
+	// Any thread, never blocks. The dump task runs dump(out) later
+	void request_dump(std::FILE *out);
+
+	/* Static getters */
+	static trace_buffer& instance();
+
+private:
+	/* Members */
+	std::array<record_t, CAPACITY> m_records;
+	std::atomic<std::uint32_t> m_next;
+	std::uint32_t m_dumped;
+	mailbox<std::FILE *, 1, REQUEST_CAPACITY> m_requests;
+
+	/* Methods */
+	void dumper();
+};
+
+#endif
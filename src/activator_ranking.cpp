@@ -0,0 +1,138 @@
+// Matching include
+#include "activator_ranking.hpp"
+// C++ includes
+#include <algorithm>
+#include <utility>
+
+constexpr std::size_t activator_ranking::CAPACITY;
+constexpr std::size_t activator_ranking::NPOS;
+
+activator_ranking::activator_ranking()
+	: m_heap()
+	, m_size(0)
+	, m_position()
+{
+	m_position.fill(NPOS);
+}
+
+std::size_t activator_ranking::size() const
+{
+	return m_size;
+}
+
+bool activator_ranking::empty() const
+{
+	return m_size == 0;
+}
+
+std::uint8_t activator_ranking::activator(std::size_t slot) const
+{
+	if (slot >= CAPACITY || m_position[slot] == NPOS)
+		return 0;
+	return m_heap[m_position[slot]].activator;
+}
+
+void activator_ranking::update(std::size_t slot, std::uint8_t activator)
+{
+	if (slot >= CAPACITY)
+		return;
+
+	auto i = m_position[slot];
+	if (i == NPOS)
+	{
+		i = m_size++;
+		m_heap[i] = {activator, slot};
+		m_position[slot] = i;
+		sift_up(i);
+		return;
+	}
+
+	const auto old = m_heap[i].activator;
+	m_heap[i].activator = activator;
+	if (activator > old)
+		sift_up(i);
+	else if (activator < old)
+		sift_down(i);
+}
+
+std::optional<std::size_t> activator_ranking::top() const
+{
+	if (m_size == 0)
+		return {};
+	return m_heap.front().slot;
+}
+
+std::size_t activator_ranking::top_k(std::size_t k, slots_t& out) const
+{
+	k = std::min(k, out.size());
+
+	// Frontier of heap indices; popping the best and pushing its children
+	// visits the k largest without touching the rest of the heap. Each
+	// index enters it once, so it never outgrows the heap.
+	const auto less = [this](std::size_t l, std::size_t r)
+	{
+		return m_heap[l].activator < m_heap[r].activator;
+	};
+	std::array<std::size_t, CAPACITY> frontier;
+	std::size_t frontier_size = 0;
+
+	if (m_size != 0)
+		frontier[frontier_size++] = 0;
+
+	std::size_t count = 0;
+	while (count < k && frontier_size != 0)
+	{
+		std::pop_heap(frontier.begin(), frontier.begin() + frontier_size, less);
+		const auto i = frontier[--frontier_size];
+		out[count++] = m_heap[i].slot;
+
+		for (auto child = 2 * i + 1; child <= 2 * i + 2 && child < m_size; child++)
+		{
+			frontier[frontier_size++] = child;
+			std::push_heap(frontier.begin(), frontier.begin() + frontier_size, less);
+		}
+	}
+
+	return count;
+}
+
+void activator_ranking::clear()
+{
+	m_size = 0;
+	m_position.fill(NPOS);
+}
+
+void activator_ranking::sift_up(std::size_t i)
+{
+	while (i > 0)
+	{
+		const auto parent = (i - 1) / 2;
+		if (m_heap[parent].activator >= m_heap[i].activator)
+			break;
+		swap_nodes(i, parent);
+		i = parent;
+	}
+}
+
+void activator_ranking::sift_down(std::size_t i)
+{
+	for (;;)
+	{
+		auto largest = i;
+		for (auto child = 2 * i + 1; child <= 2 * i + 2 && child < m_size; child++)
+			if (m_heap[child].activator > m_heap[largest].activator)
+				largest = child;
+
+		if (largest == i)
+			break;
+		swap_nodes(i, largest);
+		i = largest;
+	}
+}
+
+void activator_ranking::swap_nodes(std::size_t a, std::size_t b)
+{
+	std::swap(m_heap[a], m_heap[b]);
+	m_position[m_heap[a].slot] = a;
+	m_position[m_heap[b].slot] = b;
+}
@@ -0,0 +1,145 @@
+// Matching include
+#include "audio_output.hpp"
+// C++ includes
+#include <algorithm>
+// ESP includes
+#include "driver/i2s.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+// My includes
+#include "sample_rate_converter.hpp"
+
+namespace
+{
+	constexpr auto TAG = "AUDIO_OUTPUT";
+
+	constexpr auto PORT = I2S_NUM_0;
+	constexpr int BCK_PIN = 26;
+	constexpr int WS_PIN = 25;
+	constexpr int DATA_PIN = 22;
+	// Well above one DMA buffer, only hit if the driver stalls
+	constexpr TickType_t WRITE_TIMEOUT = pdMS_TO_TICKS(100);
+
+	const std::uint8_t SILENCE[audio_output::DMA_BYTES] = {};
+
+	std::size_t jitter_bytes(std::uint32_t sample_rate)
+	{
+		const auto frames = sample_rate * audio_output::JITTER_MS / 1000;
+		return frames * audio_output::BYTES_PER_FRAME;
+	}
+}
+
+constexpr std::size_t audio_output::BYTES_PER_FRAME;
+constexpr std::size_t audio_output::DMA_BUFFERS;
+constexpr std::size_t audio_output::DMA_FRAMES;
+constexpr std::size_t audio_output::DMA_BYTES;
+constexpr std::uint32_t audio_output::JITTER_MS;
+constexpr std::uint32_t audio_output::DEFAULT_SOURCE_RATE;
+
+audio_output::audio_output()
+	: m_pending_rate(DEFAULT_SOURCE_RATE)
+	, m_source_rate(DEFAULT_SOURCE_RATE)
+	, m_jitter_bytes(jitter_bytes(DEFAULT_SOURCE_RATE))
+	, m_playing(false)
+	, m_silent(true)
+	, m_underruns(0)
+{
+}
+
+std::uint32_t audio_output::source_rate() const
+{
+	return m_source_rate;
+}
+
+std::uint32_t audio_output::underruns() const
+{
+	return m_underruns;
+}
+
+void audio_output::start()
+{
+	i2s_config_t config = {};
+	config.mode = static_cast<i2s_mode_t>(I2S_MODE_MASTER | I2S_MODE_TX);
+	config.sample_rate = sample_rate_converter::OUTPUT_RATE;
+	config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+	config.channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT;
+	config.communication_format = static_cast<i2s_comm_format_t>(I2S_COMM_FORMAT_I2S | I2S_COMM_FORMAT_I2S_MSB);
+	config.intr_alloc_flags = 0;
+	config.dma_buf_count = DMA_BUFFERS;
+	config.dma_buf_len = DMA_FRAMES;
+	config.use_apll = false;
+	ESP_ERROR_CHECK(i2s_driver_install(PORT, &config, 0, nullptr));
+
+	i2s_pin_config_t pins = {};
+	pins.bck_io_num = BCK_PIN;
+	pins.ws_io_num = WS_PIN;
+	pins.data_out_num = DATA_PIN;
+	pins.data_in_num = I2S_PIN_NO_CHANGE;
+	ESP_ERROR_CHECK(i2s_set_pin(PORT, &pins));
+}
+
+void audio_output::set_source_rate(std::uint32_t sample_rate)
+{
+	m_pending_rate.store(sample_rate, std::memory_order_relaxed);
+}
+
+std::size_t audio_output::available(std::size_t buffered)
+{
+	if (m_pending_rate.load(std::memory_order_relaxed) != m_source_rate)
+		apply_source_rate();
+
+	if (!m_playing)
+	{
+		if (buffered < m_jitter_bytes)
+			return 0;
+		m_playing = true;
+	}
+	else if (buffered == 0)
+	{
+		// Refill the jitter buffer rather than play every packet as it comes
+		m_playing = false;
+		++m_underruns;
+		return 0;
+	}
+
+	// Whole frames, so a packet split at the wrap cannot swap the channels
+	return std::min(buffered, DMA_BYTES) / BYTES_PER_FRAME * BYTES_PER_FRAME;
+}
+
+std::size_t audio_output::play(const std::uint8_t *data, std::size_t len)
+{
+	// Silence paces the caller just like audio does
+	if (len == 0)
+	{
+		data = SILENCE;
+		len = DMA_BYTES;
+	}
+	else
+	{
+		m_silent = false;
+	}
+
+	std::size_t written = 0;
+	const auto err = i2s_write(PORT, data, len, &written, WRITE_TIMEOUT);
+	if (err != ESP_OK)
+		ESP_LOGW(TAG, "I2S write failed (%d)", err);
+	return data == SILENCE ? 0 : written;
+}
+
+void audio_output::idle()
+{
+	m_playing = false;
+	if (m_silent)
+		return;
+
+	m_silent = true;
+	i2s_zero_dma_buffer(PORT);
+}
+
+void audio_output::apply_source_rate()
+{
+	m_source_rate = m_pending_rate.load(std::memory_order_relaxed);
+	m_jitter_bytes = jitter_bytes(m_source_rate);
+	m_playing = false;
+	ESP_LOGI(TAG, "Source rate %u, jitter buffer %u B", m_source_rate, static_cast<unsigned>(m_jitter_bytes));
+}
@@ -3,10 +3,12 @@
 // C++ includes
 #include <ostream>
 // C includes
-#include <cstdio>
 #include <cstring>
 
+constexpr std::size_t bluetooth_address::STRING_SIZE;
+
 bluetooth_address::bluetooth_address(esp_bd_addr_t addr)
+    : m_packed(0)
 {
     std::memcpy(m_addr, addr, sizeof(esp_bd_addr_t));
 }
@@ -31,31 +33,37 @@ bluetooth_address::operator const esp_bd_addr_t&() const
 	return m_addr;
 }
 
-bool operator==(const bluetooth_address& l, const bluetooth_address& r)
+bool operator<(const bluetooth_address& l, const bluetooth_address& r)
 {
-    return std::memcmp(l, r, sizeof(esp_bd_addr_t)) == 0;
-}
-
-bool operator!=(const bluetooth_address& l, const bluetooth_address& r)
-{
-    return !(l == r);
+    // The first address byte is the most significant when printed
+    return __builtin_bswap64(l.packed()) < __builtin_bswap64(r.packed());
 }
 
 std::ostream& operator<<(std::ostream& out, const bluetooth_address& addr)
 {
-	out << to_string(addr);
+    char buffer[bluetooth_address::STRING_SIZE];
+	out << format(addr, buffer);
 	return out;
 }
 
-std::string to_string(const bluetooth_address& addr)
+const char *format(const bluetooth_address& addr, char (&buffer)[bluetooth_address::STRING_SIZE])
 {
-	// Kill me
-	char buffer[ESP_BD_ADDR_LEN * 2 + (ESP_BD_ADDR_LEN - 1) + 1] = "";
+    static constexpr char digits[] = "0123456789abcdef";
 
-	static const auto sep = ":";
-	std::sprintf(buffer, "%02x", addr[0]);
-	for (auto i = 1; i < ESP_BD_ADDR_LEN; i++)
-		std::sprintf(buffer + 2 + 3*(i - 1), "%s%02x", sep, addr[i]);
+    auto packed = addr.packed();
+    for (auto i = 0; i < ESP_BD_ADDR_LEN; i++, packed >>= 8)
+    {
+        buffer[3*i + 0] = digits[(packed >> 4) & 0xf];
+        buffer[3*i + 1] = digits[packed & 0xf];
+        buffer[3*i + 2] = ':';
+    }
+    buffer[bluetooth_address::STRING_SIZE - 1] = '\0';
 
-	return buffer;
-}
\ No newline at end of file
+    return buffer;
+}
+
+std::string to_string(const bluetooth_address& addr)
+{
+    char buffer[bluetooth_address::STRING_SIZE];
+    return format(addr, buffer);
+}
@@ -1,5 +1,7 @@
 // Matching include
 #include "bluetooth_client.hpp"
+// C++ includes
+#include <thread>
 // C includes
 #include <cstring>
 // ESP includes
@@ -10,14 +12,48 @@
 #include "esp_gap_ble_api.h"
 #include "esp_gap_bt_api.h"
 #include "esp_log.h"
+// My includes
+#include "deferred_log.hpp"
+#include "timer_service.hpp"
+#include "trace_buffer.hpp"
 
 constexpr auto TAG = "A2DP_CB";
 
+constexpr std::size_t bluetooth_client::AUDIO_CHANNELS;
+constexpr std::size_t bluetooth_client::LEVEL_BLOCK_FRAMES;
+
+// Roughly 90 ms of 44.1 kHz stereo
+constexpr auto PCM_RING_CAPACITY = 16 * 1024;
+
+// The capture gets a UART of its own, fast enough for uncompressed 48 kHz stereo
+constexpr auto CAPTURE_CAPACITY = 16 * 1024;
+constexpr auto CAPTURE_UART = 1;
+constexpr auto CAPTURE_TX_PIN = 17;
+constexpr auto CAPTURE_BAUD_RATE = 3000000;
+
 bluetooth_client::bluetooth_client()
 	: m_servers()
+	, m_index()
+	, m_ranking()
+	, m_cache()
+	, m_policy()
+	, m_switching()
+	, m_switch_mutex()
 	, m_sm()
-	, m_peer(cend(m_servers))
     , m_interface(ESP_GATT_IF_NONE)
+	, m_a2dp_timer(timer_service::NO_TIMER)
+	, m_flush_timer(timer_service::NO_TIMER)
+	, m_pcm(PCM_RING_CAPACITY)
+	, m_converter()
+	, m_unplayed(nullptr)
+	, m_unplayed_len(0)
+	, m_output()
+	, m_capture(CAPTURE_CAPACITY, true)
+	, m_levels()
+	, m_pcm_mutex()
+	, m_pcm_cv()
+	, m_streaming(false)
+	, m_silent_since_ms(0)
 {
 }
 
@@ -29,7 +65,22 @@ bluetooth_client& bluetooth_client::instance()
 
 void bluetooth_client::start()
 {
+	deferred_log::instance().start();
+	trace_buffer::instance().start();
+
+	// The callbacks run on the service task: the first only posts to the
+	// state machine, the second holds m_switch_mutex for one decision
+	m_a2dp_timer = timer_service::instance().create([this]() { m_sm.a2dp_to_ble(); });
+	m_flush_timer = timer_service::instance().create([this]() { handle_window_end(); });
+	timer_service::instance().start();
+
+	for (auto& server : m_cache.load())
+		add_server(server);
+
 	initialize();
+	m_output.start();
+	m_capture.start(pcm_capture::uart_sink(CAPTURE_UART, CAPTURE_TX_PIN, CAPTURE_BAUD_RATE));
+	std::thread([this]() { pcm_consumer(); }).detach();
 	m_sm.start();
 }
 
@@ -1,21 +1,44 @@
 // Matching include
 #include "bluetooth_client.hpp"
+// C++ includes
+#include <chrono>
 // C includes
 #include <cstring>
 // ESP includes
 #include "esp_a2dp_api.h"
 #include "esp_gap_bt_api.h"
 #include "esp_log.h"
+// My includes
+#include "deferred_log.hpp"
+#include "trace_buffer.hpp"
+
+using namespace std::literals;
 
 namespace
 {
 	constexpr auto TAG = "CLIENT_A2DP";
 
-	std::uint32_t m_pkt_cnt = 0;
+	// Upper bound on how long a missed wakeup can delay the consumer
+	constexpr auto PCM_WAIT = 20ms;
+
+	static_assert(
+		audio_output::DMA_BYTES <= sample_rate_converter::MAX_INPUT_BYTES,
+		"a DMA buffer of input must fit the converter");
+
+	std::atomic<std::uint32_t> m_pkt_cnt(0);
+
+	// Audio Source service class
+	constexpr std::uint16_t A2DP_SOURCE_UUID = 0x110a;
 }
 
 void bluetooth_client::a2dp_callback(esp_a2d_cb_event_t event, esp_a2d_cb_param_t *a2d)
 {
+    trace_buffer::instance().record(
+        trace_buffer::event_t::A2DP,
+        0,
+        bluetooth_server_info::INVALID_CONN_ID,
+        event);
+
     switch (event)
     {
     case ESP_A2D_CONNECTION_STATE_EVT:
@@ -32,7 +55,8 @@ void bluetooth_client::a2dp_callback(esp_a2d_cb_event_t event, esp_a2d_cb_param_
         else if (a2d->conn_stat.state == ESP_A2D_CONNECTION_STATE_DISCONNECTED)
         {
             ESP_LOGI(TAG, "A2DP disconnected");
-            m_peer = end(m_servers);
+            if (m_silent_since_ms == 0)
+                m_silent_since_ms = now_ms();
             m_sm.notify_a2dp_disconnected();
         }
         break;
@@ -41,9 +65,18 @@ void bluetooth_client::a2dp_callback(esp_a2d_cb_event_t event, esp_a2d_cb_param_
         if (a2d->audio_stat.state == ESP_A2D_AUDIO_STATE_STARTED)
         {
             m_pkt_cnt = 0;
+            m_streaming = true;
+            if (m_silent_since_ms != 0)
+            {
+                ESP_LOGI(TAG, "Audio gap %u ms", now_ms() - m_silent_since_ms);
+                m_silent_since_ms = 0;
+            }
         }
         else if (a2d->audio_stat.state == ESP_A2D_AUDIO_STATE_STOPPED)
         {
+            m_streaming = false;
+            if (m_silent_since_ms == 0)
+                m_silent_since_ms = now_ms();
             m_sm.notify_a2dp_media_stopped();
         }
         break;
@@ -80,6 +113,8 @@ void bluetooth_client::a2dp_callback(esp_a2d_cb_event_t event, esp_a2d_cb_param_
                 TAG,
                 "Audio player configured, sample rate=%d",
                 sample_rate);
+            m_output.set_source_rate(sample_rate);
+            m_converter.set_input_rate(sample_rate);
         }
         break;
 
@@ -91,29 +126,121 @@ void bluetooth_client::a2dp_callback(esp_a2d_cb_event_t event, esp_a2d_cb_param_
 
 void bluetooth_client::a2dp_data_callback(const std::uint8_t *data, std::uint32_t len)
 {
-    static std::uint32_t sum_len = 0;
-
     if (len == 0 || data == nullptr)
         return;
 
-    for (std::uint32_t i = 0; i < len / 2; i++)
+    // Runs on the Bluedroid A2DP task: hand the packet over and get out.
+    // The consumer is woken without taking the mutex, so a wakeup can be
+    // missed; PCM_WAIT bounds the delay that causes.
+    m_pcm.write(data, len);
+    ++m_pkt_cnt;
+    m_pcm_cv.notify_one();
+}
+
+void bluetooth_client::pcm_consumer()
+{
+    std::uint32_t sum_len = 0;
+    std::uint32_t last_log = 0;
+
+    for (;;)
     {
-        std::int16_t value =
-            (data[2 * i + 0] << 0) |
-            (data[2 * i + 1] << 8);
-        fprintf(stderr, "VALUE: %hu\n", value);
-    }
+        {
+            std::unique_lock<std::mutex> l(m_pcm_mutex);
+            m_pcm_cv.wait_for(l, PCM_WAIT, [this]() { return !m_pcm.empty() || m_unplayed_len != 0; });
+        }
 
-    sum_len += len;
+        // Only an empty ring while the source is streaming is an underrun
+        if (m_pcm.empty() && !m_streaming && m_unplayed_len == 0)
+        {
+            m_output.idle();
+            continue;
+        }
 
-    if (++m_pkt_cnt % 100 == 0)
-        ESP_LOGI(TAG, "RECEIVED PACKETS 0x%08x (0x%08x B)", m_pkt_cnt, sum_len);
+        // A driver that stalled and took less than converted plays the rest
+        // first, before convert() reuses its buffer
+        if (m_unplayed_len != 0)
+        {
+            const auto played = m_output.play(m_unplayed, m_unplayed_len);
+            m_capture.write(m_unplayed, played, sample_rate_converter::OUTPUT_RATE, AUDIO_CHANNELS);
+            m_levels.write(m_unplayed, played);
+            m_unplayed += played;
+            m_unplayed_len -= played;
+            continue;
+        }
+
+        // 48 kHz goes straight from the ring into the DMA buffers, other rates
+        // through the converter. A jitter buffer still filling, or an
+        // underrun, plays silence.
+        const std::uint8_t *data = nullptr;
+        const auto len = m_pcm.peek(data, m_output.available(m_pcm.size()));
+        const std::uint8_t *pcm = data;
+        const auto converted = len != 0 ? m_converter.convert(data, len, pcm) : 0;
+
+        const auto played = m_output.play(pcm, converted);
+        m_capture.write(pcm, played, sample_rate_converter::OUTPUT_RATE, AUDIO_CHANNELS);
+        m_levels.write(pcm, played);
+
+        // Passed through, the rest simply stays in the ring. Converted, the
+        // input is used up and the rest of the output is kept
+        if (pcm == data)
+        {
+            m_pcm.consume(played);
+        }
+        else
+        {
+            m_pcm.consume(len);
+            m_unplayed = pcm + played;
+            m_unplayed_len = converted - played;
+        }
+
+        sum_len += len;
+
+        if (m_pkt_cnt - last_log >= 100)
+        {
+            last_log = m_pkt_cnt;
+            ESP_LOGI(
+                TAG,
+                "RECEIVED PACKETS 0x%08x (0x%08x B), overruns %u, underruns %u, capture %u/%u B, dropped %u",
+                last_log,
+                sum_len,
+                m_pcm.overruns(),
+                m_output.underruns(),
+                m_capture.encoded_bytes(),
+                m_capture.pcm_bytes(),
+                m_capture.dropped());
+
+            const auto& levels = m_levels.metrics();
+            for (std::size_t c = 0; c < AUDIO_CHANNELS; c++)
+            {
+                ESP_LOGI(
+                    TAG,
+                    "Channel %u: rms %.1f dBFS, peak %.1f dBFS, dc %.4f, clips %u",
+                    static_cast<unsigned>(c),
+                    to_dbfs(levels.channels[c].rms),
+                    to_dbfs(levels.channels[c].peak),
+                    levels.channels[c].dc_offset,
+                    levels.channels[c].clips);
+            }
+            ESP_LOGI(
+                TAG,
+                "Blocks %u, silent %u, clipped samples %u",
+                levels.blocks,
+                levels.silent_blocks,
+                levels.clips);
+        }
+    }
 }
 
 void bluetooth_client::a2dp_gap_callback(
     esp_bt_gap_cb_event_t event,
     esp_bt_gap_cb_param_t *param)
 {
+    trace_buffer::instance().record(
+        trace_buffer::event_t::A2DP_GAP,
+        0,
+        bluetooth_server_info::INVALID_CONN_ID,
+        event);
+
     switch (event)
     {
     case ESP_BT_GAP_AUTH_CMPL_EVT:
@@ -128,8 +255,27 @@ void bluetooth_client::a2dp_gap_callback(
         }
         break;
 
+    case ESP_BT_GAP_RMT_SRVCS_EVT:
+    {
+        // Answer to the SDP query of a handover
+        bool a2dp_source = false;
+        if (param->rmt_srvcs.stat == ESP_BT_STATUS_SUCCESS)
+        {
+            for (int i = 0; i < param->rmt_srvcs.num_uuids; i++)
+            {
+                const auto& uuid = param->rmt_srvcs.uuid_list[i];
+                if (uuid.len == ESP_UUID_LEN_16 && uuid.uuid.uuid16 == A2DP_SOURCE_UUID)
+                    a2dp_source = true;
+            }
+        }
+
+        DEFERRED_LOGI(TAG, "Remote services %s, A2DP source %d", bluetooth_address(param->rmt_srvcs.bda), a2dp_source);
+        m_sm.notify_peer_prepared(bluetooth_address(param->rmt_srvcs.bda), a2dp_source);
+        break;
+    }
+
     default:
-        ESP_LOGI(TAG, "event: %d", event);
+        DEFERRED_LOGI(TAG, "event: %d", event);
         break;
     }
 }
\ No newline at end of file
@@ -1,29 +1,87 @@
 // Matching include
 #include "bluetooth_client.hpp"
 // C++ includes
-#include <algorithm>
-#include <chrono>
-#include <thread>
+#include <utility>
 // C includes
 #include <cstring>
 // ESP includes
 #include "esp_gap_ble_api.h"
 #include "esp_log.h"
-
-using namespace std::literals;
+#include "esp_timer.h"
+// My includes
+#include "deferred_log.hpp"
+#include "timer_service.hpp"
+#include "trace_buffer.hpp"
 
 namespace
 {
 	constexpr auto TAG = "CLIENT_BLE";
+	// Every notification is logged; its own tag keeps it from using up
+	// the deferred_log rate limit of the switch and connection messages
+	constexpr auto NOTIFY_TAG = "CLIENT_NOTIFY";
+
+	// How long an A2DP session lasts before going back to BLE
+	constexpr std::uint32_t A2DP_SESSION_MS = 3600 * 1000;
+
+	// Manufacturer data of a server that advertises its activator: company
+	// id (little endian, the id reserved for testing), then the activator
+	constexpr std::uint16_t ACTIVATOR_COMPANY_ID = 0xffff;
+	constexpr std::uint8_t ACTIVATOR_ADV_LEN = 3;
+
+	std::uint16_t gattc_conn_id(esp_gattc_cb_event_t event, const esp_ble_gattc_cb_param_t *param)
+	{
+		switch (event)
+		{
+		case ESP_GATTC_CONNECT_EVT:
+			return param->connect.conn_id;
+		case ESP_GATTC_OPEN_EVT:
+			return param->open.conn_id;
+		case ESP_GATTC_CFG_MTU_EVT:
+			return param->cfg_mtu.conn_id;
+		case ESP_GATTC_SEARCH_CMPL_EVT:
+			return param->search_cmpl.conn_id;
+		case ESP_GATTC_WRITE_DESCR_EVT:
+			return param->write.conn_id;
+		case ESP_GATTC_NOTIFY_EVT:
+			return param->notify.conn_id;
+		case ESP_GATTC_DISCONNECT_EVT:
+			return param->disconnect.conn_id;
+		default:
+			return bluetooth_server_info::INVALID_CONN_ID;
+		}
+	}
 }
 
 void bluetooth_client::ble_gap_callback(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
+    trace_buffer::instance().record(
+        trace_buffer::event_t::BLE_GAP,
+        0,
+        bluetooth_server_info::INVALID_CONN_ID,
+        event);
+
     switch (event)
     {
     case ESP_GAP_BLE_SCAN_RESULT_EVT:
     	if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT)
     	{
+            // Known servers that advertise their activator are sampled without a link
+            const auto known = m_index.find(bluetooth_address(param->scan_rst.bda));
+            if (known)
+            {
+                std::uint8_t adv_data_len;
+                const auto *adv_data = esp_ble_resolve_adv_data(
+                    param->scan_rst.ble_adv,
+                    ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE,
+                    &adv_data_len);
+                if (adv_data != nullptr && adv_data_len >= ACTIVATOR_ADV_LEN
+                    && (adv_data[0] | adv_data[1] << 8) == ACTIVATOR_COMPANY_ID)
+                {
+                    handle_activator(*known, adv_data[2]);
+                }
+                break;
+            }
+
 			std::uint8_t adv_name_len;
 			const auto *adv_name = (char *)esp_ble_resolve_adv_data(
 				param->scan_rst.ble_adv,
@@ -36,29 +94,62 @@ void bluetooth_client::ble_gap_callback(esp_gap_ble_cb_event_t event, esp_ble_ga
 			constexpr auto DEVICE_NAME = "SERVER";
 			if (strncmp(adv_name, DEVICE_NAME, strlen(DEVICE_NAME)) == 0)
 			{
-                const auto it = std::find_if(
-                    cbegin(m_servers),
-                    cend(m_servers),
-                    [param](const auto& val)
-                    {
-                        return val.address() == bluetooth_address(param->scan_rst.bda);
-                    });
-                if (it == cend(m_servers))
+                const auto addr = bluetooth_address(param->scan_rst.bda);
+                const auto added = add_server({
+                    addr,
+                    bluetooth_server_info::INVALID_CONN_ID,
+                    0,
+                    param->scan_rst.ble_addr_type});
+                if (added)
                 {
-                    ESP_LOGI(TAG, "Adding server with address %s and RSSI %d",
-                        to_string(bluetooth_address(param->scan_rst.bda)).c_str(),
+                    DEFERRED_LOGI(TAG, "Adding server with address %s and RSSI %d",
+                        addr,
                         param->scan_rst.rssi);
-                    m_servers.emplace_back(param->scan_rst.bda);
                 }
 			}
 			break;
 		}
+        // A scan with a duration ends here, not with SCAN_STOP_COMPLETE
+        else if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_CMPL_EVT)
+        {
+            m_sm.notify_scan_finished();
+        }
+        break;
 
     case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
         m_sm.notify_scan_finished();
     	break;
 
+    case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+        if (param->scan_param_cmpl.status != ESP_BT_STATUS_SUCCESS)
+            ESP_LOGE(TAG, "Setting scan parameters failed (%d)", param->scan_param_cmpl.status);
+        break;
+
+    case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+        if (param->scan_start_cmpl.status != ESP_BT_STATUS_SUCCESS)
+            ESP_LOGE(TAG, "Starting scan failed (%d)", param->scan_start_cmpl.status);
+        break;
+
     case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+    {
+        const auto slot = m_index.find(bluetooth_address(param->update_conn_params.bda));
+        const auto success = param->update_conn_params.status == ESP_BT_STATUS_SUCCESS;
+        if (slot && m_policy.on_update_result(*slot, success))
+        {
+            DEFERRED_LOGI(TAG, "Moving %s to slow interval again", m_servers.address(*slot));
+            update_conn_params(m_servers.address(*slot), m_servers.conn_params(*slot));
+        }
+
+        // Remember what a quiet link settled on, the cache reuses it next boot
+        if (slot && success && m_policy.mode(*slot) == conn_param_policy::mode_t::SLOW)
+        {
+            m_servers.set_conn_params(*slot, {
+                param->update_conn_params.min_int,
+                param->update_conn_params.max_int,
+                param->update_conn_params.latency,
+                param->update_conn_params.timeout});
+        }
+
          ESP_LOGI(
         	TAG,
 			"Connection updated\n"\
@@ -75,6 +166,7 @@ void bluetooth_client::ble_gap_callback(esp_gap_ble_cb_event_t event, esp_ble_ga
             param->update_conn_params.latency,
             param->update_conn_params.timeout);
         break;
+    }
 
     default:
         break;
@@ -86,6 +178,12 @@ void bluetooth_client::ble_gattc_callback(
 	esp_gatt_if_t gattc_if,
 	esp_ble_gattc_cb_param_t *param)
 {
+    trace_buffer::instance().record(
+        trace_buffer::event_t::BLE_GATTC,
+        gattc_if,
+        gattc_conn_id(event, param),
+        event);
+
     /* If event is register event, store the gattc_if for each profile */
     if (event == ESP_GATTC_REG_EVT)
     {
@@ -114,7 +212,7 @@ void bluetooth_client::ble_gattc_callback(
     case ESP_GATTC_REG_EVT:
     {
         ESP_LOGI(TAG, "REG_EVT");
-        m_sm.idle_to_ble(m_interface, &m_servers);
+        m_sm.idle_to_ble(m_interface, &m_servers, &m_cache);
         break;
     }
 
@@ -127,27 +225,20 @@ void bluetooth_client::ble_gattc_callback(
 			"ESP_GATTC_CONNECT_EVT conn_id %d, if %d",
 			conn_id,
 			gattc_if);   
-        auto it = std::find_if(
-        	begin(m_servers),
-        	end(m_servers),
-        	[param](auto& val)
-        	{
-        		return val.address() == bluetooth_address(param->connect.remote_bda);
-        	});
-        if (it != end(m_servers))
-        	it->conn_id() = conn_id;
-        esp_ble_conn_update_params_t conn_params = {};
-        std::memcpy(
-            conn_params.bda,
-            param->connect.remote_bda,
-            sizeof(esp_bd_addr_t));
-        conn_params.latency = 0;
-        conn_params.max_int = 3200;    // * 1.25ms
-        conn_params.min_int = 3200;    // * 1.25ms
-        conn_params.timeout = 400;     // * 10ms
-        //start sent the update connection parameters to the peer device.
-        esp_ble_gap_update_conn_params(&conn_params);
-        m_sm.notify_ble_opened(conn_id);
+        auto params = bluetooth_server_info::DEFAULT_CONN_PARAMS;
+        auto opened = state_machine::NO_SLOT;
+        const auto slot = m_index.find(bluetooth_address(param->connect.remote_bda));
+        if (slot)
+        {
+        	m_index.bind(conn_id, *slot);
+        	m_policy.on_connected(*slot, now_ms());
+        	params = m_servers.conn_params(*slot);
+        	opened = static_cast<std::uint32_t>(*slot);
+        }
+        // Every link starts on its slow (cached) parameters
+        update_conn_params(param->connect.remote_bda, params);
+        // The handler puts the conn_id into the table
+        m_sm.notify_ble_opened(conn_id, opened);
         break;
     }
 
@@ -158,6 +249,10 @@ void bluetooth_client::ble_gattc_callback(
             	TAG,
 				"open failed, status %d",
 				param->open.status);
+            // The pipeline retries or skips the server
+            const auto slot = m_index.find(bluetooth_address(param->open.remote_bda));
+            if (slot)
+                m_sm.notify_ble_open_failed(*slot);
             break;
         }
         ESP_LOGI(TAG, "open success");
@@ -177,51 +272,112 @@ void bluetooth_client::ble_gattc_callback(
 			param->cfg_mtu.status,
 			param->cfg_mtu.mtu,
 			param->cfg_mtu.conn_id);
-        m_sm.notify_mtu_configured();
+        m_sm.notify_mtu_configured(param->cfg_mtu.conn_id);
+        break;
+
+    case ESP_GATTC_SEARCH_CMPL_EVT:
+        ESP_LOGI(
+        	TAG,
+			"ESP_GATTC_SEARCH_CMPL_EVT, status %d, conn_id %d",
+			param->search_cmpl.status,
+			param->search_cmpl.conn_id);
+        m_sm.notify_services_discovered(param->search_cmpl.conn_id, param->search_cmpl.status);
+        break;
+
+    case ESP_GATTC_WRITE_DESCR_EVT:
+        if (param->write.status != ESP_GATT_OK)
+        {
+            ESP_LOGE(
+            	TAG,
+				"write descriptor failed, status %d",
+				param->write.status);
+        }
+        m_sm.notify_notifications_enabled(param->write.conn_id, param->write.status);
         break;
 
     case ESP_GATTC_REG_FOR_NOTIFY_EVT:
-    	ESP_LOGI(TAG, "register for notify");
-        m_sm.notify_ble_connected();
+        if (param->reg_for_notify.status != ESP_GATT_OK)
+            ESP_LOGE(TAG, "register for notify failed, status %d", param->reg_for_notify.status);
+        else
+            ESP_LOGI(TAG, "register for notify");
+        m_sm.notify_ble_connected(param->reg_for_notify.status);
     	break;
 
     case ESP_GATTC_NOTIFY_EVT:
     {
-    	ESP_LOGI(
-    		TAG,
+    	// An empty notification carries no activator to read
+    	if (param->notify.value_len == 0)
+    		break;
+
+    	static auto first_notification = true;
+    	if (first_notification)
+    	{
+    		first_notification = false;
+    		DEFERRED_LOGI(
+    			TAG,
+    			"Boot to first notification: %d ms",
+    			static_cast<int>(esp_timer_get_time() / 1000));
+    	}
+
+    	DEFERRED_LOGI(
+    		NOTIFY_TAG,
 			"notified from boi %d: %d",
 			param->notify.conn_id,
 			param->notify.value[0]);
 
-    	auto it = std::find_if(
-    		begin(m_servers),
-    		end(m_servers),
-    		[param](const auto& val)
+    	const auto slot = m_index.find(param->notify.conn_id);
+    	if (slot)
+    	{
+    		conn_param_policy::decisions_t decisions;
+    		const auto count = m_policy.on_activator(*slot, param->notify.value[0], now_ms(), decisions);
+    		for (std::size_t i = 0; i < count; i++)
     		{
-    			return param->notify.conn_id == val.conn_id();
-    		});
-    	if (it != end(m_servers))
-    		it->activator() = param->notify.value[0];
-    	handle_activator_notification();
+    			const auto server = decisions[i].slot;
+    			const auto fast = decisions[i].mode == conn_param_policy::mode_t::FAST;
+    			DEFERRED_LOGI(
+    				TAG,
+    				fast ? "Moving %s to fast interval" : "Moving %s to slow interval",
+    				m_servers.address(server));
+    			update_conn_params(
+    				m_servers.address(server),
+    				fast ? conn_param_policy::FAST_PARAMS : m_servers.conn_params(server));
+    		}
+
+    		handle_activator(*slot, param->notify.value[0]);
+    	}
     	break;
     }
 
     case ESP_GATTC_DISCONNECT_EVT:
     {
-        auto it = std::find_if(
-            begin(m_servers),
-            end(m_servers),
-            [param](const auto& val)
+        const auto slot = m_index.find(bluetooth_address(param->disconnect.remote_bda));
+        // The handler clears the link from the table and decides whether
+        // it is worth bringing back
+        auto dropped = state_machine::NO_SLOT;
+        if (slot)
+        {
+            dropped = static_cast<std::uint32_t>(*slot);
+            m_policy.on_disconnected(*slot);
             {
-                return bluetooth_address(param->disconnect.remote_bda) == val.address();
-            });
-        it->ble_connected() = false;
+                std::lock_guard<std::mutex> lock(m_switch_mutex);
+                m_switching.on_disconnected(*slot);
+            }
+            m_index.unbind(param->disconnect.conn_id);
+        }
+        else
+        {
+            char addr_str[bluetooth_address::STRING_SIZE];
+            ESP_LOGW(
+                TAG,
+                "Disconnect from unknown server %s",
+                format(bluetooth_address(param->disconnect.remote_bda), addr_str));
+        }
 
         ESP_LOGI(
         	TAG,
 			"ESP_GATTC_DISCONNECT_EVT, reason = %d",
 			param->disconnect.reason);
-        m_sm.notify_ble_disconnected();
+        m_sm.notify_ble_disconnected(param->disconnect.conn_id, dropped);
     }
         break;
 
@@ -230,42 +386,103 @@ void bluetooth_client::ble_gattc_callback(
     }
 }
 
-void bluetooth_client::handle_activator_notification()
+std::uint32_t bluetooth_client::now_ms()
 {
-    static size_t i = 0;
-
-    const auto max_it = std::max_element(
-        cbegin(m_servers),
-        cend(m_servers),
-        [](const auto& l, const auto& r)
-        {
-            return l.activator() < r.activator();
-        });
+    return static_cast<std::uint32_t>(esp_timer_get_time() / 1000);
+}
 
-    const auto addr = to_string(max_it->address());
-    ESP_LOGI(TAG, "Max activator from %s: %d", addr.c_str(), max_it->activator());
+void bluetooth_client::update_conn_params(
+    const bluetooth_address& addr,
+    const bluetooth_server_info::conn_params_t& params)
+{
+    esp_ble_conn_update_params_t conn_params = {};
+    std::memcpy(conn_params.bda, addr.raw(), sizeof(esp_bd_addr_t));
+    conn_params.latency = params.latency;
+    conn_params.max_int = params.max_int;
+    conn_params.min_int = params.min_int;
+    conn_params.timeout = params.timeout;
+    // Sends the update connection parameters to the peer device
+    esp_ble_gap_update_conn_params(&conn_params);
+}
 
-    // If there is no active A2DP connection and the maximum activator is big enough,
-    // then we should switch to A2DP.
-    if (i > 0)
+bool bluetooth_client::add_server(const bluetooth_server_info& server)
+{
+    // Slots are handed out in order, so the index can take it before the table does
+    const auto slot = m_servers.size();
+    if (m_servers.full() || !m_index.insert(server.address(), slot))
     {
-        ESP_LOGI(TAG, "MAXIMUM REACHED");
+        DEFERRED_LOGI(TAG, "Server table full, ignoring %s", server.address());
+        return false;
     }
-    else if (!m_sm.a2dp_address() && max_it->activator() > 2)
+
+    m_servers.add(server);
+    std::lock_guard<std::mutex> lock(m_switch_mutex);
+    m_ranking.update(slot, server.activator());
+    return true;
+}
+
+void bluetooth_client::handle_activator(std::size_t slot, std::uint8_t activator)
+{
+    const auto now = now_ms();
+    m_sm.notify_activator_sampled(slot, activator);
+
+    std::lock_guard<std::mutex> lock(m_switch_mutex);
+    m_ranking.update(slot, activator);
+    switch (m_switching.on_activator(slot, activator, now))
     {
-        ESP_LOGI(TAG, "Want to switch from BLE to A2DP (%d)", i);
-        m_sm.ble_to_a2dp(max_it->address());
+    case switch_policy::notify_t::DECIDE:
+        handle_activator_notification();
+        break;
 
-        i++;
+    case switch_policy::notify_t::FLUSH_LATER:
+        timer_service::instance().arm(m_flush_timer, m_switching.window_left(now));
+        break;
 
-        std::thread([this]()
-        {
-            std::this_thread::sleep_for(3600s);
-            m_sm.a2dp_to_ble();
-        }).detach();
+    default:
+        break;
     }
-    else
+}
+
+void bluetooth_client::handle_window_end()
+{
+    std::lock_guard<std::mutex> lock(m_switch_mutex);
+    if (m_switching.on_window_end(now_ms()))
+        handle_activator_notification();
+}
+
+void bluetooth_client::handle_activator_notification()
+{
+    const auto max_slot = m_ranking.top();
+    if (!max_slot)
+        return;
+
+    DEFERRED_LOGI(TAG, "Max activator from %s: %d", m_servers.address(*max_slot), m_ranking.activator(*max_slot));
+
+    const auto a2dp = m_sm.a2dp_address();
+    const auto peer = a2dp ? m_index.find(*a2dp) : std::optional<std::size_t>();
+    const auto now = now_ms();
+    const auto decision = m_switching.decide(max_slot, static_cast<bool>(a2dp), peer, now);
+    switch (decision.action)
     {
-        ESP_LOGI(TAG, "Nothing to happen in regards to switching");
+    case switch_policy::action_t::CONNECT:
+        // A refused switch is not committed, the next decision tries again
+        if (!m_sm.ble_to_a2dp(decision.slot))
+            break;
+        m_switching.commit(decision, now);
+        DEFERRED_LOGI(TAG, "Want to switch from BLE to A2DP (%d)", m_switching.switches());
+        timer_service::instance().arm(m_a2dp_timer, A2DP_SESSION_MS);
+        break;
+
+    case switch_policy::action_t::HANDOVER:
+        if (!m_sm.handover(decision.slot))
+            break;
+        m_switching.commit(decision, now);
+        DEFERRED_LOGI(TAG, "Want to hand A2DP over to %s", m_servers.address(decision.slot));
+        timer_service::instance().arm(m_a2dp_timer, A2DP_SESSION_MS);
+        break;
+
+    default:
+        DEFERRED_LOGI(TAG, "Nothing to happen in regards to switching");
+        break;
     }
 }
@@ -7,14 +7,23 @@
 // My includes
 #include "bluetooth_address.hpp"
 
+constexpr std::uint16_t bluetooth_server_info::INVALID_CONN_ID;
+constexpr std::uint16_t bluetooth_server_info::INVALID_HANDLE;
+constexpr bluetooth_server_info::conn_params_t bluetooth_server_info::DEFAULT_CONN_PARAMS;
+
 bluetooth_server_info::bluetooth_server_info(
 	bluetooth_address address,
 	std::uint16_t conn_id,
-	std::uint8_t activator)
+	std::uint8_t activator,
+	esp_ble_addr_type_t address_type)
 	: m_address(std::move(address))
 	, m_conn_id(conn_id)
 	, m_activator(activator)
 	, m_ble_connected(false)
+	, m_address_type(address_type)
+	, m_notify_handle(INVALID_HANDLE)
+	, m_cccd_handle(INVALID_HANDLE)
+	, m_conn_params(DEFAULT_CONN_PARAMS)
 {
 }
 
@@ -58,6 +67,46 @@ bool& bluetooth_server_info::ble_connected()
 	return m_ble_connected;
 }
 
+const esp_ble_addr_type_t& bluetooth_server_info::address_type() const
+{
+	return m_address_type;
+}
+
+esp_ble_addr_type_t& bluetooth_server_info::address_type()
+{
+	return m_address_type;
+}
+
+const std::uint16_t& bluetooth_server_info::notify_handle() const
+{
+	return m_notify_handle;
+}
+
+std::uint16_t& bluetooth_server_info::notify_handle()
+{
+	return m_notify_handle;
+}
+
+const std::uint16_t& bluetooth_server_info::cccd_handle() const
+{
+	return m_cccd_handle;
+}
+
+std::uint16_t& bluetooth_server_info::cccd_handle()
+{
+	return m_cccd_handle;
+}
+
+const bluetooth_server_info::conn_params_t& bluetooth_server_info::conn_params() const
+{
+	return m_conn_params;
+}
+
+bluetooth_server_info::conn_params_t& bluetooth_server_info::conn_params()
+{
+	return m_conn_params;
+}
+
 bool operator==(const bluetooth_server_info& l, const bluetooth_server_info& r)
 {
 	return l.address() == r.address()
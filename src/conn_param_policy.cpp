@@ -0,0 +1,147 @@
+// Matching include
+#include "conn_param_policy.hpp"
+// C++ includes
+#include <algorithm>
+
+constexpr bluetooth_server_info::conn_params_t conn_param_policy::FAST_PARAMS;
+constexpr std::size_t conn_param_policy::FAST_LINKS;
+constexpr std::uint8_t conn_param_policy::PROMOTE_LEVEL;
+constexpr std::uint8_t conn_param_policy::DEMOTE_LEVEL;
+constexpr std::uint32_t conn_param_policy::ACTIVITY_WINDOW_MS;
+constexpr std::uint32_t conn_param_policy::QUIET_PERIOD_MS;
+constexpr std::uint8_t conn_param_policy::DEMOTE_RETRIES;
+
+conn_param_policy::conn_param_policy()
+	: m_links()
+{
+}
+
+conn_param_policy::mode_t conn_param_policy::mode(std::size_t slot) const
+{
+	return slot < m_links.size() ? m_links[slot].mode : mode_t::SLOW;
+}
+
+void conn_param_policy::on_connected(std::size_t slot, std::uint32_t now_ms)
+{
+	if (slot >= m_links.size())
+		return;
+
+	m_links[slot] = {true, false, mode_t::SLOW, 0, 0, now_ms, now_ms};
+}
+
+void conn_param_policy::on_disconnected(std::size_t slot)
+{
+	if (slot < m_links.size())
+		m_links[slot] = {};
+}
+
+std::size_t conn_param_policy::on_activator(
+	std::size_t slot,
+	std::uint8_t activator,
+	std::uint32_t now_ms,
+	decisions_t& out)
+{
+	std::size_t count = 0;
+	if (slot >= m_links.size() || !m_links[slot].connected)
+		return count;
+
+	auto& link = m_links[slot];
+	const auto changed = activator != link.activator;
+	if (changed && now_ms - link.last_notification <= ACTIVITY_WINDOW_MS)
+		link.last_activity = now_ms;
+	if (activator >= PROMOTE_LEVEL)
+		link.last_activity = now_ms;
+	link.activator = activator;
+	link.last_notification = now_ms;
+
+	// Demote fast links that have been quiet and low for long enough
+	for (std::size_t i = 0; i < m_links.size() && count < out.size(); i++)
+	{
+		auto& other = m_links[i];
+		if (other.mode == mode_t::FAST && !other.pending
+			&& other.activator <= DEMOTE_LEVEL
+			&& now_ms - other.last_activity >= QUIET_PERIOD_MS)
+		{
+			other.mode = mode_t::SLOW;
+			other.pending = true;
+			other.attempts = 0;
+			out[count++] = {i, mode_t::SLOW};
+		}
+	}
+
+	const auto active = link.last_activity == now_ms;
+	if (link.mode == mode_t::FAST || link.pending || !active)
+		return count;
+
+	if (count == out.size())
+		return count;
+
+	// Over budget: take the slot of the least active fast link, if this one beats it
+	if (fast_links() >= FAST_LINKS)
+	{
+		if (count + 1 == out.size())
+			return count;
+
+		auto victim = m_links.end();
+		for (auto it = m_links.begin(); it != m_links.end(); ++it)
+			if (it->mode == mode_t::FAST && !it->pending
+				&& (victim == m_links.end() || it->activator < victim->activator))
+				victim = it;
+
+		if (victim == m_links.end() || victim->activator >= activator)
+			return count;
+
+		victim->mode = mode_t::SLOW;
+		victim->pending = true;
+		victim->attempts = 0;
+		out[count++] = {static_cast<std::size_t>(victim - m_links.begin()), mode_t::SLOW};
+	}
+
+	link.mode = mode_t::FAST;
+	link.pending = true;
+	out[count++] = {slot, mode_t::FAST};
+	return count;
+}
+
+bool conn_param_policy::on_update_result(std::size_t slot, bool success)
+{
+	if (slot >= m_links.size() || !m_links[slot].pending)
+		return false;
+
+	auto& link = m_links[slot];
+	link.pending = false;
+	if (success)
+		return false;
+
+	if (link.mode == mode_t::FAST)
+	{
+		link.mode = mode_t::SLOW;
+		return false;
+	}
+
+	// The fast slot of a rejected demotion may have gone to another link
+	// already. Then it stays slow and is sent again; once out of retries
+	// it is only booked as slow, the budget counts what was decided.
+	if (fast_links() < FAST_LINKS)
+	{
+		link.mode = mode_t::FAST;
+		return false;
+	}
+	if (link.attempts >= DEMOTE_RETRIES)
+		return false;
+
+	++link.attempts;
+	link.pending = true;
+	return true;
+}
+
+std::size_t conn_param_policy::fast_links() const
+{
+	return std::count_if(
+		cbegin(m_links),
+		cend(m_links),
+		[](const auto& link)
+		{
+			return link.mode == mode_t::FAST;
+		});
+}
@@ -0,0 +1,498 @@
+// Matching include
+#include "connection_pipeline.hpp"
+// C++ includes
+#include <algorithm>
+// ESP includes
+#include "esp_gap_ble_api.h"
+#include "esp_gattc_api.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+namespace
+{
+	constexpr auto TAG = "CONN_PIPELINE";
+
+	esp_bt_uuid_t uuid16(std::uint16_t value)
+	{
+		esp_bt_uuid_t uuid = {};
+		uuid.len = ESP_UUID_LEN_16;
+		uuid.uuid.uuid16 = value;
+		return uuid;
+	}
+}
+
+constexpr std::size_t connection_pipeline::MAX_IN_FLIGHT;
+constexpr std::uint16_t connection_pipeline::SERVICE_UUID;
+constexpr std::uint16_t connection_pipeline::NOTIFY_CHAR_UUID;
+constexpr retry_policy connection_pipeline::STEP_POLICIES[];
+
+connection_pipeline::connection_pipeline(
+	timer_wheel *timers,
+	std::size_t first_timer,
+	const reconnect_engine *reconnects)
+	: m_entries()
+	, m_servers(nullptr)
+	, m_next(0)
+	, m_interface(ESP_GATT_IF_NONE)
+	, m_order(0)
+	, m_started()
+	, m_timers(timers)
+	, m_first_timer(first_timer)
+	, m_skipped(0)
+	, m_reconnects(reconnects)
+	, m_limit(MAX_IN_FLIGHT)
+{
+	for (auto& e : m_entries)
+		e.step = step_t::FREE;
+}
+
+bool connection_pipeline::done() const
+{
+	return in_flight() == 0 && (m_servers == nullptr || m_next >= m_servers->size());
+}
+
+std::size_t connection_pipeline::in_flight() const
+{
+	return std::count_if(
+		cbegin(m_entries),
+		cend(m_entries),
+		[](const auto& e)
+		{
+			return e.step != step_t::FREE;
+		});
+}
+
+std::size_t connection_pipeline::skipped() const
+{
+	return m_skipped;
+}
+
+void connection_pipeline::start(std::uint16_t interface, server_table *servers, std::size_t limit)
+{
+	m_servers = servers;
+	m_limit = std::min(limit, MAX_IN_FLIGHT);
+	m_interface = interface;
+	m_next = 0;
+	m_skipped = 0;
+	m_started = std::chrono::steady_clock::now();
+	fill();
+}
+
+void connection_pipeline::on_opened(std::size_t server, std::uint16_t conn_id)
+{
+	for (auto& e : m_entries)
+	{
+		if (e.step == step_t::OPENING && e.server == server)
+		{
+			e.conn_id = conn_id;
+			m_servers->conn_id(server) = conn_id;
+			enter(e, step_t::CONFIGURING_MTU);
+			return;
+		}
+	}
+
+	// A late open for a server that was given up on
+	ESP_LOGW(TAG, "Opened conn_id %d which is not being set up, closing it", conn_id);
+	esp_ble_gattc_close(m_interface, conn_id);
+}
+
+void connection_pipeline::on_open_failed(std::size_t server)
+{
+	for (auto& e : m_entries)
+	{
+		if (e.step == step_t::OPENING && e.server == server && !e.backing_off)
+		{
+			retry(e, "open failed");
+			return;
+		}
+	}
+}
+
+void connection_pipeline::on_mtu_configured(std::uint16_t conn_id)
+{
+	auto e = find(step_t::CONFIGURING_MTU, conn_id);
+	if (e == nullptr)
+	{
+		ESP_LOGW(TAG, "MTU configured on conn_id %d which is not being set up", conn_id);
+		return;
+	}
+
+	// Known handles go straight to subscribe; stale ones are caught when
+	// enabling notifications fails
+	if (m_servers->notify_handle(e->server) == bluetooth_server_info::INVALID_HANDLE)
+		enter(*e, step_t::DISCOVERING);
+	else
+		enter(*e, step_t::SUBSCRIBING);
+}
+
+void connection_pipeline::on_discovered(std::uint16_t conn_id, std::uint32_t status)
+{
+	auto e = find(step_t::DISCOVERING, conn_id);
+	// A late failure of a try already given up on is not another attempt
+	if (e == nullptr || (status != ESP_GATT_OK && e->backing_off))
+		return;
+
+	if (status != ESP_GATT_OK)
+	{
+		retry(*e, "service discovery failed");
+		return;
+	}
+
+	// Discovery filled Bluedroid's attribute cache, look the handles up there
+	esp_gattc_char_elem_t characteristic;
+	std::uint16_t count = 1;
+	const auto char_status = esp_ble_gattc_get_char_by_uuid(
+		m_interface,
+		conn_id,
+		0x0001,
+		0xffff,
+		uuid16(NOTIFY_CHAR_UUID),
+		&characteristic,
+		&count);
+	if (char_status != ESP_GATT_OK || count == 0)
+	{
+		fail(*e, "activator characteristic not found");
+		return;
+	}
+
+	esp_gattc_descr_elem_t descriptor;
+	count = 1;
+	const auto descr_status = esp_ble_gattc_get_descr_by_char_handle(
+		m_interface,
+		conn_id,
+		characteristic.char_handle,
+		uuid16(ESP_GATT_UUID_CHAR_CLIENT_CONFIG),
+		&descriptor,
+		&count);
+
+	m_servers->notify_handle(e->server) = characteristic.char_handle;
+	m_servers->cccd_handle(e->server) = descr_status == ESP_GATT_OK && count > 0
+		? descriptor.handle
+		: bluetooth_server_info::INVALID_HANDLE;
+	e->discovered = true;
+
+	ESP_LOGI(
+		TAG,
+		"Discovered conn_id %d: notify handle 0x%04x, CCCD 0x%04x",
+		conn_id,
+		m_servers->notify_handle(e->server),
+		m_servers->cccd_handle(e->server));
+	enter(*e, step_t::SUBSCRIBING);
+}
+
+void connection_pipeline::on_subscribed(std::uint32_t status)
+{
+	entry_t *oldest = nullptr;
+	for (auto& e : m_entries)
+		if (e.step == step_t::SUBSCRIBING && !e.backing_off
+			&& (oldest == nullptr || e.order < oldest->order))
+			oldest = &e;
+
+	if (oldest == nullptr)
+		return;
+
+	if (status != ESP_GATT_OK)
+	{
+		retry(*oldest, "registering for notifications failed");
+		return;
+	}
+
+	if (m_servers->cccd_handle(oldest->server) == bluetooth_server_info::INVALID_HANDLE)
+	{
+		// Nothing to write, the server notifies unconditionally
+		finish(*oldest);
+		return;
+	}
+
+	enter(*oldest, step_t::ENABLING);
+}
+
+void connection_pipeline::on_notifications_enabled(std::uint16_t conn_id, std::uint32_t status)
+{
+	auto e = find(step_t::ENABLING, conn_id);
+	if (e == nullptr || (status != ESP_GATT_OK && e->backing_off))
+		return;
+
+	if (status == ESP_GATT_OK)
+	{
+		finish(*e);
+	}
+	else if (!e->discovered)
+	{
+		// The cached handles no longer match the server, learn them again
+		ESP_LOGW(TAG, "Cached handles of conn_id %d are stale, rediscovering", conn_id);
+		m_servers->notify_handle(e->server) = bluetooth_server_info::INVALID_HANDLE;
+		m_servers->cccd_handle(e->server) = bluetooth_server_info::INVALID_HANDLE;
+		enter(*e, step_t::DISCOVERING);
+	}
+	else
+	{
+		retry(*e, "enabling notifications failed");
+	}
+}
+
+void connection_pipeline::on_dropped(std::size_t server)
+{
+	// By server: the drop overtakes the open of its link in the mailbox
+	for (auto& e : m_entries)
+	{
+		if (e.step != step_t::FREE && e.server == server)
+		{
+			fail(e, "link dropped", false);
+			return;
+		}
+	}
+}
+
+void connection_pipeline::resume()
+{
+	if (m_servers != nullptr)
+		fill();
+}
+
+void connection_pipeline::stop()
+{
+	for (auto& e : m_entries)
+	{
+		if (e.step == step_t::FREE)
+			continue;
+
+		m_timers->cancel(timer_of(e));
+		if (e.conn_id != bluetooth_server_info::INVALID_CONN_ID)
+			esp_ble_gattc_close(m_interface, e.conn_id);
+		else
+			esp_ble_gap_disconnect(m_servers->address(e.server));
+		e.step = step_t::FREE;
+	}
+
+	if (m_servers != nullptr)
+		m_next = m_servers->size();
+}
+
+void connection_pipeline::on_timeout(std::size_t entry)
+{
+	if (entry >= m_entries.size() || m_entries[entry].step == step_t::FREE)
+		return;
+
+	auto& e = m_entries[entry];
+	if (e.backing_off)
+	{
+		e.backing_off = false;
+		issue(e);
+		return;
+	}
+
+	// Cancel the pending connection, so the retry does not find the controller busy
+	if (e.step == step_t::OPENING)
+		esp_ble_gap_disconnect(m_servers->address(e.server));
+	retry(e, "timed out");
+}
+
+std::uint32_t connection_pipeline::now_ms()
+{
+	return static_cast<std::uint32_t>(esp_timer_get_time() / 1000);
+}
+
+void connection_pipeline::fill()
+{
+	for (auto& e : m_entries)
+	{
+		if (e.step != step_t::FREE)
+			continue;
+		if (in_flight() >= m_limit)
+			return;
+
+		const auto next = m_servers->next_to_connect(m_next, now_ms());
+		if (!next)
+		{
+			m_next = m_servers->size();
+			return;
+		}
+
+		e.server = *next;
+		m_next = *next + 1;
+		e.conn_id = bluetooth_server_info::INVALID_CONN_ID;
+		e.round_trips = 0;
+		e.discovered = false;
+		enter(e, step_t::OPENING);
+	}
+}
+
+void connection_pipeline::enter(entry_t& e, step_t step)
+{
+	e.step = step;
+	e.attempts = 0;
+	e.backing_off = false;
+	issue(e);
+}
+
+void connection_pipeline::issue(entry_t& e)
+{
+	auto address = m_servers->address(e.server);
+	char addr[bluetooth_address::STRING_SIZE];
+	esp_err_t err = ESP_OK;
+
+	switch (e.step)
+	{
+	case step_t::OPENING:
+		ESP_LOGI(TAG, "Open new connection with %s", format(address, addr));
+		// The CONNECT event fills in the real conn_id
+		m_servers->conn_id(e.server) = bluetooth_server_info::INVALID_CONN_ID;
+		err = esp_ble_gattc_open(
+			m_interface,
+			address,
+			m_servers->address_type(e.server),
+			true);
+		break;
+
+	case step_t::CONFIGURING_MTU:
+		ESP_LOGI(TAG, "Send MTU negotation to %s", format(address, addr));
+		err = esp_ble_gattc_send_mtu_req(m_interface, e.conn_id);
+		break;
+
+	case step_t::DISCOVERING:
+	{
+		auto uuid = uuid16(SERVICE_UUID);
+		err = esp_ble_gattc_search_service(m_interface, e.conn_id, &uuid);
+		break;
+	}
+
+	case step_t::SUBSCRIBING:
+		ESP_LOGI(TAG, "Register for notifications with %s", format(address, addr));
+		// Local to Bluedroid, no round trip
+		e.order = m_order++;
+		err = esp_ble_gattc_register_for_notify(
+			m_interface,
+			address,
+			m_servers->notify_handle(e.server));
+		break;
+
+	case step_t::ENABLING:
+	{
+		std::uint8_t enable[] = {0x01, 0x00};
+		err = esp_ble_gattc_write_char_descr(
+			m_interface,
+			e.conn_id,
+			m_servers->cccd_handle(e.server),
+			sizeof(enable),
+			enable,
+			ESP_GATT_WRITE_TYPE_RSP,
+			ESP_GATT_AUTH_REQ_NONE);
+		break;
+	}
+
+	case step_t::FREE:
+		return;
+	}
+
+	// A busy stack or a conn_id that went stale: no answer will come, back
+	// off and try again like after a failed one
+	if (err != ESP_OK)
+	{
+		ESP_LOGW(TAG, "%s: request refused (%d)", format(address, addr), err);
+		retry(e, "request refused");
+		return;
+	}
+
+	if (e.step != step_t::SUBSCRIBING)
+		e.round_trips++;
+
+	const auto& policy = STEP_POLICIES[static_cast<std::size_t>(e.step)];
+	if (policy.deadline_ms != 0)
+		m_timers->arm(timer_of(e), policy.deadline_ms);
+}
+
+void connection_pipeline::retry(entry_t& e, const char *reason)
+{
+	const auto& policy = STEP_POLICIES[static_cast<std::size_t>(e.step)];
+	if (e.attempts >= policy.retries)
+	{
+		fail(e, reason);
+		return;
+	}
+
+	++e.attempts;
+	e.backing_off = true;
+	const auto delay = policy.backoff(e.attempts);
+
+	char addr[bluetooth_address::STRING_SIZE];
+	ESP_LOGW(
+		TAG,
+		"%s: %s, retry %d of %d in %d ms",
+		format(m_servers->address(e.server), addr),
+		reason,
+		e.attempts,
+		policy.retries,
+		static_cast<int>(delay));
+	m_timers->arm(timer_of(e), delay);
+}
+
+std::size_t connection_pipeline::timer_of(const entry_t& e) const
+{
+	return m_first_timer + static_cast<std::size_t>(&e - m_entries.data());
+}
+
+void connection_pipeline::finish(entry_t& e)
+{
+	ESP_LOGI(
+		TAG,
+		"conn_id %d ready after %d round trips%s",
+		e.conn_id,
+		e.round_trips,
+		e.discovered ? "" : " (cached handles)");
+
+	m_timers->cancel(timer_of(e));
+	m_servers->ble_connected(e.server) = true;
+	m_reconnects->on_connected(*m_servers, e.server);
+	e.step = step_t::FREE;
+	fill();
+	report();
+}
+
+void connection_pipeline::fail(entry_t& e, const char *reason, bool close)
+{
+	auto address = m_servers->address(e.server);
+	char addr[bluetooth_address::STRING_SIZE];
+	ESP_LOGE(TAG, "Giving up on %s: %s", format(address, addr), reason);
+
+	m_timers->cancel(timer_of(e));
+	if (close && e.conn_id != bluetooth_server_info::INVALID_CONN_ID)
+		esp_ble_gattc_close(m_interface, e.conn_id);
+	else if (close)
+		esp_ble_gap_disconnect(address);
+
+	if (!m_reconnects->on_failed(*m_servers, e.server, now_ms()))
+		ESP_LOGW(TAG, "No more reconnects to %s", format(address, addr));
+
+	++m_skipped;
+	e.step = step_t::FREE;
+	fill();
+	report();
+}
+
+void connection_pipeline::report() const
+{
+	if (!done())
+		return;
+
+	const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - m_started);
+	// Servers given up on may have dropped out of the live ones since
+	const auto live = m_servers->live_count();
+	ESP_LOGI(
+		TAG,
+		"%d of %d servers set up in %d ms",
+		static_cast<int>(live > m_skipped ? live - m_skipped : 0),
+		static_cast<int>(live),
+		static_cast<int>(elapsed.count()));
+}
+
+connection_pipeline::entry_t *connection_pipeline::find(step_t step, std::uint16_t conn_id)
+{
+	for (auto& e : m_entries)
+	{
+		if (e.step == step && e.conn_id == conn_id)
+			return &e;
+	}
+	return nullptr;
+}
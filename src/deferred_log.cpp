@@ -0,0 +1,197 @@
+// Matching include
+#include "deferred_log.hpp"
+// C++ includes
+#include <algorithm>
+// C includes
+#include <cstdio>
+#include <cstring>
+// ESP includes
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+namespace
+{
+	constexpr auto TAG = "DEFERRED_LOG";
+
+	constexpr auto TASK_STACK = 3072;
+	constexpr auto TASK_PRIORITY = tskIDLE_PRIORITY + 1;
+	// Longest formatted message, longer ones are truncated
+	constexpr auto LINE_SIZE = 160;
+}
+
+constexpr std::size_t deferred_log::MAX_ARGS;
+constexpr std::size_t deferred_log::QUEUE_CAPACITY;
+constexpr std::uint32_t deferred_log::RATE_LIMIT;
+constexpr std::size_t deferred_log::MAX_TAGS;
+
+deferred_log::deferred_log()
+	: m_queue()
+	, m_limits()
+	, m_rate_limited(0)
+	, m_overflowed(0)
+{
+	for (auto& limit : m_limits)
+	{
+		limit.tag.store(nullptr, std::memory_order_relaxed);
+		limit.second.store(0, std::memory_order_relaxed);
+		limit.count.store(0, std::memory_order_relaxed);
+	}
+}
+
+deferred_log& deferred_log::instance()
+{
+	static deferred_log log;
+	return log;
+}
+
+std::uint32_t deferred_log::rate_limited() const
+{
+	return m_rate_limited.load(std::memory_order_relaxed);
+}
+
+std::uint32_t deferred_log::overflowed() const
+{
+	return m_overflowed.load(std::memory_order_relaxed);
+}
+
+void deferred_log::start()
+{
+	xTaskCreate(
+		[](void *self)
+		{
+			static_cast<deferred_log *>(self)->consumer();
+		},
+		"deferred_log",
+		TASK_STACK,
+		this,
+		TASK_PRIORITY,
+		nullptr);
+}
+
+bool deferred_log::admit(const char *tag)
+{
+	const auto second = static_cast<std::uint32_t>(esp_timer_get_time() / 1000000);
+
+	for (auto& limit : m_limits)
+	{
+		auto current = limit.tag.load(std::memory_order_acquire);
+		if (current == nullptr)
+		{
+			// Claim a free entry; if another producer beat us, re-check it
+			if (!limit.tag.compare_exchange_strong(current, tag, std::memory_order_acq_rel))
+				if (current != tag)
+					continue;
+		}
+		else if (current != tag)
+		{
+			continue;
+		}
+
+		// Fixed one-second windows; racing resets only ever admit a few extra
+		auto window = limit.second.load(std::memory_order_relaxed);
+		if (window != second && limit.second.compare_exchange_strong(window, second, std::memory_order_relaxed))
+			limit.count.store(0, std::memory_order_relaxed);
+
+		if (limit.count.fetch_add(1, std::memory_order_relaxed) >= RATE_LIMIT)
+		{
+			m_rate_limited.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		return true;
+	}
+
+	// Out of tag entries: no limiting for this tag
+	return true;
+}
+
+void deferred_log::consumer()
+{
+	std::uint32_t reported_rate_limited = 0;
+	std::uint32_t reported_overflowed = 0;
+
+	for (;;)
+	{
+		// Drops are reported whenever the queue runs empty, before blocking
+		entry_t entry;
+		if (!m_queue.try_pop(entry))
+		{
+			const auto limited = rate_limited();
+			const auto overflow = overflowed();
+			if (limited != reported_rate_limited || overflow != reported_overflowed)
+			{
+				ESP_LOGW(
+					TAG,
+					"Dropped %u rate limited and %u overflowed messages",
+					limited - reported_rate_limited,
+					overflow - reported_overflowed);
+				reported_rate_limited = limited;
+				reported_overflowed = overflow;
+			}
+
+			entry = m_queue.pop();
+		}
+
+		print(entry);
+	}
+}
+
+void deferred_log::print(const entry_t& entry)
+{
+	char line[LINE_SIZE];
+	std::size_t used = 0;
+	std::size_t next_arg = 0;
+
+	const auto append = [&](int written)
+	{
+		if (written > 0)
+			used = std::min(used + written, sizeof(line) - 1);
+	};
+
+	for (const char *p = entry.format; *p != '\0' && used < sizeof(line) - 1; p++)
+	{
+		if (*p != '%' || p[1] == '%')
+		{
+			line[used++] = *p;
+			p += *p == '%';
+			continue;
+		}
+
+		// Copy one conversion specification, e.g. "%02x"
+		char spec[16];
+		std::size_t len = 0;
+		do
+			spec[len++] = *p++;
+		while (*p != '\0' && std::strchr("diouxXcs", *p) == nullptr && len < sizeof(spec) - 2);
+		spec[len++] = *p;
+		spec[len] = '\0';
+		if (*p == '\0')
+			break;
+
+		if (next_arg >= entry.count)
+		{
+			append(std::snprintf(line + used, sizeof(line) - used, "<?>"));
+			continue;
+		}
+
+		const auto& arg = entry.args[next_arg++];
+		if (arg.kind == kind_t::ADDRESS)
+		{
+			char addr[bluetooth_address::STRING_SIZE];
+			format(bluetooth_address(static_cast<std::uint64_t>(arg.value)), addr);
+			append(std::snprintf(line + used, sizeof(line) - used, "%s", addr));
+		}
+		else if (*p == 's')
+		{
+			append(std::snprintf(line + used, sizeof(line) - used, "<?>"));
+		}
+		else
+		{
+			append(std::snprintf(line + used, sizeof(line) - used, spec, static_cast<int>(arg.value)));
+		}
+	}
+	line[used] = '\0';
+
+	ESP_LOGI(entry.tag, "%s", line);
+}
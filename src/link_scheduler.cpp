@@ -0,0 +1,151 @@
+// Matching include
+#include "link_scheduler.hpp"
+// C++ includes
+#include <algorithm>
+// My includes
+#include "reconnect_engine.hpp"
+
+constexpr std::size_t link_scheduler::LINKS;
+constexpr std::uint32_t link_scheduler::ROTATE_MS;
+constexpr std::uint32_t link_scheduler::DWELL_MS;
+constexpr std::uint32_t link_scheduler::STALE_MS;
+constexpr std::uint32_t link_scheduler::ACTIVE_MS;
+constexpr std::uint8_t link_scheduler::ACTIVE_LEVEL;
+
+link_scheduler::link_scheduler()
+	: m_joined_ms()
+	, m_rotations(0)
+{
+}
+
+std::uint32_t link_scheduler::rotations() const
+{
+	return m_rotations;
+}
+
+void link_scheduler::on_sample(
+	server_table& servers,
+	std::size_t slot,
+	std::uint8_t activator,
+	std::uint32_t now_ms)
+{
+	if (activator != servers.activator(slot) || activator >= ACTIVE_LEVEL)
+		servers.active_ms(slot) = now_ms;
+	servers.activator(slot) = activator;
+	servers.sampled_ms(slot) = now_ms;
+}
+
+std::size_t link_scheduler::plan(server_table& servers, std::uint32_t now_ms, evictions_t& out)
+{
+	std::size_t count = 0;
+
+	// Members the pipeline gave up on make room without being closed, the ones
+	// still being reconnected keep their place until the engine gives up too
+	for (std::size_t slot = 0; slot < servers.size(); slot++)
+		if (servers.live(slot)
+			&& !servers.ble_connected(slot)
+			&& !reconnect_engine::holding(servers, slot)
+			&& now_ms - m_joined_ms[slot] >= DWELL_MS)
+			servers.live(slot) = false;
+
+	auto live = servers.live_count();
+	for (; live < LINKS; live++)
+	{
+		const auto slot = best_outsider(servers, now_ms);
+		if (!slot)
+			return count;
+		join(servers, *slot, now_ms);
+	}
+
+	while (count < out.size())
+	{
+		const auto in = best_outsider(servers, now_ms);
+		if (!in)
+			break;
+		if (!active(servers, *in, now_ms) && now_ms - servers.sampled_ms(*in) < STALE_MS)
+			break;
+
+		const auto victim = weakest_member(servers, now_ms);
+		if (!victim)
+			break;
+
+		// A link without notifications saw no change, its value is current
+		servers.live(*victim) = false;
+		servers.sampled_ms(*victim) = now_ms;
+		out[count++] = *victim;
+		join(servers, *in, now_ms);
+		++m_rotations;
+	}
+
+	return count;
+}
+
+std::uint32_t link_scheduler::worst_staleness(const server_table& servers, std::uint32_t now_ms)
+{
+	std::uint32_t worst = 0;
+	for (std::size_t slot = 0; slot < servers.size(); slot++)
+		if (!servers.ble_connected(slot))
+			worst = std::max(worst, now_ms - servers.sampled_ms(slot));
+	return worst;
+}
+
+bool link_scheduler::active(const server_table& servers, std::size_t slot, std::uint32_t now_ms)
+{
+	return servers.active_ms(slot) != 0 && now_ms - servers.active_ms(slot) < ACTIVE_MS;
+}
+
+std::optional<std::size_t> link_scheduler::best_outsider(const server_table& servers, std::uint32_t now_ms)
+{
+	std::optional<std::size_t> best;
+	for (std::size_t slot = 0; slot < servers.size(); slot++)
+	{
+		if (servers.live(slot))
+			continue;
+		if (!best)
+		{
+			best = slot;
+			continue;
+		}
+
+		// Active first, most recent activity wins; then the oldest sample
+		const auto a = active(servers, slot, now_ms);
+		const auto b = active(servers, *best, now_ms);
+		if (a != b)
+		{
+			if (a)
+				best = slot;
+		}
+		else if (a)
+		{
+			if (now_ms - servers.active_ms(slot) < now_ms - servers.active_ms(*best))
+				best = slot;
+		}
+		else if (now_ms - servers.sampled_ms(slot) > now_ms - servers.sampled_ms(*best))
+		{
+			best = slot;
+		}
+	}
+	return best;
+}
+
+std::optional<std::size_t> link_scheduler::weakest_member(const server_table& servers, std::uint32_t now_ms) const
+{
+	// Round robin: the member that has been in the set the longest
+	std::optional<std::size_t> weakest;
+	for (std::size_t slot = 0; slot < servers.size(); slot++)
+	{
+		if (!servers.live(slot) || !servers.ble_connected(slot))
+			continue;
+		if (active(servers, slot, now_ms) || now_ms - m_joined_ms[slot] < DWELL_MS)
+			continue;
+		if (!weakest || now_ms - m_joined_ms[slot] > now_ms - m_joined_ms[*weakest])
+			weakest = slot;
+	}
+	return weakest;
+}
+
+void link_scheduler::join(server_table& servers, std::size_t slot, std::uint32_t now_ms)
+{
+	servers.live(slot) = true;
+	m_joined_ms[slot] = now_ms;
+}
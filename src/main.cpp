@@ -23,8 +23,14 @@ namespace
 
 extern "C" void app_main()
 {
-    ESP_ERROR_CHECK(nvs_flash_erase());
-    ESP_ERROR_CHECK(nvs_flash_init());
+    // NVS holds the server cache, so it is only wiped when it cannot be used
+    auto err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES)
+    {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(err);
 
     bluetooth_client::instance().start();
 }
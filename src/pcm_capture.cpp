@@ -0,0 +1,240 @@
+// Matching include
+#include "pcm_capture.hpp"
+// C++ includes
+#include <algorithm>
+// C includes
+#include <cstring>
+// ESP includes
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+namespace
+{
+	constexpr auto TAG = "PCM_CAPTURE";
+
+	constexpr auto TASK_STACK = 2048;
+	constexpr auto TASK_PRIORITY = tskIDLE_PRIORITY + 1;
+	constexpr auto IDLE_DELAY_MS = 10;
+	// Bytes handed to the sink per call
+	constexpr std::size_t DRAIN_CHUNK = 1024;
+	// The driver needs an RX buffer larger than the FIFO even if nothing is received
+	constexpr int UART_RX_BUFFER = 256;
+	constexpr int UART_TX_BUFFER = 4096;
+
+	std::uint8_t *put16(std::uint8_t *out, std::uint16_t value)
+	{
+		out[0] = value & 0xff;
+		out[1] = value >> 8;
+		return out + 2;
+	}
+
+	std::uint8_t *put32(std::uint8_t *out, std::uint32_t value)
+	{
+		return put16(put16(out, value & 0xffff), value >> 16);
+	}
+
+	std::uint16_t fletcher16(const std::uint8_t *data, std::size_t len)
+	{
+		std::uint32_t sum1 = 0;
+		std::uint32_t sum2 = 0;
+		for (std::size_t i = 0; i < len; i++)
+		{
+			sum1 = (sum1 + data[i]) % 255;
+			sum2 = (sum2 + sum1) % 255;
+		}
+		return static_cast<std::uint16_t>(sum2 << 8 | sum1);
+	}
+
+	// Returns the payload size, or 0 if it would not be smaller than len
+	std::size_t delta_encode(std::uint8_t *out, const std::uint8_t *data, std::size_t len, std::uint8_t channels)
+	{
+		std::int32_t previous[pcm_capture::MAX_CHANNELS] = {};
+		std::size_t used = 0;
+
+		for (std::size_t i = 0; i < len / 2; i++)
+		{
+			const auto sample = static_cast<std::int16_t>(data[2 * i] | data[2 * i + 1] << 8);
+			auto& last = previous[i % channels];
+			const std::int32_t delta = sample - last;
+			last = sample;
+
+			auto zigzag = static_cast<std::uint32_t>(delta) << 1 ^ static_cast<std::uint32_t>(delta >> 31);
+			for (; zigzag >= 0x80; zigzag >>= 7)
+				out[used++] = static_cast<std::uint8_t>(zigzag | 0x80);
+			out[used++] = static_cast<std::uint8_t>(zigzag);
+
+			if (used >= len)
+				return 0;
+		}
+
+		return used;
+	}
+}
+
+constexpr std::uint16_t pcm_capture::MAGIC;
+constexpr std::uint8_t pcm_capture::VERSION;
+constexpr std::uint8_t pcm_capture::FLAG_DELTA;
+constexpr std::uint8_t pcm_capture::MAX_CHANNELS;
+constexpr std::size_t pcm_capture::HEADER_SIZE;
+constexpr std::size_t pcm_capture::MAX_PCM_BYTES;
+constexpr std::size_t pcm_capture::MAX_FRAME_SIZE;
+
+pcm_capture::pcm_capture(std::size_t capacity, bool compress)
+	: m_ring(capacity)
+	, m_compress(compress)
+	, m_sink()
+	, m_seq(0)
+	, m_dropped(0)
+	, m_pcm_bytes(0)
+	, m_encoded_bytes(0)
+	, m_frame()
+{
+}
+
+std::uint32_t pcm_capture::frames() const
+{
+	return m_seq;
+}
+
+std::uint32_t pcm_capture::dropped() const
+{
+	return m_dropped.load(std::memory_order_relaxed);
+}
+
+std::uint32_t pcm_capture::pcm_bytes() const
+{
+	return m_pcm_bytes.load(std::memory_order_relaxed);
+}
+
+std::uint32_t pcm_capture::encoded_bytes() const
+{
+	return m_encoded_bytes.load(std::memory_order_relaxed);
+}
+
+void pcm_capture::start(sink_t sink)
+{
+	m_sink = std::move(sink);
+	xTaskCreate(
+		[](void *self)
+		{
+			static_cast<pcm_capture *>(self)->drain();
+		},
+		"pcm_capture",
+		TASK_STACK,
+		this,
+		TASK_PRIORITY,
+		nullptr);
+}
+
+void pcm_capture::write(
+	const std::uint8_t *data,
+	std::size_t len,
+	std::uint32_t sample_rate,
+	std::uint8_t channels)
+{
+	if (channels == 0 || channels > MAX_CHANNELS)
+		return;
+
+	// Whole frames only, so a split never separates the channels of a frame
+	const std::size_t frame_bytes = 2 * channels;
+	const auto chunk = MAX_PCM_BYTES / frame_bytes * frame_bytes;
+	len = len / frame_bytes * frame_bytes;
+
+	for (std::size_t offset = 0; offset < len; offset += chunk)
+	{
+		const auto part = std::min(chunk, len - offset);
+		const auto size = encode(m_frame, data + offset, part, sample_rate, channels);
+		if (!m_ring.write(m_frame, size))
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+
+		m_pcm_bytes.fetch_add(part, std::memory_order_relaxed);
+		m_encoded_bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+}
+
+std::size_t pcm_capture::encode(
+	std::uint8_t *out,
+	const std::uint8_t *data,
+	std::size_t len,
+	std::uint32_t sample_rate,
+	std::uint8_t channels)
+{
+	len = std::min(len, MAX_PCM_BYTES);
+
+	auto *const payload = out + HEADER_SIZE;
+	auto payload_len = m_compress ? delta_encode(payload, data, len, channels) : 0;
+	const std::uint8_t flags = payload_len != 0 ? FLAG_DELTA : 0;
+	if (payload_len == 0)
+	{
+		std::memcpy(payload, data, len);
+		payload_len = len;
+	}
+
+	auto *p = put16(out, MAGIC);
+	*p++ = VERSION;
+	*p++ = flags;
+	p = put32(p, m_seq++);
+	p = put32(p, now_ms());
+	p = put32(p, sample_rate);
+	*p++ = channels;
+	*p++ = 0;
+	p = put16(p, static_cast<std::uint16_t>(len / (2 * channels)));
+	p = put16(p, static_cast<std::uint16_t>(payload_len));
+	put16(p, fletcher16(payload, payload_len));
+
+	return HEADER_SIZE + payload_len;
+}
+
+pcm_capture::sink_t pcm_capture::uart_sink(int port, int tx_pin, int baud_rate)
+{
+	const auto uart = static_cast<uart_port_t>(port);
+
+	uart_config_t config = {};
+	config.baud_rate = baud_rate;
+	config.data_bits = UART_DATA_8_BITS;
+	config.parity = UART_PARITY_DISABLE;
+	config.stop_bits = UART_STOP_BITS_1;
+	config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+	ESP_ERROR_CHECK(uart_param_config(uart, &config));
+	ESP_ERROR_CHECK(uart_set_pin(uart, tx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+	ESP_ERROR_CHECK(uart_driver_install(uart, UART_RX_BUFFER, UART_TX_BUFFER, 0, nullptr, 0));
+
+	return [uart](const std::uint8_t *data, std::size_t len) -> std::size_t
+	{
+		const auto written = uart_write_bytes(uart, reinterpret_cast<const char *>(data), len);
+		return written > 0 ? written : 0;
+	};
+}
+
+void pcm_capture::drain()
+{
+	std::uint32_t reported_dropped = 0;
+
+	for (;;)
+	{
+		const std::uint8_t *data = nullptr;
+		const auto len = m_ring.peek(data, DRAIN_CHUNK);
+		if (len == 0)
+		{
+			const auto lost = dropped();
+			if (lost != reported_dropped)
+			{
+				ESP_LOGW(TAG, "Dropped %u frames, sink too slow", lost - reported_dropped);
+				reported_dropped = lost;
+			}
+
+			vTaskDelay(IDLE_DELAY_MS / portTICK_PERIOD_MS);
+			continue;
+		}
+
+		m_ring.consume(m_sink(data, len));
+	}
+}
+
+std::uint32_t pcm_capture::now_ms()
+{
+	return static_cast<std::uint32_t>(esp_timer_get_time() / 1000);
+}
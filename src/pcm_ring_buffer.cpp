@@ -0,0 +1,110 @@
+// Matching include
+#include "pcm_ring_buffer.hpp"
+// C++ includes
+#include <algorithm>
+// C includes
+#include <cstring>
+
+namespace
+{
+	std::size_t round_up_pow2(std::size_t n)
+	{
+		std::size_t p = 1;
+		while (p < n)
+			p <<= 1;
+		return p;
+	}
+}
+
+pcm_ring_buffer::pcm_ring_buffer(std::size_t capacity)
+	: m_data(new std::uint8_t[round_up_pow2(capacity)])
+	, m_mask(round_up_pow2(capacity) - 1)
+	, m_head(0)
+	, m_tail(0)
+	, m_overruns(0)
+	, m_underruns(0)
+{
+}
+
+std::size_t pcm_ring_buffer::capacity() const
+{
+	return m_mask + 1;
+}
+
+std::size_t pcm_ring_buffer::size() const
+{
+	return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+}
+
+bool pcm_ring_buffer::empty() const
+{
+	return size() == 0;
+}
+
+std::uint32_t pcm_ring_buffer::overruns() const
+{
+	return m_overruns.load(std::memory_order_relaxed);
+}
+
+std::uint32_t pcm_ring_buffer::underruns() const
+{
+	return m_underruns.load(std::memory_order_relaxed);
+}
+
+bool pcm_ring_buffer::write(const std::uint8_t *data, std::size_t len)
+{
+	// Head and tail run freely and are only masked on access
+	const auto head = m_head.load(std::memory_order_relaxed);
+	const auto tail = m_tail.load(std::memory_order_acquire);
+
+	if (capacity() - (head - tail) < len)
+	{
+		m_overruns.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	const auto offset = head & m_mask;
+	const auto first = std::min(len, capacity() - offset);
+	std::memcpy(&m_data[offset], data, first);
+	std::memcpy(&m_data[0], data + first, len - first);
+
+	m_head.store(head + len, std::memory_order_release);
+	return true;
+}
+
+std::size_t pcm_ring_buffer::read(std::uint8_t *out, std::size_t len)
+{
+	const auto tail = m_tail.load(std::memory_order_relaxed);
+	const auto head = m_head.load(std::memory_order_acquire);
+
+	len = std::min(len, head - tail);
+	if (len == 0)
+	{
+		m_underruns.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+
+	const auto offset = tail & m_mask;
+	const auto first = std::min(len, capacity() - offset);
+	std::memcpy(out, &m_data[offset], first);
+	std::memcpy(out + first, &m_data[0], len - first);
+
+	m_tail.store(tail + len, std::memory_order_release);
+	return len;
+}
+
+std::size_t pcm_ring_buffer::peek(const std::uint8_t *&data, std::size_t len) const
+{
+	const auto tail = m_tail.load(std::memory_order_relaxed);
+	const auto head = m_head.load(std::memory_order_acquire);
+
+	// Only up to the wrap, the rest comes with the next peek
+	const auto offset = tail & m_mask;
+	data = &m_data[offset];
+	return std::min({ len, head - tail, capacity() - offset });
+}
+
+void pcm_ring_buffer::consume(std::size_t len)
+{
+	m_tail.store(m_tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
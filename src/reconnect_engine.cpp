@@ -0,0 +1,53 @@
+// Matching include
+#include "reconnect_engine.hpp"
+// ESP includes
+#include "esp_system.h"
+
+constexpr retry_policy reconnect_engine::POLICY;
+constexpr std::size_t reconnect_engine::MAX_IN_FLIGHT;
+
+void reconnect_engine::on_dropped(server_table& servers, std::size_t slot, std::uint32_t now_ms) const
+{
+	servers.failures(slot) = 0;
+	hold(servers, slot, 1, now_ms);
+}
+
+void reconnect_engine::on_connected(server_table& servers, std::size_t slot) const
+{
+	servers.failures(slot) = 0;
+	servers.retry_at_ms(slot) = 0;
+}
+
+bool reconnect_engine::on_failed(server_table& servers, std::size_t slot, std::uint32_t now_ms) const
+{
+	auto& failures = servers.failures(slot);
+	if (failures >= POLICY.retries)
+	{
+		on_connected(servers, slot);
+		return false;
+	}
+
+	++failures;
+	hold(servers, slot, failures + 1, now_ms);
+	return true;
+}
+
+bool reconnect_engine::holding(const server_table& servers, std::size_t slot)
+{
+	return servers.retry_at_ms(slot) != 0;
+}
+
+bool reconnect_engine::ready(const server_table& servers, std::size_t slot, std::uint32_t now_ms)
+{
+	// Differences only, the millisecond clock may wrap
+	return !holding(servers, slot)
+		|| static_cast<std::int32_t>(now_ms - servers.retry_at_ms(slot)) >= 0;
+}
+
+void reconnect_engine::hold(server_table& servers, std::size_t slot, std::uint8_t attempt, std::uint32_t now_ms) const
+{
+	const auto backoff = POLICY.backoff(attempt);
+	const auto delay = backoff / 2 + esp_random() % (backoff / 2 + 1);
+	// 0 means not held
+	servers.retry_at_ms(slot) = (now_ms + delay) | 1;
+}
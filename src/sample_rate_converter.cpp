@@ -0,0 +1,92 @@
+// Matching include
+#include "sample_rate_converter.hpp"
+// C++ includes
+#include <algorithm>
+// ESP includes
+#include "esp_log.h"
+
+namespace
+{
+	constexpr auto TAG = "RATE_CONVERTER";
+}
+
+constexpr std::uint32_t sample_rate_converter::OUTPUT_RATE;
+constexpr std::size_t sample_rate_converter::CHANNELS;
+constexpr std::size_t sample_rate_converter::BYTES_PER_FRAME;
+constexpr std::size_t sample_rate_converter::TAPS;
+constexpr std::size_t sample_rate_converter::MAX_INPUT_FRAMES;
+constexpr std::size_t sample_rate_converter::MAX_INPUT_BYTES;
+constexpr std::size_t sample_rate_converter::MAX_OUTPUT_FRAMES;
+
+sample_rate_converter::sample_rate_converter()
+	: m_pending_rate(OUTPUT_RATE)
+	, m_input_rate(OUTPUT_RATE)
+	, m_from_16k()
+	, m_from_32k()
+	, m_from_44k()
+	, m_output()
+{
+}
+
+std::uint32_t sample_rate_converter::input_rate() const
+{
+	return m_input_rate;
+}
+
+void sample_rate_converter::set_input_rate(std::uint32_t sample_rate)
+{
+	m_pending_rate.store(sample_rate, std::memory_order_relaxed);
+}
+
+std::size_t sample_rate_converter::convert(const std::uint8_t *in, std::size_t len, const std::uint8_t *&out)
+{
+	if (m_pending_rate.load(std::memory_order_relaxed) != m_input_rate)
+		apply_input_rate();
+
+	const auto frames = std::min(len, MAX_INPUT_BYTES) / BYTES_PER_FRAME;
+	std::size_t produced = 0;
+	switch (m_input_rate)
+	{
+	case 16000:
+		produced = m_from_16k.process(in, frames, m_output);
+		break;
+	case 32000:
+		produced = m_from_32k.process(in, frames, m_output);
+		break;
+	case 44100:
+		produced = m_from_44k.process(in, frames, m_output);
+		break;
+	default:
+		out = in;
+		return frames * BYTES_PER_FRAME;
+	}
+
+	out = reinterpret_cast<const std::uint8_t *>(m_output);
+	return produced * BYTES_PER_FRAME;
+}
+
+void sample_rate_converter::apply_input_rate()
+{
+	m_input_rate = m_pending_rate.load(std::memory_order_relaxed);
+
+	// Only the one taking over needs a clean history
+	switch (m_input_rate)
+	{
+	case 16000:
+		m_from_16k.reset();
+		break;
+	case 32000:
+		m_from_32k.reset();
+		break;
+	case 44100:
+		m_from_44k.reset();
+		break;
+	case OUTPUT_RATE:
+		break;
+	default:
+		ESP_LOGW(TAG, "No resampler for %u Hz, passing it through", m_input_rate);
+		return;
+	}
+
+	ESP_LOGI(TAG, "Converting %u Hz to %u Hz", m_input_rate, OUTPUT_RATE);
+}
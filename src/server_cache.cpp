@@ -0,0 +1,116 @@
+// Matching include
+#include "server_cache.hpp"
+// C++ includes
+#include <algorithm>
+// ESP includes
+#include "esp_log.h"
+#include "nvs.h"
+
+namespace
+{
+	constexpr auto TAG = "SERVER_CACHE";
+
+	constexpr auto NAMESPACE = "bt_client";
+	constexpr auto KEY = "servers";
+	// Bump whenever record_t changes
+	constexpr std::uint16_t VERSION = 2;
+
+	struct __attribute__((packed)) record_t
+	{
+		std::uint8_t address[ESP_BD_ADDR_LEN];
+		std::uint8_t address_type;
+		std::uint16_t notify_handle;
+		std::uint16_t cccd_handle;
+		bluetooth_server_info::conn_params_t conn_params;
+	};
+
+	struct __attribute__((packed)) blob_t
+	{
+		std::uint16_t version;
+		std::uint16_t count;
+		record_t records[server_cache::MAX_ENTRIES];
+	};
+}
+
+constexpr std::size_t server_cache::MAX_ENTRIES;
+
+std::vector<bluetooth_server_info> server_cache::load() const
+{
+	std::vector<bluetooth_server_info> servers;
+
+	nvs_handle handle;
+	if (nvs_open(NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+		return servers;
+
+	blob_t blob;
+	auto size = sizeof(blob);
+	const auto err = nvs_get_blob(handle, KEY, &blob, &size);
+	nvs_close(handle);
+
+	if (err != ESP_OK)
+	{
+		if (err != ESP_ERR_NVS_NOT_FOUND)
+			ESP_LOGW(TAG, "Reading cache failed (%d)", err);
+		return servers;
+	}
+
+	if (blob.version != VERSION || blob.count > MAX_ENTRIES
+		|| size != sizeof(blob) - sizeof(record_t) * (MAX_ENTRIES - blob.count))
+	{
+		ESP_LOGW(TAG, "Ignoring cache with version %d", blob.version);
+		return servers;
+	}
+
+	servers.reserve(blob.count);
+	for (std::size_t i = 0; i < blob.count; i++)
+	{
+		auto& r = blob.records[i];
+		servers.emplace_back(
+			r.address,
+			bluetooth_server_info::INVALID_CONN_ID,
+			0,
+			static_cast<esp_ble_addr_type_t>(r.address_type));
+		servers.back().notify_handle() = r.notify_handle;
+		servers.back().cccd_handle() = r.cccd_handle;
+		servers.back().conn_params() = r.conn_params;
+	}
+
+	ESP_LOGI(TAG, "Loaded %d cached servers", static_cast<int>(servers.size()));
+	return servers;
+}
+
+bool server_cache::store(const server_table& servers) const
+{
+	blob_t blob;
+	blob.version = VERSION;
+	blob.count = std::min(servers.size(), MAX_ENTRIES);
+	for (std::size_t i = 0; i < blob.count; i++)
+	{
+		auto& r = blob.records[i];
+		std::copy_n(servers.address(i).raw(), ESP_BD_ADDR_LEN, r.address);
+		r.address_type = servers.address_type(i);
+		r.notify_handle = servers.notify_handle(i);
+		r.cccd_handle = servers.cccd_handle(i);
+		r.conn_params = servers.conn_params(i);
+	}
+
+	nvs_handle handle;
+	auto err = nvs_open(NAMESPACE, NVS_READWRITE, &handle);
+	if (err == ESP_OK)
+	{
+		// Only the used records are written
+		err = nvs_set_blob(handle, KEY, &blob, sizeof(blob) - sizeof(record_t) * (MAX_ENTRIES - blob.count));
+		if (err == ESP_OK)
+			err = nvs_commit(handle);
+		nvs_close(handle);
+	}
+
+	if (err != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Writing cache failed (%d)", err);
+		return false;
+	}
+
+	ESP_LOGI(TAG, "Stored %d servers", blob.count);
+	return true;
+}
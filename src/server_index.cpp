@@ -0,0 +1,90 @@
+// Matching include
+#include "server_index.hpp"
+
+constexpr std::size_t server_index::MAX_CONN_ID;
+constexpr std::size_t server_index::ADDRESS_BUCKETS;
+constexpr std::uint16_t server_index::EMPTY;
+
+server_index::server_index()
+	: m_by_conn_id()
+	, m_by_address()
+	, m_addresses(0)
+{
+	clear();
+}
+
+bool server_index::insert(const bluetooth_address& addr, std::size_t slot)
+{
+	if (slot >= EMPTY)
+		return false;
+
+	const auto key = addr.packed();
+	for (auto i = hash(addr);; i = (i + 1) & (ADDRESS_BUCKETS - 1))
+	{
+		auto& bucket = m_by_address[i];
+		if (bucket.slot == EMPTY)
+		{
+			// A full table still rebinds addresses it already holds
+			if (2 * (m_addresses + 1) > ADDRESS_BUCKETS)
+				return false;
+			bucket.key = key;
+			bucket.slot = slot;
+			++m_addresses;
+			return true;
+		}
+		if (bucket.key == key)
+		{
+			bucket.slot = slot;
+			return true;
+		}
+	}
+}
+
+std::optional<std::size_t> server_index::find(const bluetooth_address& addr) const
+{
+	const auto key = addr.packed();
+	// Load factor <= 1/2 guarantees an empty bucket ends the probe
+	for (auto i = hash(addr);; i = (i + 1) & (ADDRESS_BUCKETS - 1))
+	{
+		const auto& bucket = m_by_address[i];
+		if (bucket.slot == EMPTY)
+			return {};
+		if (bucket.key == key)
+			return bucket.slot;
+	}
+}
+
+void server_index::bind(std::uint16_t conn_id, std::size_t slot)
+{
+	if (conn_id < MAX_CONN_ID)
+		m_by_conn_id[conn_id] = slot;
+}
+
+void server_index::unbind(std::uint16_t conn_id)
+{
+	if (conn_id < MAX_CONN_ID)
+		m_by_conn_id[conn_id] = EMPTY;
+}
+
+std::optional<std::size_t> server_index::find(std::uint16_t conn_id) const
+{
+	if (conn_id >= MAX_CONN_ID || m_by_conn_id[conn_id] == EMPTY)
+		return {};
+	return m_by_conn_id[conn_id];
+}
+
+void server_index::clear()
+{
+	m_by_conn_id.fill(EMPTY);
+	for (auto& bucket : m_by_address)
+		bucket = {0, EMPTY};
+	m_addresses = 0;
+}
+
+std::size_t server_index::hash(const bluetooth_address& addr)
+{
+	// The top bits of the address hash select the bucket
+	constexpr auto bits = 7;
+	static_assert(1u << bits == ADDRESS_BUCKETS, "bits must match ADDRESS_BUCKETS");
+	return std::hash<bluetooth_address>()(addr) >> (8 * sizeof(std::size_t) - bits);
+}
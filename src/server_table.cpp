@@ -0,0 +1,244 @@
+// Matching include
+#include "server_table.hpp"
+// C++ includes
+#include <algorithm>
+// My includes
+#include "reconnect_engine.hpp"
+
+constexpr std::size_t server_table::CAPACITY;
+
+server_table::server_table()
+	: m_size(0)
+	, m_addresses()
+	, m_address_types()
+	, m_conn_ids()
+	, m_activators()
+	, m_ble_connected()
+	, m_notify_handles()
+	, m_cccd_handles()
+	, m_conn_params()
+	, m_live()
+	, m_sampled_ms()
+	, m_active_ms()
+	, m_retry_at_ms()
+	, m_failures()
+{
+	m_conn_ids.fill(bluetooth_server_info::INVALID_CONN_ID);
+}
+
+std::size_t server_table::size() const
+{
+	return m_size.load(std::memory_order_acquire);
+}
+
+bool server_table::empty() const
+{
+	return size() == 0;
+}
+
+bool server_table::full() const
+{
+	return size() == CAPACITY;
+}
+
+bluetooth_address server_table::address(std::size_t slot) const
+{
+	return bluetooth_address(m_addresses[slot]);
+}
+
+const esp_ble_addr_type_t& server_table::address_type(std::size_t slot) const
+{
+	return m_address_types[slot];
+}
+
+esp_ble_addr_type_t& server_table::address_type(std::size_t slot)
+{
+	return m_address_types[slot];
+}
+
+const std::uint16_t& server_table::conn_id(std::size_t slot) const
+{
+	return m_conn_ids[slot];
+}
+
+std::uint16_t& server_table::conn_id(std::size_t slot)
+{
+	return m_conn_ids[slot];
+}
+
+const std::uint8_t& server_table::activator(std::size_t slot) const
+{
+	return m_activators[slot];
+}
+
+std::uint8_t& server_table::activator(std::size_t slot)
+{
+	return m_activators[slot];
+}
+
+const bool& server_table::ble_connected(std::size_t slot) const
+{
+	return m_ble_connected[slot];
+}
+
+bool& server_table::ble_connected(std::size_t slot)
+{
+	return m_ble_connected[slot];
+}
+
+const std::uint16_t& server_table::notify_handle(std::size_t slot) const
+{
+	return m_notify_handles[slot];
+}
+
+std::uint16_t& server_table::notify_handle(std::size_t slot)
+{
+	return m_notify_handles[slot];
+}
+
+const std::uint16_t& server_table::cccd_handle(std::size_t slot) const
+{
+	return m_cccd_handles[slot];
+}
+
+std::uint16_t& server_table::cccd_handle(std::size_t slot)
+{
+	return m_cccd_handles[slot];
+}
+
+bluetooth_server_info::conn_params_t server_table::conn_params(std::size_t slot) const
+{
+	return unpack(m_conn_params[slot].load(std::memory_order_relaxed));
+}
+
+const bool& server_table::live(std::size_t slot) const
+{
+	return m_live[slot];
+}
+
+bool& server_table::live(std::size_t slot)
+{
+	return m_live[slot];
+}
+
+const std::uint32_t& server_table::sampled_ms(std::size_t slot) const
+{
+	return m_sampled_ms[slot];
+}
+
+std::uint32_t& server_table::sampled_ms(std::size_t slot)
+{
+	return m_sampled_ms[slot];
+}
+
+const std::uint32_t& server_table::active_ms(std::size_t slot) const
+{
+	return m_active_ms[slot];
+}
+
+std::uint32_t& server_table::active_ms(std::size_t slot)
+{
+	return m_active_ms[slot];
+}
+
+const std::uint32_t& server_table::retry_at_ms(std::size_t slot) const
+{
+	return m_retry_at_ms[slot];
+}
+
+std::uint32_t& server_table::retry_at_ms(std::size_t slot)
+{
+	return m_retry_at_ms[slot];
+}
+
+const std::uint8_t& server_table::failures(std::size_t slot) const
+{
+	return m_failures[slot];
+}
+
+std::uint8_t& server_table::failures(std::size_t slot)
+{
+	return m_failures[slot];
+}
+
+void server_table::set_conn_params(std::size_t slot, const bluetooth_server_info::conn_params_t& params)
+{
+	m_conn_params[slot].store(pack(params), std::memory_order_relaxed);
+}
+
+std::optional<std::size_t> server_table::add(const bluetooth_server_info& server)
+{
+	// Only the adding task changes the size
+	const auto slot = m_size.load(std::memory_order_relaxed);
+	if (slot == CAPACITY)
+		return {};
+
+	m_addresses[slot] = server.address().packed();
+	m_address_types[slot] = server.address_type();
+	m_conn_ids[slot] = server.conn_id();
+	m_activators[slot] = server.activator();
+	m_ble_connected[slot] = server.ble_connected();
+	m_notify_handles[slot] = server.notify_handle();
+	m_cccd_handles[slot] = server.cccd_handle();
+	set_conn_params(slot, server.conn_params());
+	m_live[slot] = false;
+	m_sampled_ms[slot] = 0;
+	m_active_ms[slot] = 0;
+	m_retry_at_ms[slot] = 0;
+	m_failures[slot] = 0;
+
+	// Published last, a reader that sees the slot sees all of it
+	m_size.store(slot + 1, std::memory_order_release);
+	return slot;
+}
+
+bluetooth_server_info server_table::info(std::size_t slot) const
+{
+	bluetooth_server_info server(
+		address(slot),
+		m_conn_ids[slot],
+		m_activators[slot],
+		m_address_types[slot]);
+	server.ble_connected() = m_ble_connected[slot];
+	server.notify_handle() = m_notify_handles[slot];
+	server.cccd_handle() = m_cccd_handles[slot];
+	server.conn_params() = conn_params(slot);
+	return server;
+}
+
+std::optional<std::size_t> server_table::next_to_connect(std::size_t from, std::uint32_t now_ms) const
+{
+	const auto count = size();
+	for (auto slot = from; slot < count; slot++)
+		if (m_live[slot] && !m_ble_connected[slot] && reconnect_engine::ready(*this, slot, now_ms))
+			return slot;
+	return {};
+}
+
+std::size_t server_table::connected() const
+{
+	return std::count(cbegin(m_ble_connected), cbegin(m_ble_connected) + size(), true);
+}
+
+std::size_t server_table::live_count() const
+{
+	return std::count(cbegin(m_live), cbegin(m_live) + size(), true);
+}
+
+std::uint64_t server_table::pack(const bluetooth_server_info::conn_params_t& params)
+{
+	return std::uint64_t(params.min_int)
+		| std::uint64_t(params.max_int) << 16
+		| std::uint64_t(params.latency) << 32
+		| std::uint64_t(params.timeout) << 48;
+}
+
+bluetooth_server_info::conn_params_t server_table::unpack(std::uint64_t packed)
+{
+	return {
+		static_cast<std::uint16_t>(packed),
+		static_cast<std::uint16_t>(packed >> 16),
+		static_cast<std::uint16_t>(packed >> 32),
+		static_cast<std::uint16_t>(packed >> 48),
+	};
+}
@@ -1,12 +1,12 @@
 // C++ includes
 #include <algorithm>
+#include <iterator>
+#include <type_traits>
 #include <chrono>
-#include <mutex>
 #include <experimental/optional>
-#include <queue>
-#include <vector>
 #include <thread>
 // C includes
+#include <cstdio>
 #include <cstring>
 // Bluetooth includes
 #include "esp_bt.h"
@@ -19,9 +19,11 @@
 #include "esp_a2dp_api.h"
 // Logging includes
 #include "esp_log.h"
+#include "esp_timer.h"
 // My includes
 #include "state_machine.hpp"
 #include "bluetooth_client.hpp"
+#include "trace_buffer.hpp"
 
 namespace std
 {
@@ -33,23 +35,498 @@ using namespace std::literals;
 namespace
 {
 	constexpr auto TAG = "STATE_MACHINE";
+
+	constexpr auto STATE_COUNT = static_cast<std::size_t>(state_machine::state_t::COUNT);
+	constexpr auto MSG_COUNT = static_cast<std::size_t>(state_machine::msg_t::COUNT);
+
+	constexpr const char *STATE_NAMES[] =
+	{
+		"IDLE",
+		"BLE",
+		"A2DP",
+		"IDLE_TO_BLE_0",
+		"IDLE_TO_BLE_1",
+		"IDLE_TO_BLE_2",
+		"BLE_TO_A2DP_1",
+		"A2DP_TO_BLE_1",
+		"A2DP_TO_BLE_2",
+		"A2DP_TO_A2DP_1",
+		"A2DP_TO_A2DP_2",
+		"A2DP_TO_A2DP_3",
+	};
+	static_assert(std::extent<decltype(STATE_NAMES)>::value == STATE_COUNT, "STATE_NAMES out of sync with state_t");
+
+	constexpr const char *MSG_NAMES[] =
+	{
+		"IDLE_TO_BLE_START",
+		"BLE_TO_A2DP_START",
+		"A2DP_TO_BLE_START",
+		"A2DP_TO_A2DP_START",
+		"SCAN_FINISHED",
+		"BLE_OPENED",
+		"BLE_OPEN_FAILED",
+		"MTU_CONFIGURED",
+		"SERVICES_DISCOVERED",
+		"NOTIFICATIONS_ENABLED",
+		"BLE_CONNECTED",
+		"BLE_DISCONNECTED",
+		"A2DP_CONNECTED",
+		"A2DP_MEDIA_STOPPED",
+		"A2DP_MEDIA_STARTED",
+		"A2DP_DISCONNECTING",
+		"A2DP_DISCONNECTED",
+		"PEER_PREPARED",
+		"PEER_UNSUITABLE",
+		"ACTIVATOR_SAMPLED",
+		"TIMEOUT",
+		"COMPLETION",
+	};
+	static_assert(std::extent<decltype(MSG_NAMES)>::value == MSG_COUNT, "MSG_NAMES out of sync with msg_t");
+
+	constexpr std::size_t index(state_machine::state_t state)
+	{
+		return static_cast<std::size_t>(state);
+	}
+
+	constexpr std::size_t index(state_machine::msg_t msg)
+	{
+		return static_cast<std::size_t>(msg);
+	}
+
+	constexpr bool is_stable(state_machine::state_t state)
+	{
+		return state == state_machine::state_t::IDLE
+			|| state == state_machine::state_t::BLE
+			|| state == state_machine::state_t::A2DP;
+	}
+
+	// Index of the first row for every (state, msg) pair
+	constexpr std::uint8_t NO_TRANSITION = 0xff;
+
+	struct dispatch_t
+	{
+		std::uint8_t first[STATE_COUNT][MSG_COUNT];
+	};
+
+	template<std::size_t N>
+	constexpr dispatch_t make_dispatch(const state_machine::transition_t (&table)[N])
+	{
+		static_assert(N < NO_TRANSITION, "Transition table too large for the dispatch table");
+
+		dispatch_t dispatch{};
+		for (std::size_t s = 0; s < STATE_COUNT; s++)
+			for (std::size_t m = 0; m < MSG_COUNT; m++)
+				dispatch.first[s][m] = NO_TRANSITION;
+
+		// Backwards, so the first row of a pair is the one left behind
+		for (std::size_t i = N; i-- > 0;)
+			dispatch.first[index(table[i].state)][index(table[i].msg)] = static_cast<std::uint8_t>(i);
+
+		return dispatch;
+	}
+
+	/* Compile time checks of the transition table */
+	template<std::size_t N>
+	constexpr bool in_range(const state_machine::transition_t (&table)[N])
+	{
+		for (std::size_t i = 0; i < N; i++)
+			if (index(table[i].state) >= STATE_COUNT
+				|| index(table[i].next) >= STATE_COUNT
+				|| index(table[i].msg) >= MSG_COUNT)
+				return false;
+		return true;
+	}
+
+	// select() stops at the first row of another pair
+	template<std::size_t N>
+	constexpr bool pairs_adjacent(const state_machine::transition_t (&table)[N])
+	{
+		for (std::size_t i = 0; i < N; i++)
+			for (std::size_t j = i + 2; j < N; j++)
+				if (table[j].state == table[i].state
+					&& table[j].msg == table[i].msg
+					&& (table[j - 1].state != table[i].state || table[j - 1].msg != table[i].msg))
+					return false;
+		return true;
+	}
+
+	template<std::size_t N>
+	constexpr bool all_reachable(const state_machine::transition_t (&table)[N])
+	{
+		bool reached[STATE_COUNT] = {};
+		reached[index(state_machine::state_t::IDLE)] = true;
+
+		// Relax until nothing changes, at most once per state
+		for (std::size_t round = 0; round < STATE_COUNT; round++)
+		{
+			for (std::size_t i = 0; i < N; i++)
+				if (reached[index(table[i].state)])
+					reached[index(table[i].next)] = true;
+		}
+
+		for (std::size_t s = 0; s < STATE_COUNT; s++)
+			if (!reached[s])
+				return false;
+		return true;
+	}
+
+	// Every step of a switch has to lead somewhere else
+	template<std::size_t N>
+	constexpr bool no_dead_ends(const state_machine::transition_t (&table)[N])
+	{
+		for (std::size_t s = 0; s < STATE_COUNT; s++)
+		{
+			if (is_stable(static_cast<state_machine::state_t>(s)))
+				continue;
+
+			bool leaves = false;
+			for (std::size_t i = 0; i < N; i++)
+				if (index(table[i].state) == s && table[i].next != table[i].state)
+					leaves = true;
+			if (!leaves)
+				return false;
+		}
+		return true;
+	}
+
+	// Every message someone can send is expected in at least one state
+	template<std::size_t N>
+	constexpr bool all_handled(const state_machine::transition_t (&table)[N])
+	{
+		for (std::size_t m = 0; m < MSG_COUNT; m++)
+		{
+			if (m == index(state_machine::msg_t::COMPLETION)
+				|| m == index(state_machine::msg_t::ACTIVATOR_SAMPLED))
+				continue;
+
+			bool handled = false;
+			for (std::size_t i = 0; i < N; i++)
+				if (index(table[i].msg) == m)
+					handled = true;
+			if (!handled)
+				return false;
+		}
+		return true;
+	}
+
+	// A step with a deadline has to say what happens when it runs out,
+	// unguarded or guarded by the timer the deadline is armed on
+	template<std::size_t N, std::size_t D>
+	constexpr bool deadlines_handled(
+		const state_machine::transition_t (&table)[N],
+		const state_machine::deadline_t (&deadlines)[D],
+		state_machine::guard_t deadline_guard)
+	{
+		for (std::size_t d = 0; d < D; d++)
+		{
+			bool gives_up = false;
+			for (std::size_t i = 0; i < N; i++)
+				if (table[i].state == deadlines[d].state
+					&& table[i].msg == state_machine::msg_t::TIMEOUT
+					&& (table[i].guard == nullptr || table[i].guard == deadline_guard)
+					&& table[i].next != table[i].state)
+					gives_up = true;
+			if (!gives_up || deadlines[d].request == nullptr)
+				return false;
+		}
+		return true;
+	}
+
+	// Completion transitions may not chain, so handler() takes at most one
+	template<std::size_t N>
+	constexpr bool completions_terminate(const state_machine::transition_t (&table)[N])
+	{
+		for (std::size_t i = 0; i < N; i++)
+		{
+			if (table[i].msg != state_machine::msg_t::COMPLETION)
+				continue;
+			if (table[i].next == table[i].state)
+				return false;
+			for (std::size_t j = 0; j < N; j++)
+				if (table[j].state == table[i].next && table[j].msg == state_machine::msg_t::COMPLETION)
+					return false;
+		}
+		return true;
+	}
 }
 
-bool state_machine::is_priority_over(const priority_msg_t& l, const priority_msg_t& r)
+struct state_machine::transitions
 {
-	return l.priority < r.priority;
+	using s = state_t;
+	using m = msg_t;
+	using sm = state_machine;
+
+	static constexpr transition_t TABLE[] =
+	{
+		/* IDLE TO BLE ALGORITHM */
+		// Takes over what idle_to_ble() was given, then starts over in IDLE_TO_BLE_0
+		{ s::IDLE,          m::IDLE_TO_BLE_START,     nullptr,               &sm::take_idle_to_ble,               s::IDLE_TO_BLE_0, "idle_to_ble()" },
+		{ s::IDLE_TO_BLE_0, m::IDLE_TO_BLE_START,     &sm::no_servers,       &sm::start_scan,                     s::IDLE_TO_BLE_1, "no servers" },
+		{ s::IDLE_TO_BLE_0, m::IDLE_TO_BLE_START,     nullptr,               &sm::start_scan_and_pipeline,        s::IDLE_TO_BLE_2, "cached servers" },
+		{ s::IDLE_TO_BLE_1, m::SCAN_FINISHED,         &sm::no_servers,       &sm::restart_idle_to_ble,            s::IDLE_TO_BLE_0, "no servers" },
+		{ s::IDLE_TO_BLE_1, m::SCAN_FINISHED,         nullptr,               &sm::start_pipeline,                 s::IDLE_TO_BLE_2, "" },
+		{ s::IDLE_TO_BLE_1, m::TIMEOUT,               nullptr,               &sm::scan_timed_out,                 s::IDLE_TO_BLE_1, "scan lost" },
+		{ s::IDLE_TO_BLE_2, m::BLE_OPENED,            nullptr,               &sm::pipeline_opened,                s::IDLE_TO_BLE_2, "" },
+		{ s::IDLE_TO_BLE_2, m::BLE_OPEN_FAILED,       nullptr,               &sm::pipeline_open_failed,           s::IDLE_TO_BLE_2, "" },
+		{ s::IDLE_TO_BLE_2, m::MTU_CONFIGURED,        nullptr,               &sm::pipeline_mtu_configured,        s::IDLE_TO_BLE_2, "" },
+		{ s::IDLE_TO_BLE_2, m::SERVICES_DISCOVERED,   nullptr,               &sm::pipeline_discovered,            s::IDLE_TO_BLE_2, "" },
+		{ s::IDLE_TO_BLE_2, m::BLE_CONNECTED,         nullptr,               &sm::pipeline_subscribed,            s::IDLE_TO_BLE_2, "" },
+		{ s::IDLE_TO_BLE_2, m::NOTIFICATIONS_ENABLED, nullptr,               &sm::pipeline_notifications_enabled, s::IDLE_TO_BLE_2, "" },
+		{ s::IDLE_TO_BLE_2, m::SCAN_FINISHED,         nullptr,               &sm::pipeline_scan_finished,         s::IDLE_TO_BLE_2, "" },
+		{ s::IDLE_TO_BLE_2, m::TIMEOUT,               &sm::scan_timer,       &sm::scan_timed_out,                 s::IDLE_TO_BLE_2, "scan lost" },
+		{ s::IDLE_TO_BLE_2, m::TIMEOUT,               nullptr,               &sm::pipeline_timeout,               s::IDLE_TO_BLE_2, "" },
+		// A server dropping out halfway through its setup is given up on
+		// right away, not at the deadline of its step
+		{ s::IDLE_TO_BLE_2, m::BLE_DISCONNECTED,      nullptr,               &sm::server_dropped,                 s::IDLE_TO_BLE_2, "" },
+		{ s::IDLE_TO_BLE_2, m::COMPLETION,            &sm::idle_to_ble_done, &sm::finish_idle_to_ble,             s::BLE,           "scan and pipeline done" },
+
+		/* BLE TO A2DP ALGORITHM */
+		{ s::BLE,           m::BLE_TO_A2DP_START,     nullptr,               &sm::start_ble_to_a2dp,              s::BLE_TO_A2DP_1, "" },
+		{ s::BLE_TO_A2DP_1, m::A2DP_CONNECTED,        nullptr,               &sm::finish_ble_to_a2dp,             s::A2DP,          "" },
+		{ s::BLE_TO_A2DP_1, m::A2DP_DISCONNECTING,    nullptr,               nullptr,                             s::BLE_TO_A2DP_1, "" },
+		{ s::BLE_TO_A2DP_1, m::A2DP_DISCONNECTED,     nullptr,               &sm::fail_ble_to_a2dp,               s::BLE,           "" },
+		{ s::BLE_TO_A2DP_1, m::TIMEOUT,               &sm::backing_off,      &sm::retry_request,                  s::BLE_TO_A2DP_1, "retry" },
+		{ s::BLE_TO_A2DP_1, m::TIMEOUT,               &sm::retries_left,     &sm::back_off,                       s::BLE_TO_A2DP_1, "back off" },
+		{ s::BLE_TO_A2DP_1, m::TIMEOUT,               &sm::state_timer,      &sm::give_up_ble_to_a2dp,            s::BLE,           "give up" },
+		// Only the state timer drives a switch step, a scan or pipeline
+		// timer left over from before the switch is dropped
+		{ s::BLE_TO_A2DP_1, m::TIMEOUT,               nullptr,               nullptr,                             s::BLE_TO_A2DP_1, "" },
+
+		/* A2DP TO BLE ALGORITHM */
+		{ s::A2DP,          m::A2DP_TO_BLE_START,     nullptr,               &sm::stop_media,                     s::A2DP_TO_BLE_1, "" },
+		{ s::A2DP_TO_BLE_1, m::A2DP_MEDIA_STOPPED,    nullptr,               &sm::disconnect_a2dp,                s::A2DP_TO_BLE_2, "" },
+		// The source went away before the stream stopped, nothing left to do
+		{ s::A2DP_TO_BLE_1, m::A2DP_DISCONNECTING,    nullptr,               nullptr,                             s::A2DP_TO_BLE_1, "" },
+		{ s::A2DP_TO_BLE_1, m::A2DP_DISCONNECTED,     nullptr,               &sm::finish_a2dp_to_ble,             s::BLE,           "source lost" },
+		{ s::A2DP_TO_BLE_1, m::TIMEOUT,               &sm::backing_off,      &sm::retry_request,                  s::A2DP_TO_BLE_1, "retry" },
+		{ s::A2DP_TO_BLE_1, m::TIMEOUT,               &sm::retries_left,     &sm::back_off,                       s::A2DP_TO_BLE_1, "back off" },
+		// Disconnecting stops the stream as well
+		{ s::A2DP_TO_BLE_1, m::TIMEOUT,               &sm::state_timer,      &sm::disconnect_a2dp,                s::A2DP_TO_BLE_2, "give up" },
+		{ s::A2DP_TO_BLE_1, m::TIMEOUT,               nullptr,               nullptr,                             s::A2DP_TO_BLE_1, "" },
+		{ s::A2DP_TO_BLE_2, m::A2DP_DISCONNECTING,    nullptr,               nullptr,                             s::A2DP_TO_BLE_2, "" },
+		{ s::A2DP_TO_BLE_2, m::A2DP_DISCONNECTED,     nullptr,               &sm::finish_a2dp_to_ble,             s::BLE,           "" },
+		{ s::A2DP_TO_BLE_2, m::TIMEOUT,               &sm::backing_off,      &sm::retry_request,                  s::A2DP_TO_BLE_2, "retry" },
+		{ s::A2DP_TO_BLE_2, m::TIMEOUT,               &sm::retries_left,     &sm::back_off,                       s::A2DP_TO_BLE_2, "back off" },
+		{ s::A2DP_TO_BLE_2, m::TIMEOUT,               &sm::state_timer,      &sm::give_up_a2dp_to_ble,            s::BLE,           "give up" },
+		{ s::A2DP_TO_BLE_2, m::TIMEOUT,               nullptr,               nullptr,                             s::A2DP_TO_BLE_2, "" },
+
+		/* A2DP TO A2DP ALGORITHM (HANDOVER) */
+		// Nothing is torn down until the next peer answered paging and SDP
+		{ s::A2DP,           m::A2DP_TO_A2DP_START,    nullptr,               &sm::prepare_handover,               s::A2DP_TO_A2DP_1, "" },
+		// Answers about a peer of an earlier handover are dropped
+		{ s::A2DP_TO_A2DP_1, m::PEER_PREPARED,         &sm::handover_peer,    &sm::break_a2dp,                     s::A2DP_TO_A2DP_2, "peer ready" },
+		{ s::A2DP_TO_A2DP_1, m::PEER_PREPARED,         nullptr,               nullptr,                             s::A2DP_TO_A2DP_1, "" },
+		{ s::A2DP_TO_A2DP_1, m::PEER_UNSUITABLE,       &sm::handover_peer,    &sm::abort_handover,                 s::A2DP,           "no A2DP source" },
+		{ s::A2DP_TO_A2DP_1, m::PEER_UNSUITABLE,       nullptr,               nullptr,                             s::A2DP_TO_A2DP_1, "" },
+		{ s::A2DP_TO_A2DP_1, m::A2DP_MEDIA_STOPPED,    nullptr,               nullptr,                             s::A2DP_TO_A2DP_1, "" },
+		{ s::A2DP_TO_A2DP_1, m::A2DP_MEDIA_STARTED,    nullptr,               nullptr,                             s::A2DP_TO_A2DP_1, "" },
+		{ s::A2DP_TO_A2DP_1, m::A2DP_DISCONNECTING,    nullptr,               nullptr,                             s::A2DP_TO_A2DP_1, "" },
+		// The current peer went away by itself, go straight to the next one
+		{ s::A2DP_TO_A2DP_1, m::A2DP_DISCONNECTED,     nullptr,               &sm::make_a2dp,                      s::A2DP_TO_A2DP_3, "current peer lost" },
+		{ s::A2DP_TO_A2DP_1, m::TIMEOUT,               &sm::backing_off,      &sm::retry_request,                  s::A2DP_TO_A2DP_1, "retry" },
+		{ s::A2DP_TO_A2DP_1, m::TIMEOUT,               &sm::retries_left,     &sm::back_off,                       s::A2DP_TO_A2DP_1, "back off" },
+		{ s::A2DP_TO_A2DP_1, m::TIMEOUT,               &sm::state_timer,      &sm::abort_handover,                 s::A2DP,           "give up" },
+		{ s::A2DP_TO_A2DP_1, m::TIMEOUT,               nullptr,               nullptr,                             s::A2DP_TO_A2DP_1, "" },
+		// Disconnecting stops the stream, no separate media stop
+		{ s::A2DP_TO_A2DP_2, m::A2DP_MEDIA_STOPPED,    nullptr,               nullptr,                             s::A2DP_TO_A2DP_2, "" },
+		{ s::A2DP_TO_A2DP_2, m::A2DP_DISCONNECTING,    nullptr,               nullptr,                             s::A2DP_TO_A2DP_2, "" },
+		{ s::A2DP_TO_A2DP_2, m::A2DP_DISCONNECTED,     nullptr,               &sm::make_a2dp,                      s::A2DP_TO_A2DP_3, "" },
+		{ s::A2DP_TO_A2DP_2, m::TIMEOUT,               &sm::backing_off,      &sm::retry_request,                  s::A2DP_TO_A2DP_2, "retry" },
+		{ s::A2DP_TO_A2DP_2, m::TIMEOUT,               &sm::retries_left,     &sm::back_off,                       s::A2DP_TO_A2DP_2, "back off" },
+		{ s::A2DP_TO_A2DP_2, m::TIMEOUT,               &sm::state_timer,      &sm::give_up_a2dp_to_ble,            s::BLE,            "give up" },
+		{ s::A2DP_TO_A2DP_2, m::TIMEOUT,               nullptr,               nullptr,                             s::A2DP_TO_A2DP_2, "" },
+		{ s::A2DP_TO_A2DP_3, m::A2DP_CONNECTED,        nullptr,               &sm::finish_handover,                s::A2DP,           "" },
+		{ s::A2DP_TO_A2DP_3, m::A2DP_DISCONNECTING,    nullptr,               nullptr,                             s::A2DP_TO_A2DP_3, "" },
+		// Both peers are gone by now, BLE is the safe place to land
+		{ s::A2DP_TO_A2DP_3, m::A2DP_DISCONNECTED,     nullptr,               &sm::fail_handover,                  s::BLE,            "" },
+		{ s::A2DP_TO_A2DP_3, m::TIMEOUT,               &sm::backing_off,      &sm::retry_request,                  s::A2DP_TO_A2DP_3, "retry" },
+		{ s::A2DP_TO_A2DP_3, m::TIMEOUT,               &sm::retries_left,     &sm::back_off,                       s::A2DP_TO_A2DP_3, "back off" },
+		{ s::A2DP_TO_A2DP_3, m::TIMEOUT,               &sm::state_timer,      &sm::give_up_ble_to_a2dp,            s::BLE,            "give up" },
+		{ s::A2DP_TO_A2DP_3, m::TIMEOUT,               nullptr,               nullptr,                             s::A2DP_TO_A2DP_3, "" },
+
+		/* Stable states */
+		// More servers than links: the set of linked servers rotates, the
+		// pipeline sets the new ones up
+		{ s::BLE,           m::TIMEOUT,               &sm::link_timer,       &sm::rotate_links,                   s::BLE,           "rotate" },
+		{ s::BLE,           m::TIMEOUT,               nullptr,               &sm::pipeline_timeout,               s::BLE,           "" },
+		{ s::BLE,           m::BLE_OPENED,            nullptr,               &sm::pipeline_opened,                s::BLE,           "" },
+		{ s::BLE,           m::BLE_OPEN_FAILED,       nullptr,               &sm::pipeline_open_failed,           s::BLE,           "" },
+		{ s::BLE,           m::MTU_CONFIGURED,        nullptr,               &sm::pipeline_mtu_configured,        s::BLE,           "" },
+		{ s::BLE,           m::SERVICES_DISCOVERED,   nullptr,               &sm::pipeline_discovered,            s::BLE,           "" },
+		{ s::BLE,           m::BLE_CONNECTED,         nullptr,               &sm::pipeline_subscribed,            s::BLE,           "" },
+		{ s::BLE,           m::NOTIFICATIONS_ENABLED, nullptr,               &sm::pipeline_notifications_enabled, s::BLE,           "" },
+		// Rotated out, or dropped; a dropped server is reconnected after a backoff
+		{ s::BLE,           m::BLE_DISCONNECTED,      nullptr,               &sm::server_dropped,                 s::BLE,           "" },
+		// No rotation while streaming, only dropped servers are set up again
+		{ s::A2DP,          m::TIMEOUT,               &sm::link_timer,       &sm::reconnect_links,                s::A2DP,          "reconnect" },
+		{ s::A2DP,          m::TIMEOUT,               nullptr,               &sm::pipeline_timeout,               s::A2DP,          "" },
+		{ s::A2DP,          m::BLE_OPENED,            nullptr,               &sm::pipeline_opened,                s::A2DP,          "" },
+		{ s::A2DP,          m::BLE_OPEN_FAILED,       nullptr,               &sm::pipeline_open_failed,           s::A2DP,          "" },
+		{ s::A2DP,          m::MTU_CONFIGURED,        nullptr,               &sm::pipeline_mtu_configured,        s::A2DP,          "" },
+		{ s::A2DP,          m::SERVICES_DISCOVERED,   nullptr,               &sm::pipeline_discovered,            s::A2DP,          "" },
+		{ s::A2DP,          m::BLE_CONNECTED,         nullptr,               &sm::pipeline_subscribed,            s::A2DP,          "" },
+		{ s::A2DP,          m::NOTIFICATIONS_ENABLED, nullptr,               &sm::pipeline_notifications_enabled, s::A2DP,          "" },
+		{ s::A2DP,          m::BLE_DISCONNECTED,      nullptr,               &sm::server_dropped,                 s::A2DP,          "" },
+		// Late answers to a switch that was given up on
+		{ s::BLE,           m::A2DP_DISCONNECTING,    nullptr,               nullptr,                             s::BLE,           "" },
+		{ s::BLE,           m::A2DP_DISCONNECTED,     nullptr,               nullptr,                             s::BLE,           "" },
+		{ s::A2DP,          m::PEER_PREPARED,         nullptr,               nullptr,                             s::A2DP,          "" },
+		{ s::A2DP,          m::PEER_UNSUITABLE,       nullptr,               nullptr,                             s::A2DP,          "" },
+		// The source went away by itself, back to BLE only
+		{ s::A2DP,          m::A2DP_DISCONNECTING,    nullptr,               nullptr,                             s::A2DP,          "" },
+		{ s::A2DP,          m::A2DP_DISCONNECTED,     nullptr,               &sm::a2dp_lost,                      s::BLE,           "source lost" },
+		// The source pausing or resuming playback
+		{ s::A2DP,          m::A2DP_MEDIA_STOPPED,    nullptr,               nullptr,                             s::A2DP,          "" },
+		{ s::A2DP,          m::A2DP_MEDIA_STARTED,    nullptr,               nullptr,                             s::A2DP,          "" },
+
+		/* Switch steps */
+		// The pipeline stopped on the way in: a link it opened meanwhile is
+		// closed, a link that drops is forgotten and reconnected later on
+		{ s::BLE_TO_A2DP_1,  m::BLE_OPENED,            nullptr,               &sm::pipeline_opened,                s::BLE_TO_A2DP_1,  "" },
+		{ s::BLE_TO_A2DP_1,  m::BLE_DISCONNECTED,      nullptr,               &sm::server_dropped,                 s::BLE_TO_A2DP_1,  "" },
+		{ s::A2DP_TO_BLE_1,  m::BLE_OPENED,            nullptr,               &sm::pipeline_opened,                s::A2DP_TO_BLE_1,  "" },
+		{ s::A2DP_TO_BLE_1,  m::BLE_DISCONNECTED,      nullptr,               &sm::server_dropped,                 s::A2DP_TO_BLE_1,  "" },
+		{ s::A2DP_TO_BLE_2,  m::BLE_OPENED,            nullptr,               &sm::pipeline_opened,                s::A2DP_TO_BLE_2,  "" },
+		{ s::A2DP_TO_BLE_2,  m::BLE_DISCONNECTED,      nullptr,               &sm::server_dropped,                 s::A2DP_TO_BLE_2,  "" },
+		{ s::A2DP_TO_A2DP_1, m::BLE_OPENED,            nullptr,               &sm::pipeline_opened,                s::A2DP_TO_A2DP_1, "" },
+		{ s::A2DP_TO_A2DP_1, m::BLE_DISCONNECTED,      nullptr,               &sm::server_dropped,                 s::A2DP_TO_A2DP_1, "" },
+		{ s::A2DP_TO_A2DP_2, m::BLE_OPENED,            nullptr,               &sm::pipeline_opened,                s::A2DP_TO_A2DP_2, "" },
+		{ s::A2DP_TO_A2DP_2, m::BLE_DISCONNECTED,      nullptr,               &sm::server_dropped,                 s::A2DP_TO_A2DP_2, "" },
+		{ s::A2DP_TO_A2DP_3, m::BLE_OPENED,            nullptr,               &sm::pipeline_opened,                s::A2DP_TO_A2DP_3, "" },
+		{ s::A2DP_TO_A2DP_3, m::BLE_DISCONNECTED,      nullptr,               &sm::server_dropped,                 s::A2DP_TO_A2DP_3, "" },
+	};
+
+	static constexpr deadline_t DEADLINES[] =
+	{
+		//                     deadline retries backoff cap
+		{ s::BLE_TO_A2DP_1, { 10000,   2,      1000,   4000 }, &sm::connect_a2dp },
+		{ s::A2DP_TO_BLE_1, {  3000,   1,       500,    500 }, &sm::stop_media },
+		{ s::A2DP_TO_BLE_2, {  5000,   1,       500,    500 }, &sm::disconnect_a2dp },
+		// Paging plus SDP of a peer that may be out of range
+		{ s::A2DP_TO_A2DP_1, {  8000,   1,      1000,   1000 }, &sm::prepare_handover },
+		{ s::A2DP_TO_A2DP_2, {  5000,   1,       500,    500 }, &sm::disconnect_a2dp },
+		{ s::A2DP_TO_A2DP_3, { 10000,   2,      1000,   4000 }, &sm::connect_a2dp },
+	};
+
+	static constexpr dispatch_t DISPATCH = make_dispatch(TABLE);
+
+	static_assert(in_range(TABLE), "Transition table uses an out of range state or message");
+	static_assert(pairs_adjacent(TABLE), "Rows of the same (state, msg) pair must be adjacent");
+	static_assert(all_reachable(TABLE), "Unreachable state");
+	static_assert(no_dead_ends(TABLE), "Switch step without a way out");
+	static_assert(all_handled(TABLE), "Message not expected in any state");
+	static_assert(completions_terminate(TABLE), "Completion transitions must not chain");
+	static_assert(deadlines_handled(TABLE, DEADLINES, &sm::state_timer), "Deadline without a way to give up");
+};
+
+constexpr state_machine::transition_t state_machine::transitions::TABLE[];
+constexpr state_machine::deadline_t state_machine::transitions::DEADLINES[];
+constexpr dispatch_t state_machine::transitions::DISPATCH;
+
+constexpr std::size_t state_machine::MAILBOX_CAPACITY;
+constexpr std::size_t state_machine::STATE_TIMER;
+constexpr std::size_t state_machine::SCAN_TIMER;
+constexpr std::size_t state_machine::LINK_TIMER;
+constexpr std::size_t state_machine::PIPELINE_TIMERS;
+constexpr std::size_t state_machine::TIMER_COUNT;
+constexpr std::uint32_t state_machine::TIMER_TICK_MS;
+constexpr std::uint32_t state_machine::NO_SLOT;
+constexpr state_machine::scan_profile_t state_machine::DISCOVERY_SCAN;
+constexpr state_machine::scan_profile_t state_machine::BACKGROUND_SCAN;
+constexpr std::uint8_t state_machine::SCAN_SECONDS;
+constexpr std::uint32_t state_machine::SCAN_DEADLINE_MS;
+
+state_machine::lane_t state_machine::lane_of(msg_t msg)
+{
+	switch (msg)
+	{
+	// Losing a link invalidates whatever progress is still queued
+	case msg_t::BLE_DISCONNECTED:
+	case msg_t::A2DP_DISCONNECTING:
+	case msg_t::A2DP_DISCONNECTED:
+		return lane_t::FAILURE;
+
+	case msg_t::IDLE_TO_BLE_START:
+	case msg_t::BLE_TO_A2DP_START:
+	case msg_t::A2DP_TO_BLE_START:
+	case msg_t::A2DP_TO_A2DP_START:
+		return lane_t::CONTROL;
+
+	case msg_t::ACTIVATOR_SAMPLED:
+		return lane_t::SAMPLE;
+
+	default:
+		return lane_t::PROGRESS;
+	}
 }
 
 state_machine::state_machine()
-	: m_messages(is_priority_over)
+	: m_messages()
+	, m_idle_to_ble()
+	, m_servers(nullptr)
+	, m_cache(nullptr)
+	, m_scan_finished(false)
+	, m_background_scan(BACKGROUND_SCAN)
 	, m_state(state_t::IDLE)
+	, m_published_state(state_t::IDLE)
+	, m_switch_requested(false)
 	, m_saved_state(state_t::IDLE)
+	, m_a2dp_address()
+	, m_published_address(0)
+	, m_timers(TIMER_COUNT, TIMER_TICK_MS, now_ms())
+	, m_attempts(0)
+	, m_backing_off(false)
+	, m_refused(false)
+	, m_reconnects()
+	, m_pipeline(&m_timers, PIPELINE_TIMERS, &m_reconnects)
+	, m_scheduler()
+{
+}
+
+const char *state_machine::state_name(state_t state)
 {
+	return index(state) < STATE_COUNT ? STATE_NAMES[index(state)] : "?";
+}
+
+const char *state_machine::msg_name(msg_t msg)
+{
+	return index(msg) < MSG_COUNT ? MSG_NAMES[index(msg)] : "?";
+}
+
+void state_machine::write_graph(std::FILE *out)
+{
+	std::fprintf(out, "digraph state_machine {\n");
+	std::fprintf(out, "\trankdir=LR;\n");
+	std::fprintf(out, "\tnode [shape=box];\n");
+
+	for (std::size_t s = 0; s < STATE_COUNT; s++)
+	{
+		if (is_stable(static_cast<state_t>(s)))
+			std::fprintf(out, "\t%s [style=bold];\n", STATE_NAMES[s]);
+	}
+
+	for (const auto& transition : transitions::TABLE)
+	{
+		// Expected but ignored messages are dotted self loops
+		std::fprintf(out, "\t%s -> %s [label=\"%s%s%s%s\"%s];\n",
+			state_name(transition.state),
+			state_name(transition.next),
+			msg_name(transition.msg),
+			transition.label[0] != '\0' ? " [" : "",
+			transition.label,
+			transition.label[0] != '\0' ? "]" : "",
+			transition.action == nullptr ? ", style=dotted" : "");
+	}
+
+	std::fprintf(out, "}\n");
 }
 
-const std::optional<bluetooth_address>& state_machine::a2dp_address() const
+std::optional<bluetooth_address> state_machine::a2dp_address() const
 {
-	return m_a2dp_address;
+	const auto packed = m_published_address.load(std::memory_order_acquire);
+	if (packed == 0)
+		return {};
+	return bluetooth_address(packed);
 }
 
 void state_machine::start()
@@ -57,291 +534,737 @@ void state_machine::start()
 	std::thread([this]() { handler(); }).detach();
 }
 
-void state_machine::idle_to_ble(std::uint16_t iface, std::vector<bluetooth_server_info> *servers)
+void state_machine::set_background_scan(scan_profile_t profile)
 {
-	ESP_LOGI(TAG, "idle->ble");
+	m_background_scan = profile;
+}
 
-	if (m_state != state_t::IDLE)
+bool state_machine::idle_to_ble(
+	std::uint16_t iface,
+	server_table *servers,
+	const server_cache *cache)
+{
+	if (!request_switch(state_t::IDLE))
 	{
 		ESP_LOGW(TAG, "Cannot start idle->ble switch when already switching modes");
-		return;
+		return false;
 	}
 
-	m_servers = servers;
-	m_interface = iface;
-	m_state = state_t::IDLE_TO_BLE_0;
-	notify_idle_to_ble_start();
+	ESP_LOGI(TAG, "idle->ble");
+	// The mailbox orders these writes before the handler's reads
+	m_idle_to_ble = {iface, servers, cache};
+	if (notify_idle_to_ble_start())
+		return true;
+	m_switch_requested.store(false, std::memory_order_release);
+	return false;
 }
 
-void state_machine::ble_to_a2dp(bluetooth_address addr)
+bool state_machine::ble_to_a2dp(std::size_t slot)
 {
-	ESP_LOGI(TAG, "ble->a2dp");
-
-	if (m_state != state_t::BLE)
+	if (!request_switch(state_t::BLE))
 	{
 		ESP_LOGW(TAG, "Cannot start ble->a2dp switch when already switching modes");
-		return;
+		return false;
 	}
 
-	m_a2dp_address = addr;
-
-	m_state = state_t::BLE_TO_A2DP_0;
-	notify_ble_to_a2dp_start();
+	ESP_LOGI(TAG, "ble->a2dp");
+	if (notify_ble_to_a2dp_start(slot))
+		return true;
+	m_switch_requested.store(false, std::memory_order_release);
+	return false;
 }
 
-void state_machine::a2dp_to_ble()
+bool state_machine::a2dp_to_ble()
 {
-	ESP_LOGI(TAG, "a2dp->ble");
-
-	if (m_state != state_t::A2DP)
+	if (!request_switch(state_t::A2DP))
 	{
 		ESP_LOGW(TAG, "Cannot start a2dp->ble switch when already switching modes");
-		return;
+		return false;
 	}
 
-	m_state = state_t::A2DP_TO_BLE_0;
-	notify_a2dp_to_ble_start();
+	ESP_LOGI(TAG, "a2dp->ble");
+	if (notify_a2dp_to_ble_start())
+		return true;
+	m_switch_requested.store(false, std::memory_order_release);
+	return false;
+}
+
+bool state_machine::handover(std::size_t slot)
+{
+	// Repeats while a switch runs are dropped here
+	if (!request_switch(state_t::A2DP))
+		return false;
+
+	ESP_LOGI(TAG, "a2dp->a2dp");
+	if (notify_a2dp_to_a2dp_start(slot))
+		return true;
+	m_switch_requested.store(false, std::memory_order_release);
+	return false;
 }
 
 void state_machine::notify_scan_finished()
 {
-	send_msg(msg_t::SCAN_FINISHED, 0);
+	send_msg(msg_t::SCAN_FINISHED);
+}
+
+void state_machine::notify_ble_opened(std::uint16_t conn_id, std::uint32_t slot)
+{
+	send_msg(msg_t::BLE_OPENED, conn_id, slot);
+}
+
+void state_machine::notify_ble_open_failed(std::size_t server)
+{
+	send_msg(msg_t::BLE_OPEN_FAILED, bluetooth_server_info::INVALID_CONN_ID, server);
+}
+
+void state_machine::notify_mtu_configured(std::uint16_t conn_id)
+{
+	send_msg(msg_t::MTU_CONFIGURED, conn_id);
 }
 
-void state_machine::notify_ble_opened(int conn_id)
+void state_machine::notify_services_discovered(std::uint16_t conn_id, std::uint32_t status)
 {
-	m_saved_conn_id = conn_id;
-	send_msg(msg_t::BLE_OPENED, 0);
+	send_msg(msg_t::SERVICES_DISCOVERED, conn_id, status);
 }
 
-void state_machine::notify_mtu_configured()
+void state_machine::notify_notifications_enabled(std::uint16_t conn_id, std::uint32_t status)
 {
-	send_msg(msg_t::MTU_CONFIGURED, 0);
+	send_msg(msg_t::NOTIFICATIONS_ENABLED, conn_id, status);
 }
 
-void state_machine::notify_ble_connected()
+void state_machine::notify_ble_connected(std::uint32_t status)
 {
-	send_msg(msg_t::BLE_CONNECTED, 0);
+	send_msg(msg_t::BLE_CONNECTED, bluetooth_server_info::INVALID_CONN_ID, status);
 }
 
-void state_machine::notify_ble_disconnected()
+void state_machine::notify_ble_disconnected(std::uint16_t conn_id, std::uint32_t slot)
 {
-	send_msg(msg_t::BLE_DISCONNECTED, 0);
+	send_msg(msg_t::BLE_DISCONNECTED, conn_id, slot);
 }
 
 void state_machine::notify_a2dp_connected()
 {
-	send_msg(msg_t::A2DP_CONNECTED, 0);
+	send_msg(msg_t::A2DP_CONNECTED);
 }
 
 void state_machine::notify_a2dp_media_started()
 {
-	send_msg(msg_t::A2DP_MEDIA_STARTED, 0);
+	send_msg(msg_t::A2DP_MEDIA_STARTED);
 }
 
 void state_machine::notify_a2dp_media_stopped()
 {
-	send_msg(msg_t::A2DP_MEDIA_STOPPED, 0);
+	send_msg(msg_t::A2DP_MEDIA_STOPPED);
 }
 
 void state_machine::notify_a2dp_disconnecting()
 {
-	send_msg(msg_t::A2DP_DISCONNECTING, 0);
+	send_msg(msg_t::A2DP_DISCONNECTING);
 }
 
 void state_machine::notify_a2dp_disconnected()
 {
-	send_msg(msg_t::A2DP_DISCONNECTED, 0);
+	send_msg(msg_t::A2DP_DISCONNECTED);
 }
 
-void state_machine::handler()
+void state_machine::notify_activator_sampled(std::size_t slot, std::uint8_t activator)
+{
+	m_messages.push(
+		static_cast<std::size_t>(lane_t::SAMPLE),
+		{msg_t::ACTIVATOR_SAMPLED, bluetooth_server_info::INVALID_CONN_ID, static_cast<std::uint32_t>(slot << 8 | activator)});
+}
+
+void state_machine::notify_peer_prepared(const bluetooth_address& peer, bool a2dp_source)
+{
+	send_msg(
+		a2dp_source ? msg_t::PEER_PREPARED : msg_t::PEER_UNSUITABLE,
+		static_cast<std::uint16_t>(peer.packed() >> 32),
+		static_cast<std::uint32_t>(peer.packed()));
+}
+
+std::uint32_t state_machine::now_ms()
+{
+	return static_cast<std::uint32_t>(esp_timer_get_time() / 1000);
+}
+
+const state_machine::deadline_t *state_machine::deadline_of(state_t state)
 {
-	const auto receive_msg = [this]() -> std::optional<msg_t>
-    {
-        std::lock_guard<std::mutex> l(m_message_mutex);
-
-        if (!m_messages.empty())
-        {
-            auto priority_msg = m_messages.top();
-            m_messages.pop();
-            return priority_msg.msg;
-        }
-        else
-        {
-            return {};
-        }
-    };
+	for (const auto& deadline : transitions::DEADLINES)
+		if (deadline.state == state)
+			return &deadline;
+	return nullptr;
+}
 
+void state_machine::handler()
+{
 	for (;;)
 	{
-		const auto opt_msg = receive_msg();
-		if (!opt_msg)
+		m_timers.advance(now_ms(), [this](std::size_t timer)
 		{
-			std::this_thread::sleep_for(10ms);
+			dispatch({msg_t::TIMEOUT, bluetooth_server_info::INVALID_CONN_ID, static_cast<std::uint32_t>(timer)});
+		});
+
+		// Blocks until send_msg has queued something or the next timer is due
+		message_t message;
+		const auto wait = m_timers.next_expiry_ms();
+		if (wait == timer_wheel::NEVER)
+			message = m_messages.pop();
+		else if (!m_messages.pop_for(message, std::chrono::milliseconds(wait)))
 			continue;
-		}
-		const auto msg = opt_msg.value();
 
-		switch (m_state)
-		{
-		case state_t::IDLE:
-		case state_t::BLE:
-		case state_t::A2DP:
-			break;
+		dispatch(message);
+	}
+}
 
-		/* IDLE TO BLE ALGORITHM */
-		case state_t::IDLE_TO_BLE_0:
-			if (msg == msg_t::IDLE_TO_BLE_START)
-			{
-				ESP_LOGI(TAG, "IDLE_TO_BLE Start Scanning");
-				m_state = state_t::IDLE_TO_BLE_1;
-				ESP_ERROR_CHECK(esp_ble_gap_start_scanning(5));
-			}
-			break;
-
-		case state_t::IDLE_TO_BLE_1:
-			if (msg == msg_t::SCAN_FINISHED)
-			{
-				if (m_servers->empty())
-				{
-					ESP_LOGI(TAG, "IDLE_TO_BLE No servers found. Restarting");
-					m_state = state_t::IDLE_TO_BLE_0;
-					notify_idle_to_ble_start();
-				}
-				else
-				{
-					ESP_LOGI(TAG, "IDLE_TO_BLE Kickstart connections");
-					m_state = state_t::IDLE_TO_BLE_2;
-					m_to_connect = begin(*m_servers);
-					// Send an "empty" connected message to kickstart connecting process
-					notify_ble_connected();
-				}
-			}
-			break;
-
-		case state_t::IDLE_TO_BLE_2:
-			if (msg == msg_t::BLE_CONNECTED)
-			{
-				if (m_to_connect != end(*m_servers))
-				{
-					ESP_LOGI(TAG, "IDLE_TO_BLE Open new connection with %s", to_string(m_to_connect->address()).c_str());
-					m_state = state_t::IDLE_TO_BLE_3;
-					ESP_ERROR_CHECK(esp_ble_gattc_open(
-	            		m_interface,
-	            		m_to_connect->address(),
-	            		BLE_ADDR_TYPE_PUBLIC,
-	            		true));
-				}
-				else
-				{
-					ESP_LOGI(TAG, "IDLE_TO_BLE Finished");
-					m_state = state_t::BLE;
-				}
-			}
-			break;
-
-		case state_t::IDLE_TO_BLE_3:
-			if (msg == msg_t::BLE_OPENED)
-			{
-				ESP_LOGI(TAG, "IDLE_TO_BLE Send MTU negotation to %s", to_string(m_to_connect->address()).c_str());
-				m_state = state_t::IDLE_TO_BLE_4;
-				ESP_ERROR_CHECK(esp_ble_gattc_send_mtu_req(m_interface, m_saved_conn_id));
-			}
-			break;
-
-		case state_t::IDLE_TO_BLE_4:
-			if (msg == msg_t::MTU_CONFIGURED)
-			{
-				ESP_LOGI(TAG, "IDLE_TO_BLE Register for notifications with %s", to_string(m_to_connect->address()).c_str());
-				m_state = state_t::IDLE_TO_BLE_2;
-				ESP_ERROR_CHECK(esp_ble_gattc_register_for_notify(
-        			m_interface,
-					m_to_connect->address(),
-					0x2a));
-				m_to_connect->ble_connected() = true;
-				++m_to_connect;
-			}
-			break;
+void state_machine::dispatch(const message_t& message)
+{
+	// Frequent and the same in every state, kept out of the table and the trace
+	if (message.msg == msg_t::ACTIVATOR_SAMPLED)
+	{
+		if (m_servers != nullptr)
+			link_scheduler::on_sample(*m_servers, message.arg >> 8, message.arg & 0xff, now_ms());
+		return;
+	}
 
+	const auto previous_state = m_state;
 
-		/* BLE TO A2DP ALGORITHM */
-		case state_t::BLE_TO_A2DP_0:
-			if (msg == msg_t::BLE_TO_A2DP_START)
-			{
-				ESP_LOGI(TAG, "BLE_TO_A2DP Connect A2DP");
-				m_state = state_t::BLE_TO_A2DP_1;
-				ESP_ERROR_CHECK(esp_a2d_sink_connect(m_a2dp_address.value()));
-			}
-			break;
-
-		case state_t::BLE_TO_A2DP_1:
-			if (msg == msg_t::A2DP_CONNECTED)
-			{
-				ESP_LOGI(TAG, "BLE_TO_A2DP Finished");
-				m_state = state_t::A2DP;
-			}
-			else if (msg == msg_t::A2DP_DISCONNECTED)
-			{
-				ESP_LOGI(TAG, "BLE_TO_A2DP Failed");
-				m_a2dp_address = {};
-				m_state = state_t::BLE;
-			}
-			break;
-
-
-		/* A2DP TO BLE ALGORITM */
-		case state_t::A2DP_TO_BLE_0:
-			if (msg == msg_t::A2DP_TO_BLE_START)
-			{
-				ESP_LOGI(TAG, "A2DP_TO_BLE Stop media stream");
-				m_state = state_t::A2DP_TO_BLE_1;
-				ESP_ERROR_CHECK(esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_STOP));
-			}
-			break;
-
-		case state_t::A2DP_TO_BLE_1:
-			if (msg == msg_t::A2DP_MEDIA_STOPPED)
-			{
-				ESP_LOGI(TAG, "A2DP_TO_BLE Disconnect A2DP");
-				m_state = state_t::A2DP_TO_BLE_2;
-				ESP_ERROR_CHECK(esp_a2d_sink_disconnect(m_a2dp_address.value()));
-			}
-			break;
-
-		case state_t::A2DP_TO_BLE_2:
-			if (msg == msg_t::A2DP_DISCONNECTED)
-			{
-				// Disconnected A2DP
-				ESP_LOGI(TAG, "A2DP_TO_BLE Finished");
-				m_state = state_t::BLE;
-				m_a2dp_address = {};
-			}
-			break;
-
-
-		default:
-			ESP_LOGE(TAG, "Unknown m_state %d", static_cast<int>(m_state));
-		}
+	trace_buffer::instance().record(
+		trace_buffer::event_t::MSG,
+		static_cast<std::uint8_t>(m_state),
+		message.conn_id,
+		static_cast<std::uint32_t>(message.msg));
+
+	const auto transition = select(message);
+	if (transition != nullptr)
+	{
+		take(*transition, message);
+
+		const auto completion = select({msg_t::COMPLETION, message.conn_id, 0});
+		if (completion != nullptr)
+			take(*completion, message);
+	}
+	else
+	{
+		ESP_LOGW(TAG, "Unexpected %s in %s", msg_name(message.msg), state_name(m_state));
+	}
+
+	// The switch request was taken and the state it leads to published,
+	// the next one may come
+	if (lane_of(message.msg) == lane_t::CONTROL)
+		m_switch_requested.store(false, std::memory_order_release);
+
+	if (m_state != previous_state)
+	{
+		trace_buffer::instance().record(
+			trace_buffer::event_t::STATE,
+			static_cast<std::uint8_t>(m_state),
+			message.conn_id,
+			static_cast<std::uint32_t>(previous_state));
+
+		// Sequence finished: print it, on the dump task, not here where the
+		// mailboxes would fill up meanwhile
+		if (m_state == state_t::BLE || m_state == state_t::A2DP)
+			trace_buffer::instance().request_dump(stdout);
+	}
+}
+
+const state_machine::transition_t *state_machine::select(const message_t& message) const
+{
+	const auto first = transitions::DISPATCH.first[index(m_state)][index(message.msg)];
+	if (first == NO_TRANSITION)
+		return nullptr;
+
+	const auto end = std::end(transitions::TABLE);
+	for (auto it = std::begin(transitions::TABLE) + first;
+		it != end && it->state == m_state && it->msg == message.msg;
+		++it)
+	{
+		if (it->guard == nullptr || (this->*(it->guard))(message))
+			return it;
+	}
+
+	return nullptr;
+}
+
+void state_machine::take(const transition_t& transition, const message_t& message)
+{
+	m_refused = false;
+	if (transition.action != nullptr)
+		(this->*(transition.action))(message);
+	if (transition.next != m_state)
+		enter(transition.next);
+	set_state(transition.next);
+
+	// No answer is coming for a refused request, the step times out now and
+	// its TIMEOUT rows back off, retry or give up
+	if (m_refused && deadline_of(m_state) != nullptr)
+		m_timers.arm(STATE_TIMER, 0);
+}
+
+void state_machine::enter(state_t state)
+{
+	m_attempts = 0;
+	m_backing_off = false;
+	m_timers.cancel(STATE_TIMER);
+
+	// Links are only looked after in the stable states, a switch has the radio
+	const auto stable = [](state_t s) { return s == state_t::BLE || s == state_t::A2DP; };
+	if (stable(state))
+	{
+		m_timers.arm(LINK_TIMER, link_scheduler::ROTATE_MS);
+	}
+	else if (stable(m_state))
+	{
+		m_timers.cancel(LINK_TIMER);
+		m_pipeline.stop();
+	}
+
+	const auto deadline = deadline_of(state);
+	if (deadline != nullptr && deadline->policy.deadline_ms != 0)
+		m_timers.arm(STATE_TIMER, deadline->policy.deadline_ms);
+}
+
+void state_machine::set_state(state_t state)
+{
+	m_state = state;
+	m_published_state.store(state, std::memory_order_release);
+}
+
+bool state_machine::request_switch(state_t from)
+{
+	// Only the handler changes the state, and only on a request: while
+	// this one is in flight the state checked below holds
+	bool requested = false;
+	if (!m_switch_requested.compare_exchange_strong(requested, true, std::memory_order_acquire))
+		return false;
+
+	if (m_published_state.load(std::memory_order_acquire) != from)
+	{
+		m_switch_requested.store(false, std::memory_order_release);
+		return false;
 	}
+	return true;
+}
+
+void state_machine::set_a2dp_address(std::optional<bluetooth_address> addr)
+{
+	m_a2dp_address = addr;
+	m_published_address.store(addr ? addr->packed() : 0, std::memory_order_release);
+}
+
+void state_machine::connect_links()
+{
+	// A pipeline still busy picks new work up when it moves on
+	if (!m_pipeline.done())
+		m_pipeline.resume();
+	else if (m_servers->next_to_connect(0, now_ms()))
+		m_pipeline.start(m_interface, m_servers, reconnect_engine::MAX_IN_FLIGHT);
+}
+
+void state_machine::scan(const scan_profile_t& profile, std::uint32_t seconds)
+{
+	// Active, names may only be in the scan response. Duplicates are kept,
+	// advertised activators are sampled from every advertisement.
+	esp_ble_scan_params_t params = {};
+	params.scan_type = BLE_SCAN_TYPE_ACTIVE;
+	params.own_addr_type = BLE_ADDR_TYPE_PUBLIC;
+	params.scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL;
+	params.scan_interval = profile.interval;
+	params.scan_window = profile.window;
+	params.scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE;
+
+	// Both go through the same Bluedroid queue, the parameters apply first.
+	// A scan that does not start is caught by the scan deadline
+	auto err = esp_ble_gap_set_scan_params(&params);
+	if (err == ESP_OK)
+		err = esp_ble_gap_start_scanning(seconds);
+	if (err != ESP_OK)
+		ESP_LOGE(TAG, "Scan refused (%d)", err);
+}
+
+void state_machine::request(const char *what, esp_err_t err)
+{
+	if (err == ESP_OK)
+		return;
+
+	ESP_LOGW(TAG, "%s %s refused (%d)", state_name(m_state), what, err);
+	m_refused = true;
+}
+
+void state_machine::plan_links()
+{
+	const auto now = now_ms();
+	link_scheduler::evictions_t evictions;
+	const auto count = m_scheduler.plan(*m_servers, now, evictions);
+	for (std::size_t i = 0; i < count; i++)
+		esp_ble_gattc_close(m_interface, m_servers->conn_id(evictions[i]));
+
+	if (count > 0)
+	{
+		ESP_LOGI(
+			TAG,
+			"BLE Rotated %d links, oldest sample %u ms",
+			static_cast<int>(count),
+			link_scheduler::worst_staleness(*m_servers, now));
+	}
+}
+
+bool state_machine::send_msg(msg_t msg, std::uint16_t conn_id, std::uint32_t arg)
+{
+	if (!m_messages.push(static_cast<std::size_t>(lane_of(msg)), {msg, conn_id, arg}))
+	{
+		trace_buffer::instance().record(
+			trace_buffer::event_t::MSG_DROPPED,
+			static_cast<std::uint8_t>(m_state),
+			conn_id,
+			static_cast<std::uint32_t>(msg));
+		ESP_LOGE(TAG, "Mailbox full, dropped message %d", static_cast<int>(msg));
+		return false;
+	}
+	return true;
+}
+
+bool state_machine::notify_idle_to_ble_start()
+{
+	return send_msg(msg_t::IDLE_TO_BLE_START);
+}
+
+bool state_machine::notify_ble_to_a2dp_start(std::size_t slot)
+{
+	return send_msg(msg_t::BLE_TO_A2DP_START, bluetooth_server_info::INVALID_CONN_ID, static_cast<std::uint32_t>(slot));
+}
+
+bool state_machine::notify_a2dp_to_ble_start()
+{
+	return send_msg(msg_t::A2DP_TO_BLE_START);
+}
+
+bool state_machine::notify_a2dp_to_a2dp_start(std::size_t slot)
+{
+	return send_msg(msg_t::A2DP_TO_A2DP_START, bluetooth_server_info::INVALID_CONN_ID, static_cast<std::uint32_t>(slot));
+}
+
+bool state_machine::no_servers(const message_t&) const
+{
+	return m_servers->empty();
+}
+
+bool state_machine::idle_to_ble_done(const message_t&) const
+{
+	return m_scan_finished && m_pipeline.done();
+}
+
+bool state_machine::scan_timer(const message_t& message) const
+{
+	return message.arg == SCAN_TIMER;
+}
+
+bool state_machine::link_timer(const message_t& message) const
+{
+	return message.arg == LINK_TIMER;
+}
+
+bool state_machine::state_timer(const message_t& message) const
+{
+	return message.arg == STATE_TIMER;
+}
+
+bool state_machine::backing_off(const message_t& message) const
+{
+	return state_timer(message) && m_backing_off;
+}
+
+bool state_machine::retries_left(const message_t& message) const
+{
+	const auto deadline = deadline_of(m_state);
+	return state_timer(message) && deadline != nullptr && m_attempts < deadline->policy.retries;
+}
+
+bool state_machine::handover_peer(const message_t& message) const
+{
+	const auto peer = std::uint64_t(message.conn_id) << 32 | message.arg;
+	return m_handover_address && m_handover_address->packed() == peer;
+}
+
+void state_machine::take_idle_to_ble(const message_t&)
+{
+	m_servers = m_idle_to_ble.servers;
+	m_cache = m_idle_to_ble.cache;
+	m_interface = m_idle_to_ble.interface;
+	notify_idle_to_ble_start();
+}
+
+void state_machine::start_scan(const message_t&)
+{
+	ESP_LOGI(TAG, "IDLE_TO_BLE Start Scanning");
+	m_scan_finished = false;
+	scan(DISCOVERY_SCAN, SCAN_SECONDS);
+	m_timers.arm(SCAN_TIMER, SCAN_DEADLINE_MS);
+}
+
+void state_machine::start_scan_and_pipeline(const message_t&)
+{
+	// Known servers: connect right away, the scan only looks for newcomers
+	ESP_LOGI(TAG, "IDLE_TO_BLE Connect cached servers while scanning");
+	m_scan_finished = false;
+	scan(DISCOVERY_SCAN, SCAN_SECONDS);
+	m_timers.arm(SCAN_TIMER, SCAN_DEADLINE_MS);
+	plan_links();
+	m_pipeline.start(m_interface, m_servers);
+}
+
+void state_machine::restart_idle_to_ble(const message_t&)
+{
+	ESP_LOGI(TAG, "IDLE_TO_BLE No servers found. Restarting");
+	m_timers.cancel(SCAN_TIMER);
+	notify_idle_to_ble_start();
+}
+
+void state_machine::start_pipeline(const message_t&)
+{
+	ESP_LOGI(TAG, "IDLE_TO_BLE Start connection pipeline");
+	m_timers.cancel(SCAN_TIMER);
+	m_scan_finished = true;
+	plan_links();
+	m_pipeline.start(m_interface, m_servers);
+}
+
+void state_machine::scan_timed_out(const message_t&)
+{
+	// The scan has a duration, the controller stops it by itself
+	ESP_LOGW(TAG, "IDLE_TO_BLE Scan did not report back, treating it as finished");
+	notify_scan_finished();
+}
+
+void state_machine::pipeline_opened(const message_t& message)
+{
+	m_pipeline.on_opened(message.arg, message.conn_id);
+}
+
+void state_machine::pipeline_open_failed(const message_t& message)
+{
+	m_pipeline.on_open_failed(message.arg);
+}
+
+void state_machine::pipeline_timeout(const message_t& message)
+{
+	m_pipeline.on_timeout(message.arg - PIPELINE_TIMERS);
+}
+
+void state_machine::pipeline_mtu_configured(const message_t& message)
+{
+	m_pipeline.on_mtu_configured(message.conn_id);
+}
+
+void state_machine::pipeline_discovered(const message_t& message)
+{
+	m_pipeline.on_discovered(message.conn_id, message.arg);
+}
+
+void state_machine::pipeline_subscribed(const message_t& message)
+{
+	m_pipeline.on_subscribed(message.arg);
+}
+
+void state_machine::pipeline_notifications_enabled(const message_t& message)
+{
+	m_pipeline.on_notifications_enabled(message.conn_id, message.arg);
+}
+
+void state_machine::pipeline_scan_finished(const message_t&)
+{
+	m_timers.cancel(SCAN_TIMER);
+	m_scan_finished = true;
+	// Servers found by the scan may fill links that are still free
+	plan_links();
+	m_pipeline.resume();
+}
+
+void state_machine::finish_idle_to_ble(const message_t&)
+{
+	ESP_LOGI(TAG, "IDLE_TO_BLE Finished");
+	if (m_cache != nullptr)
+		m_cache->store(*m_servers);
+
+	// Runs for good; new servers are admitted by the next rotation
+	ESP_LOGI(
+		TAG,
+		"Background scan every %d ms for %d ms, %d.%d%% of the radio",
+		m_background_scan.interval * 5 / 8,
+		m_background_scan.window * 5 / 8,
+		m_background_scan.window * 100 / m_background_scan.interval,
+		m_background_scan.window * 1000 / m_background_scan.interval % 10);
+	scan(m_background_scan, 0);
+}
+
+void state_machine::rotate_links(const message_t&)
+{
+	m_timers.arm(LINK_TIMER, link_scheduler::ROTATE_MS);
+	plan_links();
+	connect_links();
+}
+
+void state_machine::reconnect_links(const message_t&)
+{
+	m_timers.arm(LINK_TIMER, link_scheduler::ROTATE_MS);
+	connect_links();
+}
+
+void state_machine::server_dropped(const message_t& message)
+{
+	if (message.arg == NO_SLOT)
+		return;
+
+	// A link closed before its server got a new one
+	const auto slot = message.arg;
+	const auto conn_id = m_servers->conn_id(slot);
+	if (conn_id != bluetooth_server_info::INVALID_CONN_ID && conn_id != message.conn_id)
+		return;
+
+	const auto was_set_up = m_servers->ble_connected(slot);
+	m_servers->conn_id(slot) = bluetooth_server_info::INVALID_CONN_ID;
+	m_servers->ble_connected(slot) = false;
+	m_pipeline.on_dropped(slot);
+
+	// Rotated out, or never set up: nothing to bring back
+	if (!was_set_up || !m_servers->live(slot))
+		return;
+
+	m_reconnects.on_dropped(*m_servers, slot, now_ms());
+	ESP_LOGI(
+		TAG,
+		"%s Server %d dropped, reconnecting in %d ms",
+		state_name(m_state),
+		static_cast<int>(message.arg),
+		static_cast<int>(m_servers->retry_at_ms(message.arg) - now_ms()));
+}
+
+void state_machine::start_ble_to_a2dp(const message_t& message)
+{
+	// Taken from the table here, on the handler, so only it touches the address
+	set_a2dp_address(m_servers->address(message.arg));
+	connect_a2dp(message);
+}
+
+void state_machine::connect_a2dp(const message_t&)
+{
+	ESP_LOGI(TAG, "BLE_TO_A2DP Connect A2DP");
+	request("A2DP connect", esp_a2d_sink_connect(m_a2dp_address.value()));
+}
+
+void state_machine::finish_ble_to_a2dp(const message_t&)
+{
+	ESP_LOGI(TAG, "BLE_TO_A2DP Finished");
+}
+
+void state_machine::fail_ble_to_a2dp(const message_t&)
+{
+	ESP_LOGI(TAG, "BLE_TO_A2DP Failed");
+	set_a2dp_address({});
+}
+
+void state_machine::give_up_ble_to_a2dp(const message_t&)
+{
+	ESP_LOGE(TAG, "%s Gave up connecting A2DP", state_name(m_state));
+	// Best effort, in case the connection is still on its way
+	esp_a2d_sink_disconnect(m_a2dp_address.value());
+	set_a2dp_address({});
+}
+
+void state_machine::stop_media(const message_t&)
+{
+	ESP_LOGI(TAG, "A2DP_TO_BLE Stop media stream");
+	request("media stop", esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_STOP));
+}
+
+void state_machine::disconnect_a2dp(const message_t&)
+{
+	ESP_LOGI(TAG, "A2DP_TO_BLE Disconnect A2DP");
+	request("A2DP disconnect", esp_a2d_sink_disconnect(m_a2dp_address.value()));
+}
+
+void state_machine::finish_a2dp_to_ble(const message_t&)
+{
+	ESP_LOGI(TAG, "A2DP_TO_BLE Finished");
+	set_a2dp_address({});
+}
+
+void state_machine::a2dp_lost(const message_t&)
+{
+	ESP_LOGW(TAG, "A2DP Source disconnected");
+	set_a2dp_address({});
+}
+
+void state_machine::give_up_a2dp_to_ble(const message_t&)
+{
+	ESP_LOGE(TAG, "A2DP_TO_BLE Gave up waiting for A2DP to disconnect");
+	set_a2dp_address({});
+}
+
+void state_machine::retry_request(const message_t& message)
+{
+	const auto deadline = deadline_of(m_state);
+	ESP_LOGW(TAG, "%s Retry %d", state_name(m_state), m_attempts);
+
+	m_backing_off = false;
+	(this->*(deadline->request))(message);
+	m_timers.arm(STATE_TIMER, deadline->policy.deadline_ms);
+}
+
+void state_machine::back_off(const message_t&)
+{
+	const auto& policy = deadline_of(m_state)->policy;
+	++m_attempts;
+	m_backing_off = true;
+
+	const auto delay = policy.backoff(m_attempts);
+	ESP_LOGW(
+		TAG,
+		"%s Timed out, retry %d of %d in %d ms",
+		state_name(m_state),
+		m_attempts,
+		policy.retries,
+		static_cast<int>(delay));
+	m_timers.arm(STATE_TIMER, delay);
+}
+
+void state_machine::prepare_handover(const message_t& message)
+{
+	// Pages the next peer and runs SDP; the ACL link it leaves behind
+	// makes the A2DP connect later on quick. Retries come in as TIMEOUT
+	ESP_LOGI(TAG, "A2DP_TO_A2DP Prepare next peer");
+	if (message.msg == msg_t::A2DP_TO_A2DP_START)
+		m_handover_address = m_servers->address(message.arg);
+	request("service discovery", esp_bt_gap_get_remote_services(m_handover_address.value()));
+}
+
+void state_machine::abort_handover(const message_t&)
+{
+	ESP_LOGW(TAG, "A2DP_TO_A2DP Next peer not ready, staying on the current one");
+	m_handover_address = {};
 }
 
-void state_machine::send_msg(msg_t msg, int priority)
+void state_machine::break_a2dp(const message_t&)
 {
-	std::lock_guard<std::mutex> l(m_message_mutex);
-	m_messages.push({msg, priority});
+	ESP_LOGI(TAG, "A2DP_TO_A2DP Disconnect current peer");
+	request("A2DP disconnect", esp_a2d_sink_disconnect(m_a2dp_address.value()));
 }
 
-void state_machine::notify_idle_to_ble_start()
+void state_machine::make_a2dp(const message_t&)
 {
-	send_msg(msg_t::IDLE_TO_BLE_START, 0);
+	ESP_LOGI(TAG, "A2DP_TO_A2DP Connect next peer");
+	set_a2dp_address(m_handover_address);
+	m_handover_address = {};
+	request("A2DP connect", esp_a2d_sink_connect(m_a2dp_address.value()));
 }
 
-void state_machine::notify_ble_to_a2dp_start()
+void state_machine::finish_handover(const message_t&)
 {
-	send_msg(msg_t::BLE_TO_A2DP_START, 0);
+	ESP_LOGI(TAG, "A2DP_TO_A2DP Finished");
 }
 
-void state_machine::notify_a2dp_to_ble_start()
+void state_machine::fail_handover(const message_t&)
 {
-	send_msg(msg_t::A2DP_TO_BLE_START, 0);
+	ESP_LOGE(TAG, "A2DP_TO_A2DP Next peer refused A2DP");
+	set_a2dp_address({});
 }
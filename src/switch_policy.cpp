@@ -0,0 +1,130 @@
+// Matching include
+#include "switch_policy.hpp"
+
+constexpr switch_policy::config_t switch_policy::DEFAULT_CONFIG;
+
+switch_policy::switch_policy(const config_t& config)
+	: m_config(config)
+	, m_servers()
+	, m_decided(false)
+	, m_last_decision(0)
+	, m_pending(false)
+	, m_switched(false)
+	, m_last_switch(0)
+	, m_coalesced(0)
+	, m_switches(0)
+{
+}
+
+const switch_policy::config_t& switch_policy::config() const
+{
+	return m_config;
+}
+
+bool switch_policy::armed(std::size_t slot) const
+{
+	return slot < m_servers.size() && m_servers[slot].armed;
+}
+
+std::uint32_t switch_policy::coalesced() const
+{
+	return m_coalesced;
+}
+
+std::uint32_t switch_policy::switches() const
+{
+	return m_switches;
+}
+
+std::uint32_t switch_policy::window_left(std::uint32_t now_ms) const
+{
+	const auto elapsed = now_ms - m_last_decision;
+	return m_decided && elapsed < m_config.window_ms ? m_config.window_ms - elapsed : 0;
+}
+
+switch_policy::notify_t switch_policy::on_activator(std::size_t slot, std::uint8_t activator, std::uint32_t now_ms)
+{
+	if (slot >= m_servers.size())
+		return notify_t::COALESCED;
+
+	auto& server = m_servers[slot];
+	server.activator = activator;
+	if (activator >= m_config.arm_level)
+		server.armed = true;
+	else if (activator <= m_config.disarm_level)
+		server.armed = false;
+
+	// Within a window of the last decision only the state above changes,
+	// the decision at the end of the window sees it
+	if (window_left(now_ms) > 0)
+	{
+		++m_coalesced;
+		if (m_pending)
+			return notify_t::COALESCED;
+		m_pending = true;
+		return notify_t::FLUSH_LATER;
+	}
+
+	m_decided = true;
+	m_last_decision = now_ms;
+	m_pending = false;
+	return notify_t::DECIDE;
+}
+
+bool switch_policy::on_window_end(std::uint32_t now_ms)
+{
+	// A notification after the window may have decided already
+	if (!m_pending)
+		return false;
+
+	m_decided = true;
+	m_last_decision = now_ms;
+	m_pending = false;
+	return true;
+}
+
+void switch_policy::on_disconnected(std::size_t slot)
+{
+	// The activator is kept: the A2DP peer has no BLE link while it streams
+	// and its last value is what a challenger has to beat
+	if (slot < m_servers.size())
+		m_servers[slot].armed = false;
+}
+
+switch_policy::decision_t switch_policy::decide(
+	std::optional<std::size_t> leader,
+	bool a2dp,
+	std::optional<std::size_t> peer,
+	std::uint32_t now_ms) const
+{
+	const decision_t none = {action_t::NONE, 0};
+	if (!leader || !armed(*leader))
+		return none;
+	if (m_switched && now_ms - m_last_switch < m_config.dwell_ms)
+		return none;
+
+	auto action = action_t::CONNECT;
+	if (a2dp)
+	{
+		if (peer && *peer == *leader)
+			return none;
+
+		const auto held = peer && *peer < m_servers.size() ? m_servers[*peer].activator : 0;
+		if (m_servers[*leader].activator < held + m_config.margin)
+			return none;
+
+		action = action_t::HANDOVER;
+	}
+
+	return {action, *leader};
+}
+
+void switch_policy::commit(const decision_t& decision, std::uint32_t now_ms)
+{
+	if (decision.action == action_t::NONE)
+		return;
+
+	m_switched = true;
+	m_last_switch = now_ms;
+	++m_switches;
+}
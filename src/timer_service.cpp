@@ -0,0 +1,146 @@
+// Matching include
+#include "timer_service.hpp"
+// C++ includes
+#include <chrono>
+#include <utility>
+// ESP includes
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+namespace
+{
+	constexpr auto TAG = "TIMER_SERVICE";
+
+	// Callbacks post messages, but through ESP_LOGx and the switch
+	// decision of the client, which need more than 2 KiB
+	constexpr auto TASK_STACK = 3072;
+	constexpr auto TASK_PRIORITY = tskIDLE_PRIORITY + 5;
+}
+
+constexpr std::size_t timer_service::CAPACITY;
+constexpr std::size_t timer_service::QUEUE_CAPACITY;
+constexpr std::uint32_t timer_service::TICK_MS;
+constexpr std::size_t timer_service::NO_TIMER;
+
+timer_service::timer_service()
+	: m_commands()
+	, m_callbacks()
+	, m_created(0)
+	, m_start_ms(now_ms())
+	, m_wheel(CAPACITY, TICK_MS, m_start_ms)
+{
+}
+
+timer_service& timer_service::instance()
+{
+	static timer_service service;
+	return service;
+}
+
+std::uint32_t timer_service::dropped() const
+{
+	return m_commands.dropped();
+}
+
+std::size_t timer_service::create(callback_t callback)
+{
+	if (m_created >= CAPACITY)
+	{
+		ESP_LOGE(TAG, "All %d timers are taken", static_cast<int>(CAPACITY));
+		return NO_TIMER;
+	}
+
+	m_callbacks[m_created] = std::move(callback);
+	return m_created++;
+}
+
+void timer_service::start()
+{
+	xTaskCreate(
+		[](void *self)
+		{
+			static_cast<timer_service *>(self)->run();
+		},
+		"timer_service",
+		TASK_STACK,
+		this,
+		TASK_PRIORITY,
+		nullptr);
+}
+
+bool timer_service::arm(std::size_t timer, std::uint32_t delay_ms)
+{
+	return post({now_ms(), delay_ms, static_cast<std::uint16_t>(timer), false});
+}
+
+bool timer_service::cancel(std::size_t timer)
+{
+	return post({now_ms(), 0, static_cast<std::uint16_t>(timer), true});
+}
+
+std::uint32_t timer_service::now_ms()
+{
+	return static_cast<std::uint32_t>(esp_timer_get_time() / 1000);
+}
+
+bool timer_service::post(const command_t& command)
+{
+	if (command.timer >= m_created)
+		return false;
+
+	if (!m_commands.push(0, command))
+	{
+		ESP_LOGE(TAG, "Command queue full, dropped command for timer %d", command.timer);
+		return false;
+	}
+	return true;
+}
+
+void timer_service::run()
+{
+	for (;;)
+	{
+		const auto now = now_ms();
+		advance(now);
+
+		// Sleeps until a command comes in or the next timer is due. The
+		// wheel counts from the start of its tick, part of which is gone
+		command_t command;
+		const auto wait = m_wheel.next_expiry_ms();
+		if (wait == timer_wheel::NEVER)
+			command = m_commands.pop();
+		else if (!m_commands.pop_for(command, std::chrono::milliseconds(wait - (now - m_start_ms) % TICK_MS)))
+			continue;
+
+		apply(command);
+	}
+}
+
+void timer_service::apply(const command_t& command)
+{
+	const auto now = now_ms();
+	advance(now);
+
+	if (command.cancel)
+	{
+		m_wheel.cancel(command.timer);
+		return;
+	}
+
+	// Delays count from the call, not from when the command got here. The
+	// wheel counts from the start of its current tick, so the part of the
+	// tick already gone is added back, or the timer could fire a tick early
+	const auto queued = now - command.issued_ms;
+	const auto left = command.delay_ms > queued ? command.delay_ms - queued : 0;
+	m_wheel.arm(command.timer, left + (now - m_start_ms) % TICK_MS);
+}
+
+void timer_service::advance(std::uint32_t now)
+{
+	m_wheel.advance(now, [this](std::size_t timer)
+	{
+		m_callbacks[timer]();
+	});
+}
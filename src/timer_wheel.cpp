@@ -0,0 +1,170 @@
+// Matching include
+#include "timer_wheel.hpp"
+
+constexpr std::size_t timer_wheel::LEVELS;
+constexpr std::size_t timer_wheel::SLOT_BITS;
+constexpr std::size_t timer_wheel::SLOTS;
+constexpr std::uint32_t timer_wheel::NEVER;
+constexpr std::uint16_t timer_wheel::NIL;
+
+timer_wheel::timer_wheel(std::size_t capacity, std::uint32_t tick_ms, std::uint32_t now_ms)
+	: m_nodes(new node_t[capacity])
+	, m_capacity(std::min<std::size_t>(capacity, NIL))
+	, m_slots()
+	, m_per_level()
+	, m_armed(0)
+	, m_tick_ms(std::max<std::uint32_t>(tick_ms, 1))
+	, m_last_ms(now_ms)
+	, m_now(0)
+{
+	for (std::size_t i = 0; i < m_capacity; i++)
+		m_nodes[i] = {0, NIL, NIL, 0, 0, false};
+	for (auto& level : m_slots)
+		level.fill(NIL);
+	m_per_level.fill(0);
+}
+
+std::size_t timer_wheel::capacity() const
+{
+	return m_capacity;
+}
+
+std::uint32_t timer_wheel::tick_ms() const
+{
+	return m_tick_ms;
+}
+
+std::size_t timer_wheel::armed() const
+{
+	return m_armed;
+}
+
+bool timer_wheel::armed(std::size_t timer) const
+{
+	return timer < m_capacity && m_nodes[timer].armed;
+}
+
+void timer_wheel::arm(std::size_t timer, std::uint32_t delay_ms)
+{
+	if (timer >= m_capacity)
+		return;
+
+	const auto id = static_cast<std::uint16_t>(timer);
+	if (m_nodes[id].armed)
+		unlink(id);
+
+	const auto ticks = (static_cast<std::uint64_t>(delay_ms) + m_tick_ms - 1) / m_tick_ms;
+	m_nodes[id].expires = m_now + static_cast<std::uint32_t>(std::max<std::uint64_t>(ticks, 1));
+	insert(id);
+}
+
+void timer_wheel::cancel(std::size_t timer)
+{
+	if (armed(timer))
+		unlink(static_cast<std::uint16_t>(timer));
+}
+
+void timer_wheel::cancel_all()
+{
+	for (std::size_t i = 0; i < m_capacity; i++)
+		cancel(i);
+}
+
+std::uint32_t timer_wheel::next_expiry_ms() const
+{
+	const auto ticks = next_expiry();
+	return ticks == NEVER ? NEVER : ticks * m_tick_ms;
+}
+
+std::uint32_t timer_wheel::next_expiry() const
+{
+	if (m_armed == 0)
+		return NEVER;
+
+	// Coarse levels need a cascade when the finest one wraps around
+	std::uint32_t limit = NEVER;
+	if (m_armed != m_per_level[0])
+		limit = SLOTS - (m_now & (SLOTS - 1));
+
+	if (m_per_level[0] == 0)
+		return limit;
+
+	for (std::uint32_t ticks = 1; ticks < limit && ticks <= SLOTS; ticks++)
+		if (m_slots[0][(m_now + ticks) & (SLOTS - 1)] != NIL)
+			return ticks;
+	return limit;
+}
+
+void timer_wheel::insert(std::uint16_t timer)
+{
+	auto& node = m_nodes[timer];
+	const auto delta = node.expires - m_now;
+
+	std::size_t level = 0;
+	std::size_t slot = 0;
+	for (; level < LEVELS; level++)
+	{
+		if (level == LEVELS - 1 || delta < (1u << (SLOT_BITS * (level + 1))))
+			break;
+	}
+
+	if (level == LEVELS - 1 && delta >= (1u << (SLOT_BITS * LEVELS)))
+	{
+		// Beyond the wheel: park on the last slot to be cascaded, it comes
+		// back here with a smaller delta
+		slot = ((m_now >> (SLOT_BITS * level)) + SLOTS - 1) & (SLOTS - 1);
+	}
+	else
+	{
+		slot = (node.expires >> (SLOT_BITS * level)) & (SLOTS - 1);
+	}
+
+	auto& head = m_slots[level][slot];
+	node.level = static_cast<std::uint8_t>(level);
+	node.slot = static_cast<std::uint8_t>(slot);
+	node.prev = NIL;
+	node.next = head;
+	node.armed = true;
+	if (head != NIL)
+		m_nodes[head].prev = timer;
+	head = timer;
+
+	++m_per_level[level];
+	++m_armed;
+}
+
+void timer_wheel::unlink(std::uint16_t timer)
+{
+	auto& node = m_nodes[timer];
+	if (node.prev != NIL)
+		m_nodes[node.prev].next = node.next;
+	else
+		m_slots[node.level][node.slot] = node.next;
+	if (node.next != NIL)
+		m_nodes[node.next].prev = node.prev;
+
+	node.prev = NIL;
+	node.next = NIL;
+	node.armed = false;
+
+	--m_per_level[node.level];
+	--m_armed;
+}
+
+void timer_wheel::cascade()
+{
+	for (std::size_t level = 1; level < LEVELS; level++)
+	{
+		// Only at the start of a new block of this level
+		if ((m_now & ((1u << (SLOT_BITS * level)) - 1)) != 0)
+			return;
+
+		auto& head = m_slots[level][(m_now >> (SLOT_BITS * level)) & (SLOTS - 1)];
+		while (head != NIL)
+		{
+			const auto timer = head;
+			unlink(timer);
+			insert(timer);
+		}
+	}
+}
@@ -0,0 +1,101 @@
+// Matching include
+#include "trace_buffer.hpp"
+// ESP includes
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+namespace
+{
+	constexpr auto TASK_STACK = 3072;
+	constexpr auto TASK_PRIORITY = tskIDLE_PRIORITY + 1;
+}
+
+constexpr std::size_t trace_buffer::CAPACITY;
+constexpr std::size_t trace_buffer::REQUEST_CAPACITY;
+
+trace_buffer::trace_buffer()
+	: m_records()
+	, m_next(0)
+	, m_dumped(0)
+	, m_requests()
+{
+}
+
+trace_buffer& trace_buffer::instance()
+{
+	static trace_buffer buffer;
+	return buffer;
+}
+
+void trace_buffer::start()
+{
+	xTaskCreate(
+		[](void *self)
+		{
+			static_cast<trace_buffer *>(self)->dumper();
+		},
+		"trace_buffer",
+		TASK_STACK,
+		this,
+		TASK_PRIORITY,
+		nullptr);
+}
+
+void trace_buffer::record(event_t event, std::uint8_t state, std::uint16_t conn_id, std::uint32_t arg)
+{
+	const auto sequence = m_next.fetch_add(1, std::memory_order_relaxed);
+	auto& r = m_records[sequence & (CAPACITY - 1)];
+
+	// Invalidate first so a concurrent dump skips the half-written record
+	r.sequence = 0;
+	std::atomic_thread_fence(std::memory_order_release);
+	r.timestamp = static_cast<std::uint32_t>(esp_timer_get_time());
+	r.event = event;
+	r.state = state;
+	r.conn_id = conn_id;
+	r.arg = arg;
+	std::atomic_thread_fence(std::memory_order_release);
+	r.sequence = sequence + 1;
+}
+
+void trace_buffer::dump(std::FILE *out)
+{
+	const auto next = m_next.load(std::memory_order_relaxed);
+	// Anything older than CAPACITY has been overwritten
+	std::uint32_t first = next - m_dumped > CAPACITY ? next - CAPACITY : m_dumped;
+
+	std::fprintf(out, "TRACE-BEGIN %u %u\n", first, next);
+	for (; first != next; first++)
+	{
+		// Read like a seqlock: a record() overwriting the slot during the
+		// copy changes its sequence, checked on both sides of the copy
+		const auto& slot = m_records[first & (CAPACITY - 1)];
+		const auto before = slot.sequence;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const auto r = slot;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const auto after = slot.sequence;
+		if (before != first + 1 || after != before)
+			continue;
+
+		const auto *bytes = reinterpret_cast<const std::uint8_t *>(&r);
+		for (std::size_t i = 0; i < sizeof(r); i++)
+			std::fprintf(out, "%02x", bytes[i]);
+		std::fputc('\n', out);
+	}
+	std::fprintf(out, "TRACE-END\n");
+
+	m_dumped = next;
+}
+
+void trace_buffer::request_dump(std::FILE *out)
+{
+	m_requests.push(0, out);
+}
+
+void trace_buffer::dumper()
+{
+	for (;;)
+		dump(m_requests.pop());
+}
@@ -0,0 +1,170 @@
+#ifndef ACTIVATOR_REPLAY_HPP
+#define ACTIVATOR_REPLAY_HPP
+
+// C++ includes
+#include <algorithm>
+#include <random>
+#include <vector>
+// C includes
+#include <cstddef>
+#include <cstdint>
+// My includes
+#include "activator_ranking.hpp"
+#include "switch_policy.hpp"
+
+// A recorded-like stream of activator notifications, replayed through the
+// switching of the client and through the rule it replaced
+namespace replay
+{
+	struct notification_t
+	{
+		std::uint32_t at_ms;
+		std::size_t slot;
+		std::uint8_t activator;
+	};
+
+	struct trace_t
+	{
+		std::vector<notification_t> notifications;
+		// The server that is really ahead, one per phase
+		std::vector<std::size_t> leaders;
+		std::uint32_t phase_ms;
+	};
+
+	struct result_t
+	{
+		std::size_t decisions;
+		std::vector<std::uint32_t> switch_ms;
+		// A2DP peer when each phase ended
+		std::vector<std::size_t> peers;
+	};
+
+	constexpr std::size_t NO_PEER = static_cast<std::size_t>(-1);
+
+	// servers notify every 40 to 100 ms. In each phase one of them is
+	// ahead, closely followed for half the phase by the last leader; the
+	// others sit around the arm level, one of them wobbling across it.
+	// Every value has a step of noise
+	inline trace_t trace(unsigned seed, std::size_t servers = 8, std::size_t phases = 10, std::uint32_t phase_ms = 60000)
+	{
+		std::mt19937 random(seed);
+		trace_t t;
+		t.phase_ms = phase_ms;
+		for (std::size_t p = 0; p < phases; p++)
+			t.leaders.push_back(random() % servers);
+
+		std::vector<std::uint32_t> next(servers);
+		for (auto& at : next)
+			at = random() % 100;
+		const auto end = static_cast<std::uint32_t>(phases * phase_ms);
+		for (;;)
+		{
+			const auto slot = static_cast<std::size_t>(std::min_element(next.begin(), next.end()) - next.begin());
+			const auto at = next[slot];
+			if (at >= end)
+				break;
+
+			const auto phase = at / phase_ms;
+			const auto leader = t.leaders[phase];
+			// The leader of the last phase fades out over the first half
+			const auto fading = phase > 0 && at % phase_ms < phase_ms / 2 && slot == t.leaders[phase - 1];
+			int level = slot == leader ? 8 : fading ? 7 : slot == (leader + 1) % servers ? 3 : 2;
+			level += static_cast<int>(random() % 3) - 1;
+			t.notifications.push_back({at, slot, static_cast<std::uint8_t>(std::max(level, 0))});
+			next[slot] += 40 + random() % 61;
+		}
+		return t;
+	}
+
+	// As bluetooth_client does it: the ranking gives the leader, the policy
+	// decides when the window says so, a flush timer ends the window
+	inline result_t coalesced(const trace_t& t, const switch_policy::config_t& config = switch_policy::DEFAULT_CONFIG)
+	{
+		activator_ranking ranking;
+		switch_policy policy(config);
+		result_t r = {0, {}, {}};
+		auto peer = NO_PEER;
+		bool flush = false;
+		std::uint32_t flush_at = 0;
+
+		const auto decide = [&](std::uint32_t now)
+		{
+			++r.decisions;
+			const auto decision = policy.decide(
+				ranking.top(),
+				peer != NO_PEER,
+				peer != NO_PEER ? std::optional<std::size_t>(peer) : std::optional<std::size_t>(),
+				now);
+			if (decision.action == switch_policy::action_t::NONE)
+				return;
+			policy.commit(decision, now);
+			peer = decision.slot;
+			r.switch_ms.push_back(now);
+		};
+
+		std::uint32_t phase_end = t.phase_ms;
+		for (const auto& n : t.notifications)
+		{
+			if (flush && flush_at <= n.at_ms)
+			{
+				flush = false;
+				if (policy.on_window_end(flush_at))
+					decide(flush_at);
+			}
+			while (n.at_ms >= phase_end)
+			{
+				r.peers.push_back(peer);
+				phase_end += t.phase_ms;
+			}
+
+			ranking.update(n.slot, n.activator);
+			switch (policy.on_activator(n.slot, n.activator, n.at_ms))
+			{
+			case switch_policy::notify_t::DECIDE:
+				decide(n.at_ms);
+				break;
+			case switch_policy::notify_t::FLUSH_LATER:
+				flush = true;
+				flush_at = n.at_ms + policy.window_left(n.at_ms);
+				break;
+			default:
+				break;
+			}
+		}
+		r.peers.push_back(peer);
+		return r;
+	}
+
+	// The rule before switch_policy, run on every notification: follow
+	// the largest activator once it is above 2
+	inline result_t per_notification(const trace_t& t)
+	{
+		std::vector<std::uint8_t> activators(server_table::CAPACITY);
+		result_t r = {0, {}, {}};
+		auto peer = NO_PEER;
+
+		std::uint32_t phase_end = t.phase_ms;
+		for (const auto& n : t.notifications)
+		{
+			while (n.at_ms >= phase_end)
+			{
+				r.peers.push_back(peer);
+				phase_end += t.phase_ms;
+			}
+
+			activators[n.slot] = n.activator;
+			++r.decisions;
+			const auto leader = static_cast<std::size_t>(
+				std::max_element(activators.begin(), activators.end()) - activators.begin());
+			if (activators[leader] > 2 && leader != peer)
+			{
+				peer = leader;
+				r.switch_ms.push_back(n.at_ms);
+			}
+		}
+		r.peers.push_back(peer);
+		return r;
+	}
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+// C++ includes
+#include <algorithm>
+#include <chrono>
+// C includes
+#include <cstddef>
+#include <cstdio>
+
+// Timing for the bench_*.cpp programs. They run on the host: the numbers
+// compare two ways of doing the same thing on one machine, they are not
+// what the ESP32 takes
+namespace bench
+{
+	// Keeps the compiler from dropping a result nobody reads
+	template<typename T>
+	inline void keep(const T& value)
+	{
+		asm volatile("" : : "g"(&value) : "memory");
+	}
+
+	// Nanoseconds per call of f, the best of a few rounds of calls
+	template<typename F>
+	double ns_per_call(std::size_t calls, F f)
+	{
+		double best = 1e300;
+		for (int round = 0; round < 5; round++)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t i = 0; i < calls; i++)
+				f();
+			const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+			best = std::min(best, elapsed.count() / calls);
+		}
+		return best;
+	}
+
+	inline void report(const char *name, double ns)
+	{
+		std::printf("%-44s %10.1f ns\n", name, ns);
+	}
+}
+
+#endif
@@ -0,0 +1,76 @@
+// C++ includes
+#include <algorithm>
+#include <random>
+#include <vector>
+// C includes
+#include <cstdio>
+// My includes
+#include "activator_ranking.hpp"
+#include "bench.hpp"
+#include "bluetooth_server_info.hpp"
+
+// What a notification costs: storing the new activator and finding the
+// leader, by std::max_element over the server records as the callback
+// used to and through the ranking now; and a top-3 query. The ranking
+// holds one entry per server_table slot, so it stops at CAPACITY; the
+// scan is timed past that for comparison
+namespace
+{
+	constexpr std::size_t CALLS = 2000000;
+
+	struct notification_t
+	{
+		std::size_t slot;
+		std::uint8_t activator;
+	};
+
+	std::vector<notification_t> notifications(std::size_t servers)
+	{
+		std::mt19937 random(5);
+		std::vector<notification_t> out(4096);
+		for (auto& n : out)
+			n = {random() % servers, static_cast<std::uint8_t>(random() % 9)};
+		return out;
+	}
+}
+
+int main()
+{
+	char name[64];
+	for (const std::size_t servers : {1, 16, 32, 256})
+	{
+		const auto in = notifications(servers);
+		std::size_t next = 0;
+
+		std::vector<bluetooth_server_info> records(servers, bluetooth_server_info(bluetooth_address(std::uint64_t(0))));
+		std::snprintf(name, sizeof(name), "%3d servers, max_element", static_cast<int>(servers));
+		bench::report(name, bench::ns_per_call(CALLS, [&]
+		{
+			const auto& n = in[next++ % in.size()];
+			records[n.slot].activator() = n.activator;
+			bench::keep(std::max_element(records.cbegin(), records.cend(), [](const auto& l, const auto& r)
+			{
+				return l.activator() < r.activator();
+			}));
+		}));
+
+		if (servers > activator_ranking::CAPACITY)
+			continue;
+
+		activator_ranking ranking;
+		for (std::size_t slot = 0; slot < servers; slot++)
+			ranking.update(slot, 0);
+		std::snprintf(name, sizeof(name), "%3d servers, activator_ranking", static_cast<int>(servers));
+		bench::report(name, bench::ns_per_call(CALLS, [&]
+		{
+			const auto& n = in[next++ % in.size()];
+			ranking.update(n.slot, n.activator);
+			bench::keep(ranking.top());
+		}));
+
+		activator_ranking::slots_t slots;
+		std::snprintf(name, sizeof(name), "%3d servers, top_k(3)", static_cast<int>(servers));
+		bench::report(name, bench::ns_per_call(CALLS, [&] { bench::keep(ranking.top_k(3, slots)); }));
+	}
+	return 0;
+}
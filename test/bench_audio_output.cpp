@@ -0,0 +1,53 @@
+// C++ includes
+#include <cmath>
+#include <vector>
+// C includes
+#include <cstdio>
+#include <ctime>
+// My includes
+#include "i2s_file.hpp"
+
+// CPU the PCM path takes per second of audio, from the ring through the
+// converter into a file standing in for the DMA buffers
+namespace
+{
+	constexpr std::uint32_t SECONDS = 60;
+
+	double cpu_s()
+	{
+		timespec t;
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+		return t.tv_sec + t.tv_nsec / 1e9;
+	}
+
+	void run(std::uint32_t rate)
+	{
+		std::vector<std::int16_t> pcm(2 * static_cast<std::size_t>(rate) * SECONDS);
+		for (std::size_t i = 0; i < pcm.size(); i++)
+			pcm[i] = static_cast<std::int16_t>(12000 * std::sin(2 * M_PI * 1000 * (i / 2) / rate + i % 2));
+
+		i2s_file::out = std::tmpfile();
+		i2s_file::written = 0;
+		i2s_file::player p;
+		const auto start = cpu_s();
+		p.play({&pcm, rate, 2048, 0xffffffff, 0});
+		const auto cpu = cpu_s() - start;
+		std::printf(
+			"%5u Hz in, %u s: %7.1f us CPU per second of audio, %llu B written, %u underruns\n",
+			rate,
+			SECONDS,
+			cpu * 1e6 / SECONDS,
+			static_cast<unsigned long long>(i2s_file::written),
+			p.output().underruns());
+		std::fclose(i2s_file::out);
+	}
+}
+
+int main()
+{
+	run(48000);
+	run(44100);
+	run(32000);
+	run(16000);
+	return 0;
+}
@@ -0,0 +1,76 @@
+// C++ includes
+#include <random>
+#include <string>
+#include <vector>
+// C includes
+#include <cstdio>
+#include <cstring>
+// My includes
+#include "bench.hpp"
+#include "bluetooth_address.hpp"
+
+// Equality and formatting as bluetooth_address did them, a memcmp of the
+// six bytes and six sprintf calls into a std::string, against the packed
+// compare, format() into a caller's buffer and to_string() on top of it;
+// and the std::hash the server tables use
+namespace
+{
+	constexpr std::size_t CALLS = 2000000;
+	constexpr std::size_t ADDRESSES = 64;
+
+	bool equal_bytes(const bluetooth_address& l, const bluetooth_address& r)
+	{
+		return std::memcmp(l.raw(), r.raw(), sizeof(esp_bd_addr_t)) == 0;
+	}
+
+	std::string sprintf_string(const bluetooth_address& addr)
+	{
+		char buffer[ESP_BD_ADDR_LEN * 2 + (ESP_BD_ADDR_LEN - 1) + 1] = "";
+		std::sprintf(buffer, "%02x", addr.raw()[0]);
+		for (auto i = 1; i < ESP_BD_ADDR_LEN; i++)
+			std::sprintf(buffer + 2 + 3*(i - 1), "%s%02x", ":", addr.raw()[i]);
+		return buffer;
+	}
+}
+
+int main()
+{
+	std::mt19937 random(6);
+	std::vector<bluetooth_address> addresses;
+	for (std::size_t i = 0; i < ADDRESSES; i++)
+	{
+		// One vendor prefix, so memcmp has to go past the first bytes
+		addresses.emplace_back(0x24, 0x0a, 0xc4,
+			static_cast<std::uint8_t>(random()), static_cast<std::uint8_t>(random()), static_cast<std::uint8_t>(random() % 2));
+	}
+
+	std::size_t next = 0;
+	const auto pair = [&]() -> std::pair<const bluetooth_address&, const bluetooth_address&>
+	{
+		next = (next + 1) % ADDRESSES;
+		return {addresses[next], addresses[(next * 7) % ADDRESSES]};
+	};
+
+	bench::report("equality, memcmp", bench::ns_per_call(CALLS, [&]
+	{
+		const auto p = pair();
+		bench::keep(equal_bytes(p.first, p.second));
+	}));
+	bench::report("equality, packed", bench::ns_per_call(CALLS, [&]
+	{
+		const auto p = pair();
+		bench::keep(p.first == p.second);
+	}));
+	bench::report("ordering, packed", bench::ns_per_call(CALLS, [&]
+	{
+		const auto p = pair();
+		bench::keep(p.first < p.second);
+	}));
+
+	char buffer[bluetooth_address::STRING_SIZE];
+	bench::report("to string, six sprintf", bench::ns_per_call(CALLS / 10, [&] { bench::keep(sprintf_string(pair().first)); }));
+	bench::report("to string, to_string()", bench::ns_per_call(CALLS / 10, [&] { bench::keep(to_string(pair().first)); }));
+	bench::report("to string, format() into a buffer", bench::ns_per_call(CALLS, [&] { bench::keep(format(pair().first, buffer)); }));
+	bench::report("std::hash", bench::ns_per_call(CALLS, [&] { bench::keep(std::hash<bluetooth_address>()(pair().first)); }));
+	return 0;
+}
@@ -0,0 +1,72 @@
+// C++ includes
+#include <algorithm>
+#include <chrono>
+#include <thread>
+// C includes
+#include <cstdio>
+// My includes
+#include "bench.hpp"
+#include "deferred_log.hpp"
+
+// What a callback pays to log a scan result: formatting the line with
+// to_string(address) as ESP_LOGI did, into /dev/null, against
+// deferred_log queueing it for the formatting task, admitted and over
+// the tag's rate limit. Admitted messages are logged in bursts with a
+// pause between them, so the formatting task keeps the queue from
+// filling up, and each burst is timed as a whole
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	constexpr std::size_t CALLS = 200000;
+	constexpr std::size_t BURST = 16;
+	constexpr std::size_t BURSTS = 2000;
+
+	const char *const TAGS[] = { "T0", "T1", "T2", "T3", "T4", "T5", "T6", "T7" };
+	constexpr auto TAG = "CLIENT_BLE";
+	constexpr auto LIMITED_TAG = "CLIENT_BLE_NOTIFY";
+}
+
+int main()
+{
+	std::FILE *null = std::fopen("/dev/null", "w");
+	if (null == nullptr)
+		return 1;
+
+	const bluetooth_address addr(0x24, 0x0a, 0xc4, 0x12, 0x34, 0x56);
+	int rssi = -60;
+
+	bench::report("ESP_LOGI-style with to_string, /dev/null", bench::ns_per_call(CALLS, [&]
+	{
+		std::fprintf(null, "I (%u) %s: Adding server with address %s and RSSI %d\n",
+			static_cast<unsigned>(esp_timer_get_time() / 1000), TAG, to_string(addr).c_str(), --rssi);
+	}));
+	std::fclose(null);
+
+	// Left alive for its formatting task, which never returns. Every tag
+	// entry taken, so TAG is never rate limited
+	auto& log = *new deferred_log;
+	for (const auto tag : TAGS)
+		log.log(tag, "filler");
+	log.start();
+
+	double best = 1e300;
+	for (std::size_t b = 0; b < BURSTS; b++)
+	{
+		const auto start = clock_type::now();
+		for (std::size_t i = 0; i < BURST; i++)
+			log.log(TAG, "Adding server with address %s and RSSI %d", addr, --rssi);
+		const std::chrono::duration<double, std::nano> elapsed = clock_type::now() - start;
+		best = std::min(best, elapsed.count() / BURST);
+		std::this_thread::sleep_for(std::chrono::microseconds(500));
+	}
+	bench::report("deferred_log, queued", best);
+	std::printf("  %u of %d overflowed\n", log.overflowed(), static_cast<int>(BURST * BURSTS));
+
+	deferred_log limited;
+	bench::report("deferred_log, over the rate limit", bench::ns_per_call(CALLS, [&]
+	{
+		limited.log(LIMITED_TAG, "notified from boi %d: %d", 3, --rssi);
+	}));
+	return 0;
+}
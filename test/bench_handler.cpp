@@ -0,0 +1,143 @@
+// C++ includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+// C includes
+#include <cstdio>
+// My includes
+#include "mailbox.hpp"
+
+// How long a message takes from send_msg to the handler thread, and how
+// often an idle handler wakes up, for the 10 ms polling loop the handler
+// had and for the blocking mailbox it waits on now. A callback thread
+// sends a message every few ms, as the steps of IDLE_TO_BLE do
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	constexpr int MESSAGES = 300;
+	constexpr int IDLE_MS = 1000;
+
+	struct message_t
+	{
+		clock_type::time_point sent;
+		bool last;
+	};
+
+	struct result_t
+	{
+		std::vector<double> latency_us;
+		std::uint32_t wakeups;
+	};
+
+	// The old handler: a mutex-guarded queue, 10 ms of sleep when empty
+	class polling
+	{
+	public:
+		void send(const message_t& message)
+		{
+			std::lock_guard<std::mutex> l(m_mutex);
+			m_messages.push(message);
+		}
+
+		message_t receive(std::uint32_t& wakeups)
+		{
+			for (;;)
+			{
+				++wakeups;
+				{
+					std::lock_guard<std::mutex> l(m_mutex);
+					if (!m_messages.empty())
+					{
+						const auto message = m_messages.front();
+						m_messages.pop();
+						return message;
+					}
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::queue<message_t> m_messages;
+	};
+
+	// The handler now, the state machine's lanes and capacity
+	class blocking
+	{
+	public:
+		void send(const message_t& message)
+		{
+			m_messages.push(2, message);
+		}
+
+		message_t receive(std::uint32_t& wakeups)
+		{
+			++wakeups;
+			return m_messages.pop();
+		}
+
+	private:
+		mailbox<message_t, 3, 32> m_messages;
+	};
+
+	template<typename Handler>
+	result_t run()
+	{
+		Handler handler;
+		result_t r{{}, 0};
+		std::thread consumer([&handler, &r]
+		{
+			for (;;)
+			{
+				const auto message = handler.receive(r.wakeups);
+				if (message.last)
+					return;
+				const std::chrono::duration<double, std::micro> latency = clock_type::now() - message.sent;
+				r.latency_us.push_back(latency.count());
+			}
+		});
+
+		std::mt19937 random(2);
+		for (int i = 0; i < MESSAGES; i++)
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(1000 + random() % 4000));
+			handler.send({clock_type::now(), false});
+		}
+
+		// Nothing to do for a while, then done
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		const auto busy = r.wakeups;
+		std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_MS));
+		const auto idle = r.wakeups - busy;
+		handler.send({clock_type::now(), true});
+		consumer.join();
+		r.wakeups = idle;
+		return r;
+	}
+
+	void print(const char *name, result_t r)
+	{
+		auto& l = r.latency_us;
+		std::sort(l.begin(), l.end());
+		double sum = 0;
+		for (const auto us : l)
+			sum += us;
+		const auto at = [&l](double q) { return l[static_cast<std::size_t>(q * (l.size() - 1))]; };
+		std::printf("%-20s send to handler mean %8.1f us, median %8.1f, p99 %8.1f, max %8.1f; %3u wakeups in %d ms idle\n",
+			name, sum / l.size(), at(0.5), at(0.99), l.back(), r.wakeups, IDLE_MS);
+	}
+}
+
+int main()
+{
+	print("polling every 10 ms", run<polling>());
+	print("blocking mailbox", run<blocking>());
+	return 0;
+}
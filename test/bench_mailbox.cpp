@@ -0,0 +1,130 @@
+// C++ includes
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+// C includes
+#include <cstdio>
+// My includes
+#include "bench.hpp"
+#include "mailbox.hpp"
+
+// The mutex-guarded std::priority_queue send_msg used to push into
+// against the mailbox with the state machine's three lanes: a push and a
+// pop on one thread, what the BT task and the handler pay with nobody in
+// the way; then messages per second from one to four producer threads
+// into one consumer. Both hold CAPACITY messages there, and a producer
+// that finds no room gives the core away and tries again
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	constexpr std::size_t LANES = 3;
+	constexpr std::size_t CAPACITY = 16;
+	constexpr std::uint32_t MESSAGES = 400000;
+
+	struct message_t
+	{
+		std::uint16_t conn_id;
+		std::uint32_t arg;
+		std::uint8_t priority;
+
+		bool operator<(const message_t& other) const
+		{
+			return priority < other.priority;
+		}
+	};
+
+	class locked_queue
+	{
+	public:
+		// The old queue had no bound
+		explicit locked_queue(std::size_t bound = CAPACITY)
+			: m_bound(bound)
+		{
+		}
+
+		bool push(std::size_t lane, const message_t& message)
+		{
+			{
+				std::lock_guard<std::mutex> l(m_mutex);
+				if (m_messages.size() == m_bound)
+					return false;
+				m_messages.push({message.conn_id, message.arg, static_cast<std::uint8_t>(LANES - lane)});
+			}
+			m_cv.notify_one();
+			return true;
+		}
+
+		message_t pop()
+		{
+			std::unique_lock<std::mutex> l(m_mutex);
+			m_cv.wait(l, [this] { return !m_messages.empty(); });
+			const auto message = m_messages.top();
+			m_messages.pop();
+			return message;
+		}
+
+	private:
+		std::size_t m_bound;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		std::priority_queue<message_t> m_messages;
+	};
+
+	template<typename Queue>
+	double messages_per_second(std::size_t producers)
+	{
+		Queue queue;
+		const auto per_producer = MESSAGES / producers;
+		const auto start = clock_type::now();
+
+		std::vector<std::thread> threads;
+		for (std::size_t p = 0; p < producers; p++)
+		{
+			threads.emplace_back([&queue, per_producer, p]
+			{
+				for (std::uint32_t i = 0; i < per_producer; i++)
+					while (!queue.push(i % LANES, {static_cast<std::uint16_t>(p), i, 0}))
+						std::this_thread::yield();
+			});
+		}
+		for (std::size_t i = 0; i < per_producer * producers; i++)
+			queue.pop();
+		for (auto& t : threads)
+			t.join();
+
+		const std::chrono::duration<double> elapsed = clock_type::now() - start;
+		return per_producer * producers / elapsed.count();
+	}
+}
+
+int main()
+{
+	{
+		locked_queue locked(static_cast<std::size_t>(-1));
+		mailbox<message_t, LANES, CAPACITY> box;
+		std::uint32_t i = 0;
+		bench::report("push and pop, mutex + priority_queue", bench::ns_per_call(MESSAGES, [&]
+		{
+			locked.push(++i % LANES, {1, i, 0});
+			bench::keep(locked.pop());
+		}));
+		bench::report("push and pop, mailbox", bench::ns_per_call(MESSAGES, [&]
+		{
+			box.push(++i % LANES, {1, i, 0});
+			bench::keep(box.pop());
+		}));
+	}
+
+	for (const std::size_t producers : {1, 2, 4})
+	{
+		std::printf("%d producers: mutex + priority_queue %6.2f M messages/s, mailbox %6.2f M messages/s\n",
+			static_cast<int>(producers),
+			messages_per_second<locked_queue>(producers) / 1e6,
+			messages_per_second<mailbox<message_t, LANES, CAPACITY>>(producers) / 1e6);
+	}
+	return 0;
+}
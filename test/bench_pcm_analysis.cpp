@@ -0,0 +1,80 @@
+// C++ includes
+#include <random>
+#include <vector>
+// C includes
+#include <cstdio>
+// My includes
+#include "bench.hpp"
+#include "pcm_analysis.hpp"
+
+// One block of levels through pcm_kernels, against a scalar reference
+// that takes the channel count and block size at run time, reassembles
+// each sample from its two bytes as a2dp_data_callback did, and branches
+// on sign and clipping. The stereo 1024 frame block is what the client
+// analyses; ns per frame is printed for comparison across sizes
+namespace
+{
+	constexpr std::size_t CALLS = 20000;
+
+	void scalar_levels(const std::uint8_t *data, std::size_t channels, std::size_t frames, pcm_level_t *out)
+	{
+		for (std::size_t c = 0; c < channels; c++)
+		{
+			std::int32_t sum = 0;
+			std::int64_t squares = 0;
+			std::int32_t peak = 0;
+			std::uint32_t clips = 0;
+			for (std::size_t i = 0; i < frames; i++)
+			{
+				const auto *bytes = data + 2 * (i * channels + c);
+				const std::int32_t x = static_cast<std::int16_t>(bytes[0] | bytes[1] << 8);
+				std::int32_t magnitude = x;
+				if (x < 0)
+					magnitude = -x;
+				sum += x;
+				squares += x * x;
+				if (magnitude > peak)
+					peak = magnitude;
+				if (magnitude >= 32767)
+					++clips;
+			}
+			out[c].rms = std::sqrt(static_cast<float>(squares) / frames) / 32768;
+			out[c].peak = static_cast<float>(peak) / 32768;
+			out[c].dc_offset = static_cast<float>(sum) / frames / 32768;
+			out[c].clips = clips;
+		}
+	}
+
+	template<std::size_t CHANNELS, std::size_t FRAMES>
+	void compare()
+	{
+		std::mt19937 random(24);
+		std::vector<std::int16_t> block(CHANNELS * FRAMES);
+		for (auto& x : block)
+			x = static_cast<std::int16_t>(random());
+
+		pcm_level_t levels[CHANNELS];
+		const auto scalar = bench::ns_per_call(CALLS, [&]
+		{
+			scalar_levels(reinterpret_cast<const std::uint8_t *>(block.data()), CHANNELS, FRAMES, levels);
+			bench::keep(levels);
+		});
+		const auto kernel = bench::ns_per_call(CALLS, [&]
+		{
+			pcm_kernels<CHANNELS, FRAMES>::levels(block.data(), levels);
+			bench::keep(levels);
+		});
+		std::printf("%d channels, %4d frames: scalar %8.1f ns (%5.2f per frame), pcm_kernels %8.1f ns (%5.2f per frame), %4.1fx\n",
+			static_cast<int>(CHANNELS), static_cast<int>(FRAMES),
+			scalar, scalar / FRAMES, kernel, kernel / FRAMES, scalar / kernel);
+	}
+}
+
+int main()
+{
+	compare<1, 256>();
+	compare<1, 1024>();
+	compare<2, 256>();
+	compare<2, 1024>();
+	return 0;
+}
@@ -0,0 +1,100 @@
+// C++ includes
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+// C includes
+#include <cstdio>
+// My includes
+#include "bench.hpp"
+#include "pcm_ring_buffer.hpp"
+
+// What the A2DP callback costs per packet, formatting every sample as it
+// used to and copying the packet into the ring now, and what that comes
+// to per second of audio at each sample rate; then a producer and a
+// consumer thread pushing packets through a ring of the client's size as
+// fast as they go
+namespace
+{
+	constexpr std::size_t CAPACITY = 16 * 1024;
+	// What the SBC decoder hands over at a time
+	constexpr std::size_t PACKET_BYTES = 512;
+	constexpr std::size_t CALLS = 200000;
+	constexpr std::size_t STREAM_BYTES = 64 << 20;
+
+	void format_samples(std::FILE *out, const std::vector<std::uint8_t>& packet)
+	{
+		const auto *samples = reinterpret_cast<const std::uint16_t *>(packet.data());
+		for (std::size_t i = 0; i < packet.size() / 2; i++)
+			std::fprintf(out, "VALUE: %hu\n", samples[i]);
+	}
+
+	// Bytes per second one producer and one consumer get through the ring
+	double stream(std::uint32_t& overruns)
+	{
+		pcm_ring_buffer ring(CAPACITY);
+		std::atomic<bool> done(false);
+		const std::vector<std::uint8_t> packet(PACKET_BYTES, 0x5a);
+
+		const auto start = std::chrono::steady_clock::now();
+		std::thread consumer([&ring, &done]
+		{
+			std::vector<std::uint8_t> out(PACKET_BYTES);
+			while (!done.load(std::memory_order_acquire) || !ring.empty())
+				if (ring.read(out.data(), out.size()) == 0)
+					std::this_thread::yield();
+		});
+
+		// Either side gives the core away when it has to wait, as the
+		// tasks on the ESP32 do
+		for (std::size_t sent = 0; sent < STREAM_BYTES; )
+		{
+			if (ring.write(packet.data(), packet.size()))
+				sent += packet.size();
+			else
+				std::this_thread::yield();
+		}
+		done.store(true, std::memory_order_release);
+		consumer.join();
+
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		overruns = ring.overruns();
+		return STREAM_BYTES / elapsed.count();
+	}
+}
+
+int main()
+{
+	std::FILE *null = std::fopen("/dev/null", "w");
+	if (null == nullptr)
+		return 1;
+
+	pcm_ring_buffer ring(CAPACITY);
+	std::vector<std::uint8_t> packet(PACKET_BYTES, 0x5a);
+	std::vector<std::uint8_t> out(PACKET_BYTES);
+
+	std::printf("%d byte packets\n", static_cast<int>(PACKET_BYTES));
+	const auto formatted = bench::ns_per_call(CALLS / 100, [&] { format_samples(null, packet); });
+	const auto copied = bench::ns_per_call(CALLS, [&]
+	{
+		ring.write(packet.data(), packet.size());
+		bench::keep(ring.read(out.data(), out.size()));
+	});
+	std::fclose(null);
+	bench::report("fprintf every sample to /dev/null", formatted);
+	bench::report("ring write and read", copied);
+
+	// Stereo 16 bit
+	for (const std::uint32_t rate : {16000, 32000, 44100, 48000})
+	{
+		const auto packets = rate * 4.0 / PACKET_BYTES;
+		std::printf("  %5u Hz, per second of audio: fprintf %8.0f us, ring %5.1f us\n",
+			rate, packets * formatted / 1000, packets * copied / 1000);
+	}
+
+	std::uint32_t overruns = 0;
+	const auto bytes_per_second = stream(overruns);
+	std::printf("two threads through %d bytes: %.0f MB/s, %u times full, %.0fx what 48 kHz needs\n",
+		static_cast<int>(CAPACITY), bytes_per_second / 1e6, overruns, bytes_per_second / (48000 * 4.0));
+	return 0;
+}
@@ -0,0 +1,67 @@
+// C++ includes
+#include <cmath>
+#include <vector>
+// C includes
+#include <cstdio>
+// My includes
+#include "bench.hpp"
+#include "sample_rate_converter.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+// Cost per output sample of each resampler, converting full packets of
+// MAX_INPUT_FRAMES. Printed in ns and, on x86, in time stamp counter
+// ticks: those run at the nominal clock, not the core's, so they are
+// near cycles but not cycles
+namespace
+{
+	constexpr std::size_t CALLS = 2000;
+
+	std::vector<std::int16_t> tone(std::uint32_t rate)
+	{
+		std::vector<std::int16_t> pcm(sample_rate_converter::MAX_INPUT_FRAMES * sample_rate_converter::CHANNELS);
+		for (std::size_t i = 0; i < pcm.size(); i++)
+			pcm[i] = static_cast<std::int16_t>(12000 * std::sin(2 * M_PI * 1000 * (i / 2) / rate));
+		return pcm;
+	}
+}
+
+int main()
+{
+	std::printf("%5u Hz passes through\n", sample_rate_converter::OUTPUT_RATE);
+	for (const std::uint32_t rate : {16000, 32000, 44100})
+	{
+		sample_rate_converter converter;
+		converter.set_input_rate(rate);
+		const auto pcm = tone(rate);
+		const auto *in = reinterpret_cast<const std::uint8_t *>(pcm.data());
+		const std::uint8_t *out = nullptr;
+
+		std::size_t out_bytes = 0;
+		const auto ns = bench::ns_per_call(CALLS, [&]
+		{
+			out_bytes = converter.convert(in, sample_rate_converter::MAX_INPUT_BYTES, out);
+			bench::keep(out);
+		});
+		const auto samples = static_cast<double>(out_bytes) / sizeof(std::int16_t);
+
+#ifdef HAVE_TSC
+		const auto start = __rdtsc();
+		for (std::size_t i = 0; i < CALLS; i++)
+		{
+			converter.convert(in, sample_rate_converter::MAX_INPUT_BYTES, out);
+			bench::keep(out);
+		}
+		const auto ticks = static_cast<double>(__rdtsc() - start) / CALLS;
+		std::printf("%5u Hz: %4d samples out per packet, %6.2f ns and %6.1f TSC ticks per output sample\n",
+			rate, static_cast<int>(samples), ns / samples, ticks / samples);
+#else
+		std::printf("%5u Hz: %4d samples out per packet, %6.2f ns per output sample\n",
+			rate, static_cast<int>(samples), ns / samples);
+#endif
+	}
+	return 0;
+}
@@ -0,0 +1,68 @@
+// C++ includes
+#include <random>
+#include <unordered_map>
+#include <vector>
+// My includes
+#include "bench.hpp"
+#include "bluetooth_server_info.hpp"
+#include "server_index.hpp"
+
+// The lookups the GATTC callbacks do, on the index and on the linear
+// scans over the server records it replaced
+namespace
+{
+	constexpr std::size_t CALLS = 2000000;
+	constexpr std::size_t SERVERS = 32;
+
+	std::size_t slot_of(const std::vector<bluetooth_server_info>& servers, const bluetooth_address& addr)
+	{
+		for (std::size_t i = 0; i < servers.size(); i++)
+			if (servers[i].address() == addr)
+				return i;
+		return servers.size();
+	}
+
+	std::size_t slot_of(const std::vector<bluetooth_server_info>& servers, std::uint16_t conn_id)
+	{
+		for (std::size_t i = 0; i < servers.size(); i++)
+			if (servers[i].conn_id() == conn_id)
+				return i;
+		return servers.size();
+	}
+}
+
+int main()
+{
+	server_index index;
+	std::unordered_map<bluetooth_address, std::size_t> map;
+	std::vector<bluetooth_server_info> records;
+	std::vector<bluetooth_address> addresses;
+	std::mt19937 random(4);
+	for (std::size_t i = 0; i < SERVERS; i++)
+	{
+		// One vendor prefix, as a fleet of the same boards has
+		const bluetooth_address addr(0x24, 0x0a, 0xc4,
+			static_cast<std::uint8_t>(random()), static_cast<std::uint8_t>(random()), static_cast<std::uint8_t>(random()));
+		bluetooth_server_info server(addr);
+		server.conn_id() = static_cast<std::uint16_t>(i % server_index::MAX_CONN_ID);
+		records.push_back(server);
+		addresses.push_back(addr);
+		index.insert(addr, i);
+		if (i < server_index::MAX_CONN_ID)
+			index.bind(server.conn_id(), i);
+		map[addr] = i;
+	}
+
+	std::printf("%d servers\n", static_cast<int>(SERVERS));
+
+	std::size_t next = 0;
+	const auto next_address = [&] { next = (next + 7) % SERVERS; return addresses[next]; };
+	const auto next_conn_id = [&] { next = (next + 7) % server_index::MAX_CONN_ID; return static_cast<std::uint16_t>(next); };
+
+	bench::report("by address, scan of records", bench::ns_per_call(CALLS, [&] { bench::keep(slot_of(records, next_address())); }));
+	bench::report("by address, unordered_map", bench::ns_per_call(CALLS, [&] { bench::keep(map.find(next_address())); }));
+	bench::report("by address, server_index", bench::ns_per_call(CALLS, [&] { bench::keep(index.find(next_address())); }));
+	bench::report("by conn_id, scan of records", bench::ns_per_call(CALLS, [&] { bench::keep(slot_of(records, next_conn_id())); }));
+	bench::report("by conn_id, server_index", bench::ns_per_call(CALLS, [&] { bench::keep(index.find(next_conn_id())); }));
+	return 0;
+}
@@ -0,0 +1,90 @@
+// C++ includes
+#include <algorithm>
+#include <random>
+#include <vector>
+// My includes
+#include "bench.hpp"
+#include "server_table.hpp"
+
+// The scans the client runs over every server, on the table's columns and
+// on the vector of records it replaced
+namespace
+{
+	constexpr std::size_t CALLS = 2000000;
+
+	std::size_t connected(const std::vector<bluetooth_server_info>& servers)
+	{
+		return std::count_if(servers.begin(), servers.end(),
+			[](const bluetooth_server_info& s) { return s.ble_connected(); });
+	}
+
+	std::size_t slot_of(const std::vector<bluetooth_server_info>& servers, std::uint16_t conn_id)
+	{
+		for (std::size_t i = 0; i < servers.size(); i++)
+			if (servers[i].conn_id() == conn_id)
+				return i;
+		return servers.size();
+	}
+
+	std::size_t slot_of(const server_table& servers, std::uint16_t conn_id)
+	{
+		const auto size = servers.size();
+		for (std::size_t i = 0; i < size; i++)
+			if (servers.conn_id(i) == conn_id)
+				return i;
+		return size;
+	}
+
+	std::size_t max_activator(const std::vector<bluetooth_server_info>& servers)
+	{
+		std::size_t best = 0;
+		for (std::size_t i = 1; i < servers.size(); i++)
+			if (servers[i].activator() > servers[best].activator())
+				best = i;
+		return best;
+	}
+
+	std::size_t max_activator(const server_table& servers)
+	{
+		const auto size = servers.size();
+		std::size_t best = 0;
+		for (std::size_t i = 1; i < size; i++)
+			if (servers.activator(i) > servers.activator(best))
+				best = i;
+		return best;
+	}
+}
+
+int main()
+{
+	server_table table;
+	std::vector<bluetooth_server_info> records;
+	std::mt19937 random(18);
+	for (std::size_t i = 0; i < server_table::CAPACITY; i++)
+	{
+		bluetooth_server_info server(bluetooth_address(0xa0, 0, 0, 0, 0, static_cast<std::uint8_t>(i)));
+		server.activator() = static_cast<std::uint8_t>(random() % 16);
+		server.ble_connected() = random() % 2 == 0;
+		server.conn_id() = static_cast<std::uint16_t>(i);
+		records.push_back(server);
+
+		const auto slot = *table.add(server);
+		table.ble_connected(slot) = server.ble_connected();
+	}
+
+	std::printf("%d servers, record %d bytes\n",
+		static_cast<int>(server_table::CAPACITY),
+		static_cast<int>(sizeof(bluetooth_server_info)));
+
+	std::uint16_t id = 0;
+	const auto next_id = [&id] { id = static_cast<std::uint16_t>((id + 7) % server_table::CAPACITY); return id; };
+
+	bench::report("connected, vector of records", bench::ns_per_call(CALLS, [&] { bench::keep(connected(records)); }));
+	bench::report("connected, table", bench::ns_per_call(CALLS, [&] { bench::keep(table.connected()); }));
+	bench::report("slot of conn_id, vector of records", bench::ns_per_call(CALLS, [&] { bench::keep(slot_of(records, next_id())); }));
+	bench::report("slot of conn_id, table", bench::ns_per_call(CALLS, [&] { bench::keep(slot_of(table, next_id())); }));
+	bench::report("max activator, vector of records", bench::ns_per_call(CALLS, [&] { bench::keep(max_activator(records)); }));
+	bench::report("max activator, table", bench::ns_per_call(CALLS, [&] { bench::keep(max_activator(table)); }));
+	bench::report("next_to_connect, table", bench::ns_per_call(CALLS, [&] { bench::keep(table.next_to_connect(0, 0)); }));
+	return 0;
+}
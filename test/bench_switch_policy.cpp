@@ -0,0 +1,29 @@
+// C includes
+#include <cstdio>
+// My includes
+#include "activator_replay.hpp"
+#include "bench.hpp"
+
+// The cost of switching per notification and how often it switches, on a
+// replayed stream, for switch_policy and for the rule it replaced
+int main()
+{
+	const auto t = replay::trace(17);
+	const auto minutes = t.leaders.size() * t.phase_ms / 60000;
+	std::printf("%d notifications from 8 servers over %d minutes, %d leader phases\n",
+		static_cast<int>(t.notifications.size()), static_cast<int>(minutes), static_cast<int>(t.leaders.size()));
+
+	const auto policy = replay::coalesced(t);
+	const auto old = replay::per_notification(t);
+	std::printf("%-44s %8d decisions %6d switches\n", "switch_policy",
+		static_cast<int>(policy.decisions), static_cast<int>(policy.switch_ms.size()));
+	std::printf("%-44s %8d decisions %6d switches\n", "per notification, above 2",
+		static_cast<int>(old.decisions), static_cast<int>(old.switch_ms.size()));
+
+	const auto per_notification = [&t](double ns) { return ns / t.notifications.size(); };
+	bench::report("per notification, switch_policy", per_notification(
+		bench::ns_per_call(20, [&t] { bench::keep(replay::coalesced(t)); })));
+	bench::report("per notification, old rule", per_notification(
+		bench::ns_per_call(20, [&t] { bench::keep(replay::per_notification(t)); })));
+	return 0;
+}
@@ -0,0 +1,156 @@
+// C++ includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+// C includes
+#include <cstdio>
+#include <malloc.h>
+// My includes
+#include "timer_service.hpp"
+
+// How late timers fire, on the timer service, on a bare timer_wheel
+// holding thousands of timers, and on a sleeping thread per timer as the
+// client had before the service
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	class lateness
+	{
+	public:
+		void add(clock_type::time_point due)
+		{
+			const std::chrono::duration<double, std::milli> late = clock_type::now() - due;
+			std::lock_guard<std::mutex> l(m_mutex);
+			m_ms.push_back(late.count());
+		}
+
+		void report(const char *name)
+		{
+			std::sort(m_ms.begin(), m_ms.end());
+			double sum = 0;
+			for (const auto ms : m_ms)
+				sum += ms;
+			std::printf(
+				"%-36s %6d fired, late ms: mean %6.2f  p50 %6.2f  p99 %6.2f  max %6.2f\n",
+				name,
+				static_cast<int>(m_ms.size()),
+				sum / m_ms.size(),
+				m_ms[m_ms.size() / 2],
+				m_ms[m_ms.size() * 99 / 100],
+				m_ms.back());
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::vector<double> m_ms;
+	};
+
+	// Heap in use, from glibc
+	std::size_t heap()
+	{
+		return mallinfo2().uordblks;
+	}
+
+	void service()
+	{
+		constexpr int FIRINGS = 3000;
+		const auto before = heap();
+		auto& service = *new timer_service();
+		std::printf("timer_service: %d timers, %d bytes heap\n",
+			static_cast<int>(timer_service::CAPACITY), static_cast<int>(heap() - before));
+
+		lateness late;
+		std::atomic<int> total(0);
+		std::vector<clock_type::time_point> due(timer_service::CAPACITY);
+		for (std::size_t i = 0; i < timer_service::CAPACITY; i++)
+		{
+			service.create([&, i]
+			{
+				late.add(due[i]);
+				if (++total >= FIRINGS)
+					return;
+				const auto delay = static_cast<std::uint32_t>(5 + (total * 7 + i) % 200);
+				due[i] = clock_type::now() + std::chrono::milliseconds(delay);
+				service.arm(i, delay);
+			});
+		}
+		service.start();
+		for (std::size_t i = 0; i < timer_service::CAPACITY; i++)
+		{
+			due[i] = clock_type::now() + std::chrono::milliseconds(10 * i);
+			service.arm(i, static_cast<std::uint32_t>(10 * i));
+		}
+		while (total < FIRINGS)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		late.report("timer_service, 16 timers re-armed");
+	}
+
+	// Driven the way the service drives it: sleep until the next expiry
+	void wheel(std::size_t timers)
+	{
+		constexpr std::uint32_t TICK_MS = 10;
+		const auto start = clock_type::now();
+		const auto now_ms = [start]
+		{
+			return static_cast<std::uint32_t>(
+				std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - start).count());
+		};
+
+		const auto before = heap();
+		timer_wheel wheel(timers, TICK_MS, 0);
+		std::printf("timer_wheel: %d timers, %d bytes heap, %d bytes inline\n",
+			static_cast<int>(timers), static_cast<int>(heap() - before), static_cast<int>(sizeof(wheel)));
+
+		std::mt19937 random(15);
+		std::vector<clock_type::time_point> due(timers);
+		for (std::size_t i = 0; i < timers; i++)
+		{
+			const auto delay = static_cast<std::uint32_t>(random() % 2000);
+			due[i] = clock_type::now() + std::chrono::milliseconds(delay);
+			wheel.arm(i, delay);
+		}
+
+		lateness late;
+		while (wheel.armed() > 0)
+		{
+			const auto now = now_ms();
+			wheel.advance(now, [&](std::size_t timer) { late.add(due[timer]); });
+			if (wheel.armed() > 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(wheel.next_expiry_ms() - now % TICK_MS));
+		}
+		late.report("timer_wheel, armed at once");
+	}
+
+	void sleepers(std::size_t timers)
+	{
+		std::mt19937 random(15);
+		lateness late;
+		std::vector<std::thread> threads;
+		for (std::size_t i = 0; i < timers; i++)
+		{
+			const auto delay = std::chrono::milliseconds(random() % 2000);
+			const auto due = clock_type::now() + delay;
+			threads.emplace_back([&late, delay, due]
+			{
+				std::this_thread::sleep_for(delay);
+				late.add(due);
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		late.report("thread per timer");
+	}
+}
+
+int main()
+{
+	service();
+	wheel(4096);
+	sleepers(1000);
+	return 0;
+}
@@ -0,0 +1,50 @@
+// C includes
+#include <cstdio>
+// My includes
+#include "bench.hpp"
+#include "esp_timer.h"
+#include "trace_buffer.hpp"
+
+// What one traced event costs, trace_buffer::record() against formatting
+// the line ESP_LOGI printed for a transition into /dev/null, and what a
+// dump of the whole ring takes. Most of a record is the timestamp, timed
+// on its own: on the host esp_timer_get_time() is a clock_gettime()
+namespace
+{
+	constexpr std::size_t CALLS = 2000000;
+
+	const char *const STATES[] = { "IDLE", "IDLE_TO_BLE_0", "BLE", "BLE_TO_A2DP_0", "A2DP" };
+}
+
+int main()
+{
+	std::FILE *null = std::fopen("/dev/null", "w");
+	if (null == nullptr)
+		return 1;
+
+	auto& trace = trace_buffer::instance();
+	std::uint32_t i = 0;
+
+	bench::report("ESP_LOGI-style line to /dev/null", bench::ns_per_call(CALLS / 10, [&]
+	{
+		++i;
+		std::fprintf(null, "I (%u) state_machine: %s -> %s on %u, conn_id %u\n",
+			i, STATES[i % 5], STATES[(i + 1) % 5], i % 23, i % 7);
+	}));
+	bench::report("esp_timer_get_time", bench::ns_per_call(CALLS, [] { bench::keep(esp_timer_get_time()); }));
+	bench::report("trace_buffer::record", bench::ns_per_call(CALLS, [&]
+	{
+		++i;
+		trace.record(trace_buffer::event_t::STATE, static_cast<std::uint8_t>(i % 5), static_cast<std::uint16_t>(i % 7), i % 23);
+	}));
+
+	bench::report("dump of 512 records to /dev/null", bench::ns_per_call(100, [&]
+	{
+		for (std::size_t r = 0; r < trace_buffer::CAPACITY; r++)
+			trace.record(trace_buffer::event_t::MSG, 2, 0, static_cast<std::uint32_t>(r));
+		trace.dump(null);
+	}));
+
+	std::fclose(null);
+	return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef CHECK_HPP
+#define CHECK_HPP
+
+// C includes
+#include <cstdio>
+
+// Just enough of a test harness: a failed CHECK reports itself and the
+// test carries on, check::result() turns the failures into the exit status
+namespace check
+{
+	inline int& failures()
+	{
+		static int count = 0;
+		return count;
+	}
+
+	inline int result(const char *name)
+	{
+		std::printf("%s: %s\n", name, failures() == 0 ? "ok" : "FAILED");
+		return failures() == 0 ? 0 : 1;
+	}
+}
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			++check::failures(); \
+		} \
+	} while (0)
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef I2S_FILE_HPP
+#define I2S_FILE_HPP
+
+// C++ includes
+#include <vector>
+// C includes
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+// ESP includes
+#include "driver/i2s.h"
+// My includes
+#include "audio_output.hpp"
+#include "pcm_ring_buffer.hpp"
+#include "sample_rate_converter.hpp"
+
+// I2S writing into a file instead of the DMA buffers: the file holds what
+// the speaker would have played, byte for byte. The driver functions are
+// defined here, so one file per program includes this.
+namespace i2s_file
+{
+	std::FILE *out = nullptr;
+	// Bytes written, silence included
+	std::uint64_t written = 0;
+	std::uint32_t zeroed = 0;
+	int installed_rate = 0;
+}
+
+esp_err_t i2s_driver_install(i2s_port_t, const i2s_config_t *config, int, void *)
+{
+	i2s_file::installed_rate = config->sample_rate;
+	return ESP_OK;
+}
+
+esp_err_t i2s_set_pin(i2s_port_t, const i2s_pin_config_t *) { return ESP_OK; }
+esp_err_t i2s_set_clk(i2s_port_t, uint32_t, i2s_bits_per_sample_t, i2s_channel_t) { return ESP_OK; }
+
+esp_err_t i2s_write(i2s_port_t, const void *src, size_t size, size_t *written, TickType_t)
+{
+	*written = std::fwrite(src, 1, size, i2s_file::out);
+	i2s_file::written += *written;
+	return ESP_OK;
+}
+
+esp_err_t i2s_zero_dma_buffer(i2s_port_t)
+{
+	++i2s_file::zeroed;
+	return ESP_OK;
+}
+
+namespace i2s_file
+{
+	// The PCM path of bluetooth_client, the A2DP callback on one side and
+	// pcm_consumer() on the other, on one thread and in audio time. A
+	// packet arrives once the speaker got to its time; i2s_write() returns
+	// as soon as the data fits into the DMA buffers, so the consumer runs
+	// that far ahead of the speaker.
+	class player
+	{
+	public:
+		struct source_t
+		{
+			// Interleaved 16 bit stereo
+			const std::vector<std::int16_t> *pcm;
+			std::uint32_t rate;
+			std::size_t packet_bytes;
+			// The source goes quiet for stall_ms from stall_at_ms on
+			std::uint32_t stall_at_ms;
+			std::uint32_t stall_ms;
+		};
+
+		static constexpr std::size_t RING_CAPACITY = 16 * 1024;
+
+		player()
+			: m_pcm(RING_CAPACITY)
+			, m_converter()
+			, m_output()
+			, m_unplayed(nullptr)
+			, m_unplayed_len(0)
+		{
+			m_output.start();
+		}
+
+		audio_output& output() { return m_output; }
+		const pcm_ring_buffer& pcm() const { return m_pcm; }
+
+		// Plays the whole source, then lets the consumer go idle
+		void play(const source_t& source)
+		{
+			m_output.set_source_rate(source.rate);
+			m_converter.set_input_rate(source.rate);
+
+			const auto bytes = source.pcm->size() * sizeof(std::int16_t);
+			const auto data = reinterpret_cast<const std::uint8_t *>(source.pcm->data());
+			const auto start_us = consumer_us();
+			std::size_t sent = 0;
+			while (sent < bytes || !m_pcm.empty() || m_unplayed_len != 0)
+			{
+				while (sent < bytes && arrival_us(source, sent) <= consumer_us() - start_us)
+				{
+					const auto len = std::min(source.packet_bytes, bytes - sent);
+					m_pcm.write(data + sent, len);
+					sent += len;
+				}
+				step(sent < bytes);
+			}
+			step(false);
+		}
+
+	private:
+		pcm_ring_buffer m_pcm;
+		sample_rate_converter m_converter;
+		audio_output m_output;
+		const std::uint8_t *m_unplayed;
+		std::size_t m_unplayed_len;
+
+		// How far the consumer got: the speaker, plus what waits in the DMA buffers
+		static std::uint64_t consumer_us()
+		{
+			const auto frames = written / audio_output::BYTES_PER_FRAME + audio_output::DMA_BUFFERS * audio_output::DMA_FRAMES;
+			return frames * 1000000 / sample_rate_converter::OUTPUT_RATE;
+		}
+
+		static std::uint64_t arrival_us(const source_t& source, std::size_t sent)
+		{
+			const std::uint64_t frames = sent / audio_output::BYTES_PER_FRAME;
+			auto us = frames * 1000000 / source.rate;
+			if (us >= source.stall_at_ms * 1000ull)
+				us += source.stall_ms * 1000ull;
+			return us;
+		}
+
+		// One pass of pcm_consumer()
+		void step(bool streaming)
+		{
+			if (m_pcm.empty() && !streaming && m_unplayed_len == 0)
+			{
+				m_output.idle();
+				return;
+			}
+
+			if (m_unplayed_len != 0)
+			{
+				const auto played = m_output.play(m_unplayed, m_unplayed_len);
+				m_unplayed += played;
+				m_unplayed_len -= played;
+				return;
+			}
+
+			const std::uint8_t *data = nullptr;
+			const auto len = m_pcm.peek(data, m_output.available(m_pcm.size()));
+			const std::uint8_t *pcm = data;
+			const auto converted = len != 0 ? m_converter.convert(data, len, pcm) : 0;
+			const auto played = m_output.play(pcm, converted);
+			if (pcm == data)
+			{
+				m_pcm.consume(played);
+			}
+			else
+			{
+				m_pcm.consume(len);
+				m_unplayed = pcm + played;
+				m_unplayed_len = converted - played;
+			}
+		}
+	};
+
+	constexpr std::size_t player::RING_CAPACITY;
+}
+
+#endif
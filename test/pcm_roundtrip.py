@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""Decodes the stream test_pcm_capture wrote with tools/pcm_decode.py and
+checks it gets back the PCM that went in.
+
+Usage: pcm_roundtrip.py DIR
+"""
+
+import contextlib
+import io
+import os
+import sys
+import wave
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'tools'))
+import pcm_decode  # noqa: E402
+
+
+def check(failures, condition, what):
+    if not condition:
+        print('pcm_roundtrip: %s' % what, file=sys.stderr)
+        failures.append(what)
+
+
+def main(args):
+    if len(args) != 1:
+        print(__doc__.strip())
+        return 2
+    capture = os.path.join(args[0], 'capture.bin')
+    with open(os.path.join(args[0], 'capture.txt')) as f:
+        decodable = int(f.readline().split()[1])
+        segments = [line.split() for line in f]
+
+    failures = []
+    with open(capture, 'rb') as f:
+        seqs = [frame[0] for frame in pcm_decode.read_frames(f.read())]
+    check(failures, len(seqs) == decodable, '%d frames decoded, expected %d' % (len(seqs), decodable))
+    check(failures, seqs == sorted(seqs), 'frames out of order')
+
+    out = os.path.join(args[0], 'capture.wav')
+    with contextlib.redirect_stdout(io.StringIO()):
+        status = pcm_decode.main([capture, out])
+    check(failures, status == 0, 'pcm_decode.py failed')
+
+    for i, (rate, channels, name) in enumerate(segments):
+        path = out if i == 0 else os.path.join(args[0], 'capture-%d.wav' % i)
+        with open(os.path.join(args[0], name), 'rb') as f:
+            expected = f.read()
+        with wave.open(path, 'rb') as w:
+            check(failures, w.getframerate() == int(rate), '%s: rate %d' % (path, w.getframerate()))
+            check(failures, w.getnchannels() == int(channels), '%s: %d channels' % (path, w.getnchannels()))
+            check(failures, w.readframes(w.getnframes()) == expected, '%s: PCM differs' % path)
+    check(failures, not os.path.exists(os.path.join(args[0], 'capture-%d.wav' % len(segments))),
+          'more files than formats')
+
+    print('pcm_roundtrip: %s' % ('FAILED' if failures else 'ok'))
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
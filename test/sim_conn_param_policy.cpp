@@ -0,0 +1,226 @@
+// C++ includes
+#include <algorithm>
+#include <random>
+#include <vector>
+// C includes
+#include <cstdio>
+// My includes
+#include "conn_param_policy.hpp"
+
+// Eight linked servers whose activators sit around 0 and 1 and now and
+// then climb past the switch level, seen through connection events: a
+// server's notifications wait for the next event of its link. Prints
+// how long after an activator crossed the switch level the client heard
+// of it, against the connection events the links cost, for fixed
+// intervals and for conn_param_policy.
+namespace
+{
+	constexpr std::size_t SERVERS = 8;
+	constexpr std::uint32_t HOUR_MS = 3600 * 1000;
+	constexpr std::uint32_t TICK_MS = 5;
+	// Switching happens above 2
+	constexpr std::uint8_t SWITCH_LEVEL = 3;
+	// Radio time of an empty connection event: two PDUs and the gap
+	constexpr double EVENT_MS = 0.4;
+
+	constexpr std::uint32_t interval_ms(const bluetooth_server_info::conn_params_t& params)
+	{
+		// The central may pick anything up to max_int
+		return params.max_int * 5 / 4;
+	}
+
+	constexpr std::uint32_t SLOW_MS = interval_ms(bluetooth_server_info::DEFAULT_CONN_PARAMS);
+	constexpr std::uint32_t FAST_MS = interval_ms(conn_param_policy::FAST_PARAMS);
+
+	struct change_t
+	{
+		std::uint32_t at;
+		std::uint8_t value;
+	};
+
+	// How fast activators climb, a step every min to max ms
+	struct workload_t
+	{
+		const char *name;
+		std::uint32_t min;
+		std::uint32_t max;
+	};
+
+	// Quiet, with blips to 1, until a climb to 4-8 that holds for a while
+	// and falls back
+	std::vector<change_t> activity(const workload_t& climb_steps, std::mt19937& random)
+	{
+		std::vector<change_t> changes;
+		std::uint8_t value = 0;
+		const auto set = [&](std::uint32_t at, std::uint8_t v)
+		{
+			if (v != value)
+				changes.push_back({at, v});
+			value = v;
+		};
+
+		std::exponential_distribution<double> quiet(1 / 120000.0);
+		std::exponential_distribution<double> blip(1 / 20000.0);
+		std::uint32_t t = 0;
+		while (t < HOUR_MS)
+		{
+			const auto climb = t + static_cast<std::uint32_t>(quiet(random));
+			for (t += static_cast<std::uint32_t>(blip(random)); t < climb; t += static_cast<std::uint32_t>(blip(random)))
+			{
+				set(t, 1);
+				set(t + 1000 + random() % 4000, 0);
+			}
+			t = climb;
+			const auto peak = static_cast<std::uint8_t>(4 + random() % 5);
+			while (value < peak)
+			{
+				t += climb_steps.min + random() % (climb_steps.max - climb_steps.min);
+				set(t, value + 1);
+			}
+			t += 10000 + random() % 30000;
+			while (value > 0)
+			{
+				t += 300 + random() % 700;
+				set(t, value - 1);
+			}
+		}
+		return changes;
+	}
+
+	struct setup_t
+	{
+		const char *name;
+		std::uint32_t slow_ms;
+		bool adaptive;
+		// The central moves a link to new parameters this many of its old
+		// connection events after asking
+		std::uint32_t update_events;
+	};
+
+	struct link_t
+	{
+		std::uint32_t interval;
+		std::uint32_t next_event;
+		// Changes of the server so far, and those the client heard of
+		std::size_t next_change;
+		std::size_t heard;
+		// Pending parameter update: the new interval and the events to go
+		std::uint32_t update_to;
+		std::uint32_t update_in;
+		// An unheard crossing of the switch level, 0 for none
+		std::uint32_t crossed_at;
+	};
+
+	void run(const setup_t& setup, const std::vector<std::vector<change_t>>& servers)
+	{
+		conn_param_policy policy;
+		std::vector<link_t> links(SERVERS);
+		for (std::size_t i = 0; i < SERVERS; i++)
+		{
+			links[i] = {setup.slow_ms, static_cast<std::uint32_t>(i * setup.slow_ms / SERVERS), 0, 0, 0, 0, 0};
+			policy.on_connected(i, 0);
+		}
+
+		std::vector<std::uint32_t> latency;
+		std::uint64_t events = 0;
+		std::uint32_t fast_ms = 0;
+		for (std::uint32_t now = 0; now < HOUR_MS; now += TICK_MS)
+		{
+			for (std::size_t i = 0; i < SERVERS; i++)
+			{
+				auto& link = links[i];
+				if (link.interval == FAST_MS)
+					fast_ms += TICK_MS;
+
+				const auto& changes = servers[i];
+				auto& next = link.next_change;
+				for (; next < changes.size() && changes[next].at <= now; next++)
+				{
+					const auto before = next > 0 ? changes[next - 1].value : 0;
+					if (before < SWITCH_LEVEL && changes[next].value >= SWITCH_LEVEL && link.crossed_at == 0)
+						link.crossed_at = changes[next].at;
+				}
+
+				if (now < link.next_event)
+					continue;
+				++events;
+
+				if (link.update_in > 0 && --link.update_in == 0)
+				{
+					link.interval = link.update_to;
+					policy.on_update_result(i, true);
+				}
+
+				// Everything notified since the last event comes in this one
+				for (; link.heard < next; link.heard++)
+				{
+					const auto value = changes[link.heard].value;
+					if (link.crossed_at != 0 && value >= SWITCH_LEVEL)
+					{
+						latency.push_back(now - link.crossed_at);
+						link.crossed_at = 0;
+					}
+					if (!setup.adaptive)
+						continue;
+
+					conn_param_policy::decisions_t decisions;
+					const auto count = policy.on_activator(i, value, now, decisions);
+					for (std::size_t d = 0; d < count; d++)
+					{
+						auto& target = links[decisions[d].slot];
+						target.update_to = decisions[d].mode == conn_param_policy::mode_t::FAST ? FAST_MS : setup.slow_ms;
+						target.update_in = setup.update_events;
+					}
+				}
+				link.next_event = now + link.interval;
+			}
+		}
+
+		std::sort(latency.begin(), latency.end());
+		double sum = 0;
+		for (const auto ms : latency)
+			sum += ms;
+		const auto at = [&latency](double q) { return latency[static_cast<std::size_t>(q * (latency.size() - 1))]; };
+		const auto per_second = events * 1000.0 / HOUR_MS;
+		std::printf(
+			"  %-28s %4d crossings heard after mean %5.0f ms, median %5u, p95 %5u, max %5u; "
+			"%6.1f events/s, %5.2f%% radio, %4.1f fast links on average\n",
+			setup.name,
+			static_cast<int>(latency.size()),
+			sum / latency.size(),
+			at(0.5),
+			at(0.95),
+			latency.back(),
+			per_second,
+			per_second * EVENT_MS / 10,
+			static_cast<double>(fast_ms) / HOUR_MS);
+	}
+}
+
+int main()
+{
+	const workload_t workloads[] = {
+		{"climbing a step every 0.2-0.8 s", 200, 800},
+		{"climbing a step every 1-4 s", 1000, 4000},
+	};
+	const setup_t setups[] = {
+		{"slow 4 s everywhere", SLOW_MS, false, 0},
+		{"1 s everywhere", 1000, false, 0},
+		{"fast 50 ms everywhere", FAST_MS, false, 0},
+		{"policy, update in 6 events", SLOW_MS, true, 6},
+		{"policy, update in 2 events", SLOW_MS, true, 2},
+	};
+
+	for (const auto& workload : workloads)
+	{
+		std::mt19937 random(12);
+		std::vector<std::vector<change_t>> servers;
+		for (std::size_t i = 0; i < SERVERS; i++)
+			servers.push_back(activity(workload, random));
+
+		std::printf("%s:\n", workload.name);
+		for (const auto& setup : setups)
+			run(setup, servers);
+	}
+	return 0;
+}
@@ -0,0 +1,249 @@
+// C++ includes
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <vector>
+// C includes
+#include <cstdio>
+// My includes
+#include "connection_pipeline.hpp"
+
+// Sets up every server from a cold start through the connection pipeline,
+// one setup at a time as the old IDLE_TO_BLE sequence did and with more
+// in flight, and prints the time until the last one is ready. The stack
+// answers each request after a latency drawn from the ranges below,
+// longer the more setups share the radio.
+namespace stack
+{
+	struct range_t
+	{
+		std::uint32_t min;
+		std::uint32_t max;
+	};
+
+	// Advertising interval of the server, then the connection request
+	constexpr range_t OPEN = { 80, 400 };
+	// A few connection events each
+	constexpr range_t MTU = { 30, 90 };
+	constexpr range_t SEARCH = { 150, 600 };
+	constexpr range_t WRITE = { 30, 90 };
+	// Local to Bluedroid
+	constexpr range_t REGISTER = { 1, 5 };
+	// Every other setup in flight makes an over the air step this much longer
+	constexpr double CONTENTION = 0.2;
+	// Opens that never complete, in percent
+	std::uint32_t lost_opens = 0;
+
+	struct event_t
+	{
+		std::uint32_t at;
+		std::function<void()> fire;
+	};
+
+	std::vector<event_t> pending;
+	connection_pipeline *pipeline = nullptr;
+	std::mt19937 random(3);
+	std::uint32_t now = 0;
+
+	std::uint32_t draw(range_t r, bool over_the_air = true)
+	{
+		const auto ms = r.min + random() % (r.max - r.min + 1);
+		if (!over_the_air)
+			return ms;
+		const auto others = pipeline->in_flight() > 0 ? pipeline->in_flight() - 1 : 0;
+		return static_cast<std::uint32_t>(ms * (1 + CONTENTION * others));
+	}
+
+	void after(std::uint32_t ms, std::function<void()> fire)
+	{
+		pending.push_back({now + ms, fire});
+	}
+
+	// Earliest pending event, or limit
+	std::uint32_t next(std::uint32_t limit)
+	{
+		for (const auto& e : pending)
+			limit = std::min(limit, e.at);
+		return limit;
+	}
+
+	void fire_due()
+	{
+		std::vector<event_t> due;
+		const auto split = std::stable_partition(pending.begin(), pending.end(),
+			[](const event_t& e) { return e.at > now; });
+		due.assign(split, pending.end());
+		pending.erase(split, pending.end());
+		std::stable_sort(due.begin(), due.end(), [](const event_t& l, const event_t& r) { return l.at < r.at; });
+		for (auto& e : due)
+			e.fire();
+	}
+}
+
+namespace
+{
+	bluetooth_address address_of(std::size_t server)
+	{
+		return bluetooth_address(0xa0, 0, 0, 0, 0, static_cast<std::uint8_t>(server));
+	}
+
+	std::size_t server_of(const bluetooth_address& addr)
+	{
+		std::size_t server = 0;
+		while (address_of(server) != addr)
+			++server;
+		return server;
+	}
+
+	std::uint16_t conn_id_of(std::size_t server)
+	{
+		return static_cast<std::uint16_t>(10 + server);
+	}
+}
+
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t, esp_bd_addr_t addr, esp_ble_addr_type_t, bool)
+{
+	const auto server = server_of(bluetooth_address(addr));
+	if (stack::random() % 100 < stack::lost_opens)
+		return ESP_OK;
+	stack::after(stack::draw(stack::OPEN), [server] { stack::pipeline->on_opened(server, conn_id_of(server)); });
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t, uint16_t) { return ESP_OK; }
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t) { return ESP_OK; }
+
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t, uint16_t conn_id)
+{
+	stack::after(stack::draw(stack::MTU), [conn_id] { stack::pipeline->on_mtu_configured(conn_id); });
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t, uint16_t conn_id, esp_bt_uuid_t *)
+{
+	stack::after(stack::draw(stack::SEARCH), [conn_id] { stack::pipeline->on_discovered(conn_id, ESP_GATT_OK); });
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t, esp_bd_addr_t, uint16_t)
+{
+	stack::after(stack::draw(stack::REGISTER, false), [] { stack::pipeline->on_subscribed(ESP_GATT_OK); });
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_write_char_descr(
+	esp_gatt_if_t, uint16_t conn_id, uint16_t, uint16_t, uint8_t *, esp_gatt_write_type_t, esp_gatt_auth_req_t)
+{
+	stack::after(stack::draw(stack::WRITE), [conn_id]
+	{
+		stack::pipeline->on_notifications_enabled(conn_id, ESP_GATT_OK);
+	});
+	return ESP_OK;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_char_by_uuid(
+	esp_gatt_if_t, uint16_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_char_elem_t *characteristic, uint16_t *count)
+{
+	characteristic->char_handle = 0x2a;
+	*count = 1;
+	return ESP_GATT_OK;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_descr_by_char_handle(
+	esp_gatt_if_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_descr_elem_t *descriptor, uint16_t *count)
+{
+	descriptor->handle = 0x2b;
+	*count = 1;
+	return ESP_GATT_OK;
+}
+
+namespace
+{
+	constexpr int RUNS = 200;
+	constexpr std::uint16_t INTERFACE = 3;
+	// The timers of the pipeline fire at most this late
+	constexpr std::uint32_t STEP_MS = 10;
+
+	struct result_t
+	{
+		std::vector<std::uint32_t> ready_ms;
+		std::size_t skipped = 0;
+	};
+
+	// Time until the pipeline is done with count servers
+	std::uint32_t run(std::size_t count, std::size_t limit, bool cached, result_t& result)
+	{
+		server_table servers;
+		timer_wheel timers(connection_pipeline::MAX_IN_FLIGHT, 10, stack::now);
+		reconnect_engine reconnects;
+		connection_pipeline pipeline(&timers, 0, &reconnects);
+		stack::pipeline = &pipeline;
+		stack::pending.clear();
+
+		for (std::size_t i = 0; i < count; i++)
+		{
+			const auto slot = *servers.add(bluetooth_server_info(address_of(i)));
+			servers.live(slot) = true;
+			if (cached)
+			{
+				servers.notify_handle(slot) = 0x2a;
+				servers.cccd_handle(slot) = 0x2b;
+			}
+		}
+
+		const auto start = stack::now;
+		pipeline.start(INTERFACE, &servers, limit);
+		while (!pipeline.done())
+		{
+			const auto to = stack::next(stack::now + STEP_MS);
+			esp_stub_advance_ms(to - stack::now);
+			stack::now = to;
+			stack::fire_due();
+			timers.advance(stack::now, [&pipeline](std::size_t timer) { pipeline.on_timeout(timer); });
+		}
+		result.skipped += pipeline.skipped();
+		return stack::now - start;
+	}
+
+	void print(std::size_t count, std::size_t limit, bool cached, result_t& r)
+	{
+		std::sort(r.ready_ms.begin(), r.ready_ms.end());
+		double sum = 0;
+		for (const auto ms : r.ready_ms)
+			sum += ms;
+		const auto at = [&r](double q) { return r.ready_ms[static_cast<std::size_t>(q * (r.ready_ms.size() - 1))]; };
+		std::printf(
+			"%2d servers, %d in flight, %-14s %d%% opens lost: ready after mean %6.0f ms, median %6u, p95 %6u, max %6u; %d skipped\n",
+			static_cast<int>(count),
+			static_cast<int>(limit),
+			cached ? "cached handles" : "discovery",
+			static_cast<int>(stack::lost_opens),
+			sum / r.ready_ms.size(),
+			at(0.5),
+			at(0.95),
+			r.ready_ms.back(),
+			static_cast<int>(r.skipped));
+	}
+}
+
+int main()
+{
+	for (const std::uint32_t lost : {0, 5})
+	{
+		stack::lost_opens = lost;
+		for (const auto cached : {false, true})
+		{
+			for (const std::size_t count : {8, 16})
+			{
+				for (std::size_t limit = 1; limit <= connection_pipeline::MAX_IN_FLIGHT; limit++)
+				{
+					result_t result;
+					for (int i = 0; i < RUNS; i++)
+						result.ready_ms.push_back(run(count, limit, cached, result));
+					print(count, limit, cached, result);
+				}
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,356 @@
+// C++ includes
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <vector>
+// C includes
+#include <cstdio>
+// My includes
+#include "state_machine_harness.hpp"
+
+// Moves A2DP from one server to the next, over and over, once through
+// A2DP_TO_BLE then BLE_TO_A2DP and once through the handover, and prints
+// the audio gaps. The state machine is the real one; the stack answers
+// each request after a latency drawn from the ranges below.
+namespace stack
+{
+	struct range_t
+	{
+		std::uint32_t min;
+		std::uint32_t max;
+	};
+
+	// The source stops streaming and confirms
+	constexpr range_t MEDIA_STOP = { 40, 120 };
+	// AVDTP close and L2CAP teardown; the stream stops at once
+	constexpr range_t DISCONNECT = { 150, 400 };
+	// Paging and SDP of a peer with no ACL link
+	constexpr range_t REMOTE_SERVICES = { 600, 1800 };
+	// Paging, SDP, L2CAP and AVDTP setup
+	constexpr range_t CONNECT_COLD = { 1200, 2600 };
+	// The same over the ACL link SDP left behind
+	constexpr range_t CONNECT_WARM = { 250, 600 };
+	// Connected to the first audio packet
+	constexpr range_t STREAM_START = { 100, 300 };
+	// An idle ACL link is dropped after this long
+	constexpr std::uint32_t ACL_IDLE_MS = 5000;
+
+	struct event_t
+	{
+		std::uint32_t at;
+		std::function<void()> fire;
+	};
+
+	std::mutex mutex;
+	std::vector<event_t> pending;
+	state_machine *machine = nullptr;
+	std::mt19937 random(16);
+	std::uint32_t now = 0;
+	// Peer that does not answer this run, 0 for none
+	std::uint64_t unreachable = 0;
+	// Peer with an ACL link and until when it stays up
+	std::uint64_t warm_peer = 0;
+	std::uint32_t warm_until = 0;
+	// Audio of the current run
+	std::uint32_t audio_off = 0;
+	std::uint32_t audio_on = 0;
+	bool streaming = false;
+
+	// Caller holds mutex
+	std::uint32_t draw(range_t r)
+	{
+		return r.min + random() % (r.max - r.min + 1);
+	}
+
+	void after(std::uint32_t ms, std::function<void()> fire)
+	{
+		pending.push_back({now + ms, fire});
+	}
+
+	void stop_audio(std::uint32_t at)
+	{
+		if (streaming)
+			audio_off = at;
+		streaming = false;
+	}
+
+	bool idle()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return pending.empty();
+	}
+
+	// Earliest pending event, or limit
+	std::uint32_t next(std::uint32_t limit)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const auto& e : pending)
+			limit = std::min(limit, e.at);
+		return limit;
+	}
+
+	void fire_due()
+	{
+		std::vector<event_t> due;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			const auto split = std::stable_partition(pending.begin(), pending.end(),
+				[](const event_t& e) { return e.at > now; });
+			due.assign(split, pending.end());
+			pending.erase(split, pending.end());
+		}
+		std::stable_sort(due.begin(), due.end(), [](const event_t& l, const event_t& r) { return l.at < r.at; });
+		for (auto& e : due)
+			e.fire();
+	}
+}
+
+esp_err_t esp_a2d_sink_connect(esp_bd_addr_t addr)
+{
+	std::lock_guard<std::mutex> lock(stack::mutex);
+	const auto peer = bluetooth_address(addr).packed();
+	if (peer == stack::unreachable)
+		return ESP_OK;
+
+	const auto warm = peer == stack::warm_peer && stack::now < stack::warm_until;
+	const auto connected = stack::draw(warm ? stack::CONNECT_WARM : stack::CONNECT_COLD);
+	const auto audio = connected + stack::draw(stack::STREAM_START);
+	stack::after(connected, [] { stack::machine->notify_a2dp_connected(); });
+	stack::after(audio, []
+	{
+		std::lock_guard<std::mutex> lock(stack::mutex);
+		stack::streaming = true;
+		stack::audio_on = stack::now;
+	});
+	return ESP_OK;
+}
+
+esp_err_t esp_a2d_sink_disconnect(esp_bd_addr_t)
+{
+	std::lock_guard<std::mutex> lock(stack::mutex);
+	stack::stop_audio(stack::now);
+	stack::after(0, [] { stack::machine->notify_a2dp_disconnecting(); });
+	stack::after(stack::draw(stack::DISCONNECT), [] { stack::machine->notify_a2dp_disconnected(); });
+	return ESP_OK;
+}
+
+esp_err_t esp_a2d_media_ctrl(esp_a2d_media_ctrl_t)
+{
+	std::lock_guard<std::mutex> lock(stack::mutex);
+	const auto stopped = stack::draw(stack::MEDIA_STOP);
+	stack::after(stopped, []
+	{
+		{
+			std::lock_guard<std::mutex> lock(stack::mutex);
+			stack::stop_audio(stack::now);
+		}
+		stack::machine->notify_a2dp_media_stopped();
+	});
+	return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_get_remote_services(esp_bd_addr_t addr)
+{
+	std::lock_guard<std::mutex> lock(stack::mutex);
+	const auto peer = bluetooth_address(addr).packed();
+	if (peer == stack::unreachable)
+		return ESP_OK;
+
+	stack::after(stack::draw(stack::REMOTE_SERVICES), [peer]
+	{
+		{
+			std::lock_guard<std::mutex> lock(stack::mutex);
+			stack::warm_peer = peer;
+			stack::warm_until = stack::now + stack::ACL_IDLE_MS;
+		}
+		stack::machine->notify_peer_prepared(bluetooth_address(peer), true);
+	});
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *) { return ESP_OK; }
+esp_err_t esp_ble_gap_start_scanning(uint32_t) { return ESP_OK; }
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t) { return ESP_OK; }
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t, esp_bd_addr_t, esp_ble_addr_type_t, bool) { return ESP_OK; }
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t, uint16_t) { return ESP_OK; }
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t, uint16_t) { return ESP_OK; }
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t, uint16_t, esp_bt_uuid_t *) { return ESP_OK; }
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t, esp_bd_addr_t, uint16_t) { return ESP_OK; }
+esp_err_t esp_ble_gattc_write_char_descr(
+	esp_gatt_if_t, uint16_t, uint16_t, uint16_t, uint8_t *, esp_gatt_write_type_t, esp_gatt_auth_req_t) { return ESP_OK; }
+esp_gatt_status_t esp_ble_gattc_get_char_by_uuid(
+	esp_gatt_if_t, uint16_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_char_elem_t *, uint16_t *) { return ESP_GATT_ERROR; }
+esp_gatt_status_t esp_ble_gattc_get_descr_by_char_handle(
+	esp_gatt_if_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_descr_elem_t *, uint16_t *) { return ESP_GATT_ERROR; }
+
+esp_err_t nvs_open(const char *, nvs_open_mode, nvs_handle *) { return ESP_FAIL; }
+void nvs_close(nvs_handle) {}
+esp_err_t nvs_set_blob(nvs_handle, const char *, const void *, size_t) { return ESP_FAIL; }
+esp_err_t nvs_get_blob(nvs_handle, const char *, void *, size_t *) { return ESP_FAIL; }
+esp_err_t nvs_commit(nvs_handle) { return ESP_FAIL; }
+
+namespace
+{
+	using state_t = state_machine::state_t;
+
+	constexpr int RUNS = 200;
+	// Of the runs, the next peer is out of range in one in this many
+	constexpr int UNREACHABLE_EVERY = 10;
+	// The timers of the state machine fire at most this late
+	constexpr std::uint32_t STEP_MS = 250;
+	constexpr std::uint32_t RUN_LIMIT_MS = 60000;
+
+	const bluetooth_address PEERS[] = {
+		bluetooth_address(0x10, 0x11, 0x12, 0x13, 0x14, 0x15),
+		bluetooth_address(0x20, 0x21, 0x22, 0x23, 0x24, 0x25),
+		bluetooth_address(0x30, 0x31, 0x32, 0x33, 0x34, 0x35),
+	};
+	constexpr std::size_t PEER_COUNT = sizeof(PEERS) / sizeof(PEERS[0]);
+
+	// Moves the clock to the next answer of the stack, at most a step at a
+	// time so the timers of the state machine fire on time
+	void step(state_machine_harness& h)
+	{
+		const auto to = stack::next(stack::now + STEP_MS);
+		h.advance(to - stack::now);
+		{
+			std::lock_guard<std::mutex> lock(stack::mutex);
+			stack::now = to;
+		}
+		stack::fire_due();
+		h.settle();
+	}
+
+	template<typename F>
+	bool run_until(state_machine_harness& h, F done)
+	{
+		const auto limit = stack::now + RUN_LIMIT_MS;
+		while (!done())
+		{
+			if (stack::now > limit)
+				return false;
+			step(h);
+		}
+		return true;
+	}
+
+	bool streaming_from(state_machine_harness& h, std::size_t slot)
+	{
+		std::lock_guard<std::mutex> lock(stack::mutex);
+		return stack::streaming && h.machine().a2dp_address() == PEERS[slot];
+	}
+
+	void connect(state_machine_harness& h, std::size_t slot)
+	{
+		h.machine().ble_to_a2dp(slot);
+		h.settle();
+		run_until(h, [&h, slot] { return streaming_from(h, slot) || (h.state() == state_t::BLE && stack::idle()); });
+	}
+
+	struct result_t
+	{
+		std::vector<std::uint32_t> gaps;
+		int kept = 0;
+		int lost = 0;
+	};
+
+	void print(const char *name, result_t& r)
+	{
+		std::sort(r.gaps.begin(), r.gaps.end());
+		double sum = 0;
+		for (const auto g : r.gaps)
+			sum += g;
+		const auto at = [&r](double q) { return r.gaps[static_cast<std::size_t>(q * (r.gaps.size() - 1))]; };
+		std::printf(
+			"%-12s %3d moved: gap mean %5.0f ms, median %5u, p95 %5u, max %5u; peer out of range: %d kept the old peer, %d lost audio\n",
+			name,
+			static_cast<int>(r.gaps.size()),
+			sum / r.gaps.size(),
+			at(0.5),
+			at(0.95),
+			r.gaps.back(),
+			r.kept,
+			r.lost);
+	}
+
+	// One move from the current peer to the next one
+	template<typename F>
+	void measure(state_machine_harness& h, std::size_t& current, int run, result_t& result, F move)
+	{
+		const auto next = (current + 1) % PEER_COUNT;
+		{
+			std::lock_guard<std::mutex> lock(stack::mutex);
+			stack::unreachable = run % UNREACHABLE_EVERY == UNREACHABLE_EVERY - 1 ? PEERS[next].packed() : 0;
+			stack::audio_off = stack::audio_on = stack::now;
+		}
+
+		move(next);
+
+		std::lock_guard<std::mutex> lock(stack::mutex);
+		if (stack::streaming && h.machine().a2dp_address() == PEERS[next])
+		{
+			result.gaps.push_back(stack::audio_on - stack::audio_off);
+			current = next;
+		}
+		else if (stack::streaming)
+		{
+			++result.kept;
+		}
+		else
+		{
+			++result.lost;
+		}
+		stack::unreachable = 0;
+	}
+}
+
+int main()
+{
+	// Never destroyed, the handler thread runs until exit
+	auto& h = *new state_machine_harness({PEERS[0], PEERS[1], PEERS[2]});
+	stack::machine = &h.machine();
+	h.machine().start();
+	h.machine().idle_to_ble(3, &h.servers(), nullptr);
+	h.settle();
+	h.machine().notify_scan_finished();
+	h.settle();
+
+	std::size_t current = 0;
+	connect(h, current);
+
+	// A2DP_TO_BLE, then BLE_TO_A2DP as soon as BLE is reached
+	result_t teardown;
+	for (int run = 0; run < RUNS; run++)
+	{
+		measure(h, current, run, teardown, [&h](std::size_t next)
+		{
+			h.machine().a2dp_to_ble();
+			h.settle();
+			run_until(h, [&h] { return h.state() == state_t::BLE; });
+			connect(h, next);
+		});
+
+		// Audio back on a peer in range before the next run
+		if (!streaming_from(h, current))
+		{
+			run_until(h, [&h] { return h.state() == state_t::BLE; });
+			connect(h, current);
+		}
+	}
+
+	result_t handover;
+	for (int run = 0; run < RUNS; run++)
+	{
+		measure(h, current, run, handover, [&h](std::size_t next)
+		{
+			h.machine().handover(next);
+			h.settle();
+			run_until(h, [&h, next] { return h.state() == state_t::A2DP && (streaming_from(h, next) || stack::idle()); });
+		});
+	}
+
+	print("a2dp->ble->a2dp", teardown);
+	print("handover", handover);
+	return 0;
+}
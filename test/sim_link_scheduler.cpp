@@ -0,0 +1,255 @@
+// C++ includes
+#include <algorithm>
+#include <random>
+#include <vector>
+// C includes
+#include <cstdio>
+// My includes
+#include "link_scheduler.hpp"
+#include "reconnect_engine.hpp"
+
+// Thirty servers watched through the links the controller holds, built
+// with CONFIG_BT_ACL_CONNECTIONS 8 so seven are for BLE. Every ROTATE_MS
+// the scheduler plans the set as state_machine::rotate_links() does; a
+// link it picks is set up after a second or so, two at a time, and then
+// hears every change of its server. Prints per server the fraction of the
+// time it held a link and the age of the client's last sample of it, and
+// how long a climb past the switch level took to be heard, once with no
+// server advertising its activator and once with half of them doing so.
+namespace
+{
+	constexpr std::size_t SERVERS = 30;
+	constexpr std::uint32_t DURATION_MS = 3600 * 1000;
+	constexpr std::uint32_t STEP_MS = 100;
+	constexpr std::uint8_t SWITCH_LEVEL = 3;
+	// Open, MTU and subscribe, then the first notification
+	constexpr std::uint32_t SETUP_MIN_MS = 600;
+	constexpr std::uint32_t SETUP_MAX_MS = 1500;
+	// The background scan hears an advertising server in one of its
+	// 1.28 s windows with this chance, in percent
+	constexpr std::uint32_t SCAN_MS = 1280;
+	constexpr std::uint32_t HEARD_PER_SCAN = 40;
+
+	static_assert(link_scheduler::LINKS == 7, "built with CONFIG_BT_ACL_CONNECTIONS 8");
+
+	struct change_t
+	{
+		std::uint32_t at;
+		std::uint8_t value;
+	};
+
+	// Mostly 0 with blips to 1; every 5 minutes or so a climb to 4-8 that
+	// holds for a while and falls back
+	std::vector<change_t> activity(std::mt19937& random)
+	{
+		std::vector<change_t> changes;
+		std::uint8_t value = 0;
+		const auto set = [&](std::uint32_t at, std::uint8_t v)
+		{
+			if (v != value)
+				changes.push_back({at, v});
+			value = v;
+		};
+
+		std::exponential_distribution<double> quiet(1 / 300000.0);
+		std::exponential_distribution<double> blip(1 / 30000.0);
+		std::uint32_t t = 0;
+		while (t < DURATION_MS)
+		{
+			const auto climb = t + static_cast<std::uint32_t>(quiet(random));
+			for (t += static_cast<std::uint32_t>(blip(random)); t < climb; t += static_cast<std::uint32_t>(blip(random)))
+			{
+				set(t, 1);
+				set(t + 1000 + random() % 4000, 0);
+			}
+			t = climb;
+			const auto peak = static_cast<std::uint8_t>(4 + random() % 5);
+			while (value < peak)
+			{
+				t += 200 + random() % 600;
+				set(t, value + 1);
+			}
+			t += 10000 + random() % 30000;
+			while (value > 0)
+			{
+				t += 300 + random() % 700;
+				set(t, value - 1);
+			}
+		}
+		return changes;
+	}
+
+	struct server_t
+	{
+		std::vector<change_t> changes;
+		std::size_t next_change = 0;
+		std::uint8_t value = 0;
+		bool advertises = false;
+		// Link being set up, ready at this time; 0 for none
+		std::uint32_t ready_at = 0;
+		// An unheard crossing of the switch level, 0 for none; if the next
+		// sample is below it again the climb was missed
+		std::uint32_t crossed_at = 0;
+
+		std::uint32_t linked_ms = 0;
+		double age_sum = 0;
+		std::uint32_t age_max = 0;
+	};
+
+	struct result_t
+	{
+		std::vector<server_t> servers;
+		std::vector<std::uint32_t> heard_after_ms;
+		std::size_t missed = 0;
+		std::uint32_t rotations;
+	};
+
+	result_t run(std::size_t advertising, unsigned seed)
+	{
+		std::mt19937 random(seed);
+		server_table table;
+		link_scheduler scheduler;
+		result_t r;
+		r.servers.resize(SERVERS);
+		for (std::size_t i = 0; i < SERVERS; i++)
+		{
+			table.add(bluetooth_server_info(bluetooth_address(0x24, 0x0a, 0xc4, 0x00, 0x02, static_cast<std::uint8_t>(i))));
+			r.servers[i].changes = activity(random);
+			r.servers[i].advertises = i < advertising;
+		}
+
+		// The client heard value; a crossing it was waiting for is heard now
+		const auto sample = [&](std::size_t slot, std::uint32_t now)
+		{
+			auto& s = r.servers[slot];
+			link_scheduler::on_sample(table, slot, s.value, now);
+			if (s.crossed_at == 0)
+				return;
+			if (s.value >= SWITCH_LEVEL)
+				r.heard_after_ms.push_back(now - s.crossed_at);
+			else
+				++r.missed;
+			s.crossed_at = 0;
+		};
+
+		for (std::uint32_t now = STEP_MS; now < DURATION_MS; now += STEP_MS)
+		{
+			for (std::size_t slot = 0; slot < SERVERS; slot++)
+			{
+				auto& s = r.servers[slot];
+				auto changed = false;
+				for (; s.next_change < s.changes.size() && s.changes[s.next_change].at <= now; s.next_change++)
+				{
+					if (s.value < SWITCH_LEVEL && s.changes[s.next_change].value >= SWITCH_LEVEL && s.crossed_at == 0)
+						s.crossed_at = s.changes[s.next_change].at;
+					s.value = s.changes[s.next_change].value;
+					changed = true;
+				}
+
+				// Notified on every change, or heard by the scan now and then
+				if (table.ble_connected(slot) && changed)
+					sample(slot, now);
+				else if (s.advertises && now % SCAN_MS < STEP_MS && random() % 100 < HEARD_PER_SCAN)
+					sample(slot, now);
+
+				if (s.ready_at != 0 && s.ready_at <= now)
+				{
+					s.ready_at = 0;
+					table.ble_connected(slot) = true;
+					sample(slot, now);
+				}
+			}
+
+			if (now % link_scheduler::ROTATE_MS == 0)
+			{
+				link_scheduler::evictions_t evictions;
+				const auto count = scheduler.plan(table, now, evictions);
+				for (std::size_t i = 0; i < count; i++)
+					table.ble_connected(evictions[i]) = false;
+
+				// Two setups at a time, as reconnect_engine::MAX_IN_FLIGHT
+				std::size_t in_flight = 0;
+				for (const auto& s : r.servers)
+					if (s.ready_at != 0)
+						++in_flight;
+				for (std::size_t slot = 0; slot < SERVERS && in_flight < reconnect_engine::MAX_IN_FLIGHT; slot++)
+				{
+					auto& s = r.servers[slot];
+					if (table.live(slot) && !table.ble_connected(slot) && s.ready_at == 0)
+					{
+						s.ready_at = now + SETUP_MIN_MS + random() % (SETUP_MAX_MS - SETUP_MIN_MS);
+						++in_flight;
+					}
+				}
+			}
+
+			for (std::size_t slot = 0; slot < SERVERS; slot++)
+			{
+				auto& s = r.servers[slot];
+				const auto age = table.ble_connected(slot) ? 0 : now - table.sampled_ms(slot);
+				if (table.ble_connected(slot))
+					s.linked_ms += STEP_MS;
+				s.age_sum += age;
+				s.age_max = std::max(s.age_max, age);
+			}
+		}
+		r.rotations = scheduler.rotations();
+		return r;
+	}
+
+	void print(const char *name, result_t& r)
+	{
+		auto& heard = r.heard_after_ms;
+		std::sort(heard.begin(), heard.end());
+		double sum = 0;
+		for (const auto ms : heard)
+			sum += ms;
+		const auto at = [&heard](double q) { return heard[static_cast<std::size_t>(q * (heard.size() - 1))]; };
+
+		double age_sum = 0;
+		std::uint32_t age_max = 0;
+		for (const auto& s : r.servers)
+		{
+			age_sum += s.age_sum;
+			age_max = std::max(age_max, s.age_max);
+		}
+		std::printf(
+			"%-22s sample age mean %5.1f s, max %5.1f s; %4d crossings heard after mean %5.0f ms, median %5u, p95 %5u, max %6u, %3d missed; %u rotations\n",
+			name,
+			age_sum * STEP_MS / DURATION_MS / SERVERS / 1000,
+			age_max / 1000.0,
+			static_cast<int>(heard.size()),
+			sum / heard.size(),
+			at(0.5),
+			at(0.95),
+			heard.back(),
+			static_cast<int>(r.missed),
+			r.rotations);
+	}
+}
+
+int main()
+{
+	auto none = run(0, 19);
+	auto half = run(SERVERS / 2, 19);
+
+	std::printf("server   none advertising: linked, age mean/max   half advertising: linked, age mean/max\n");
+	for (std::size_t slot = 0; slot < SERVERS; slot++)
+	{
+		const auto& n = none.servers[slot];
+		const auto& h = half.servers[slot];
+		std::printf(
+			"%6d   %25.1f%% %6.1f s %6.1f s   %20.1f%% %6.1f s %6.1f s%s\n",
+			static_cast<int>(slot),
+			100.0 * n.linked_ms / DURATION_MS,
+			n.age_sum * STEP_MS / DURATION_MS / 1000,
+			n.age_max / 1000.0,
+			100.0 * h.linked_ms / DURATION_MS,
+			h.age_sum * STEP_MS / DURATION_MS / 1000,
+			h.age_max / 1000.0,
+			h.advertises ? "  (advertises)" : "");
+	}
+	print("none advertising", none);
+	print("half advertising", half);
+	return 0;
+}
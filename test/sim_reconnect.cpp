@@ -0,0 +1,391 @@
+// C++ includes
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <vector>
+// C includes
+#include <cstdio>
+// My includes
+#include "state_machine_harness.hpp"
+
+// Runs the real state machine in BLE for an hour while the links of its
+// servers drop at random, and now and then a server is out of range for a
+// while, so reconnecting fails until it is back. Prints the fraction of
+// the time each server was monitored, and how long it took to get a
+// dropped server back. The stack answers each request after a latency
+// drawn from the ranges below.
+namespace stack
+{
+	struct range_t
+	{
+		std::uint32_t min;
+		std::uint32_t max;
+	};
+
+	constexpr range_t OPEN = { 80, 400 };
+	constexpr range_t MTU = { 30, 90 };
+	constexpr range_t SEARCH = { 150, 600 };
+	constexpr range_t WRITE = { 30, 90 };
+	constexpr range_t REGISTER = { 1, 5 };
+	constexpr range_t CLOSE = { 10, 50 };
+
+	struct event_t
+	{
+		std::uint32_t at;
+		std::function<void()> fire;
+	};
+
+	struct outage_t
+	{
+		std::uint32_t from;
+		std::uint32_t to;
+	};
+
+	std::mutex mutex;
+	std::vector<event_t> pending;
+	state_machine *machine = nullptr;
+	server_table *servers = nullptr;
+	std::mt19937 random(21);
+	std::uint32_t now = 0;
+	// Links that are up, conn_id to slot
+	std::map<std::uint16_t, std::size_t> links;
+	std::uint16_t next_conn_id = 100;
+	// By slot
+	std::vector<std::vector<outage_t>> outages;
+	// When the link of a slot drops if it is up then, and the next one due
+	std::vector<std::vector<std::uint32_t>> drops;
+	std::vector<std::size_t> next_drop;
+
+	// Caller holds mutex
+	std::uint32_t draw(range_t r)
+	{
+		return r.min + random() % (r.max - r.min + 1);
+	}
+
+	void after(std::uint32_t ms, std::function<void()> fire)
+	{
+		pending.push_back({now + ms, fire});
+	}
+
+	bool in_range(std::size_t slot, std::uint32_t at)
+	{
+		for (const auto& o : outages[slot])
+			if (at >= o.from && at < o.to)
+				return false;
+		return true;
+	}
+
+	std::size_t slot_of(const bluetooth_address& addr)
+	{
+		for (std::size_t slot = 0; slot < servers->size(); slot++)
+			if (servers->address(slot) == addr)
+				return slot;
+		return state_machine::NO_SLOT;
+	}
+
+	// Caller holds mutex
+	void drop(std::uint16_t conn_id)
+	{
+		const auto link = links.find(conn_id);
+		if (link == links.end())
+			return;
+		const auto slot = link->second;
+		links.erase(link);
+		after(0, [conn_id, slot] { machine->notify_ble_disconnected(conn_id, static_cast<std::uint32_t>(slot)); });
+	}
+
+	// Earliest pending event, or limit
+	std::uint32_t next(std::uint32_t limit)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const auto& e : pending)
+			limit = std::min(limit, e.at);
+		return limit;
+	}
+
+	void fire_due()
+	{
+		std::vector<event_t> due;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			const auto split = std::stable_partition(pending.begin(), pending.end(),
+				[](const event_t& e) { return e.at > now; });
+			due.assign(split, pending.end());
+			pending.erase(split, pending.end());
+		}
+		std::stable_sort(due.begin(), due.end(), [](const event_t& l, const event_t& r) { return l.at < r.at; });
+		for (auto& e : due)
+			e.fire();
+	}
+}
+
+// An open to a server out of range is never answered, the pipeline's
+// deadline ends it
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t, esp_bd_addr_t addr, esp_ble_addr_type_t, bool)
+{
+	std::lock_guard<std::mutex> lock(stack::mutex);
+	const auto slot = stack::slot_of(bluetooth_address(addr));
+	const auto at = stack::draw(stack::OPEN);
+	if (!stack::in_range(slot, stack::now + at))
+		return ESP_OK;
+
+	const auto conn_id = stack::next_conn_id++;
+	stack::links[conn_id] = slot;
+	stack::after(at, [conn_id, slot]
+	{
+		stack::machine->notify_ble_opened(conn_id, static_cast<std::uint32_t>(slot));
+	});
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t, uint16_t conn_id)
+{
+	std::lock_guard<std::mutex> lock(stack::mutex);
+	const auto link = stack::links.find(conn_id);
+	if (link == stack::links.end())
+		return ESP_OK;
+	const auto slot = link->second;
+	stack::links.erase(link);
+	stack::after(stack::draw(stack::CLOSE), [conn_id, slot]
+	{
+		stack::machine->notify_ble_disconnected(conn_id, static_cast<std::uint32_t>(slot));
+	});
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t) { return ESP_OK; }
+
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t, uint16_t conn_id)
+{
+	std::lock_guard<std::mutex> lock(stack::mutex);
+	stack::after(stack::draw(stack::MTU), [conn_id] { stack::machine->notify_mtu_configured(conn_id); });
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t, uint16_t conn_id, esp_bt_uuid_t *)
+{
+	std::lock_guard<std::mutex> lock(stack::mutex);
+	stack::after(stack::draw(stack::SEARCH), [conn_id]
+	{
+		stack::machine->notify_services_discovered(conn_id, ESP_GATT_OK);
+	});
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t, esp_bd_addr_t, uint16_t)
+{
+	std::lock_guard<std::mutex> lock(stack::mutex);
+	stack::after(stack::draw(stack::REGISTER), [] { stack::machine->notify_ble_connected(ESP_GATT_OK); });
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_write_char_descr(
+	esp_gatt_if_t, uint16_t conn_id, uint16_t, uint16_t, uint8_t *, esp_gatt_write_type_t, esp_gatt_auth_req_t)
+{
+	std::lock_guard<std::mutex> lock(stack::mutex);
+	stack::after(stack::draw(stack::WRITE), [conn_id]
+	{
+		stack::machine->notify_notifications_enabled(conn_id, ESP_GATT_OK);
+	});
+	return ESP_OK;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_char_by_uuid(
+	esp_gatt_if_t, uint16_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_char_elem_t *characteristic, uint16_t *count)
+{
+	characteristic->char_handle = 0x2a;
+	*count = 1;
+	return ESP_GATT_OK;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_descr_by_char_handle(
+	esp_gatt_if_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_descr_elem_t *descriptor, uint16_t *count)
+{
+	descriptor->handle = 0x2b;
+	*count = 1;
+	return ESP_GATT_OK;
+}
+
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *) { return ESP_OK; }
+esp_err_t esp_ble_gap_start_scanning(uint32_t) { return ESP_OK; }
+
+// Not reached, there is no A2DP here
+esp_err_t esp_a2d_sink_connect(esp_bd_addr_t) { return ESP_OK; }
+esp_err_t esp_a2d_sink_disconnect(esp_bd_addr_t) { return ESP_OK; }
+esp_err_t esp_a2d_media_ctrl(esp_a2d_media_ctrl_t) { return ESP_OK; }
+esp_err_t esp_bt_gap_get_remote_services(esp_bd_addr_t) { return ESP_OK; }
+
+esp_err_t nvs_open(const char *, nvs_open_mode, nvs_handle *) { return ESP_FAIL; }
+void nvs_close(nvs_handle) {}
+esp_err_t nvs_set_blob(nvs_handle, const char *, const void *, size_t) { return ESP_FAIL; }
+esp_err_t nvs_get_blob(nvs_handle, const char *, void *, size_t *) { return ESP_FAIL; }
+esp_err_t nvs_commit(nvs_handle) { return ESP_FAIL; }
+
+namespace
+{
+	using state_t = state_machine::state_t;
+
+	// As many servers as there are links, so the link scheduler has
+	// nothing to rotate and every gap is a drop
+	constexpr std::size_t SERVERS = link_scheduler::LINKS;
+	constexpr std::uint32_t DURATION_MS = 3600 * 1000;
+	// The timers of the state machine fire at most this late
+	constexpr std::uint32_t STEP_MS = 100;
+	// A link that is up drops after this long on average
+	constexpr double DROP_MEAN_MS = 120000;
+	// A server goes out of range this often on average, for 5 to 60 s
+	constexpr double OUTAGE_MEAN_MS = 600000;
+
+	bluetooth_address address_of(std::size_t slot)
+	{
+		return bluetooth_address(0x24, 0x0a, 0xc4, 0x00, 0x01, static_cast<std::uint8_t>(slot));
+	}
+
+	void step(state_machine_harness& h)
+	{
+		const auto to = stack::next(stack::now + STEP_MS);
+		h.advance(to - stack::now);
+		{
+			std::lock_guard<std::mutex> lock(stack::mutex);
+			stack::now = to;
+		}
+		stack::fire_due();
+		h.settle();
+	}
+
+	struct server_t
+	{
+		std::uint32_t monitored_ms = 0;
+		std::uint32_t drops = 0;
+		std::uint32_t dropped_at = 0;
+		bool was_monitored = true;
+		// Gaps the server was in range for, and those it was out of range in part
+		std::vector<std::uint32_t> back_in_range_ms;
+		std::vector<std::uint32_t> back_after_outage_ms;
+	};
+
+	void print_gaps(const char *name, std::vector<std::uint32_t>& gaps)
+	{
+		if (gaps.empty())
+			return;
+		std::sort(gaps.begin(), gaps.end());
+		double sum = 0;
+		for (const auto ms : gaps)
+			sum += ms;
+		const auto at = [&gaps](double q) { return gaps[static_cast<std::size_t>(q * (gaps.size() - 1))]; };
+		std::printf(
+			"dropped while %-12s %3d times, back after mean %5.0f ms, median %5u, p95 %5u, max %5u\n",
+			name,
+			static_cast<int>(gaps.size()),
+			sum / gaps.size(),
+			at(0.5),
+			at(0.95),
+			gaps.back());
+	}
+}
+
+int main()
+{
+	static_assert(SERVERS == 3, "one address per link below");
+	// Never destroyed, the handler thread runs until exit
+	auto& h = *new state_machine_harness({address_of(0), address_of(1), address_of(2)});
+	stack::machine = &h.machine();
+	stack::servers = &h.servers();
+
+	// Linked by the harness under conn_id = slot
+	std::exponential_distribution<double> outage(1 / OUTAGE_MEAN_MS);
+	std::exponential_distribution<double> drop(1 / DROP_MEAN_MS);
+	stack::outages.resize(SERVERS);
+	stack::drops.resize(SERVERS);
+	stack::next_drop.resize(SERVERS);
+	for (std::size_t slot = 0; slot < SERVERS; slot++)
+	{
+		stack::links[static_cast<std::uint16_t>(slot)] = slot;
+		for (auto at = drop(stack::random); at < DURATION_MS; at += drop(stack::random))
+			stack::drops[slot].push_back(static_cast<std::uint32_t>(at));
+		for (auto at = outage(stack::random); at < DURATION_MS; at += outage(stack::random))
+		{
+			const auto from = static_cast<std::uint32_t>(at);
+			stack::outages[slot].push_back({from, from + 5000 + static_cast<std::uint32_t>(stack::random() % 55000)});
+		}
+	}
+
+	h.machine().start();
+	h.machine().idle_to_ble(3, &h.servers(), nullptr);
+	h.settle();
+	h.machine().notify_scan_finished();
+	h.settle();
+	if (h.state() != state_t::BLE)
+		return 1;
+
+	std::vector<server_t> servers(SERVERS);
+	while (stack::now < DURATION_MS)
+	{
+		const auto before = stack::now;
+		{
+			// Every link that is up may drop, and does once out of range
+			std::lock_guard<std::mutex> lock(stack::mutex);
+			std::vector<std::uint16_t> dropping;
+			for (std::size_t slot = 0; slot < SERVERS; slot++)
+			{
+				auto& next = stack::next_drop[slot];
+				auto due = false;
+				for (; next < stack::drops[slot].size() && stack::drops[slot][next] <= stack::now; next++)
+					due = true;
+				if (!due && stack::in_range(slot, stack::now))
+					continue;
+				for (const auto& link : stack::links)
+					if (link.second == slot)
+						dropping.push_back(link.first);
+			}
+			for (const auto conn_id : dropping)
+				stack::drop(conn_id);
+		}
+		step(h);
+
+		for (std::size_t slot = 0; slot < SERVERS; slot++)
+		{
+			auto& s = servers[slot];
+			const auto monitored = h.servers().ble_connected(slot);
+			if (monitored)
+				s.monitored_ms += stack::now - before;
+			if (!monitored && s.was_monitored)
+			{
+				++s.drops;
+				s.dropped_at = stack::now;
+			}
+			else if (monitored && !s.was_monitored)
+			{
+				auto in_range = true;
+				for (const auto& o : stack::outages[slot])
+					if (o.from < stack::now && o.to > s.dropped_at)
+						in_range = false;
+				(in_range ? s.back_in_range_ms : s.back_after_outage_ms).push_back(stack::now - s.dropped_at);
+			}
+			s.was_monitored = monitored;
+		}
+	}
+
+	std::vector<std::uint32_t> in_range;
+	std::vector<std::uint32_t> after_outage;
+	for (std::size_t slot = 0; slot < SERVERS; slot++)
+	{
+		const auto& s = servers[slot];
+		std::uint32_t out_of_range = 0;
+		for (const auto& o : stack::outages[slot])
+			out_of_range += std::min(o.to, DURATION_MS) - o.from;
+		std::printf(
+			"server %d: monitored %5.1f%% of the time, out of range %4.1f%%, %3d drops\n",
+			static_cast<int>(slot),
+			100.0 * s.monitored_ms / DURATION_MS,
+			100.0 * out_of_range / DURATION_MS,
+			static_cast<int>(s.drops));
+		in_range.insert(in_range.end(), s.back_in_range_ms.begin(), s.back_in_range_ms.end());
+		after_outage.insert(after_outage.end(), s.back_after_outage_ms.begin(), s.back_after_outage_ms.end());
+	}
+	print_gaps("in range", in_range);
+	print_gaps("out of range", after_outage);
+	return 0;
+}
@@ -0,0 +1,112 @@
+#ifndef STATE_MACHINE_HARNESS_HPP
+#define STATE_MACHINE_HARNESS_HPP
+
+// C++ includes
+#include <chrono>
+#include <initializer_list>
+#include <thread>
+// C includes
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+// My includes
+#include "server_table.hpp"
+#include "state_machine.hpp"
+#include "trace_buffer.hpp"
+
+// Runs the real handler thread. Its clock is the stub one, moved ahead
+// by advance(); what it did is read back from the trace buffer, the
+// same records tools/trace_decode.py shows.
+class state_machine_harness
+{
+public:
+	// The servers are linked already, the pipeline has nothing to set up
+	explicit state_machine_harness(std::initializer_list<bluetooth_address> servers)
+		: m_servers()
+		, m_machine()
+		, m_state(state_machine::state_t::IDLE)
+		, m_wakes_sent(0)
+		, m_wakes_seen(0)
+	{
+		for (const auto& addr : servers)
+		{
+			const auto slot = *m_servers.add(bluetooth_server_info(addr));
+			m_servers.ble_connected(slot) = true;
+			m_servers.conn_id(slot) = static_cast<std::uint16_t>(slot);
+		}
+	}
+
+	server_table& servers() { return m_servers; }
+	state_machine& machine() { return m_machine; }
+
+	state_machine::state_t state()
+	{
+		read_trace();
+		return m_state;
+	}
+
+	// Returns once the handler took everything sent so far, and every
+	// timer due by now
+	void settle()
+	{
+		// A message that is a no-op or unexpected in every state. The
+		// handler fires timers after dispatching the first one, the
+		// second one marks that done
+		for (int i = 0; i < 2; i++)
+		{
+			m_machine.notify_a2dp_media_started();
+			++m_wakes_sent;
+			const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+			while (read_trace(), m_wakes_seen < m_wakes_sent)
+			{
+				if (std::chrono::steady_clock::now() > deadline)
+				{
+					std::fprintf(stderr, "state_machine: handler stopped answering\n");
+					std::_Exit(1);
+				}
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		}
+	}
+
+	void advance(std::uint32_t ms)
+	{
+		esp_stub_advance_ms(ms);
+		settle();
+	}
+
+private:
+	server_table m_servers;
+	state_machine m_machine;
+	state_machine::state_t m_state;
+	std::size_t m_wakes_sent;
+	std::size_t m_wakes_seen;
+
+	void read_trace()
+	{
+		char *text = nullptr;
+		std::size_t size = 0;
+		auto out = open_memstream(&text, &size);
+		trace_buffer::instance().dump(out);
+		std::fclose(out);
+
+		for (auto line = std::strtok(text, "\n"); line != nullptr; line = std::strtok(nullptr, "\n"))
+		{
+			std::uint8_t bytes[sizeof(trace_buffer::record_t)];
+			if (std::strlen(line) != 2 * sizeof(bytes))
+				continue;
+			for (std::size_t i = 0; i < sizeof(bytes); i++)
+				std::sscanf(line + 2 * i, "%2hhx", &bytes[i]);
+
+			trace_buffer::record_t r;
+			std::memcpy(&r, bytes, sizeof(r));
+			if (r.event == trace_buffer::event_t::STATE)
+				m_state = static_cast<state_machine::state_t>(r.state);
+			else if (r.event == trace_buffer::event_t::MSG && r.arg == static_cast<std::uint32_t>(state_machine::msg_t::A2DP_MEDIA_STARTED))
+				++m_wakes_seen;
+		}
+		std::free(text);
+	}
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef UART_STUB_H
+#define UART_STUB_H
+#include "../esp_stubs.h"
+#include <stddef.h>
+typedef int uart_port_t;
+typedef enum { UART_DATA_8_BITS = 3 } uart_word_length_t;
+typedef enum { UART_PARITY_DISABLE } uart_parity_t;
+typedef enum { UART_STOP_BITS_1 = 1 } uart_stop_bits_t;
+typedef enum { UART_HW_FLOWCTRL_DISABLE } uart_hw_flowcontrol_t;
+#define UART_PIN_NO_CHANGE (-1)
+typedef struct { int baud_rate; uart_word_length_t data_bits; uart_parity_t parity; uart_stop_bits_t stop_bits; uart_hw_flowcontrol_t flow_ctrl; uint8_t rx_flow_ctrl_thresh; } uart_config_t;
+esp_err_t uart_param_config(uart_port_t, const uart_config_t*);
+esp_err_t uart_set_pin(uart_port_t, int, int, int, int);
+esp_err_t uart_driver_install(uart_port_t, int, int, int, void*, int);
+int uart_write_bytes(uart_port_t, const char*, size_t);
+#endif
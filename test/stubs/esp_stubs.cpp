@@ -0,0 +1,59 @@
+// Matching include
+#include "esp_stubs.h"
+// C++ includes
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+// C includes
+#include <cstdarg>
+#include <cstdlib>
+
+void esp_stub_log(char level, const char *tag, const char *format, ...)
+{
+	static const bool verbose = std::getenv("TEST_VERBOSE") != nullptr;
+	if (!verbose)
+		return;
+
+	std::printf("%c (%s) ", level, tag);
+	va_list args;
+	va_start(args, format);
+	std::vprintf(format, args);
+	va_end(args);
+	std::printf("\n");
+}
+
+namespace
+{
+	std::atomic<int64_t> clock_offset_us(0);
+}
+
+int64_t esp_timer_get_time()
+{
+	static const auto start = std::chrono::steady_clock::now();
+	return clock_offset_us.load() + std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+void esp_stub_advance_ms(uint32_t ms)
+{
+	clock_offset_us += int64_t(ms) * 1000;
+}
+
+uint32_t esp_random(void)
+{
+	static std::mt19937 random(1);
+	return random();
+}
+
+// Tasks become detached threads, they never return on the device either
+BaseType_t xTaskCreate(TaskFunction_t task, const char *, uint32_t, void *arg, UBaseType_t, TaskHandle_t *)
+{
+	std::thread(task, arg).detach();
+	return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
@@ -0,0 +1,146 @@
+#ifndef ESP_STUBS_H
+#define ESP_STUBS_H
+
+// Declarations of the ESP-IDF (v3.x) API the client uses, enough for the
+// host tests to compile it. Only what the tests link is defined, in
+// esp_stubs.cpp.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NVS_NO_FREE_PAGES 0x1100
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERROR_CHECK(x) do { esp_err_t r_ = (x); (void)r_; } while (0)
+// Printed only with TEST_VERBOSE set in the environment
+void esp_stub_log(char level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+#define ESP_LOGI(tag, format, ...) esp_stub_log('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) esp_stub_log('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGE(tag, format, ...) esp_stub_log('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) esp_stub_log('D', tag, format, ##__VA_ARGS__)
+inline void esp_log_buffer_hex(const char*, const void*, int) {}
+int64_t esp_timer_get_time();
+// Moves esp_timer_get_time() ahead, for tests that wait out deadlines
+void esp_stub_advance_ms(uint32_t ms);
+#define ESP_BD_ADDR_LEN 6
+typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
+typedef enum { BLE_ADDR_TYPE_PUBLIC = 0, BLE_ADDR_TYPE_RANDOM } esp_ble_addr_type_t;
+typedef uint8_t esp_gatt_if_t;
+#define ESP_GATT_IF_NONE 0xff
+typedef enum { ESP_GATT_OK = 0, ESP_GATT_ERROR = 0x85 } esp_gatt_status_t;
+typedef enum { ESP_BT_STATUS_SUCCESS = 0 } esp_bt_status_t;
+#define ESP_UUID_LEN_16 2
+#define ESP_GATT_UUID_CHAR_CLIENT_CONFIG 0x2902
+typedef struct { uint16_t len; union { uint16_t uuid16; uint32_t uuid32; uint8_t uuid128[16]; } uuid; } esp_bt_uuid_t;
+typedef enum { ESP_GATT_WRITE_TYPE_NO_RSP = 1, ESP_GATT_WRITE_TYPE_RSP } esp_gatt_write_type_t;
+typedef enum { ESP_GATT_AUTH_REQ_NONE = 0 } esp_gatt_auth_req_t;
+typedef struct { uint16_t char_handle; uint8_t properties; esp_bt_uuid_t uuid; } esp_gattc_char_elem_t;
+typedef struct { uint16_t handle; esp_bt_uuid_t uuid; } esp_gattc_descr_elem_t;
+typedef enum { ESP_GATTC_REG_EVT, ESP_GATTC_OPEN_EVT, ESP_GATTC_CLOSE_EVT, ESP_GATTC_SEARCH_CMPL_EVT, ESP_GATTC_NOTIFY_EVT, ESP_GATTC_WRITE_DESCR_EVT, ESP_GATTC_CFG_MTU_EVT, ESP_GATTC_REG_FOR_NOTIFY_EVT, ESP_GATTC_CONNECT_EVT, ESP_GATTC_DISCONNECT_EVT, ESP_GATTC_READ_CHAR_EVT } esp_gattc_cb_event_t;
+typedef union {
+  struct { esp_gatt_status_t status; uint16_t app_id; } reg;
+  struct { uint16_t conn_id; esp_bd_addr_t remote_bda; } connect;
+  struct { esp_gatt_status_t status; uint16_t conn_id; esp_bd_addr_t remote_bda; uint16_t mtu; } open;
+  struct { esp_gatt_status_t status; uint16_t conn_id; uint16_t mtu; } cfg_mtu;
+  struct { esp_gatt_status_t status; uint16_t conn_id; } search_cmpl;
+  struct { esp_gatt_status_t status; uint16_t handle; } reg_for_notify;
+  struct { esp_gatt_status_t status; uint16_t conn_id; uint16_t handle; } write;
+  struct { esp_gatt_status_t status; uint16_t conn_id; uint16_t handle; uint8_t *value; uint16_t value_len; } read;
+  struct { uint16_t conn_id; esp_bd_addr_t remote_bda; uint16_t handle; uint16_t value_len; uint8_t *value; bool is_notify; } notify;
+  struct { int reason; uint16_t conn_id; esp_bd_addr_t remote_bda; } disconnect;
+} esp_ble_gattc_cb_param_t;
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t, esp_bd_addr_t, esp_ble_addr_type_t, bool);
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t, uint16_t);
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t, uint16_t);
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t, uint16_t, esp_bt_uuid_t*);
+esp_gatt_status_t esp_ble_gattc_get_char_by_uuid(esp_gatt_if_t, uint16_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_char_elem_t*, uint16_t*);
+esp_gatt_status_t esp_ble_gattc_get_descr_by_char_handle(esp_gatt_if_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_descr_elem_t*, uint16_t*);
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t, esp_bd_addr_t, uint16_t);
+esp_err_t esp_ble_gattc_write_char_descr(esp_gatt_if_t, uint16_t, uint16_t, uint16_t, uint8_t*, esp_gatt_write_type_t, esp_gatt_auth_req_t);
+esp_err_t esp_ble_gattc_read_char(esp_gatt_if_t, uint16_t, uint16_t, esp_gatt_auth_req_t);
+typedef void (*esp_gattc_cb_t)(esp_gattc_cb_event_t, esp_gatt_if_t, esp_ble_gattc_cb_param_t*);
+esp_err_t esp_ble_gattc_register_callback(esp_gattc_cb_t);
+esp_err_t esp_ble_gattc_app_register(uint16_t);
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t);
+typedef enum { ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT, ESP_GAP_BLE_SCAN_RESULT_EVT, ESP_GAP_BLE_SCAN_START_COMPLETE_EVT, ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT, ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT } esp_gap_ble_cb_event_t;
+typedef enum { ESP_GAP_SEARCH_INQ_RES_EVT, ESP_GAP_SEARCH_INQ_CMPL_EVT } esp_gap_search_evt_t;
+#define ESP_BLE_AD_TYPE_NAME_CMPL 0x09
+#define ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE 0xff
+typedef enum { BLE_SCAN_TYPE_PASSIVE = 0, BLE_SCAN_TYPE_ACTIVE } esp_ble_scan_type_t;
+typedef enum { BLE_SCAN_FILTER_ALLOW_ALL = 0 } esp_ble_scan_filter_t;
+typedef enum { BLE_SCAN_DUPLICATE_DISABLE = 0, BLE_SCAN_DUPLICATE_ENABLE } esp_ble_scan_duplicate_t;
+typedef struct { esp_ble_scan_type_t scan_type; esp_ble_addr_type_t own_addr_type; esp_ble_scan_filter_t scan_filter_policy; uint16_t scan_interval; uint16_t scan_window; esp_ble_scan_duplicate_t scan_duplicate; } esp_ble_scan_params_t;
+typedef union {
+  struct { esp_gap_search_evt_t search_evt; esp_bd_addr_t bda; int rssi; uint8_t ble_adv[62]; esp_ble_addr_type_t ble_addr_type; uint8_t adv_data_len; uint8_t scan_rsp_len; } scan_rst;
+  struct { esp_bt_status_t status; } scan_param_cmpl;
+  struct { esp_bt_status_t status; } scan_start_cmpl;
+  struct { esp_bt_status_t status; } scan_stop_cmpl;
+  struct { esp_bt_status_t status; esp_bd_addr_t bda; uint16_t min_int, max_int, latency, conn_int, timeout; } update_conn_params;
+} esp_ble_gap_cb_param_t;
+typedef struct { esp_bd_addr_t bda; uint16_t min_int, max_int, latency, timeout; } esp_ble_conn_update_params_t;
+esp_err_t esp_ble_gap_start_scanning(uint32_t);
+esp_err_t esp_ble_gap_stop_scanning();
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t*);
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t);
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t*);
+uint8_t *esp_ble_resolve_adv_data(uint8_t*, uint8_t, uint8_t*);
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t, esp_ble_gap_cb_param_t*);
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t);
+typedef enum { ESP_BT_GAP_AUTH_CMPL_EVT, ESP_BT_GAP_DISC_RES_EVT, ESP_BT_GAP_RMT_SRVCS_EVT } esp_bt_gap_cb_event_t;
+typedef union { struct { esp_bd_addr_t bda; esp_bt_status_t stat; uint8_t device_name[249]; } auth_cmpl; struct { esp_bd_addr_t bda; esp_bt_status_t stat; int num_uuids; esp_bt_uuid_t *uuid_list; } rmt_srvcs; } esp_bt_gap_cb_param_t;
+esp_err_t esp_bt_gap_get_remote_services(esp_bd_addr_t);
+typedef enum { ESP_BT_SCAN_MODE_CONNECTABLE_DISCOVERABLE = 2 } esp_bt_scan_mode_t;
+esp_err_t esp_bt_gap_set_scan_mode(esp_bt_scan_mode_t);
+typedef void (*esp_bt_gap_cb_t)(esp_bt_gap_cb_event_t, esp_bt_gap_cb_param_t*);
+esp_err_t esp_bt_gap_register_callback(esp_bt_gap_cb_t);
+esp_err_t esp_bt_dev_set_device_name(const char*);
+typedef struct { int x; } esp_bt_controller_config_t;
+#define BT_CONTROLLER_INIT_CONFIG_DEFAULT() {0}
+typedef enum { ESP_BT_MODE_BTDM = 3 } esp_bt_mode_t;
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t*);
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t);
+esp_err_t esp_bluedroid_init();
+esp_err_t esp_bluedroid_enable();
+typedef enum { ESP_A2D_CONNECTION_STATE_EVT, ESP_A2D_AUDIO_STATE_EVT, ESP_A2D_AUDIO_CFG_EVT, ESP_A2D_MEDIA_CTRL_ACK_EVT } esp_a2d_cb_event_t;
+typedef enum { ESP_A2D_CONNECTION_STATE_DISCONNECTED, ESP_A2D_CONNECTION_STATE_CONNECTING, ESP_A2D_CONNECTION_STATE_CONNECTED, ESP_A2D_CONNECTION_STATE_DISCONNECTING } esp_a2d_connection_state_t;
+typedef enum { ESP_A2D_AUDIO_STATE_REMOTE_SUSPEND, ESP_A2D_AUDIO_STATE_STOPPED, ESP_A2D_AUDIO_STATE_STARTED } esp_a2d_audio_state_t;
+typedef enum { ESP_A2D_MEDIA_CTRL_NONE, ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY, ESP_A2D_MEDIA_CTRL_START, ESP_A2D_MEDIA_CTRL_STOP, ESP_A2D_MEDIA_CTRL_SUSPEND } esp_a2d_media_ctrl_t;
+#define ESP_A2D_MCT_SBC 0
+typedef struct { uint8_t type; union { uint8_t sbc[4]; } cie; } esp_a2d_mcc_t;
+typedef union {
+  struct { esp_a2d_connection_state_t state; esp_bd_addr_t remote_bda; int disc_rsn; } conn_stat;
+  struct { esp_a2d_audio_state_t state; esp_bd_addr_t remote_bda; } audio_stat;
+  struct { esp_bd_addr_t remote_bda; esp_a2d_mcc_t mcc; } audio_cfg;
+  struct { esp_a2d_media_ctrl_t cmd; int status; } media_ctrl_stat;
+} esp_a2d_cb_param_t;
+typedef void (*esp_a2d_cb_t)(esp_a2d_cb_event_t, esp_a2d_cb_param_t*);
+typedef void (*esp_a2d_sink_data_cb_t)(const uint8_t*, uint32_t);
+esp_err_t esp_a2d_register_callback(esp_a2d_cb_t);
+esp_err_t esp_a2d_sink_register_data_callback(esp_a2d_sink_data_cb_t);
+esp_err_t esp_a2d_sink_init();
+esp_err_t esp_a2d_sink_connect(esp_bd_addr_t);
+esp_err_t esp_a2d_sink_disconnect(esp_bd_addr_t);
+esp_err_t esp_a2d_media_ctrl(esp_a2d_media_ctrl_t);
+typedef uint32_t nvs_handle;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode;
+esp_err_t nvs_open(const char*, nvs_open_mode, nvs_handle*);
+void nvs_close(nvs_handle);
+esp_err_t nvs_set_blob(nvs_handle, const char*, const void*, size_t);
+esp_err_t nvs_get_blob(nvs_handle, const char*, void*, size_t*);
+esp_err_t nvs_commit(nvs_handle);
+esp_err_t nvs_flash_init();
+esp_err_t nvs_flash_erase();
+typedef int BaseType_t; typedef unsigned UBaseType_t; typedef uint32_t TickType_t; typedef void* TaskHandle_t;
+#define tskIDLE_PRIORITY 0
+#define portTICK_PERIOD_MS 10
+#define pdMS_TO_TICKS(x) ((x)/10)
+#define pdPASS 1
+typedef void (*TaskFunction_t)(void*);
+BaseType_t xTaskCreate(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*, BaseType_t);
+uint32_t esp_random(void);
+void vTaskDelay(TickType_t);
+
+#endif
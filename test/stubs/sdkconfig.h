@@ -0,0 +1,4 @@
+// A program may set its own, sim_link_scheduler runs with 8
+#ifndef CONFIG_BT_ACL_CONNECTIONS
+#define CONFIG_BT_ACL_CONNECTIONS 4
+#endif
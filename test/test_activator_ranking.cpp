@@ -0,0 +1,82 @@
+// C++ includes
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <vector>
+// My includes
+#include "activator_ranking.hpp"
+#include "check.hpp"
+
+namespace
+{
+	constexpr std::uint8_t UNRANKED = 0xff;
+
+	// Random updates against a plain array; ties may come out in any order,
+	// so only the activators are compared
+	void matches_brute_force()
+	{
+		activator_ranking ranking;
+		std::vector<std::uint8_t> reference(activator_ranking::CAPACITY, UNRANKED);
+		std::mt19937 random(2);
+
+		for (int i = 0; i < 20000; i++)
+		{
+			const auto slot = random() % activator_ranking::CAPACITY;
+			const auto activator = static_cast<std::uint8_t>(random() % 8);
+			ranking.update(slot, activator);
+			reference[slot] = activator;
+
+			std::vector<std::uint8_t> sorted;
+			for (const auto a : reference)
+				if (a != UNRANKED)
+					sorted.push_back(a);
+			std::sort(sorted.begin(), sorted.end(), std::greater<std::uint8_t>());
+			CHECK(ranking.size() == sorted.size());
+
+			const auto top = ranking.top();
+			CHECK(top && reference[*top] == sorted.front());
+
+			activator_ranking::slots_t slots;
+			const auto k = random() % (activator_ranking::CAPACITY + 4);
+			const auto count = ranking.top_k(k, slots);
+			CHECK(count == std::min<std::size_t>(k, sorted.size()));
+			for (std::size_t j = 0; j < count; j++)
+				CHECK(reference[slots[j]] == sorted[j]);
+
+			// Every slot once
+			std::sort(slots.begin(), slots.begin() + count);
+			CHECK(std::adjacent_find(slots.begin(), slots.begin() + count) == slots.begin() + count);
+		}
+	}
+
+	void empty_and_clear()
+	{
+		activator_ranking ranking;
+		activator_ranking::slots_t slots;
+		CHECK(ranking.empty());
+		CHECK(!ranking.top());
+		CHECK(ranking.top_k(3, slots) == 0);
+
+		ranking.update(4, 1);
+		ranking.update(9, 5);
+		CHECK(ranking.top() && *ranking.top() == 9);
+		ranking.update(9, 0);
+		CHECK(ranking.top() && *ranking.top() == 4);
+
+		// Out of range slots are not ranked
+		ranking.update(activator_ranking::CAPACITY, 9);
+		CHECK(ranking.size() == 2);
+
+		ranking.clear();
+		CHECK(ranking.empty());
+		ranking.update(9, 2);
+		CHECK(ranking.size() == 1 && *ranking.top() == 9);
+	}
+}
+
+int main()
+{
+	matches_brute_force();
+	empty_and_clear();
+	return check::result("activator_ranking");
+}
@@ -0,0 +1,178 @@
+// C++ includes
+#include <cmath>
+#include <vector>
+// C includes
+#include <cstdio>
+#include <cstring>
+// My includes
+#include "check.hpp"
+#include "i2s_file.hpp"
+
+namespace
+{
+	using pcm_t = std::vector<std::int16_t>;
+
+	constexpr std::size_t PACKET_BYTES = 2048;
+
+	// Stereo, never a zero sample, so silence in the output is ours
+	pcm_t tone(std::uint32_t ms, std::uint32_t rate)
+	{
+		pcm_t pcm(2 * static_cast<std::size_t>(rate) * ms / 1000);
+		for (std::size_t i = 0; i < pcm.size(); i++)
+			pcm[i] = static_cast<std::int16_t>(16000 + 8000 * std::sin(2 * M_PI * 1000 * (i / 2) / rate + i % 2));
+		return pcm;
+	}
+
+	// What the file got since the last call, as frames
+	pcm_t played()
+	{
+		static long at = 0;
+		std::fflush(i2s_file::out);
+		const auto end = std::ftell(i2s_file::out);
+		pcm_t pcm(static_cast<std::size_t>(end - at) / sizeof(std::int16_t));
+		std::fseek(i2s_file::out, at, SEEK_SET);
+		CHECK(std::fread(pcm.data(), sizeof(std::int16_t), pcm.size(), i2s_file::out) == pcm.size());
+		std::fseek(i2s_file::out, end, SEEK_SET);
+		at = end;
+		return pcm;
+	}
+
+	bool silent(const pcm_t& pcm, std::size_t frame)
+	{
+		return pcm[2 * frame] == 0 && pcm[2 * frame + 1] == 0;
+	}
+
+	std::size_t frames(const pcm_t& pcm)
+	{
+		return pcm.size() / 2;
+	}
+
+	// Runs of silence in frames, in the order they were played
+	std::vector<std::size_t> gaps(const pcm_t& pcm)
+	{
+		std::vector<std::size_t> runs;
+		std::size_t run = 0;
+		for (std::size_t f = 0; f < frames(pcm); f++)
+		{
+			if (silent(pcm, f))
+			{
+				++run;
+			}
+			else if (run != 0)
+			{
+				runs.push_back(run);
+				run = 0;
+			}
+		}
+		return runs;
+	}
+
+	pcm_t without_silence(const pcm_t& pcm)
+	{
+		pcm_t audio;
+		for (std::size_t f = 0; f < frames(pcm); f++)
+			if (!silent(pcm, f))
+				audio.insert(audio.end(), &pcm[2 * f], &pcm[2 * f + 2]);
+		return audio;
+	}
+
+	std::size_t ms_to_frames(std::uint32_t ms)
+	{
+		return sample_rate_converter::OUTPUT_RATE * ms / 1000;
+	}
+
+	// 48 kHz is played as it came, after the jitter buffer filled and
+	// without a gap
+	void passes_48k_through(i2s_file::player& p)
+	{
+		CHECK(i2s_file::installed_rate == static_cast<int>(sample_rate_converter::OUTPUT_RATE));
+
+		const auto source = tone(2000, 48000);
+		p.play({&source, 48000, PACKET_BYTES, 0xffffffff, 0});
+		const auto out = played();
+
+		CHECK(without_silence(out) == source);
+		const auto runs = gaps(out);
+		CHECK(runs.size() == 1);
+		// The DMA buffers start out silent, the file does not see those
+		CHECK(runs.size() == 1 && runs[0] + audio_output::DMA_BUFFERS * audio_output::DMA_FRAMES >= ms_to_frames(audio_output::JITTER_MS));
+		CHECK(runs.size() == 1 && runs[0] <= ms_to_frames(audio_output::JITTER_MS) + audio_output::DMA_FRAMES);
+		CHECK(p.output().underruns() == 0);
+		CHECK(p.pcm().overruns() == 0);
+	}
+
+	// The stream ended: the DMA buffers are zeroed once, not on every pass
+	void zeroes_once_idle(i2s_file::player& p)
+	{
+		CHECK(i2s_file::zeroed == 1);
+		p.output().idle();
+		CHECK(i2s_file::zeroed == 1);
+	}
+
+	// 44.1 kHz comes out at 48 kHz, as long as the source
+	void converts_44k(i2s_file::player& p)
+	{
+		const auto source = tone(2000, 44100);
+		p.play({&source, 44100, PACKET_BYTES, 0xffffffff, 0});
+		const auto audio = without_silence(played());
+
+		const auto expected = static_cast<double>(frames(source)) * 48000 / 44100;
+		CHECK(std::fabs(frames(audio) - expected) <= sample_rate_converter::TAPS);
+		CHECK(p.output().underruns() == 0);
+	}
+
+	// The source stalls mid-stream: one underrun, silence until the jitter
+	// buffer is full again, and not a frame of audio lost
+	void plays_silence_on_underrun(i2s_file::player& p)
+	{
+		const auto source = tone(2000, 48000);
+		p.play({&source, 48000, PACKET_BYTES, 1000, 200});
+		const auto out = played();
+
+		CHECK(without_silence(out) == source);
+		CHECK(p.output().underruns() == 1);
+		const auto runs = gaps(out);
+		CHECK(runs.size() == 2);
+		CHECK(runs.size() == 2 && runs[1] >= ms_to_frames(200));
+		CHECK(runs.size() == 2 && runs[1] <= ms_to_frames(200 + audio_output::JITTER_MS) + 2 * audio_output::DMA_FRAMES);
+	}
+
+	// AUDIO_CFG sizes the jitter buffer in the source's bytes
+	void sizes_jitter_from_the_source_rate()
+	{
+		audio_output output;
+		const std::size_t at_16k = 16000 * audio_output::JITTER_MS / 1000 * audio_output::BYTES_PER_FRAME;
+		CHECK(output.available(at_16k) == 0);
+		output.set_source_rate(16000);
+		CHECK(output.available(at_16k - audio_output::BYTES_PER_FRAME) == 0);
+		CHECK(output.available(at_16k) == audio_output::DMA_BYTES);
+		CHECK(output.source_rate() == 16000);
+		// Whole frames, at most a DMA buffer
+		CHECK(output.available(7) == 4);
+	}
+}
+
+int main()
+{
+	i2s_file::out = std::tmpfile();
+	if (i2s_file::out == nullptr)
+		return 1;
+
+	{
+		i2s_file::player p;
+		passes_48k_through(p);
+		zeroes_once_idle(p);
+	}
+	{
+		i2s_file::player p;
+		converts_44k(p);
+	}
+	{
+		i2s_file::player p;
+		plays_silence_on_underrun(p);
+	}
+	sizes_jitter_from_the_source_rate();
+
+	std::fclose(i2s_file::out);
+	return check::result("audio_output");
+}
@@ -0,0 +1,62 @@
+// C++ includes
+#include <random>
+#include <sstream>
+// C includes
+#include <cstring>
+// My includes
+#include "bluetooth_address.hpp"
+#include "check.hpp"
+
+namespace
+{
+	void packs_bytes_in_order()
+	{
+		esp_bd_addr_t raw = {0x01, 0x23, 0x45, 0x67, 0x89, 0xab};
+		const bluetooth_address addr(raw);
+		CHECK(addr.packed() == 0xab8967452301ull);
+		CHECK(std::memcmp(addr.raw(), raw, sizeof(raw)) == 0);
+		CHECK(addr == bluetooth_address(0x01, 0x23, 0x45, 0x67, 0x89, 0xab));
+
+		// The two top bytes are not part of the address
+		CHECK(bluetooth_address(0xffff000000000001ull).packed() == 1);
+	}
+
+	void formats()
+	{
+		const bluetooth_address addr(0x01, 0x23, 0x45, 0x67, 0x89, 0xab);
+		char buffer[bluetooth_address::STRING_SIZE];
+		CHECK(std::strcmp(format(addr, buffer), "01:23:45:67:89:ab") == 0);
+		CHECK(to_string(addr) == "01:23:45:67:89:ab");
+
+		std::ostringstream out;
+		out << addr;
+		CHECK(out.str() == "01:23:45:67:89:ab");
+	}
+
+	// Ordering is the order of the printed addresses
+	void orders_like_strings()
+	{
+		std::mt19937_64 random(4);
+		for (int i = 0; i < 10000; i++)
+		{
+			// Few distinct bytes so equal prefixes are common
+			esp_bd_addr_t l, r;
+			for (auto j = 0; j < ESP_BD_ADDR_LEN; j++)
+			{
+				l[j] = random() % 3;
+				r[j] = random() % 3;
+			}
+			const bluetooth_address a(l), b(r);
+			CHECK((a < b) == (to_string(a) < to_string(b)));
+			CHECK((a == b) == (to_string(a) == to_string(b)));
+		}
+	}
+}
+
+int main()
+{
+	packs_bytes_in_order();
+	formats();
+	orders_like_strings();
+	return check::result("bluetooth_address");
+}
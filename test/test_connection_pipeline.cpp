@@ -0,0 +1,475 @@
+// C++ includes
+#include <vector>
+// My includes
+#include "check.hpp"
+#include "connection_pipeline.hpp"
+
+// The GATT client API the pipeline calls, reduced to a log of the
+// requests. The answers are given by the tests, in whatever order they
+// like, by calling the pipeline's on_*() as the client does
+namespace gatt
+{
+	enum class request_t
+	{
+		OPEN,
+		CLOSE,
+		DISCONNECT,
+		MTU,
+		SEARCH,
+		REGISTER,
+		WRITE,
+	};
+
+	struct sent_t
+	{
+		request_t request;
+		// Packed address for OPEN, DISCONNECT and REGISTER, conn_id otherwise
+		std::uint64_t target;
+		std::uint16_t handle;
+	};
+
+	std::vector<sent_t> sent;
+	// The next this many requests are refused, as by a busy stack
+	int refusals = 0;
+	// What discovery finds in Bluedroid's attribute cache
+	bool has_characteristic = true;
+	constexpr std::uint16_t NOTIFY_HANDLE = 0x2a;
+	constexpr std::uint16_t CCCD_HANDLE = 0x2b;
+
+	esp_err_t send(request_t request, std::uint64_t target, std::uint16_t handle = 0)
+	{
+		sent.push_back({request, target, handle});
+		if (refusals > 0)
+		{
+			--refusals;
+			return ESP_ERR_INVALID_STATE;
+		}
+		return ESP_OK;
+	}
+
+	// Takes the requests sent since the last call
+	std::vector<sent_t> take()
+	{
+		std::vector<sent_t> taken;
+		taken.swap(sent);
+		return taken;
+	}
+}
+
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t, esp_bd_addr_t addr, esp_ble_addr_type_t, bool)
+{
+	return gatt::send(gatt::request_t::OPEN, bluetooth_address(addr).packed());
+}
+
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t, uint16_t conn_id)
+{
+	return gatt::send(gatt::request_t::CLOSE, conn_id);
+}
+
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t addr)
+{
+	return gatt::send(gatt::request_t::DISCONNECT, bluetooth_address(addr).packed());
+}
+
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t, uint16_t conn_id)
+{
+	return gatt::send(gatt::request_t::MTU, conn_id);
+}
+
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t, uint16_t conn_id, esp_bt_uuid_t *)
+{
+	return gatt::send(gatt::request_t::SEARCH, conn_id);
+}
+
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t, esp_bd_addr_t addr, uint16_t handle)
+{
+	return gatt::send(gatt::request_t::REGISTER, bluetooth_address(addr).packed(), handle);
+}
+
+esp_err_t esp_ble_gattc_write_char_descr(
+	esp_gatt_if_t, uint16_t conn_id, uint16_t handle, uint16_t, uint8_t *, esp_gatt_write_type_t, esp_gatt_auth_req_t)
+{
+	return gatt::send(gatt::request_t::WRITE, conn_id, handle);
+}
+
+esp_gatt_status_t esp_ble_gattc_get_char_by_uuid(
+	esp_gatt_if_t, uint16_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_char_elem_t *characteristic, uint16_t *count)
+{
+	if (!gatt::has_characteristic)
+	{
+		*count = 0;
+		return ESP_GATT_ERROR;
+	}
+	characteristic->char_handle = gatt::NOTIFY_HANDLE;
+	*count = 1;
+	return ESP_GATT_OK;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_descr_by_char_handle(
+	esp_gatt_if_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_descr_elem_t *descriptor, uint16_t *count)
+{
+	descriptor->handle = gatt::CCCD_HANDLE;
+	*count = 1;
+	return ESP_GATT_OK;
+}
+
+namespace
+{
+	using request_t = gatt::request_t;
+	using step_t = connection_pipeline::step_t;
+
+	constexpr std::uint16_t INTERFACE = 3;
+
+	bluetooth_address address_of(std::size_t server)
+	{
+		return bluetooth_address(0xa0, 0, 0, 0, 0, static_cast<std::uint8_t>(server));
+	}
+
+	std::uint16_t conn_id_of(std::size_t server)
+	{
+		return static_cast<std::uint16_t>(10 + server);
+	}
+
+	// A pipeline over count live servers, with its own timers and clock
+	class fixture
+	{
+	public:
+		explicit fixture(std::size_t count)
+			: m_servers()
+			, m_timers(connection_pipeline::MAX_IN_FLIGHT, 10, 0)
+			, m_reconnects()
+			, m_pipeline(&m_timers, 0, &m_reconnects)
+			, m_now_ms(0)
+		{
+			gatt::take();
+			gatt::refusals = 0;
+			gatt::has_characteristic = true;
+			for (std::size_t i = 0; i < count; i++)
+				m_servers.live(*m_servers.add(bluetooth_server_info(address_of(i)))) = true;
+		}
+
+		server_table& servers() { return m_servers; }
+		connection_pipeline& pipeline() { return m_pipeline; }
+
+		void start(std::size_t limit = connection_pipeline::MAX_IN_FLIGHT)
+		{
+			m_pipeline.start(INTERFACE, &m_servers, limit);
+		}
+
+		// Runs the pipeline's timers for ms
+		void advance(std::uint32_t ms)
+		{
+			m_now_ms += ms;
+			m_timers.advance(m_now_ms, [this](std::size_t timer) { m_pipeline.on_timeout(timer); });
+		}
+
+		// Answers every step of server's setup after the open
+		void complete(std::size_t server)
+		{
+			const auto conn_id = conn_id_of(server);
+			m_pipeline.on_opened(server, conn_id);
+			m_pipeline.on_mtu_configured(conn_id);
+			if (m_servers.notify_handle(server) == bluetooth_server_info::INVALID_HANDLE)
+				m_pipeline.on_discovered(conn_id, ESP_GATT_OK);
+			m_pipeline.on_subscribed(ESP_GATT_OK);
+			m_pipeline.on_notifications_enabled(conn_id, ESP_GATT_OK);
+		}
+
+	private:
+		server_table m_servers;
+		timer_wheel m_timers;
+		reconnect_engine m_reconnects;
+		connection_pipeline m_pipeline;
+		std::uint32_t m_now_ms;
+	};
+
+	bool sent(const std::vector<gatt::sent_t>& requests, request_t request, std::uint64_t target)
+	{
+		for (const auto& r : requests)
+			if (r.request == request && r.target == target)
+				return true;
+		return false;
+	}
+
+	bool only(const std::vector<gatt::sent_t>& requests, request_t request, std::uint64_t target)
+	{
+		return requests.size() == 1 && requests[0].request == request && requests[0].target == target;
+	}
+
+	// Three setups overlap, each answer moves on the server it belongs to
+	// whatever order they come in, and a finished setup starts the next
+	void overlaps_setups()
+	{
+		fixture b(5);
+		b.start();
+		auto requests = gatt::take();
+		CHECK(requests.size() == 3);
+		for (std::size_t i = 0; i < 3; i++)
+			CHECK(requests[i].request == request_t::OPEN && requests[i].target == address_of(i).packed());
+		CHECK(b.pipeline().in_flight() == 3);
+
+		// Opens out of order
+		b.pipeline().on_opened(2, conn_id_of(2));
+		CHECK(only(gatt::take(), request_t::MTU, conn_id_of(2)));
+		CHECK(b.servers().conn_id(2) == conn_id_of(2));
+		b.pipeline().on_opened(0, conn_id_of(0));
+		CHECK(only(gatt::take(), request_t::MTU, conn_id_of(0)));
+
+		b.pipeline().on_mtu_configured(conn_id_of(0));
+		CHECK(only(gatt::take(), request_t::SEARCH, conn_id_of(0)));
+		b.pipeline().on_mtu_configured(conn_id_of(2));
+		CHECK(only(gatt::take(), request_t::SEARCH, conn_id_of(2)));
+
+		// Server 2 subscribes first, then server 0
+		b.pipeline().on_discovered(conn_id_of(2), ESP_GATT_OK);
+		requests = gatt::take();
+		CHECK(only(requests, request_t::REGISTER, address_of(2).packed()));
+		CHECK(requests.size() == 1 && requests[0].handle == gatt::NOTIFY_HANDLE);
+		CHECK(b.servers().notify_handle(2) == gatt::NOTIFY_HANDLE);
+		CHECK(b.servers().cccd_handle(2) == gatt::CCCD_HANDLE);
+		b.pipeline().on_discovered(conn_id_of(0), ESP_GATT_OK);
+		CHECK(only(gatt::take(), request_t::REGISTER, address_of(0).packed()));
+
+		// Registration answers carry no conn_id, they go to the servers in
+		// the order they registered
+		b.pipeline().on_subscribed(ESP_GATT_OK);
+		requests = gatt::take();
+		CHECK(only(requests, request_t::WRITE, conn_id_of(2)));
+		CHECK(requests.size() == 1 && requests[0].handle == gatt::CCCD_HANDLE);
+		b.pipeline().on_subscribed(ESP_GATT_OK);
+		CHECK(only(gatt::take(), request_t::WRITE, conn_id_of(0)));
+
+		// Server 0 is done first, its place goes to server 3
+		b.pipeline().on_notifications_enabled(conn_id_of(0), ESP_GATT_OK);
+		CHECK(only(gatt::take(), request_t::OPEN, address_of(3).packed()));
+		CHECK(b.servers().ble_connected(0));
+		CHECK(!b.servers().ble_connected(2));
+		CHECK(b.pipeline().in_flight() == 3);
+
+		b.pipeline().on_notifications_enabled(conn_id_of(2), ESP_GATT_OK);
+		CHECK(only(gatt::take(), request_t::OPEN, address_of(4).packed()));
+		b.complete(1);
+		b.complete(4);
+		b.complete(3);
+		gatt::take();
+
+		CHECK(b.pipeline().done());
+		CHECK(b.pipeline().skipped() == 0);
+		CHECK(b.servers().connected() == 5);
+	}
+
+	// Handles from the cache skip discovery; when the server no longer
+	// has them, enabling fails and they are discovered again
+	void uses_cached_handles()
+	{
+		fixture b(1);
+		b.servers().notify_handle(0) = gatt::NOTIFY_HANDLE + 10;
+		b.servers().cccd_handle(0) = gatt::CCCD_HANDLE + 10;
+		b.start();
+		gatt::take();
+
+		b.pipeline().on_opened(0, conn_id_of(0));
+		b.pipeline().on_mtu_configured(conn_id_of(0));
+		auto requests = gatt::take();
+		CHECK(requests.size() == 2 && requests[1].request == request_t::REGISTER);
+		CHECK(requests.size() == 2 && requests[1].handle == gatt::NOTIFY_HANDLE + 10);
+
+		b.pipeline().on_subscribed(ESP_GATT_OK);
+		CHECK(only(gatt::take(), request_t::WRITE, conn_id_of(0)));
+		b.pipeline().on_notifications_enabled(conn_id_of(0), ESP_GATT_ERROR);
+		CHECK(only(gatt::take(), request_t::SEARCH, conn_id_of(0)));
+		CHECK(b.servers().notify_handle(0) == bluetooth_server_info::INVALID_HANDLE);
+
+		b.pipeline().on_discovered(conn_id_of(0), ESP_GATT_OK);
+		b.pipeline().on_subscribed(ESP_GATT_OK);
+		b.pipeline().on_notifications_enabled(conn_id_of(0), ESP_GATT_OK);
+		gatt::take();
+		CHECK(b.servers().ble_connected(0));
+		CHECK(b.servers().notify_handle(0) == gatt::NOTIFY_HANDLE);
+	}
+
+	// A failed answer is retried after the step's backoff, a missing one
+	// after its deadline, and a server out of retries is closed and
+	// skipped
+	void retries_failed_steps()
+	{
+		fixture b(2);
+		b.start(1);
+		gatt::take();
+
+		const auto& open = connection_pipeline::STEP_POLICIES[static_cast<std::size_t>(step_t::OPENING)];
+		b.pipeline().on_open_failed(0);
+		CHECK(gatt::take().empty());
+		b.advance(open.backoff(1));
+		CHECK(only(gatt::take(), request_t::OPEN, address_of(0).packed()));
+
+		// No MTU answer: asked again after the deadline and the backoff
+		const auto& mtu = connection_pipeline::STEP_POLICIES[static_cast<std::size_t>(step_t::CONFIGURING_MTU)];
+		b.pipeline().on_opened(0, conn_id_of(0));
+		CHECK(only(gatt::take(), request_t::MTU, conn_id_of(0)));
+		b.advance(mtu.deadline_ms);
+		CHECK(gatt::take().empty());
+		b.advance(mtu.backoff(1));
+		CHECK(only(gatt::take(), request_t::MTU, conn_id_of(0)));
+
+		// Discovery fails every time
+		const auto& discover = connection_pipeline::STEP_POLICIES[static_cast<std::size_t>(step_t::DISCOVERING)];
+		b.pipeline().on_mtu_configured(conn_id_of(0));
+		CHECK(only(gatt::take(), request_t::SEARCH, conn_id_of(0)));
+		for (std::uint8_t attempt = 1; attempt <= discover.retries; attempt++)
+		{
+			b.pipeline().on_discovered(conn_id_of(0), ESP_GATT_ERROR);
+			// A failure while backing off is a late answer, not another try
+			b.pipeline().on_discovered(conn_id_of(0), ESP_GATT_ERROR);
+			b.advance(discover.backoff(attempt));
+			CHECK(only(gatt::take(), request_t::SEARCH, conn_id_of(0)));
+		}
+		b.pipeline().on_discovered(conn_id_of(0), ESP_GATT_ERROR);
+
+		auto requests = gatt::take();
+		CHECK(requests.size() == 2);
+		CHECK(sent(requests, request_t::CLOSE, conn_id_of(0)));
+		CHECK(sent(requests, request_t::OPEN, address_of(1).packed()));
+		CHECK(b.pipeline().skipped() == 1);
+		CHECK(!b.servers().ble_connected(0));
+		CHECK(reconnect_engine::holding(b.servers(), 0));
+
+		// A server without the activator characteristic is given up on at once
+		gatt::has_characteristic = false;
+		b.pipeline().on_opened(1, conn_id_of(1));
+		b.pipeline().on_mtu_configured(conn_id_of(1));
+		gatt::take();
+		b.pipeline().on_discovered(conn_id_of(1), ESP_GATT_OK);
+		CHECK(only(gatt::take(), request_t::CLOSE, conn_id_of(1)));
+		CHECK(b.pipeline().skipped() == 2);
+		CHECK(b.pipeline().done());
+	}
+
+	// A request the stack refuses gets no answer; it is retried after the
+	// backoff rather than waiting out the deadline
+	void retries_refused_requests()
+	{
+		fixture b(1);
+		gatt::refusals = 1;
+		b.start();
+		CHECK(only(gatt::take(), request_t::OPEN, address_of(0).packed()));
+		b.advance(connection_pipeline::STEP_POLICIES[static_cast<std::size_t>(step_t::OPENING)].backoff(1));
+		CHECK(only(gatt::take(), request_t::OPEN, address_of(0).packed()));
+
+		// Refused every time, the server is skipped without a link to close
+		gatt::refusals = 100;
+		b.pipeline().on_opened(0, conn_id_of(0));
+		const auto& mtu = connection_pipeline::STEP_POLICIES[static_cast<std::size_t>(step_t::CONFIGURING_MTU)];
+		for (std::uint8_t attempt = 1; attempt <= mtu.retries; attempt++)
+			b.advance(mtu.backoff(attempt));
+		const auto requests = gatt::take();
+		CHECK(requests.size() == 1u + mtu.retries + 1);
+		CHECK(requests.back().request == request_t::CLOSE && requests.back().target == conn_id_of(0));
+		CHECK(b.pipeline().skipped() == 1);
+		CHECK(b.pipeline().done());
+	}
+
+	// Answers for servers that are not at that step are ignored; an open
+	// of a server that was given up on is closed again
+	void ignores_stray_answers()
+	{
+		fixture b(2);
+		b.start(1);
+		gatt::take();
+
+		b.pipeline().on_opened(0, conn_id_of(0));
+		gatt::take();
+		b.pipeline().on_mtu_configured(conn_id_of(1));
+		b.pipeline().on_discovered(conn_id_of(0), ESP_GATT_OK);
+		b.pipeline().on_subscribed(ESP_GATT_OK);
+		b.pipeline().on_notifications_enabled(conn_id_of(0), ESP_GATT_OK);
+		b.pipeline().on_open_failed(1);
+		CHECK(gatt::take().empty());
+		CHECK(b.pipeline().in_flight() == 1);
+
+		b.pipeline().on_opened(1, conn_id_of(1));
+		CHECK(only(gatt::take(), request_t::CLOSE, conn_id_of(1)));
+		CHECK(b.servers().conn_id(1) == bluetooth_server_info::INVALID_CONN_ID);
+	}
+
+	// The oldest registration is answered first, also when one of them
+	// failed and is backing off
+	void matches_subscribes_in_issue_order()
+	{
+		fixture b(3);
+		b.start();
+		gatt::take();
+		for (const std::size_t server : {1, 0, 2})
+		{
+			b.pipeline().on_opened(server, conn_id_of(server));
+			b.pipeline().on_mtu_configured(conn_id_of(server));
+			b.pipeline().on_discovered(conn_id_of(server), ESP_GATT_OK);
+		}
+		gatt::take();
+
+		// Server 1 registered first, its registration fails
+		b.pipeline().on_subscribed(ESP_GATT_ERROR);
+		CHECK(gatt::take().empty());
+		b.pipeline().on_subscribed(ESP_GATT_OK);
+		CHECK(only(gatt::take(), request_t::WRITE, conn_id_of(0)));
+
+		// Server 1 registers again, after server 2
+		const auto& subscribe = connection_pipeline::STEP_POLICIES[static_cast<std::size_t>(step_t::SUBSCRIBING)];
+		b.advance(subscribe.backoff(1));
+		CHECK(only(gatt::take(), request_t::REGISTER, address_of(1).packed()));
+		b.pipeline().on_subscribed(ESP_GATT_OK);
+		CHECK(only(gatt::take(), request_t::WRITE, conn_id_of(2)));
+		b.pipeline().on_subscribed(ESP_GATT_OK);
+		CHECK(only(gatt::take(), request_t::WRITE, conn_id_of(1)));
+	}
+
+	// A dropped link ends its setup at once, without closing what is
+	// already gone, and the next server takes its place
+	void gives_up_on_dropped_links()
+	{
+		fixture b(4);
+		b.start(2);
+		gatt::take();
+
+		// Dropped while discovering
+		b.pipeline().on_opened(0, conn_id_of(0));
+		b.pipeline().on_mtu_configured(conn_id_of(0));
+		gatt::take();
+		b.pipeline().on_dropped(0);
+		CHECK(only(gatt::take(), request_t::OPEN, address_of(2).packed()));
+		CHECK(b.pipeline().skipped() == 1);
+		CHECK(reconnect_engine::holding(b.servers(), 0));
+		// Its late answer finds nothing to move on
+		b.pipeline().on_discovered(conn_id_of(0), ESP_GATT_OK);
+		CHECK(gatt::take().empty());
+
+		// Dropped before its open was seen
+		b.pipeline().on_dropped(1);
+		CHECK(only(gatt::take(), request_t::OPEN, address_of(3).packed()));
+		CHECK(b.pipeline().skipped() == 2);
+
+		// A server that is not being set up
+		b.pipeline().on_dropped(0);
+		CHECK(gatt::take().empty());
+		CHECK(b.pipeline().in_flight() == 2);
+
+		// No timer of the dropped setups is left to fire on the new ones
+		b.advance(60000);
+		const auto requests = gatt::take();
+		CHECK(sent(requests, request_t::OPEN, address_of(2).packed()));
+		CHECK(sent(requests, request_t::OPEN, address_of(3).packed()));
+		CHECK(!sent(requests, request_t::OPEN, address_of(0).packed()));
+	}
+}
+
+int main()
+{
+	overlaps_setups();
+	uses_cached_handles();
+	retries_failed_steps();
+	retries_refused_requests();
+	ignores_stray_answers();
+	matches_subscribes_in_issue_order();
+	gives_up_on_dropped_links();
+	return check::result("connection_pipeline");
+}
@@ -0,0 +1,283 @@
+// C++ includes
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <vector>
+// My includes
+#include "check.hpp"
+#include "state_machine_harness.hpp"
+
+// The radio as far as the BLE setup of a server goes: every request is
+// answered at once, the way a server in range answers it
+namespace radio
+{
+	state_machine *machine = nullptr;
+	server_table *servers = nullptr;
+
+	std::atomic<int> scans(0);
+	std::atomic<std::uint16_t> scan_interval(0);
+	std::atomic<std::uint16_t> scan_window(0);
+	std::atomic<std::uint32_t> scan_seconds(0);
+	std::atomic<int> closes(0);
+	// Packed address of the last open
+	std::atomic<std::uint64_t> opened(0);
+
+	std::uint16_t conn_id_of(std::size_t slot)
+	{
+		return static_cast<std::uint16_t>(10 + slot);
+	}
+
+	std::size_t slot_of(std::uint16_t conn_id)
+	{
+		for (std::size_t slot = 0; slot < servers->size(); slot++)
+			if (servers->conn_id(slot) == conn_id)
+				return slot;
+		return state_machine::NO_SLOT;
+	}
+}
+
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *params)
+{
+	radio::scan_interval = params->scan_interval;
+	radio::scan_window = params->scan_window;
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_start_scanning(uint32_t seconds)
+{
+	radio::scan_seconds = seconds;
+	++radio::scans;
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t, esp_bd_addr_t addr, esp_ble_addr_type_t, bool)
+{
+	const bluetooth_address address(addr);
+	radio::opened = address.packed();
+	for (std::size_t slot = 0; slot < radio::servers->size(); slot++)
+		if (radio::servers->address(slot) == address)
+			radio::machine->notify_ble_opened(radio::conn_id_of(slot), static_cast<std::uint32_t>(slot));
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t, uint16_t conn_id)
+{
+	++radio::closes;
+	radio::machine->notify_ble_disconnected(conn_id, static_cast<std::uint32_t>(radio::slot_of(conn_id)));
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t, uint16_t conn_id)
+{
+	radio::machine->notify_mtu_configured(conn_id);
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t, uint16_t conn_id, esp_bt_uuid_t *)
+{
+	radio::machine->notify_services_discovered(conn_id, ESP_GATT_OK);
+	return ESP_OK;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_char_by_uuid(
+	esp_gatt_if_t, uint16_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_char_elem_t *characteristic, uint16_t *count)
+{
+	characteristic->char_handle = 0x2a;
+	*count = 1;
+	return ESP_GATT_OK;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_descr_by_char_handle(
+	esp_gatt_if_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_descr_elem_t *descriptor, uint16_t *count)
+{
+	descriptor->handle = 0x2b;
+	*count = 1;
+	return ESP_GATT_OK;
+}
+
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t, esp_bd_addr_t, uint16_t)
+{
+	radio::machine->notify_ble_connected(ESP_GATT_OK);
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_write_char_descr(
+	esp_gatt_if_t, uint16_t conn_id, uint16_t, uint16_t, uint8_t *, esp_gatt_write_type_t, esp_gatt_auth_req_t)
+{
+	radio::machine->notify_notifications_enabled(conn_id, ESP_GATT_OK);
+	return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t) { return ESP_OK; }
+
+// Not reached, there is no A2DP here
+esp_err_t esp_a2d_sink_connect(esp_bd_addr_t) { return ESP_OK; }
+esp_err_t esp_a2d_sink_disconnect(esp_bd_addr_t) { return ESP_OK; }
+esp_err_t esp_a2d_media_ctrl(esp_a2d_media_ctrl_t) { return ESP_OK; }
+esp_err_t esp_bt_gap_get_remote_services(esp_bd_addr_t) { return ESP_OK; }
+
+esp_err_t nvs_open(const char *, nvs_open_mode, nvs_handle *) { return ESP_FAIL; }
+void nvs_close(nvs_handle) {}
+esp_err_t nvs_set_blob(nvs_handle, const char *, const void *, size_t) { return ESP_FAIL; }
+esp_err_t nvs_get_blob(nvs_handle, const char *, void *, size_t *) { return ESP_FAIL; }
+esp_err_t nvs_commit(nvs_handle) { return ESP_FAIL; }
+
+namespace
+{
+	using state_t = state_machine::state_t;
+
+	constexpr std::uint32_t STEP_MS = 100;
+
+	bluetooth_address address_of(std::uint8_t i)
+	{
+		return bluetooth_address(0x24, 0x0a, 0xc4, 0x00, 0x00, i);
+	}
+
+	// A server in range, as seen by the scan. A scan window hears an
+	// advertising event when the packet on the window's channel falls
+	// into it. Scan responses are taken to always come back.
+	struct advertiser_t
+	{
+		std::uint32_t interval_us;
+		// One packet on each of the three channels, this far apart
+		std::uint32_t channel_gap_us;
+	};
+
+	constexpr advertiser_t SERVER = { 100000, 400 };
+
+	// Microseconds from boot_us until the scan hears the server
+	std::uint64_t discovery_us(
+		const state_machine::scan_profile_t& scan,
+		const advertiser_t& adv,
+		std::uint64_t boot_us,
+		std::mt19937& random)
+	{
+		const std::uint64_t interval_us = scan.interval * 625u;
+		const std::uint64_t window_us = scan.window * 625u;
+		// The first advertising event, then the interval plus 0..10 ms advDelay
+		auto event = boot_us + random() % adv.interval_us;
+		for (;;)
+		{
+			for (std::uint64_t channel = 0; channel < 3; channel++)
+			{
+				const auto at = event + channel * adv.channel_gap_us;
+				const auto scan_event = at / interval_us;
+				if (scan_event % 3 == channel && at % interval_us < window_us)
+					return at - boot_us;
+			}
+			event += adv.interval_us + random() % 10001;
+		}
+	}
+
+	struct latency_t
+	{
+		double mean_ms;
+		double p95_ms;
+		double max_ms;
+	};
+
+	latency_t discovery(const state_machine::scan_profile_t& scan, std::size_t boots)
+	{
+		std::mt19937 random(20);
+		std::vector<double> ms;
+		for (std::size_t i = 0; i < boots; i++)
+			ms.push_back(discovery_us(scan, SERVER, random() % 60000000u, random) / 1000.0);
+		std::sort(ms.begin(), ms.end());
+		double sum = 0;
+		for (const auto v : ms)
+			sum += v;
+		return {sum / ms.size(), ms[ms.size() * 95 / 100], ms.back()};
+	}
+
+	double airtime(const state_machine::scan_profile_t& scan)
+	{
+		return 100.0 * scan.window / scan.interval;
+	}
+
+	// The background scan costs a few percent of the radio and still
+	// hears a late server within seconds
+	void scan_airtime()
+	{
+		CHECK(airtime(state_machine::BACKGROUND_SCAN) < 2.5);
+
+		const auto background = discovery(state_machine::BACKGROUND_SCAN, 2000);
+		const auto start_up = discovery(state_machine::DISCOVERY_SCAN, 2000);
+		CHECK(start_up.p95_ms < background.p95_ms);
+		CHECK(background.p95_ms < 30000);
+
+		ESP_LOGI("late_join", "%-16s airtime %5.1f%%, heard after mean %7.0f ms, p95 %7.0f ms, max %7.0f ms",
+			"discovery scan", airtime(state_machine::DISCOVERY_SCAN),
+			start_up.mean_ms, start_up.p95_ms, start_up.max_ms);
+		ESP_LOGI("late_join", "%-16s airtime %5.1f%%, heard after mean %7.0f ms, p95 %7.0f ms, max %7.0f ms",
+			"background scan", airtime(state_machine::BACKGROUND_SCAN),
+			background.mean_ms, background.p95_ms, background.max_ms);
+	}
+
+	// What the GAP callback does with a new server's advertisement;
+	// returns how long it took the state machine to open a link to it
+	std::uint32_t join(state_machine_harness& h, std::uint8_t i)
+	{
+		const auto addr = address_of(i);
+		const auto slot = *h.servers().add(bluetooth_server_info(addr));
+		std::uint32_t waited = 0;
+		while (radio::opened != addr.packed() && waited < 4 * link_scheduler::ROTATE_MS + link_scheduler::DWELL_MS)
+		{
+			h.advance(STEP_MS);
+			waited += STEP_MS;
+		}
+		h.settle();
+		CHECK(h.servers().ble_connected(slot));
+		CHECK(h.servers().conn_id(slot) == radio::conn_id_of(slot));
+		return waited;
+	}
+
+	// Servers that boot once the client is in BLE are admitted by the
+	// next link rotation, into a free link or in place of an idle one
+	void admits_late_servers()
+	{
+		// Never destroyed, the handler thread runs until exit
+		auto& h = *new state_machine_harness({address_of(0), address_of(1)});
+		radio::machine = &h.machine();
+		radio::servers = &h.servers();
+		// Linked under these conn_ids
+		for (std::size_t slot = 0; slot < h.servers().size(); slot++)
+			h.servers().conn_id(slot) = radio::conn_id_of(slot);
+
+		h.machine().start();
+		CHECK(h.machine().idle_to_ble(3, &h.servers(), nullptr));
+		h.settle();
+		h.machine().notify_scan_finished();
+		h.settle();
+		CHECK(h.state() == state_t::BLE);
+
+		// The background scan runs without end
+		CHECK(radio::scans == 2);
+		CHECK(radio::scan_seconds == 0);
+		CHECK(radio::scan_interval == state_machine::BACKGROUND_SCAN.interval);
+		CHECK(radio::scan_window == state_machine::BACKGROUND_SCAN.window);
+
+		// Into the free link, without touching the others
+		const auto free_link = join(h, 2);
+		CHECK(free_link <= link_scheduler::ROTATE_MS);
+		CHECK(radio::closes == 0);
+		CHECK(h.servers().connected() == link_scheduler::LINKS);
+
+		// Every link is taken: an idle member makes room once its dwell is over
+		h.advance(link_scheduler::DWELL_MS);
+		const auto rotated = join(h, 3);
+		CHECK(rotated <= link_scheduler::ROTATE_MS);
+		CHECK(radio::closes == 1);
+		CHECK(h.servers().connected() == link_scheduler::LINKS);
+		CHECK(h.state() == state_t::BLE);
+
+		ESP_LOGI("late_join", "admitted after %u ms into a free link, %u ms in place of an idle one",
+			free_link, rotated);
+	}
+}
+
+int main()
+{
+	scan_airtime();
+	admits_late_servers();
+	return check::result("late_join");
+}
@@ -0,0 +1,125 @@
+// C++ includes
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+// C includes
+#include <cstdio>
+#include <cstdlib>
+// My includes
+#include "check.hpp"
+#include "mailbox.hpp"
+
+namespace
+{
+	using namespace std::chrono_literals;
+
+	struct message_t
+	{
+		std::uint32_t producer;
+		std::uint32_t sequence;
+	};
+
+	void lanes_in_priority_order()
+	{
+		mailbox<int, 3, 4> box;
+		box.push(2, 20);
+		box.push(1, 10);
+		box.push(2, 21);
+		box.push(0, 0);
+		box.push(1, 11);
+
+		int value;
+		const int expected[] = {0, 10, 11, 20, 21};
+		for (const auto e : expected)
+			CHECK(box.try_pop(value) && value == e);
+		CHECK(!box.try_pop(value));
+	}
+
+	void full_lane_drops()
+	{
+		mailbox<int, 2, 4> box;
+		for (int i = 0; i < 4; i++)
+			CHECK(box.push(1, i));
+		CHECK(!box.push(1, 4));
+		CHECK(box.dropped() == 1);
+		// Other lanes are unaffected
+		CHECK(box.push(0, 5));
+
+		int value;
+		CHECK(box.try_pop(value) && value == 5);
+		for (int i = 0; i < 4; i++)
+			CHECK(box.try_pop(value) && value == i);
+	}
+
+	void pop_for_times_out()
+	{
+		mailbox<int, 1, 4> box;
+		int value;
+		const auto start = std::chrono::steady_clock::now();
+		CHECK(!box.pop_for(value, 20ms));
+		CHECK(std::chrono::steady_clock::now() - start >= 20ms);
+
+		std::thread producer([&box]
+		{
+			std::this_thread::sleep_for(10ms);
+			box.push(0, 7);
+		});
+		CHECK(box.pop_for(value, 5s) && value == 7);
+		producer.join();
+	}
+
+	// Several producers, a consumer that keeps going to sleep. A lost wakeup
+	// leaves pop() blocked, which the watchdog below turns into a failure.
+	void no_lost_wakeups()
+	{
+		constexpr std::uint32_t PRODUCERS = 4;
+		constexpr std::uint32_t MESSAGES = 50000;
+		mailbox<message_t, 2, 16> box;
+
+		auto consumer = std::async(std::launch::async, [&box]
+		{
+			std::vector<std::uint32_t> next(PRODUCERS, 0);
+			bool ordered = true;
+			for (std::uint32_t i = 0; i < PRODUCERS * MESSAGES; i++)
+			{
+				const auto message = box.pop();
+				ordered &= message.sequence == next[message.producer]++;
+			}
+			return ordered;
+		});
+
+		std::vector<std::thread> producers;
+		for (std::uint32_t p = 0; p < PRODUCERS; p++)
+			producers.emplace_back([&box, p]
+			{
+				for (std::uint32_t i = 0; i < MESSAGES; i++)
+				{
+					// Each producer sticks to one lane so its order is kept
+					while (!box.push(p % 2, {p, i}))
+						std::this_thread::yield();
+					// Let the consumer drain and block now and then
+					if (i % 1024 == 0)
+						std::this_thread::sleep_for(100us);
+				}
+			});
+		for (auto& producer : producers)
+			producer.join();
+
+		if (consumer.wait_for(10s) != std::future_status::ready)
+		{
+			std::fprintf(stderr, "mailbox: consumer never woke up\n");
+			std::_Exit(1);
+		}
+		CHECK(consumer.get());
+	}
+}
+
+int main()
+{
+	lanes_in_priority_order();
+	full_lane_drops();
+	pop_for_times_out();
+	no_lost_wakeups();
+	return check::result("mailbox");
+}
@@ -0,0 +1,135 @@
+// C++ includes
+#include <cmath>
+#include <random>
+#include <vector>
+// My includes
+#include "check.hpp"
+#include "pcm_analysis.hpp"
+
+namespace
+{
+	// The same levels in double, one channel at a time
+	pcm_level_t reference(const std::vector<std::int16_t>& block, std::size_t channels, std::size_t channel)
+	{
+		double sum = 0;
+		double squares = 0;
+		double peak = 0;
+		std::uint32_t clips = 0;
+		const auto frames = block.size() / channels;
+		for (std::size_t i = 0; i < frames; i++)
+		{
+			const double x = block[i * channels + channel];
+			sum += x;
+			squares += x * x;
+			peak = std::max(peak, std::abs(x));
+			clips += std::abs(x) >= 32767;
+		}
+		return {
+			static_cast<float>(std::sqrt(squares / frames) / 32768),
+			static_cast<float>(peak / 32768),
+			static_cast<float>(sum / frames / 32768),
+			clips,
+		};
+	}
+
+	bool close(float a, float b)
+	{
+		return std::abs(a - b) <= 1e-5f + 1e-5f * std::abs(b);
+	}
+
+	std::vector<std::int16_t> random_block(std::mt19937& random, std::size_t samples)
+	{
+		// Some blocks quiet and offset, some loud enough to clip
+		const auto scale = 1 + random() % 40000;
+		const auto offset = static_cast<int>(random() % 2001) - 1000;
+		std::vector<std::int16_t> block(samples);
+		for (auto& x : block)
+		{
+			const auto v = offset + static_cast<int>(random() % (2 * scale + 1)) - static_cast<int>(scale);
+			x = static_cast<std::int16_t>(std::max(-32768, std::min(32767, v)));
+		}
+		return block;
+	}
+
+	template<std::size_t CHANNELS, std::size_t FRAMES>
+	void levels_match_reference()
+	{
+		using kernels = pcm_kernels<CHANNELS, FRAMES>;
+		std::mt19937 random(CHANNELS * 1000 + FRAMES);
+		for (int n = 0; n < 200; n++)
+		{
+			const auto block = random_block(random, kernels::SAMPLES);
+			pcm_level_t levels[CHANNELS];
+			kernels::levels(block.data(), levels);
+
+			for (std::size_t c = 0; c < CHANNELS; c++)
+			{
+				const auto expected = reference(block, CHANNELS, c);
+				CHECK(close(levels[c].rms, expected.rms));
+				CHECK(levels[c].peak == expected.peak);
+				CHECK(close(levels[c].dc_offset, expected.dc_offset));
+				CHECK(levels[c].clips == expected.clips);
+			}
+		}
+	}
+
+	void full_scale()
+	{
+		using kernels = pcm_kernels<1, 4>;
+		const std::int16_t block[] = {-32768, 32767, -32767, 0};
+		pcm_level_t levels[1];
+		kernels::levels(block, levels);
+		CHECK(levels[0].peak == 1.0f);
+		CHECK(levels[0].clips == 3);
+		CHECK(levels[0].dc_offset == -0.25f);
+	}
+
+	// Writes of any size, even splitting a sample, make the same blocks
+	void analyzer_counts_blocks()
+	{
+		constexpr std::size_t FRAMES = 64;
+		pcm_analyzer<2, FRAMES> analyzer;
+		std::mt19937 random(9);
+
+		std::vector<std::int16_t> pcm;
+		// Loud with clips, then silent, then quiet but audible
+		auto loud = random_block(random, 2 * FRAMES);
+		loud[3] = 32767;
+		pcm.insert(pcm.end(), loud.begin(), loud.end());
+		for (std::size_t i = 0; i < 2 * FRAMES; i++)
+			pcm.push_back(static_cast<std::int16_t>(i % 31) - 15);
+		for (std::size_t i = 0; i < 2 * FRAMES; i++)
+			pcm.push_back(i == 5 ? 16 : 0);
+		// Half a block, not analyzed yet
+		pcm.insert(pcm.end(), FRAMES, 1000);
+
+		const auto *bytes = reinterpret_cast<const std::uint8_t *>(pcm.data());
+		const auto size = 2 * pcm.size();
+		for (std::size_t offset = 0; offset < size;)
+		{
+			const auto part = std::min<std::size_t>(1 + random() % 37, size - offset);
+			analyzer.write(bytes + offset, part);
+			offset += part;
+		}
+
+		const auto& metrics = analyzer.metrics();
+		CHECK(metrics.blocks == 3);
+		CHECK(metrics.silent_blocks == 1);
+		CHECK(metrics.clips == reference(loud, 2, 0).clips + reference(loud, 2, 1).clips);
+
+		// The last block counts for the levels
+		const std::vector<std::int16_t> last(pcm.begin() + 4 * FRAMES, pcm.begin() + 6 * FRAMES);
+		CHECK(metrics.channels[1].peak == reference(last, 2, 1).peak);
+		CHECK(metrics.channels[0].peak == 0);
+	}
+}
+
+int main()
+{
+	levels_match_reference<1, 256>();
+	levels_match_reference<2, 512>();
+	levels_match_reference<3, 7>();
+	full_scale();
+	analyzer_counts_blocks();
+	return check::result("pcm_analysis");
+}
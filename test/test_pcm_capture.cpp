@@ -0,0 +1,202 @@
+// C++ includes
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+// C includes
+#include <cstdio>
+#include <cstring>
+// ESP includes
+#include "driver/uart.h"
+// My includes
+#include "check.hpp"
+#include "pcm_capture.hpp"
+
+// Not called, uart_sink() only has to link
+esp_err_t uart_param_config(uart_port_t, const uart_config_t *) { return ESP_OK; }
+esp_err_t uart_set_pin(uart_port_t, int, int, int, int) { return ESP_OK; }
+esp_err_t uart_driver_install(uart_port_t, int, int, int, void *, int) { return ESP_OK; }
+int uart_write_bytes(uart_port_t, const char *, size_t) { return 0; }
+
+namespace
+{
+	using namespace std::chrono_literals;
+	using pcm_t = std::vector<std::int16_t>;
+
+	pcm_t sine(std::size_t frames, std::uint8_t channels, double hz, std::uint32_t rate, double amplitude = 12000)
+	{
+		pcm_t pcm(frames * channels);
+		for (std::size_t i = 0; i < pcm.size(); i++)
+		{
+			const auto channel = i % channels;
+			pcm[i] = static_cast<std::int16_t>(amplitude * std::sin(2 * M_PI * hz * (i / channels) / rate + channel));
+		}
+		return pcm;
+	}
+
+	std::uint16_t get16(const std::uint8_t *p)
+	{
+		return static_cast<std::uint16_t>(p[0] | p[1] << 8);
+	}
+
+	void encodes_header()
+	{
+		pcm_capture capture(1024, true);
+		std::vector<std::uint8_t> frame(pcm_capture::MAX_FRAME_SIZE);
+		const auto pcm = sine(100, 2, 100, 44100, 3000);
+		const auto size = capture.encode(
+			frame.data(), reinterpret_cast<const std::uint8_t *>(pcm.data()), 400, 44100, 2);
+
+		CHECK(get16(&frame[0]) == pcm_capture::MAGIC);
+		CHECK(frame[2] == pcm_capture::VERSION);
+		CHECK(frame[3] == pcm_capture::FLAG_DELTA);
+		CHECK(get16(&frame[12]) == 44100 && get16(&frame[14]) == 0);
+		CHECK(frame[16] == 2);
+		CHECK(get16(&frame[18]) == 100);
+		CHECK(size == pcm_capture::HEADER_SIZE + get16(&frame[20]));
+		// A quiet, low signal shrinks
+		CHECK(size < pcm_capture::HEADER_SIZE + 400);
+		CHECK(capture.frames() == 1);
+
+		// Full scale jumps do not, they go out raw
+		pcm_t jumps(200);
+		for (std::size_t i = 0; i < jumps.size(); i++)
+			jumps[i] = i / 2 % 2 == 0 ? -32768 : 32767;
+		const auto raw = capture.encode(
+			frame.data(), reinterpret_cast<const std::uint8_t *>(jumps.data()), 400, 44100, 2);
+		CHECK(frame[3] == 0);
+		CHECK(raw == pcm_capture::HEADER_SIZE + 400);
+		CHECK(std::memcmp(&frame[pcm_capture::HEADER_SIZE], jumps.data(), 400) == 0);
+	}
+
+	// Writes go through the ring and the drain task to the sink, with
+	// garbage added between them as a noisy line would. The stream and
+	// the PCM tools/pcm_decode.py should get back out of it are left in
+	// dir for pcm_roundtrip.py.
+	void writes_stream(const std::string& dir)
+	{
+		// The drain task never returns, what it uses has to outlive it
+		auto& capture = *new pcm_capture(64 * 1024, true);
+		auto& mutex = *new std::mutex();
+		auto& stream = *new std::vector<std::uint8_t>();
+		capture.start([&mutex, &stream](const std::uint8_t *data, std::size_t len)
+		{
+			std::lock_guard<std::mutex> l(mutex);
+			stream.insert(stream.end(), data, data + len);
+			return len;
+		});
+
+		std::size_t garbage = 0;
+		const auto drained = [&]
+		{
+			const auto deadline = std::chrono::steady_clock::now() + 5s;
+			for (;;)
+			{
+				{
+					std::lock_guard<std::mutex> l(mutex);
+					if (stream.size() == capture.encoded_bytes() + garbage)
+						return true;
+				}
+				if (std::chrono::steady_clock::now() > deadline)
+					return false;
+				std::this_thread::sleep_for(1ms);
+			}
+		};
+		const auto add_garbage = [&](const std::vector<std::uint8_t>& bytes)
+		{
+			std::lock_guard<std::mutex> l(mutex);
+			stream.insert(stream.end(), bytes.begin(), bytes.end());
+			garbage += bytes.size();
+		};
+
+		struct segment_t
+		{
+			std::uint32_t rate;
+			std::uint8_t channels;
+			pcm_t expected;
+		};
+		std::vector<segment_t> segments;
+		std::uint32_t decodable = 0;
+		const auto write = [&](const pcm_t& pcm, std::uint32_t rate, std::uint8_t channels, bool keep)
+		{
+			const auto frames = capture.frames();
+			capture.write(reinterpret_cast<const std::uint8_t *>(pcm.data()), 2 * pcm.size(), rate, channels);
+			CHECK(drained());
+			if (!keep)
+				return;
+
+			decodable += capture.frames() - frames;
+			if (segments.empty() || segments.back().rate != rate || segments.back().channels != channels)
+				segments.push_back({rate, channels, {}});
+			auto& expected = segments.back().expected;
+			expected.insert(expected.end(), pcm.begin(), pcm.end());
+		};
+
+		std::mt19937 random(7);
+		std::vector<std::uint8_t> noise(300);
+		for (auto& b : noise)
+			b = static_cast<std::uint8_t>(random());
+		// The magic, and a header whose payload never arrives
+		const std::vector<std::uint8_t> fake = {'P', 'C', 'P', 'C', 1, 0, 0, 0};
+
+		// Quiet stereo, split into several delta coded frames per write
+		for (int i = 0; i < 3; i++)
+		{
+			write(sine(3000, 2, 60 + 20 * i, 44100, 3000), 44100, 2, true);
+			add_garbage(i == 1 ? fake : noise);
+		}
+		CHECK(capture.encoded_bytes() < capture.pcm_bytes() * 3 / 4);
+
+		// One frame hit on the line: its checksum fails, the decoder skips it
+		write(sine(256, 2, 1000, 44100), 44100, 2, false);
+		{
+			std::lock_guard<std::mutex> l(mutex);
+			stream[stream.size() - 10] ^= 0x40;
+		}
+		write(sine(500, 2, 200, 44100), 44100, 2, true);
+
+		// Full scale noise does not compress and goes out raw
+		pcm_t white(4000);
+		for (auto& s : white)
+			s = static_cast<std::int16_t>(random());
+		write(white, 48000, 2, true);
+		add_garbage(noise);
+
+		// Mono, with full scale steps
+		auto steps = sine(3000, 1, 300, 16000);
+		for (std::size_t i = 0; i < steps.size(); i += 100)
+			steps[i] = i % 200 == 0 ? 32767 : -32768;
+		write(steps, 16000, 1, true);
+
+		CHECK(capture.dropped() == 0);
+		CHECK(segments.size() == 3);
+
+		std::lock_guard<std::mutex> l(mutex);
+		auto out = std::fopen((dir + "/capture.bin").c_str(), "wb");
+		std::fwrite(stream.data(), 1, stream.size(), out);
+		std::fclose(out);
+
+		auto manifest = std::fopen((dir + "/capture.txt").c_str(), "w");
+		std::fprintf(manifest, "frames %u\n", decodable);
+		for (std::size_t i = 0; i < segments.size(); i++)
+		{
+			const auto name = "expected-" + std::to_string(i) + ".pcm";
+			std::fprintf(manifest, "%u %u %s\n", segments[i].rate, segments[i].channels, name.c_str());
+
+			out = std::fopen((dir + "/" + name).c_str(), "wb");
+			std::fwrite(segments[i].expected.data(), 2, segments[i].expected.size(), out);
+			std::fclose(out);
+		}
+		std::fclose(manifest);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	encodes_header();
+	writes_stream(argc > 1 ? argv[1] : ".");
+	return check::result("pcm_capture");
+}
@@ -0,0 +1,145 @@
+// C++ includes
+#include <deque>
+#include <random>
+#include <thread>
+#include <vector>
+// My includes
+#include "check.hpp"
+#include "pcm_ring_buffer.hpp"
+
+namespace
+{
+	void capacity_rounds_up()
+	{
+		CHECK(pcm_ring_buffer(1000).capacity() == 1024);
+		CHECK(pcm_ring_buffer(1024).capacity() == 1024);
+		CHECK(pcm_ring_buffer(1).capacity() == 1);
+	}
+
+	// Random packets against a deque, across many wraps
+	void matches_reference()
+	{
+		pcm_ring_buffer ring(256);
+		std::deque<std::uint8_t> reference;
+		std::mt19937 random(1);
+		std::uint8_t next = 0;
+
+		for (int i = 0; i < 10000; i++)
+		{
+			std::vector<std::uint8_t> packet(random() % 100);
+			for (auto& b : packet)
+				b = next++;
+
+			const auto fits = reference.size() + packet.size() <= ring.capacity();
+			CHECK(ring.write(packet.data(), packet.size()) == fits);
+			if (fits)
+				reference.insert(reference.end(), packet.begin(), packet.end());
+			else
+				next -= packet.size();
+
+			std::vector<std::uint8_t> out(random() % 120);
+			const auto len = ring.read(out.data(), out.size());
+			CHECK(len == std::min(out.size(), reference.size()));
+			for (std::size_t j = 0; j < len; j++)
+			{
+				CHECK(out[j] == reference.front());
+				reference.pop_front();
+			}
+			CHECK(ring.size() == reference.size());
+		}
+	}
+
+	void counts_overruns_and_underruns()
+	{
+		pcm_ring_buffer ring(16);
+		std::uint8_t data[17] = {};
+
+		CHECK(!ring.write(data, sizeof(data)));
+		CHECK(ring.overruns() == 1);
+		CHECK(ring.empty());
+
+		CHECK(ring.read(data, 4) == 0);
+		CHECK(ring.underruns() == 1);
+
+		// A whole packet or nothing
+		CHECK(ring.write(data, 10));
+		CHECK(!ring.write(data, 7));
+		CHECK(ring.size() == 10);
+		CHECK(ring.overruns() == 2);
+	}
+
+	void peek_stops_at_the_wrap()
+	{
+		pcm_ring_buffer ring(16);
+		std::uint8_t data[12];
+		for (std::uint8_t i = 0; i < sizeof(data); i++)
+			data[i] = i;
+
+		CHECK(ring.write(data, 12));
+		std::uint8_t out[12];
+		CHECK(ring.read(out, 10) == 10);
+		CHECK(ring.write(data, 12));
+
+		// 2 bytes left of the first packet, then 4 up to the end of storage
+		const std::uint8_t *p = nullptr;
+		CHECK(ring.peek(p, 100) == 6);
+		CHECK(p[0] == 10 && p[1] == 11 && p[2] == 0);
+		CHECK(ring.size() == 14);
+
+		ring.consume(6);
+		CHECK(ring.peek(p, 100) == 8);
+		CHECK(p[0] == 4 && p[7] == 11);
+		CHECK(ring.peek(p, 3) == 3);
+
+		ring.consume(8);
+		CHECK(ring.empty());
+		CHECK(ring.peek(p, 100) == 0);
+	}
+
+	// One producer and one consumer thread, the bytes come out in order
+	void keeps_order_across_threads()
+	{
+		constexpr std::size_t TOTAL = 1 << 20;
+		pcm_ring_buffer ring(512);
+
+		std::thread producer([&ring]()
+		{
+			std::uint8_t packet[64];
+			std::size_t sent = 0;
+			while (sent < TOTAL)
+			{
+				for (std::size_t i = 0; i < sizeof(packet); i++)
+					packet[i] = static_cast<std::uint8_t>((sent + i) * 7);
+				if (ring.write(packet, sizeof(packet)))
+					sent += sizeof(packet);
+				else
+					std::this_thread::yield();
+			}
+		});
+
+		std::size_t received = 0;
+		std::size_t wrong = 0;
+		while (received < TOTAL)
+		{
+			std::uint8_t out[100];
+			const auto len = ring.read(out, sizeof(out));
+			for (std::size_t i = 0; i < len; i++)
+				wrong += out[i] != static_cast<std::uint8_t>((received + i) * 7);
+			received += len;
+		}
+		producer.join();
+
+		CHECK(wrong == 0);
+		CHECK(ring.empty());
+	}
+}
+
+int main()
+{
+	capacity_rounds_up();
+	matches_reference();
+	counts_overruns_and_underruns();
+	peek_stops_at_the_wrap();
+	keeps_order_across_threads();
+	return check::result("pcm_ring_buffer");
+}
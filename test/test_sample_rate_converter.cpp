@@ -0,0 +1,159 @@
+// C++ includes
+#include <cmath>
+#include <random>
+#include <vector>
+// My includes
+#include "check.hpp"
+#include "sample_rate_converter.hpp"
+
+namespace
+{
+	constexpr auto CHANNELS = sample_rate_converter::CHANNELS;
+	constexpr auto OUTPUT_RATE = sample_rate_converter::OUTPUT_RATE;
+
+	// Stereo sine, the right channel at half the amplitude of the left
+	std::vector<std::int16_t> sine(std::size_t frames, double hz, std::uint32_t rate, double amplitude)
+	{
+		std::vector<std::int16_t> pcm(frames * CHANNELS);
+		for (std::size_t i = 0; i < frames; i++)
+		{
+			const auto x = amplitude * std::sin(2 * M_PI * hz * i / rate);
+			pcm[i * CHANNELS] = static_cast<std::int16_t>(std::lround(x));
+			pcm[i * CHANNELS + 1] = static_cast<std::int16_t>(std::lround(x / 2));
+		}
+		return pcm;
+	}
+
+	// Feeds pcm in blocks of random size, as the A2DP sink does, and
+	// collects the output
+	std::vector<std::int16_t> convert(sample_rate_converter& converter, const std::vector<std::int16_t>& pcm, std::mt19937& random)
+	{
+		std::vector<std::int16_t> result;
+		const auto *in = reinterpret_cast<const std::uint8_t *>(pcm.data());
+		const auto frames = pcm.size() / CHANNELS;
+		for (std::size_t offset = 0; offset < frames;)
+		{
+			const auto block = std::min<std::size_t>(1 + random() % sample_rate_converter::MAX_INPUT_FRAMES, frames - offset);
+			const std::uint8_t *out = nullptr;
+			const auto len = converter.convert(in + offset * sample_rate_converter::BYTES_PER_FRAME, block * sample_rate_converter::BYTES_PER_FRAME, out);
+
+			// Never more than the ratio allows, plus the frame in progress
+			CHECK(len % sample_rate_converter::BYTES_PER_FRAME == 0);
+			CHECK(len / sample_rate_converter::BYTES_PER_FRAME <= block * OUTPUT_RATE / converter.input_rate() + 2);
+
+			const auto *samples = reinterpret_cast<const std::int16_t *>(out);
+			result.insert(result.end(), samples, samples + len / sizeof(std::int16_t));
+			offset += block;
+		}
+		return result;
+	}
+
+	// Amplitude of hz in channel of pcm at rate, and the RMS of what is left
+	void measure(
+		const std::vector<std::int16_t>& pcm,
+		std::size_t channel,
+		double hz,
+		std::uint32_t rate,
+		double& amplitude,
+		double& residual)
+	{
+		const auto frames = pcm.size() / CHANNELS;
+		double s = 0;
+		double c = 0;
+		for (std::size_t i = 0; i < frames; i++)
+		{
+			const auto phase = 2 * M_PI * hz * i / rate;
+			s += pcm[i * CHANNELS + channel] * std::sin(phase);
+			c += pcm[i * CHANNELS + channel] * std::cos(phase);
+		}
+		s *= 2.0 / frames;
+		c *= 2.0 / frames;
+		amplitude = std::hypot(s, c);
+
+		double squares = 0;
+		for (std::size_t i = 0; i < frames; i++)
+		{
+			const auto phase = 2 * M_PI * hz * i / rate;
+			const auto e = pcm[i * CHANNELS + channel] - s * std::sin(phase) - c * std::cos(phase);
+			squares += e * e;
+		}
+		residual = std::sqrt(squares / frames);
+	}
+
+	double db(double ratio)
+	{
+		return 20 * std::log10(ratio);
+	}
+
+	void converts(std::uint32_t rate)
+	{
+		sample_rate_converter converter;
+		converter.set_input_rate(rate);
+		std::mt19937 random(rate);
+
+		// One second: exactly OUTPUT_RATE frames come out, give or take the
+		// one in progress
+		const auto pcm = sine(rate, 1000, rate, 16000);
+		const auto out = convert(converter, pcm, random);
+		CHECK(converter.input_rate() == rate);
+		const auto frames = static_cast<long>(out.size() / CHANNELS);
+		CHECK(std::abs(frames - static_cast<long>(OUTPUT_RATE)) <= 1);
+
+		// Past the filter's start up, a whole number of periods
+		const std::vector<std::int16_t> settled(out.begin() + 480 * CHANNELS, out.begin() + 48000 * CHANNELS);
+		for (std::size_t channel = 0; channel < CHANNELS; channel++)
+		{
+			const auto expected = channel == 0 ? 16000.0 : 8000.0;
+			double amplitude;
+			double residual;
+			measure(settled, channel, 1000, OUTPUT_RATE, amplitude, residual);
+			// Flat passband, images and aliases well down
+			CHECK(std::abs(db(amplitude / expected)) < 0.1);
+			CHECK(db(residual / expected) < -70);
+		}
+
+		// Near the top of the passband, 0.4 of the input rate
+		const auto high = 0.4 * rate;
+		const auto top = convert(converter, sine(rate / 10, high, rate, 16000), random);
+		const std::vector<std::int16_t> top_settled(top.begin() + 480 * CHANNELS, top.end());
+		double amplitude;
+		double residual;
+		measure(top_settled, 0, high, OUTPUT_RATE, amplitude, residual);
+		CHECK(std::abs(db(amplitude / 16000)) < 0.5);
+	}
+
+	void passes_through()
+	{
+		sample_rate_converter converter;
+		std::mt19937 random(1);
+		const auto pcm = sine(300, 1000, OUTPUT_RATE, 16000);
+		const auto *in = reinterpret_cast<const std::uint8_t *>(pcm.data());
+
+		// 48 kHz, and rates without a resampler, are handed back as they are
+		for (const std::uint32_t rate : {OUTPUT_RATE, 22050u})
+		{
+			converter.set_input_rate(rate);
+			const std::uint8_t *out = nullptr;
+			// A trailing half frame is dropped
+			CHECK(converter.convert(in, 2 * pcm.size() - 1, out) == 2 * pcm.size() - sample_rate_converter::BYTES_PER_FRAME);
+			CHECK(out == in);
+		}
+
+		// Blocks over the limit are cut
+		std::vector<std::int16_t> large((sample_rate_converter::MAX_INPUT_FRAMES + 10) * CHANNELS);
+		const std::uint8_t *out = nullptr;
+		CHECK(converter.convert(
+			reinterpret_cast<const std::uint8_t *>(large.data()),
+			2 * large.size(),
+			out) == sample_rate_converter::MAX_INPUT_BYTES);
+	}
+}
+
+int main()
+{
+	converts(16000);
+	converts(32000);
+	converts(44100);
+	passes_through();
+	return check::result("sample_rate_converter");
+}
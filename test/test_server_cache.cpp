@@ -0,0 +1,264 @@
+// C++ includes
+#include <map>
+#include <string>
+#include <vector>
+// C includes
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+// ESP includes
+#include "nvs.h"
+// My includes
+#include "check.hpp"
+#include "server_cache.hpp"
+
+// NVS backed by one file per key under a directory, so what a store()
+// wrote survives into the next "boot". Writes are staged until
+// nvs_commit(), as a cache that forgot to commit would lose them
+namespace nvs
+{
+	std::string dir;
+	// Flash not initialised: every open fails
+	bool broken = false;
+
+	struct open_t
+	{
+		std::string name;
+		nvs_open_mode mode;
+		std::map<std::string, std::vector<std::uint8_t>> staged;
+	};
+
+	std::map<nvs_handle, open_t> handles;
+	nvs_handle next_handle = 1;
+
+	std::string path(const std::string& name, const std::string& key)
+	{
+		return dir + "/" + name + "." + key;
+	}
+
+	bool read(const std::string& file, std::vector<std::uint8_t>& data)
+	{
+		auto in = std::fopen(file.c_str(), "rb");
+		if (in == nullptr)
+			return false;
+		data.clear();
+		std::uint8_t buffer[256];
+		std::size_t got;
+		while ((got = std::fread(buffer, 1, sizeof(buffer), in)) > 0)
+			data.insert(data.end(), buffer, buffer + got);
+		std::fclose(in);
+		return true;
+	}
+
+	void write(const std::string& file, const std::vector<std::uint8_t>& data)
+	{
+		auto out = std::fopen(file.c_str(), "wb");
+		std::fwrite(data.data(), 1, data.size(), out);
+		std::fclose(out);
+	}
+
+	// Size of what is stored under key, -1 if nothing is
+	long stored_size(const std::string& name, const std::string& key)
+	{
+		std::vector<std::uint8_t> data;
+		return read(path(name, key), data) ? static_cast<long>(data.size()) : -1;
+	}
+
+	void erase()
+	{
+		std::remove(path("bt_client", "servers").c_str());
+	}
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode mode, nvs_handle *handle)
+{
+	if (nvs::broken)
+		return ESP_FAIL;
+	*handle = nvs::next_handle++;
+	nvs::handles[*handle] = {name, mode, {}};
+	return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle)
+{
+	// Uncommitted writes are lost
+	nvs::handles.erase(handle);
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length)
+{
+	auto& open = nvs::handles.at(handle);
+	if (open.mode != NVS_READWRITE)
+		return ESP_FAIL;
+	const auto bytes = static_cast<const std::uint8_t *>(value);
+	open.staged[key].assign(bytes, bytes + length);
+	return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *value, size_t *length)
+{
+	std::vector<std::uint8_t> data;
+	if (!nvs::read(nvs::path(nvs::handles.at(handle).name, key), data))
+		return ESP_ERR_NVS_NOT_FOUND;
+	// As NVS: a buffer too small is an error, a larger one is partly filled
+	if (data.size() > *length)
+		return ESP_FAIL;
+	std::memcpy(value, data.data(), data.size());
+	*length = data.size();
+	return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+	auto& open = nvs::handles.at(handle);
+	for (const auto& staged : open.staged)
+		nvs::write(nvs::path(open.name, staged.first), staged.second);
+	open.staged.clear();
+	return ESP_OK;
+}
+
+namespace
+{
+	// Address, address type, handles and parameters: what a reboot needs
+	constexpr std::size_t RECORD_SIZE = 6 + 1 + 2 + 2 + 8;
+	constexpr std::size_t HEADER_SIZE = 4;
+
+	bluetooth_server_info server_of(std::size_t i)
+	{
+		const auto b = static_cast<std::uint8_t>(i);
+		bluetooth_server_info server(
+			bluetooth_address(0x24, 0x0a, 0xc4, b, 0x10, b),
+			static_cast<std::uint16_t>(i),
+			static_cast<std::uint8_t>(i % 5),
+			i % 2 == 0 ? BLE_ADDR_TYPE_PUBLIC : BLE_ADDR_TYPE_RANDOM);
+		server.notify_handle() = static_cast<std::uint16_t>(0x2a + i);
+		server.cccd_handle() = i % 3 == 0 ? bluetooth_server_info::INVALID_HANDLE : static_cast<std::uint16_t>(0x2b + i);
+		const auto s = static_cast<std::uint16_t>(i);
+		server.conn_params() = {static_cast<std::uint16_t>(0x18 + s), static_cast<std::uint16_t>(0x28 + s), s, static_cast<std::uint16_t>(400 + s)};
+		return server;
+	}
+
+	void fill(server_table& servers, std::size_t count)
+	{
+		for (std::size_t i = 0; i < count; i++)
+			servers.add(server_of(i));
+	}
+
+	// Only what reconnecting needs comes back, the rest starts afresh
+	bool restored(const bluetooth_server_info& loaded, const bluetooth_server_info& stored)
+	{
+		const auto& l = loaded.conn_params();
+		const auto& s = stored.conn_params();
+		return loaded.address() == stored.address()
+			&& loaded.address_type() == stored.address_type()
+			&& loaded.notify_handle() == stored.notify_handle()
+			&& loaded.cccd_handle() == stored.cccd_handle()
+			&& l.min_int == s.min_int && l.max_int == s.max_int
+			&& l.latency == s.latency && l.timeout == s.timeout
+			&& loaded.conn_id() == bluetooth_server_info::INVALID_CONN_ID
+			&& loaded.activator() == 0
+			&& !loaded.ble_connected();
+	}
+
+	void empty_without_a_store()
+	{
+		nvs::erase();
+		CHECK(server_cache().load().empty());
+
+		nvs::broken = true;
+		CHECK(server_cache().load().empty());
+		nvs::broken = false;
+	}
+
+	// Stored, then loaded by a new cache as after a reboot, for every
+	// size up to a full table. Only the used records take flash
+	void round_trips()
+	{
+		for (std::size_t count = 0; count <= server_table::CAPACITY; count++)
+		{
+			nvs::erase();
+			server_table servers;
+			fill(servers, count);
+			CHECK(server_cache().store(servers));
+			CHECK(nvs::stored_size("bt_client", "servers") == static_cast<long>(HEADER_SIZE + RECORD_SIZE * count));
+			CHECK(nvs::handles.empty());
+
+			const auto loaded = server_cache().load();
+			CHECK(loaded.size() == count);
+			for (std::size_t i = 0; i < loaded.size() && i < count; i++)
+				CHECK(restored(loaded[i], server_of(i)));
+		}
+
+		// A store replaces what was there
+		server_table fewer;
+		fill(fewer, 3);
+		CHECK(server_cache().store(fewer));
+		CHECK(server_cache().load().size() == 3);
+	}
+
+	// A blob of another layout or size is ignored rather than misread
+	void ignores_foreign_blobs()
+	{
+		server_table servers;
+		fill(servers, 4);
+		CHECK(server_cache().store(servers));
+
+		std::vector<std::uint8_t> blob;
+		CHECK(nvs::read(nvs::path("bt_client", "servers"), blob));
+
+		auto old_version = blob;
+		old_version[0] = 1;
+		nvs::write(nvs::path("bt_client", "servers"), old_version);
+		CHECK(server_cache().load().empty());
+
+		auto truncated = blob;
+		truncated.pop_back();
+		nvs::write(nvs::path("bt_client", "servers"), truncated);
+		CHECK(server_cache().load().empty());
+
+		auto overcounted = blob;
+		overcounted[2] = 5;
+		nvs::write(nvs::path("bt_client", "servers"), overcounted);
+		CHECK(server_cache().load().empty());
+
+		auto too_many = blob;
+		too_many[2] = server_cache::MAX_ENTRIES + 1;
+		nvs::write(nvs::path("bt_client", "servers"), too_many);
+		CHECK(server_cache().load().empty());
+
+		nvs::write(nvs::path("bt_client", "servers"), blob);
+		CHECK(server_cache().load().size() == 4);
+	}
+
+	// Without flash the store fails and leaves the old cache alone
+	void reports_failed_stores()
+	{
+		server_table servers;
+		fill(servers, 2);
+		CHECK(server_cache().store(servers));
+
+		server_table more;
+		fill(more, 6);
+		nvs::broken = true;
+		CHECK(!server_cache().store(more));
+		nvs::broken = false;
+		CHECK(server_cache().load().size() == 2);
+	}
+}
+
+int main()
+{
+	char dir[] = "/tmp/test_server_cache.XXXXXX";
+	if (mkdtemp(dir) == nullptr)
+		return 1;
+	nvs::dir = dir;
+
+	empty_without_a_store();
+	round_trips();
+	ignores_foreign_blobs();
+	reports_failed_stores();
+
+	nvs::erase();
+	std::remove(dir);
+	return check::result("server_cache");
+}
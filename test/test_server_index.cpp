@@ -0,0 +1,75 @@
+// C++ includes
+#include <map>
+#include <random>
+// My includes
+#include "check.hpp"
+#include "server_index.hpp"
+
+namespace
+{
+	bluetooth_address random_address(std::mt19937_64& random)
+	{
+		return bluetooth_address(random());
+	}
+
+	// Random inserts and lookups against a std::map, up to the full table
+	void addresses_match_map()
+	{
+		server_index index;
+		std::map<std::uint64_t, std::size_t> reference;
+		std::mt19937_64 random(3);
+
+		std::size_t slot = 0;
+		while (reference.size() < server_index::ADDRESS_BUCKETS / 2)
+		{
+			const auto addr = random_address(random);
+			CHECK(!index.find(addr));
+			CHECK(index.insert(addr, slot));
+			reference[addr.packed()] = slot++;
+		}
+
+		for (const auto& entry : reference)
+		{
+			const auto found = index.find(bluetooth_address(entry.first));
+			CHECK(found && *found == entry.second);
+		}
+
+		// Full: new addresses are refused, known ones still rebind
+		CHECK(!index.insert(random_address(random), slot));
+		const bluetooth_address known(reference.begin()->first);
+		CHECK(index.insert(known, 7));
+		CHECK(index.find(known) && *index.find(known) == 7);
+
+		index.clear();
+		CHECK(!index.find(known));
+		CHECK(index.insert(random_address(random), 0));
+	}
+
+	void conn_ids()
+	{
+		server_index index;
+		CHECK(!index.find(std::uint16_t(0)));
+
+		index.bind(3, 12);
+		CHECK(index.find(std::uint16_t(3)) && *index.find(std::uint16_t(3)) == 12);
+		index.bind(3, 5);
+		CHECK(*index.find(std::uint16_t(3)) == 5);
+		index.unbind(3);
+		CHECK(!index.find(std::uint16_t(3)));
+
+		// Out of range conn_ids are ignored
+		index.bind(server_index::MAX_CONN_ID, 1);
+		CHECK(!index.find(std::uint16_t(server_index::MAX_CONN_ID)));
+
+		index.bind(0, 1);
+		index.clear();
+		CHECK(!index.find(std::uint16_t(0)));
+	}
+}
+
+int main()
+{
+	addresses_match_map();
+	conn_ids();
+	return check::result("server_index");
+}
@@ -0,0 +1,153 @@
+// C++ includes
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+// My includes
+#include "check.hpp"
+#include "server_table.hpp"
+
+namespace
+{
+	bluetooth_address address_of(std::size_t slot)
+	{
+		const auto b = static_cast<std::uint8_t>(slot);
+		return bluetooth_address(0xa0, b, 0x01, b, 0x02, b);
+	}
+
+	bluetooth_server_info::conn_params_t params_of(std::size_t slot)
+	{
+		const auto s = static_cast<std::uint16_t>(slot);
+		return {static_cast<std::uint16_t>(0x10 + s), static_cast<std::uint16_t>(0x20 + s), s, static_cast<std::uint16_t>(0x400 + s)};
+	}
+
+	bool same(const bluetooth_server_info::conn_params_t& l, const bluetooth_server_info::conn_params_t& r)
+	{
+		return l.min_int == r.min_int && l.max_int == r.max_int && l.latency == r.latency && l.timeout == r.timeout;
+	}
+
+	bluetooth_server_info server_of(std::size_t slot)
+	{
+		bluetooth_server_info server(address_of(slot));
+		server.activator() = static_cast<std::uint8_t>(slot % 7);
+		server.notify_handle() = static_cast<std::uint16_t>(0x100 + slot);
+		server.cccd_handle() = static_cast<std::uint16_t>(0x200 + slot);
+		server.conn_params() = params_of(slot);
+		return server;
+	}
+
+	// Slots are handed out in order and a record never moves, whatever is
+	// added or changed after it
+	void slots_are_stable()
+	{
+		server_table servers;
+		CHECK(servers.empty());
+
+		for (std::size_t i = 0; i < server_table::CAPACITY; i++)
+		{
+			const auto slot = servers.add(server_of(i));
+			CHECK(slot && *slot == i);
+			CHECK(servers.size() == i + 1);
+			servers.conn_id(i) = static_cast<std::uint16_t>(i);
+
+			for (std::size_t j = 0; j <= i; j++)
+			{
+				CHECK(servers.address(j) == address_of(j));
+				CHECK(servers.conn_id(j) == j);
+				CHECK(same(servers.conn_params(j), params_of(j)));
+			}
+		}
+
+		CHECK(servers.full());
+		CHECK(!servers.add(server_of(0)));
+		CHECK(servers.size() == server_table::CAPACITY);
+
+		// The copy out for the cache has every column
+		auto expected = server_of(5);
+		expected.conn_id() = 5;
+		CHECK(servers.info(5) == expected);
+		CHECK(same(servers.info(5).conn_params(), params_of(5)));
+
+		servers.set_conn_params(5, params_of(9));
+		CHECK(same(servers.conn_params(5), params_of(9)));
+		CHECK(same(servers.conn_params(4), params_of(4)));
+	}
+
+	// The scans against a plain walk over the records
+	void scans_match_reference()
+	{
+		server_table servers;
+		std::mt19937 random(18);
+		for (std::size_t i = 0; i < 20; i++)
+			servers.add(server_of(i));
+
+		for (int round = 0; round < 1000; round++)
+		{
+			const auto slot = random() % servers.size();
+			switch (random() % 3)
+			{
+			case 0: servers.live(slot) = !servers.live(slot); break;
+			case 1: servers.ble_connected(slot) = !servers.ble_connected(slot); break;
+			default: servers.retry_at_ms(slot) = random() % 2 == 0 ? 0 : 5000; break;
+			}
+
+			std::size_t connected = 0;
+			std::size_t live = 0;
+			for (std::size_t i = 0; i < servers.size(); i++)
+			{
+				connected += servers.ble_connected(i);
+				live += servers.live(i);
+			}
+			CHECK(servers.connected() == connected);
+			CHECK(servers.live_count() == live);
+
+			const auto from = random() % servers.size();
+			std::optional<std::size_t> next;
+			for (auto i = from; i < servers.size() && !next; i++)
+				if (servers.live(i) && !servers.ble_connected(i) && servers.retry_at_ms(i) <= 1000)
+					next = i;
+			CHECK(servers.next_to_connect(from, 1000) == next);
+		}
+	}
+
+	// add() runs on the BT task while the handler reads. A reader that
+	// sees a slot below size() must see all of it, never a half filled one
+	void publishes_complete_slots()
+	{
+		for (int round = 0; round < 2000; round++)
+		{
+			server_table servers;
+			std::atomic<bool> go(false);
+			std::thread writer([&servers, &go]
+			{
+				while (!go.load(std::memory_order_acquire))
+					;
+				for (std::size_t i = 0; i < server_table::CAPACITY; i++)
+					servers.add(server_of(i));
+			});
+
+			go.store(true, std::memory_order_release);
+			std::size_t seen = 0;
+			while (seen < server_table::CAPACITY)
+			{
+				const auto size = servers.size();
+				for (auto i = seen; i < size; i++)
+				{
+					CHECK(servers.address(i) == address_of(i));
+					CHECK(servers.cccd_handle(i) == 0x200 + i);
+					CHECK(same(servers.conn_params(i), params_of(i)));
+				}
+				seen = size;
+			}
+			writer.join();
+		}
+	}
+}
+
+int main()
+{
+	slots_are_stable();
+	scans_match_reference();
+	publishes_complete_slots();
+	return check::result("server_table");
+}
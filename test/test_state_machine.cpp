@@ -0,0 +1,376 @@
+// C++ includes
+#include <atomic>
+// My includes
+#include "check.hpp"
+#include "state_machine_harness.hpp"
+
+// The parts of the BT stack the state machine talks to, reduced to counters
+namespace bt
+{
+	std::atomic<int> scans(0);
+	std::atomic<int> a2dp_connects(0);
+	std::atomic<int> a2dp_disconnects(0);
+	std::atomic<int> media_stops(0);
+	std::atomic<int> remote_services(0);
+	// Packed address of the last A2DP connect
+	std::atomic<std::uint64_t> a2dp_peer(0);
+	// The next this many A2DP requests are refused, as by a busy stack
+	std::atomic<int> refusals(0);
+
+	esp_err_t answer()
+	{
+		if (refusals > 0)
+		{
+			--refusals;
+			return ESP_ERR_INVALID_STATE;
+		}
+		return ESP_OK;
+	}
+}
+
+// Refused requests are counted as well
+esp_err_t esp_a2d_sink_connect(esp_bd_addr_t addr)
+{
+	bt::a2dp_peer = bluetooth_address(addr).packed();
+	++bt::a2dp_connects;
+	return bt::answer();
+}
+
+esp_err_t esp_a2d_sink_disconnect(esp_bd_addr_t)
+{
+	++bt::a2dp_disconnects;
+	return bt::answer();
+}
+
+esp_err_t esp_a2d_media_ctrl(esp_a2d_media_ctrl_t)
+{
+	++bt::media_stops;
+	return bt::answer();
+}
+
+esp_err_t esp_bt_gap_get_remote_services(esp_bd_addr_t)
+{
+	++bt::remote_services;
+	return bt::answer();
+}
+
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *) { return ESP_OK; }
+esp_err_t esp_ble_gap_start_scanning(uint32_t) { ++bt::scans; return ESP_OK; }
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t) { return ESP_OK; }
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t, esp_bd_addr_t, esp_ble_addr_type_t, bool) { return ESP_OK; }
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t, uint16_t) { return ESP_OK; }
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t, uint16_t) { return ESP_OK; }
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t, uint16_t, esp_bt_uuid_t *) { return ESP_OK; }
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t, esp_bd_addr_t, uint16_t) { return ESP_OK; }
+esp_err_t esp_ble_gattc_write_char_descr(
+	esp_gatt_if_t, uint16_t, uint16_t, uint16_t, uint8_t *, esp_gatt_write_type_t, esp_gatt_auth_req_t) { return ESP_OK; }
+esp_gatt_status_t esp_ble_gattc_get_char_by_uuid(
+	esp_gatt_if_t, uint16_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_char_elem_t *, uint16_t *) { return ESP_GATT_ERROR; }
+esp_gatt_status_t esp_ble_gattc_get_descr_by_char_handle(
+	esp_gatt_if_t, uint16_t, uint16_t, esp_bt_uuid_t, esp_gattc_descr_elem_t *, uint16_t *) { return ESP_GATT_ERROR; }
+
+// No flash, the cache is never given to the state machine here
+esp_err_t nvs_open(const char *, nvs_open_mode, nvs_handle *) { return ESP_FAIL; }
+void nvs_close(nvs_handle) {}
+esp_err_t nvs_set_blob(nvs_handle, const char *, const void *, size_t) { return ESP_FAIL; }
+esp_err_t nvs_get_blob(nvs_handle, const char *, void *, size_t *) { return ESP_FAIL; }
+esp_err_t nvs_commit(nvs_handle) { return ESP_FAIL; }
+
+namespace
+{
+	using state_t = state_machine::state_t;
+	using msg_t = state_machine::msg_t;
+
+	constexpr bluetooth_address FIRST(0x10, 0x11, 0x12, 0x13, 0x14, 0x15);
+	constexpr bluetooth_address SECOND(0x20, 0x21, 0x22, 0x23, 0x24, 0x25);
+
+	using harness = state_machine_harness;
+
+	void idle_to_ble(harness& h)
+	{
+		h.machine().start();
+		CHECK(h.machine().idle_to_ble(3, &h.servers(), nullptr));
+		// Taken by the handler, on its own thread
+		CHECK(!h.machine().idle_to_ble(3, &h.servers(), nullptr));
+		h.settle();
+		// Known servers are set up while the scan runs
+		CHECK(h.state() == state_t::IDLE_TO_BLE_2);
+		CHECK(!h.machine().ble_to_a2dp(0));
+		CHECK(!h.machine().idle_to_ble(3, &h.servers(), nullptr));
+
+		h.machine().notify_scan_finished();
+		h.settle();
+		CHECK(h.state() == state_t::BLE);
+		// The discovery scan, then the background one
+		CHECK(bt::scans == 2);
+	}
+
+	// Deadline 10 s, two retries backing off 1 s then 2 s, then give up
+	void ble_to_a2dp_gives_up(harness& h)
+	{
+		CHECK(h.machine().ble_to_a2dp(0));
+		// One request at a time
+		CHECK(!h.machine().ble_to_a2dp(1));
+		h.settle();
+		CHECK(h.state() == state_t::BLE_TO_A2DP_1);
+		CHECK(bt::a2dp_connects == 1 && bt::a2dp_peer == FIRST.packed());
+		CHECK(h.machine().a2dp_address() == FIRST);
+		CHECK(!h.machine().ble_to_a2dp(1));
+		CHECK(!h.machine().a2dp_to_ble());
+
+		// Due times counted from the request. The link timer of BLE was
+		// due meanwhile, it must not count
+		std::uint32_t now = 0;
+		const auto at = [&h, &now](std::uint32_t ms) { h.advance(ms - now); now = ms; };
+		at(9900);
+		CHECK(bt::a2dp_connects == 1);
+		at(10100);
+		at(10900);
+		CHECK(bt::a2dp_connects == 1);
+		at(11100);
+		CHECK(bt::a2dp_connects == 2);
+
+		at(20900);
+		at(21100);
+		at(22900);
+		CHECK(bt::a2dp_connects == 2);
+		at(23100);
+		CHECK(bt::a2dp_connects == 3);
+		at(32900);
+		CHECK(h.state() == state_t::BLE_TO_A2DP_1);
+
+		at(33100);
+		CHECK(h.state() == state_t::BLE);
+		CHECK(bt::a2dp_connects == 3 && bt::a2dp_disconnects == 1);
+		CHECK(!h.machine().a2dp_address());
+	}
+
+	void ble_to_a2dp_refused(harness& h)
+	{
+		CHECK(h.machine().ble_to_a2dp(1));
+		h.settle();
+		CHECK(h.machine().a2dp_address() == SECOND);
+
+		h.machine().notify_a2dp_disconnected();
+		h.settle();
+		CHECK(h.state() == state_t::BLE);
+		CHECK(!h.machine().a2dp_address());
+
+		// Nothing left armed to retry with
+		h.advance(15000);
+		CHECK(bt::a2dp_connects == 4);
+	}
+
+	void ble_to_a2dp_connects(harness& h, bluetooth_address addr, std::size_t slot)
+	{
+		CHECK(h.machine().ble_to_a2dp(slot));
+		h.settle();
+		h.machine().notify_a2dp_connected();
+		h.settle();
+		CHECK(h.state() == state_t::A2DP);
+		CHECK(h.machine().a2dp_address() == addr);
+	}
+
+	void handover_to_peer_without_a2dp(harness& h)
+	{
+		const auto connects = bt::a2dp_connects.load();
+		const auto disconnects = bt::a2dp_disconnects.load();
+		CHECK(h.machine().handover(1));
+		CHECK(!h.machine().handover(1));
+		h.settle();
+		CHECK(h.state() == state_t::A2DP_TO_A2DP_1);
+		CHECK(bt::remote_services == 1);
+
+		// An answer about another peer, from a handover given up on earlier
+		h.machine().notify_peer_prepared(FIRST, true);
+		h.settle();
+		CHECK(h.state() == state_t::A2DP_TO_A2DP_1);
+		CHECK(bt::a2dp_disconnects == disconnects);
+
+		h.machine().notify_peer_prepared(SECOND, false);
+		h.settle();
+		CHECK(h.state() == state_t::A2DP);
+		CHECK(h.machine().a2dp_address() == FIRST);
+		CHECK(bt::a2dp_connects == connects);
+	}
+
+	// The current peer drops while the next one is being prepared
+	void handover_after_peer_lost(harness& h)
+	{
+		CHECK(h.machine().handover(1));
+		h.settle();
+		h.machine().notify_a2dp_disconnected();
+		h.settle();
+		CHECK(h.state() == state_t::A2DP_TO_A2DP_3);
+		CHECK(bt::a2dp_peer == SECOND.packed());
+		CHECK(h.machine().a2dp_address() == SECOND);
+
+		h.machine().notify_a2dp_connected();
+		h.settle();
+		CHECK(h.state() == state_t::A2DP);
+		CHECK(h.machine().a2dp_address() == SECOND);
+	}
+
+	// The next peer was ready but refuses the A2DP connection
+	void handover_refused(harness& h)
+	{
+		const auto disconnects = bt::a2dp_disconnects.load();
+		CHECK(h.machine().handover(0));
+		h.settle();
+		h.machine().notify_peer_prepared(FIRST, true);
+		h.settle();
+		CHECK(h.state() == state_t::A2DP_TO_A2DP_2);
+		CHECK(bt::a2dp_disconnects == disconnects + 1);
+
+		h.machine().notify_a2dp_disconnected();
+		h.settle();
+		CHECK(h.state() == state_t::A2DP_TO_A2DP_3);
+		CHECK(bt::a2dp_peer == FIRST.packed());
+
+		h.machine().notify_a2dp_disconnected();
+		h.settle();
+		CHECK(h.state() == state_t::BLE);
+		CHECK(!h.machine().a2dp_address());
+	}
+
+	// Stopping the stream is retried once after 3 s and a 500 ms backoff,
+	// then the peer is disconnected without it
+	void a2dp_to_ble_stop_times_out(harness& h)
+	{
+		const auto disconnects = bt::a2dp_disconnects.load();
+		CHECK(h.machine().a2dp_to_ble());
+		h.settle();
+		CHECK(h.state() == state_t::A2DP_TO_BLE_1);
+		CHECK(bt::media_stops == 1);
+
+		std::uint32_t now = 0;
+		const auto at = [&h, &now](std::uint32_t ms) { h.advance(ms - now); now = ms; };
+		at(2900);
+		at(3100);
+		at(3400);
+		CHECK(bt::media_stops == 1);
+		at(3600);
+		CHECK(bt::media_stops == 2);
+		at(6400);
+		CHECK(h.state() == state_t::A2DP_TO_BLE_1);
+		at(6600);
+		CHECK(h.state() == state_t::A2DP_TO_BLE_2);
+		CHECK(bt::media_stops == 2 && bt::a2dp_disconnects == disconnects + 1);
+
+		h.machine().notify_a2dp_disconnected();
+		h.settle();
+		CHECK(h.state() == state_t::BLE);
+		CHECK(!h.machine().a2dp_address());
+	}
+
+	// The stack refuses the media stop: no answer will come, so the step
+	// backs off 500 ms right away instead of waiting out its 3 s deadline
+	void a2dp_to_ble_stop_refused(harness& h)
+	{
+		const auto stops = bt::media_stops.load();
+		bt::refusals = 1;
+		CHECK(h.machine().a2dp_to_ble());
+		h.settle();
+		CHECK(h.state() == state_t::A2DP_TO_BLE_1);
+		CHECK(bt::media_stops == stops + 1);
+
+		std::uint32_t now = 0;
+		const auto at = [&h, &now](std::uint32_t ms) { h.advance(ms - now); now = ms; };
+		at(100);
+		at(400);
+		CHECK(bt::media_stops == stops + 1);
+		at(700);
+		CHECK(bt::media_stops == stops + 2);
+		CHECK(h.state() == state_t::A2DP_TO_BLE_1);
+
+		h.machine().notify_a2dp_media_stopped();
+		h.settle();
+		CHECK(h.state() == state_t::A2DP_TO_BLE_2);
+		h.machine().notify_a2dp_disconnected();
+		h.settle();
+		CHECK(h.state() == state_t::BLE);
+	}
+
+	// Connecting is refused on every attempt: the retries run back to
+	// back after their backoffs, the deadline never comes into it
+	void ble_to_a2dp_always_refused(harness& h)
+	{
+		const auto connects = bt::a2dp_connects.load();
+		bt::refusals = 3;
+		CHECK(h.machine().ble_to_a2dp(1));
+		h.settle();
+
+		std::uint32_t now = 0;
+		const auto at = [&h, &now](std::uint32_t ms) { h.advance(ms - now); now = ms; };
+		at(1100);
+		CHECK(bt::a2dp_connects == connects + 2);
+		at(3200);
+		CHECK(bt::a2dp_connects == connects + 3);
+		at(3300);
+		CHECK(h.state() == state_t::BLE);
+		CHECK(!h.machine().a2dp_address());
+		CHECK(bt::refusals == 0);
+	}
+
+	// The source disconnects by itself while streaming
+	void source_lost(harness& h)
+	{
+		h.machine().notify_a2dp_disconnecting();
+		h.settle();
+		CHECK(h.state() == state_t::A2DP);
+
+		h.machine().notify_a2dp_disconnected();
+		h.settle();
+		CHECK(h.state() == state_t::BLE);
+		CHECK(!h.machine().a2dp_address());
+		// BLE switches work again
+		CHECK(h.machine().ble_to_a2dp(0));
+		h.settle();
+		CHECK(h.state() == state_t::BLE_TO_A2DP_1);
+		h.machine().notify_a2dp_connected();
+		h.settle();
+		CHECK(h.state() == state_t::A2DP);
+	}
+
+	// The BT task only posts what it learns, the handler writes the table
+	void table_written_by_handler(harness& h)
+	{
+		h.machine().notify_activator_sampled(1, 5);
+		h.settle();
+		CHECK(h.servers().activator(1) == 5);
+
+		// A late disconnect of an older link of slot 0 leaves the new one be
+		h.machine().notify_ble_disconnected(7, 0);
+		h.settle();
+		CHECK(h.servers().conn_id(0) == 0 && h.servers().ble_connected(0));
+
+		h.machine().notify_ble_disconnected(1, 1);
+		h.settle();
+		CHECK(h.servers().conn_id(1) == bluetooth_server_info::INVALID_CONN_ID);
+		CHECK(!h.servers().ble_connected(1));
+		CHECK(h.state() == state_t::A2DP);
+	}
+}
+
+int main()
+{
+	// Never destroyed, the handler thread runs until exit
+	auto& h = *new harness({FIRST, SECOND});
+
+	idle_to_ble(h);
+	ble_to_a2dp_gives_up(h);
+	ble_to_a2dp_refused(h);
+	ble_to_a2dp_connects(h, FIRST, 0);
+	handover_to_peer_without_a2dp(h);
+	handover_after_peer_lost(h);
+	handover_refused(h);
+	ble_to_a2dp_connects(h, FIRST, 0);
+	a2dp_to_ble_stop_times_out(h);
+	ble_to_a2dp_connects(h, SECOND, 1);
+	a2dp_to_ble_stop_refused(h);
+	ble_to_a2dp_always_refused(h);
+	ble_to_a2dp_connects(h, FIRST, 0);
+	source_lost(h);
+	table_written_by_handler(h);
+	return check::result("state_machine");
+}
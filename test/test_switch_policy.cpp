@@ -0,0 +1,114 @@
+// My includes
+#include "activator_replay.hpp"
+#include "check.hpp"
+
+namespace
+{
+	using action_t = switch_policy::action_t;
+	using notify_t = switch_policy::notify_t;
+
+	const auto& CONFIG = switch_policy::DEFAULT_CONFIG;
+
+	std::optional<std::size_t> slot(std::size_t s)
+	{
+		return s;
+	}
+
+	// Armed at arm_level, still armed above disarm_level
+	void arms_with_hysteresis()
+	{
+		switch_policy policy;
+		std::uint32_t now = 0;
+		const auto notify = [&](std::uint8_t activator)
+		{
+			now += CONFIG.window_ms;
+			policy.on_activator(0, activator, now);
+			return policy.armed(0);
+		};
+
+		CHECK(!notify(CONFIG.arm_level - 1));
+		CHECK(notify(CONFIG.arm_level));
+		CHECK(notify(CONFIG.disarm_level + 1));
+		CHECK(!notify(CONFIG.disarm_level));
+		CHECK(!notify(CONFIG.arm_level - 1));
+
+		// Only an armed leader is connected
+		CHECK(policy.decide(slot(0), false, {}, now).action == action_t::NONE);
+		notify(CONFIG.arm_level);
+		const auto decision = policy.decide(slot(0), false, {}, now);
+		CHECK(decision.action == action_t::CONNECT && decision.slot == 0);
+	}
+
+	// One decision per window, the first notification in it asks for the
+	// flush, the flush decides once
+	void coalesces_within_a_window()
+	{
+		switch_policy policy;
+		CHECK(policy.on_activator(0, 5, 1000) == notify_t::DECIDE);
+		CHECK(policy.window_left(1000) == CONFIG.window_ms);
+		CHECK(policy.on_activator(1, 5, 1010) == notify_t::FLUSH_LATER);
+		CHECK(policy.on_activator(2, 5, 1020) == notify_t::COALESCED);
+		CHECK(policy.coalesced() == 2);
+
+		CHECK(policy.on_window_end(1000 + CONFIG.window_ms));
+		CHECK(!policy.on_window_end(1000 + CONFIG.window_ms));
+		CHECK(policy.on_activator(0, 5, 1000 + 2 * CONFIG.window_ms) == notify_t::DECIDE);
+	}
+
+	// Taking A2DP over needs a margin, and nothing moves for the dwell time
+	void hands_over_with_margin_and_dwell()
+	{
+		switch_policy policy;
+		policy.on_activator(0, 5, 0);
+		policy.on_activator(1, 5, CONFIG.window_ms);
+		const auto connect = policy.decide(slot(0), false, {}, 0);
+		policy.commit(connect, 0);
+		CHECK(policy.switches() == 1);
+
+		const auto after = CONFIG.dwell_ms;
+		CHECK(policy.decide(slot(1), true, slot(0), after).action == action_t::NONE);
+		policy.on_activator(1, 5 + CONFIG.margin, after);
+		CHECK(policy.decide(slot(1), true, slot(0), after - 1).action == action_t::NONE);
+		const auto handover = policy.decide(slot(1), true, slot(0), after);
+		CHECK(handover.action == action_t::HANDOVER && handover.slot == 1);
+		CHECK(policy.decide(slot(0), true, slot(0), after).action == action_t::NONE);
+
+		// A refused switch is not committed and starts no dwell
+		CHECK(policy.switches() == 1);
+		policy.commit(handover, after);
+		CHECK(policy.switches() == 2);
+		policy.on_activator(0, 15, after + 1);
+		CHECK(policy.decide(slot(0), true, slot(1), after + 1).action == action_t::NONE);
+	}
+
+	// A noisy stream, with near ties while the leader changes: the policy
+	// ends every phase on its leader, with a fraction of the decisions and
+	// switches of the per-notification rule, and never within the dwell
+	void replays_notifications()
+	{
+		for (unsigned seed = 1; seed <= 5; seed++)
+		{
+			const auto t = replay::trace(seed);
+			const auto policy = replay::coalesced(t);
+			const auto old = replay::per_notification(t);
+
+			CHECK(policy.peers == t.leaders);
+			CHECK(old.peers == t.leaders);
+			CHECK(policy.decisions * 10 < t.notifications.size());
+			CHECK(policy.switch_ms.size() * 10 < old.switch_ms.size());
+			// At least one switch per leader change
+			CHECK(policy.switch_ms.size() >= t.leaders.size());
+			for (std::size_t i = 1; i < policy.switch_ms.size(); i++)
+				CHECK(policy.switch_ms[i] - policy.switch_ms[i - 1] >= CONFIG.dwell_ms);
+		}
+	}
+}
+
+int main()
+{
+	arms_with_hysteresis();
+	coalesces_within_a_window();
+	hands_over_with_margin_and_dwell();
+	replays_notifications();
+	return check::result("switch_policy");
+}
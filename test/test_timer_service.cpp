@@ -0,0 +1,157 @@
+// C++ includes
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+// My includes
+#include "check.hpp"
+#include "timer_service.hpp"
+
+namespace
+{
+	using namespace std::chrono_literals;
+	using clock_type = std::chrono::steady_clock;
+
+	std::int64_t ms_since(clock_type::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - start).count();
+	}
+
+	template<typename F>
+	bool wait_for(F done, std::chrono::milliseconds timeout = 5s)
+	{
+		const auto deadline = clock_type::now() + timeout;
+		while (!done())
+		{
+			if (clock_type::now() > deadline)
+				return false;
+			std::this_thread::sleep_for(1ms);
+		}
+		return true;
+	}
+
+	// The service task never returns, a service has to outlive the test
+	timer_service& started(std::vector<timer_service::callback_t> callbacks)
+	{
+		auto& service = *new timer_service();
+		for (auto& callback : callbacks)
+			CHECK(service.create(std::move(callback)) != timer_service::NO_TIMER);
+		service.start();
+		return service;
+	}
+
+	void creates_up_to_capacity()
+	{
+		timer_service service;
+		for (std::size_t i = 0; i < timer_service::CAPACITY; i++)
+			CHECK(service.create([] {}) == i);
+		CHECK(service.create([] {}) == timer_service::NO_TIMER);
+		CHECK(!service.arm(timer_service::NO_TIMER, 10));
+		CHECK(!service.cancel(timer_service::CAPACITY));
+	}
+
+	// Not before its delay, once, and a cancelled or moved timer not at
+	// its old time
+	void fires_cancels_and_moves()
+	{
+		std::atomic<int> fired[3] = {};
+		std::atomic<std::int64_t> at_ms(0);
+		const auto start = clock_type::now();
+		auto& service = started({
+			[&] { ++fired[0]; at_ms = ms_since(start); },
+			[&] { ++fired[1]; },
+			[&] { ++fired[2]; },
+		});
+
+		CHECK(service.arm(0, 50));
+		CHECK(service.arm(1, 60));
+		CHECK(service.cancel(1));
+		CHECK(service.arm(2, 400));
+		CHECK(service.arm(2, 30));
+
+		CHECK(wait_for([&] { return fired[0] == 1 && fired[2] == 1; }));
+		CHECK(at_ms >= 50);
+		std::this_thread::sleep_for(500ms);
+		CHECK(fired[0] == 1);
+		CHECK(fired[1] == 0);
+		CHECK(fired[2] == 1);
+		CHECK(service.dropped() == 0);
+	}
+
+	// Every timer re-arms itself from its callback until thousands have
+	// fired: none fires early, none is lost
+	void keeps_rearming()
+	{
+		constexpr int FIRINGS = 2000;
+		std::atomic<int> total(0);
+		std::atomic<int> early(0);
+		std::vector<clock_type::time_point> due(timer_service::CAPACITY);
+		timer_service *service = nullptr;
+
+		std::vector<timer_service::callback_t> callbacks;
+		for (std::size_t i = 0; i < timer_service::CAPACITY; i++)
+		{
+			callbacks.push_back([&, i]
+			{
+				// Whole milliseconds: the service counts time in them
+				if (clock_type::now() < due[i] - 1ms)
+					++early;
+				if (++total >= FIRINGS)
+					return;
+				const auto delay = static_cast<std::uint32_t>(5 + (total * 7 + i) % 40);
+				due[i] = clock_type::now() + std::chrono::milliseconds(delay);
+				service->arm(i, delay);
+			});
+		}
+		service = &started(callbacks);
+
+		for (std::size_t i = 0; i < timer_service::CAPACITY; i++)
+		{
+			due[i] = clock_type::now() + std::chrono::milliseconds(i);
+			service->arm(i, static_cast<std::uint32_t>(i));
+		}
+
+		CHECK(wait_for([&] { return total >= FIRINGS; }, 30s));
+		CHECK(early == 0);
+		CHECK(service->dropped() == 0);
+	}
+
+	// Arms and cancels from several tasks at once. A full queue drops
+	// commands, and says so to the caller
+	void counts_dropped_commands()
+	{
+		std::atomic<int> fired(0);
+		std::vector<timer_service::callback_t> callbacks(timer_service::CAPACITY, [&] { ++fired; });
+		auto& service = started(callbacks);
+
+		std::atomic<int> refused(0);
+		std::vector<std::thread> tasks;
+		for (int t = 0; t < 4; t++)
+		{
+			tasks.emplace_back([&, t]
+			{
+				for (int i = 0; i < 2000; i++)
+				{
+					const auto timer = static_cast<std::size_t>((t * 5 + i) % timer_service::CAPACITY);
+					const auto ok = i % 3 == 2 ? service.cancel(timer) : service.arm(timer, 60000);
+					if (!ok)
+						++refused;
+				}
+			});
+		}
+		for (auto& task : tasks)
+			task.join();
+
+		CHECK(service.dropped() == static_cast<std::uint32_t>(refused));
+		CHECK(fired == 0);
+	}
+}
+
+int main()
+{
+	creates_up_to_capacity();
+	fires_cancels_and_moves();
+	keeps_rearming();
+	counts_dropped_commands();
+	return check::result("timer_service");
+}
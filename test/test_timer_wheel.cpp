@@ -0,0 +1,178 @@
+// C++ includes
+#include <algorithm>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+// My includes
+#include "check.hpp"
+#include "timer_wheel.hpp"
+
+namespace
+{
+	constexpr std::size_t TIMERS = 24;
+	constexpr std::uint32_t TICK_MS = 10;
+	constexpr std::uint32_t DISARMED = 0xffffffff;
+
+	using fired_t = std::vector<std::pair<std::uint32_t, std::size_t>>;
+
+	std::uint32_t ticks(std::uint32_t delay_ms)
+	{
+		return std::max<std::uint32_t>((delay_ms + TICK_MS - 1) / TICK_MS, 1);
+	}
+
+	// What an expired timer does next depends only on which timer it is and
+	// when it fired, so the wheel and the reference make the same choice.
+	// It may only touch itself: same-tick expiry order is unspecified.
+	std::uint32_t rearm_delay_ms(std::size_t timer, std::uint32_t tick)
+	{
+		const auto h = (tick * 2654435761u) ^ (timer * 40503u);
+		return h % 3 == 0 ? DISARMED : h % 2000;
+	}
+
+	std::uint32_t random_delay_ms(std::mt19937& random)
+	{
+		// Mostly on the finest level, some on the coarse ones and some past
+		// the end of the wheel
+		switch (random() % 8)
+		{
+		case 0:
+			return random() % (1u << 22);
+		case 1:
+		case 2:
+			return random() % 80000;
+		default:
+			return random() % 700;
+		}
+	}
+
+	// Every timer due by target, in expiry order, by scanning all of them
+	void reference_advance(std::vector<std::uint32_t>& expires, std::uint32_t target, fired_t& fired)
+	{
+		for (;;)
+		{
+			std::size_t next = TIMERS;
+			for (std::size_t t = 0; t < TIMERS; t++)
+				if (expires[t] != DISARMED && expires[t] <= target && (next == TIMERS || expires[t] < expires[next]))
+					next = t;
+			if (next == TIMERS)
+				return;
+
+			const auto tick = expires[next];
+			fired.emplace_back(tick, next);
+			const auto delay = rearm_delay_ms(next, tick);
+			expires[next] = delay == DISARMED ? DISARMED : tick + ticks(delay);
+		}
+	}
+
+	void run(std::uint32_t start_ms, unsigned seed)
+	{
+		std::mt19937 random(seed);
+		timer_wheel wheel(TIMERS, TICK_MS, start_ms);
+		std::vector<std::uint32_t> reference(TIMERS, DISARMED);
+		// The wheel's view, kept up to date by its own callback
+		std::vector<std::uint32_t> shadow(TIMERS, DISARMED);
+		std::uint32_t now_ms = start_ms;
+		std::uint32_t now = 0;
+
+		for (int step = 0; step < 4000 && check::failures() == 0; step++)
+		{
+			for (auto changes = random() % 4; changes > 0; changes--)
+			{
+				const auto timer = random() % TIMERS;
+				if (random() % 4 == 0)
+				{
+					wheel.cancel(timer);
+					reference[timer] = shadow[timer] = DISARMED;
+				}
+				else
+				{
+					const auto delay = random_delay_ms(random);
+					wheel.arm(timer, delay);
+					reference[timer] = shadow[timer] = now + ticks(delay);
+				}
+			}
+
+			// Work is never further away than the next expiry
+			const auto due = *std::min_element(reference.begin(), reference.end());
+			if (due == DISARMED)
+				CHECK(wheel.next_expiry_ms() == timer_wheel::NEVER);
+			else
+				CHECK(wheel.next_expiry_ms() > 0 && wheel.next_expiry_ms() <= (due - now) * TICK_MS);
+
+			// Jumps of a fraction of a tick up to several wheel turns
+			now_ms += random() % 2 == 0 ? random() % 50 : random() % 200000;
+			now = (now_ms - start_ms) / TICK_MS;
+
+			fired_t fired;
+			wheel.advance(now_ms, [&](std::size_t timer)
+			{
+				const auto tick = shadow[timer];
+				fired.emplace_back(tick, timer);
+				const auto delay = rearm_delay_ms(timer, tick);
+				if (delay == DISARMED)
+				{
+					shadow[timer] = DISARMED;
+				}
+				else
+				{
+					wheel.arm(timer, delay);
+					shadow[timer] = tick + ticks(delay);
+				}
+			});
+
+			fired_t expected;
+			reference_advance(reference, now, expected);
+
+			CHECK(std::is_sorted(fired.begin(), fired.end(),
+				[](const fired_t::value_type& l, const fired_t::value_type& r) { return l.first < r.first; }));
+			std::sort(fired.begin(), fired.end());
+			CHECK(fired == expected);
+
+			std::size_t armed = 0;
+			for (std::size_t t = 0; t < TIMERS; t++)
+			{
+				CHECK(wheel.armed(t) == (reference[t] != DISARMED));
+				CHECK(shadow[t] == reference[t]);
+				armed += reference[t] != DISARMED;
+			}
+			CHECK(wheel.armed() == armed);
+		}
+
+		wheel.cancel_all();
+		CHECK(wheel.armed() == 0);
+		CHECK(wheel.next_expiry_ms() == timer_wheel::NEVER);
+	}
+
+	void rounds_to_ticks()
+	{
+		timer_wheel wheel(2, TICK_MS, 0);
+		std::size_t fired = 0;
+		const auto count = [&fired](std::size_t) { ++fired; };
+
+		// 0 ms still waits one tick, 11 ms waits two
+		wheel.arm(0, 0);
+		wheel.arm(1, 11);
+		wheel.advance(9, count);
+		CHECK(fired == 0);
+		wheel.advance(10, count);
+		CHECK(fired == 1);
+		wheel.advance(19, count);
+		CHECK(fired == 1);
+		wheel.advance(20, count);
+		CHECK(fired == 2);
+
+		// Out of range timers are ignored
+		wheel.arm(2, 10);
+		CHECK(wheel.armed() == 0);
+	}
+}
+
+int main()
+{
+	rounds_to_ticks();
+	run(0, 5);
+	// The millisecond clock wraps during the run
+	run(0xffffffff - 300000, 6);
+	return check::result("timer_wheel");
+}
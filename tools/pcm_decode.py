@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Decodes a pcm_capture stream into WAV files.
+
+Usage: pcm_decode.py CAPTURE OUT.wav
+
+CAPTURE holds the raw bytes read from the capture UART. Frames are
+found by their magic and checked against their checksum, so bytes lost
+on the line only cost the frames they hit. A change of sample rate or
+channel count starts a new file, OUT-1.wav, OUT-2.wav, ... Gaps in the
+sequence numbers are reported, not filled. The frame layout mirrors
+pcm_capture.hpp.
+"""
+
+import os
+import struct
+import sys
+import wave
+
+HEADER = struct.Struct('<HBBIIIBBHHH')
+MAGIC = 0x4350
+VERSION = 1
+FLAG_DELTA = 0x01
+
+
+def fletcher16(data):
+    sum1 = sum2 = 0
+    for b in data:
+        sum1 = (sum1 + b) % 255
+        sum2 = (sum2 + sum1) % 255
+    return sum2 << 8 | sum1
+
+
+def delta_decode(payload, count, channels):
+    samples = []
+    previous = [0] * channels
+    value = shift = 0
+    for b in payload:
+        value |= (b & 0x7f) << shift
+        shift += 7
+        if b & 0x80:
+            continue
+        delta = (value >> 1) ^ -(value & 1)
+        channel = len(samples) % channels
+        previous[channel] = (previous[channel] + delta + 0x8000) % 0x10000 - 0x8000
+        samples.append(previous[channel])
+        value = shift = 0
+    if len(samples) != count:
+        raise ValueError('payload holds %d samples, expected %d' % (len(samples), count))
+    return struct.pack('<%dh' % count, *samples)
+
+
+def read_frames(data):
+    """Yields (seq, timestamp_ms, sample_rate, channels, pcm) of every valid frame."""
+    pos = 0
+    magic = struct.pack('<H', MAGIC)
+    while True:
+        pos = data.find(magic, pos)
+        if pos < 0 or pos + HEADER.size > len(data):
+            return
+        (_, version, flags, seq, ts, rate, channels, _,
+         frames, payload_len, checksum) = HEADER.unpack_from(data, pos)
+        payload = data[pos + HEADER.size:pos + HEADER.size + payload_len]
+        if version != VERSION or channels == 0 or len(payload) != payload_len \
+                or fletcher16(payload) != checksum:
+            pos += 1
+            continue
+        try:
+            if flags & FLAG_DELTA:
+                pcm = delta_decode(payload, frames * channels, channels)
+            else:
+                pcm = payload
+        except ValueError:
+            pos += 1
+            continue
+        yield seq, ts, rate, channels, pcm
+        pos += HEADER.size + payload_len
+
+
+def main(args):
+    if len(args) != 2:
+        print(__doc__.strip())
+        return 2
+    with open(args[0], 'rb') as f:
+        data = f.read()
+
+    base, ext = os.path.splitext(args[1])
+    out = None
+    fmt = None
+    files = 0
+    frames = gaps = 0
+    last_seq = None
+    for seq, ts, rate, channels, pcm in read_frames(data):
+        if (rate, channels) != fmt:
+            if out:
+                out.close()
+            path = args[1] if files == 0 else '%s-%d%s' % (base, files, ext)
+            files += 1
+            out = wave.open(path, 'wb')
+            out.setnchannels(channels)
+            out.setsampwidth(2)
+            out.setframerate(rate)
+            fmt = (rate, channels)
+            print('%s: %d Hz, %d channels, from %d ms' % (path, rate, channels, ts))
+        if last_seq is not None and seq != (last_seq + 1) & 0xffffffff:
+            gaps += 1
+            print('gap before seq %d, %d frames missing' % (seq, (seq - last_seq - 1) & 0xffffffff))
+        last_seq = seq
+        frames += 1
+        out.writeframes(pcm)
+
+    if out:
+        out.close()
+    print('%d frames, %d gaps, %d files' % (frames, gaps, files))
+    return 0 if frames else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
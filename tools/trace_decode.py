@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Decodes trace_buffer dumps captured from the serial monitor.
+
+Usage: trace_decode.py LOG [LOG...]
+
+Prints the event timeline, the time spent in each state_machine state
+and a latency histogram per state transition. Name tables mirror the
+enums in trace_buffer.hpp and state_machine.hpp; unknown values are
+printed as numbers.
+"""
+
+import collections
+import struct
+import sys
+
+RECORD = struct.Struct('<IIBBHI')
+
+EVENTS = ['STATE', 'MSG', 'MSG_DROPPED', 'BLE_GAP', 'BLE_GATTC', 'A2DP', 'A2DP_GAP']
+
+STATES = [
+    'IDLE', 'BLE', 'A2DP',
+    'IDLE_TO_BLE_0', 'IDLE_TO_BLE_1', 'IDLE_TO_BLE_2',
+    'BLE_TO_A2DP_1',
+    'A2DP_TO_BLE_1', 'A2DP_TO_BLE_2',
+    'A2DP_TO_A2DP_1', 'A2DP_TO_A2DP_2', 'A2DP_TO_A2DP_3',
+]
+
+MSGS = [
+    'IDLE_TO_BLE_START', 'BLE_TO_A2DP_START', 'A2DP_TO_BLE_START',
+    'A2DP_TO_A2DP_START',
+    'SCAN_FINISHED', 'BLE_OPENED', 'BLE_OPEN_FAILED', 'MTU_CONFIGURED',
+    'SERVICES_DISCOVERED', 'NOTIFICATIONS_ENABLED',
+    'BLE_CONNECTED', 'BLE_DISCONNECTED',
+    'A2DP_CONNECTED', 'A2DP_MEDIA_STOPPED', 'A2DP_MEDIA_STARTED',
+    'A2DP_DISCONNECTING', 'A2DP_DISCONNECTED', 'PEER_PREPARED',
+    'TIMEOUT',
+]
+
+
+def name(table, value):
+    return table[value] if value < len(table) else str(value)
+
+
+def read_records(lines):
+    records = {}
+    inside = False
+    for line in lines:
+        line = line.strip()
+        if line.startswith('TRACE-BEGIN'):
+            inside = True
+        elif line.startswith('TRACE-END'):
+            inside = False
+        elif inside and len(line) == 2 * RECORD.size:
+            seq, ts, event, state, conn_id, arg = RECORD.unpack(bytes.fromhex(line))
+            records[seq] = (ts, event, state, conn_id, arg)
+
+    # Unwrap the 32-bit microsecond timestamps
+    result = []
+    offset = 0
+    last = None
+    for seq in sorted(records):
+        ts, event, state, conn_id, arg = records[seq]
+        if last is not None and ts + offset < last:
+            offset += 1 << 32
+        last = ts + offset
+        result.append((seq, last, event, state, conn_id, arg))
+    return result
+
+
+def histogram(values, buckets=(100, 1000, 10000, 100000, 1000000)):
+    counts = [0] * (len(buckets) + 1)
+    for v in values:
+        for i, b in enumerate(buckets):
+            if v < b:
+                counts[i] += 1
+                break
+        else:
+            counts[-1] += 1
+    labels = ['<%dus' % b for b in buckets] + ['>=%dus' % buckets[-1]]
+    return ' '.join('%s:%d' % (l, c) for l, c in zip(labels, counts) if c)
+
+
+def main(paths):
+    lines = []
+    for path in paths:
+        with open(path, errors='replace') as f:
+            lines.extend(f)
+    records = read_records(lines)
+    if not records:
+        print('no trace records found')
+        return 1
+
+    start = records[0][1]
+    print('== timeline')
+    for seq, ts, event, state, conn_id, arg in records:
+        kind = name(EVENTS, event)
+        if kind == 'STATE':
+            detail = '%s -> %s' % (name(STATES, arg), name(STATES, state))
+        elif kind in ('MSG', 'MSG_DROPPED'):
+            detail = '%s in %s' % (name(MSGS, arg), name(STATES, state))
+        else:
+            detail = 'event %d' % arg
+        conn = '' if conn_id == 0xffff else ' conn %d' % conn_id
+        print('%6d %12.3f ms %-11s %s%s' % (seq, (ts - start) / 1000.0, kind, detail, conn))
+
+    # Time spent in a state is the gap between consecutive STATE records
+    transitions = collections.defaultdict(list)
+    entered = None
+    for seq, ts, event, state, conn_id, arg in records:
+        if name(EVENTS, event) != 'STATE':
+            continue
+        if entered is not None and entered[0] == arg:
+            key = '%s -> %s' % (name(STATES, arg), name(STATES, state))
+            transitions[key].append(ts - entered[1])
+        entered = (state, ts)
+
+    print('== transition latency')
+    for key in sorted(transitions):
+        v = sorted(transitions[key])
+        print('%-32s n=%-4d min=%dus median=%dus max=%dus  %s' % (
+            key, len(v), v[0], v[len(v) // 2], v[-1], histogram(v)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))